@@ -0,0 +1,188 @@
+// Closed-loop load generator: starts a Server in-process, keeps a fixed
+// number of clients each issuing one request after another, and reports
+// throughput and latency percentiles per server mode.
+#include "net/http.h"
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <thread>
+
+namespace {
+
+struct Options {
+  std::string mode{"all"};
+  u32 connections{8};
+  u32 seconds{5};
+  u16 port{18080};
+  size_t body_size{128};
+};
+
+struct Report {
+  size_t requests{0};
+  size_t errors{0};
+  double seconds{0};
+  std::vector<u32> latencies_us;
+};
+
+using Clock = std::chrono::steady_clock;
+
+void usage() {
+  std::fprintf(stderr,
+               "usage: sap_http_loadgen [--mode "
+               "single|multi|keepalive|eventloop|all]\n"
+               "                        [--connections N] [--seconds S]\n"
+               "                        [--port P] [--body BYTES]\n");
+}
+
+bool parse_options(i32 argc, char **argv, Options &opts) {
+  for (i32 i = 1; i < argc; ++i) {
+    std::string_view arg = argv[i];
+    if (i + 1 >= argc) {
+      usage();
+      return false;
+    }
+    const char *value = argv[++i];
+    if (arg == "--mode")
+      opts.mode = value;
+    else if (arg == "--connections")
+      opts.connections = static_cast<u32>(std::strtoul(value, nullptr, 10));
+    else if (arg == "--seconds")
+      opts.seconds = static_cast<u32>(std::strtoul(value, nullptr, 10));
+    else if (arg == "--port")
+      opts.port = static_cast<u16>(std::strtoul(value, nullptr, 10));
+    else if (arg == "--body")
+      opts.body_size = std::strtoull(value, nullptr, 10);
+    else {
+      usage();
+      return false;
+    }
+  }
+  return opts.connections > 0 && opts.seconds > 0;
+}
+
+u32 percentile(const std::vector<u32> &sorted, double p) {
+  if (sorted.empty())
+    return 0;
+  auto rank = static_cast<size_t>(p * static_cast<double>(sorted.size() - 1));
+  return sorted[rank];
+}
+
+Report run_clients(const Options &opts, http::ClientPool *pool) {
+  auto url = http::URL::parse("http://127.0.0.1:" + std::to_string(opts.port) +
+                              "/bench")
+                 .value();
+  auto deadline = Clock::now() + std::chrono::seconds(opts.seconds);
+  std::vector<Report> partial(opts.connections);
+  std::vector<std::thread> clients;
+  auto started = Clock::now();
+  for (u32 c = 0; c < opts.connections; ++c) {
+    clients.emplace_back([&, c]() {
+      Report &report = partial[c];
+      http::Request req(http::EMethod::GET, url);
+      while (Clock::now() < deadline) {
+        auto begin = Clock::now();
+        auto result = pool ? http::Client::send(req, *pool)
+                           : http::Client::send(req);
+        auto elapsed = std::chrono::duration_cast<std::chrono::microseconds>(
+            Clock::now() - begin);
+        if (!result || result.value().status_code != 200) {
+          ++report.errors;
+          continue;
+        }
+        ++report.requests;
+        report.latencies_us.push_back(static_cast<u32>(elapsed.count()));
+      }
+    });
+  }
+  for (auto &client : clients)
+    client.join();
+  Report total;
+  total.seconds =
+      std::chrono::duration<double>(Clock::now() - started).count();
+  for (auto &report : partial) {
+    total.requests += report.requests;
+    total.errors += report.errors;
+    total.latencies_us.insert(total.latencies_us.end(),
+                              report.latencies_us.begin(),
+                              report.latencies_us.end());
+  }
+  std::sort(total.latencies_us.begin(), total.latencies_us.end());
+  return total;
+}
+
+bool run_mode(const Options &opts, std::string_view mode) {
+  http::ServerConfig cfg{-1, opts.port};
+  bool pooled = false;
+  if (mode == "multi") {
+    cfg.is_multithreaded = true;
+  } else if (mode == "keepalive") {
+    // Every pooled connection pins a worker while it is idle.
+    cfg.is_multithreaded = true;
+    cfg.worker_threads = opts.connections;
+    pooled = true;
+  } else if (mode == "eventloop") {
+    cfg.use_event_loop = true;
+    cfg.event_loop_threads =
+        std::max(1u, std::thread::hardware_concurrency() / 2);
+    pooled = true;
+  } else if (mode != "single") {
+    usage();
+    return false;
+  }
+  cfg.max_keep_alive_requests = 0;
+
+  http::Server server{std::move(cfg)};
+  std::string body(opts.body_size, 'x');
+  server.route("/bench", http::EMethod::GET,
+               [&body](const http::Request &) {
+                 return http::Response(200, body);
+               });
+  auto started = server.start();
+  if (!started) {
+    std::fprintf(stderr, "%.*s: %s\n", static_cast<i32>(mode.size()),
+                 mode.data(), started.error().c_str());
+    return false;
+  }
+  std::thread server_thread([&server]() { server.run(); });
+  std::this_thread::sleep_for(std::chrono::milliseconds(100));
+
+  http::ClientPool pool(
+      http::ClientPoolConfig{opts.connections, std::chrono::seconds(30)});
+  Report report = run_clients(opts, pooled ? &pool : nullptr);
+  pool.clear();
+  server.stop();
+  server_thread.join();
+
+  std::printf("%-10.*s %10zu %8zu %12.0f %8u %8u %8u\n",
+              static_cast<i32>(mode.size()), mode.data(), report.requests,
+              report.errors,
+              static_cast<double>(report.requests) / report.seconds,
+              percentile(report.latencies_us, 0.50),
+              percentile(report.latencies_us, 0.99),
+              percentile(report.latencies_us, 0.999));
+  std::fflush(stdout);
+  return true;
+}
+
+} // namespace
+
+int main(int argc, char **argv) {
+  Options opts;
+  if (!parse_options(argc, argv, opts))
+    return 2;
+  std::printf("%u connections, %u s per mode, %zu-byte bodies\n",
+              opts.connections, opts.seconds, opts.body_size);
+  std::printf("%-10s %10s %8s %12s %8s %8s %8s\n", "mode", "requests",
+              "errors", "req/s", "p50 us", "p99 us", "p999 us");
+  std::vector<std::string_view> modes;
+  if (opts.mode == "all")
+    modes = {"single", "multi", "keepalive", "eventloop"};
+  else
+    modes = {opts.mode};
+  for (auto mode : modes) {
+    if (!run_mode(opts, mode))
+      return 1;
+  }
+  return 0;
+}
@@ -0,0 +1,184 @@
+#include "net/http.h"
+#include "router.h"
+#include "wire.h"
+#include <benchmark/benchmark.h>
+
+namespace {
+
+const std::string k_SmallHead = "GET /api/users/42 HTTP/1.1\r\n"
+                                "Host: localhost:8080\r\n"
+                                "Accept: */*\r\n"
+                                "\r\n";
+
+const std::string k_BrowserHead =
+    "GET /static/css/site.css?v=1234 HTTP/1.1\r\n"
+    "Host: www.example.com\r\n"
+    "User-Agent: Mozilla/5.0 (X11; Linux x86_64; rv:120.0) Gecko/20100101\r\n"
+    "Accept: text/css,*/*;q=0.1\r\n"
+    "Accept-Language: en-US,en;q=0.5\r\n"
+    "Accept-Encoding: gzip, deflate, br\r\n"
+    "Connection: keep-alive\r\n"
+    "Referer: https://www.example.com/index.html\r\n"
+    "Cookie: session=0123456789abcdef0123456789abcdef; theme=dark\r\n"
+    "Sec-Fetch-Dest: style\r\n"
+    "Sec-Fetch-Mode: no-cors\r\n"
+    "Sec-Fetch-Site: same-origin\r\n"
+    "If-None-Match: \"5f1d-18b4c\"\r\n"
+    "Cache-Control: max-age=0\r\n"
+    "\r\n";
+
+void BM_ParseRequestHead(benchmark::State &state, const std::string &head) {
+  http::MessageParser parser;
+  for (auto _ : state) {
+    parser.reset();
+    auto status = parser.parse(head);
+    benchmark::DoNotOptimize(status);
+  }
+  state.SetBytesProcessed(static_cast<int64_t>(state.iterations()) *
+                          static_cast<int64_t>(head.size()));
+}
+BENCHMARK_CAPTURE(BM_ParseRequestHead, small, k_SmallHead);
+BENCHMARK_CAPTURE(BM_ParseRequestHead, browser, k_BrowserHead);
+
+// The head arrives a few bytes at a time, as over a slow connection.
+void BM_ParseRequestHeadIncremental(benchmark::State &state) {
+  const size_t step = static_cast<size_t>(state.range(0));
+  const std::string_view head = k_BrowserHead;
+  http::MessageParser parser;
+  for (auto _ : state) {
+    parser.reset();
+    auto status = http::EParseStatus::NeedMore;
+    for (size_t n = step; status == http::EParseStatus::NeedMore; n += step) {
+      status = parser.parse(head.substr(0, std::min(n, head.size())));
+    }
+    benchmark::DoNotOptimize(status);
+  }
+}
+BENCHMARK(BM_ParseRequestHeadIncremental)->Arg(16)->Arg(128);
+
+void BM_DecodeChunkedBody(benchmark::State &state) {
+  std::string wire;
+  for (i32 i = 0; i < 64; ++i)
+    wire += "400\r\n" + std::string(1024, 'x') + "\r\n";
+  wire += "0\r\n\r\n";
+  http::BodyDecoder decoder;
+  size_t total = 0;
+  http::BodyDecoder::Sink sink = [&total](std::string_view data) {
+    total += data.size();
+  };
+  for (auto _ : state) {
+    decoder.reset(http::BodyDecoder::EMode::Chunked);
+    size_t consumed = 0;
+    benchmark::DoNotOptimize(decoder.decode(wire, consumed, sink));
+  }
+  state.SetBytesProcessed(static_cast<int64_t>(state.iterations()) *
+                          static_cast<int64_t>(wire.size()));
+}
+BENCHMARK(BM_DecodeChunkedBody);
+
+void BM_UrlParse(benchmark::State &state) {
+  for (auto _ : state) {
+    auto url = http::URL::parse(
+        "http://api.example.com:8080/v1/users/42/posts?limit=10&offset=20");
+    benchmark::DoNotOptimize(url);
+  }
+}
+BENCHMARK(BM_UrlParse);
+
+void BM_HeadersSet(benchmark::State &state) {
+  for (auto _ : state) {
+    http::Headers headers;
+    headers.set("Content-Type", "application/json");
+    headers.set("Content-Length", "1024");
+    headers.set("Connection", "keep-alive");
+    headers.set("X-Request-Id", "0123456789abcdef");
+    headers.set("Cache-Control", "no-cache");
+    benchmark::DoNotOptimize(headers);
+  }
+}
+BENCHMARK(BM_HeadersSet);
+
+void BM_HeadersGet(benchmark::State &state) {
+  http::Headers headers;
+  headers.set("Content-Type", "application/json");
+  headers.set("X-Request-Id", "0123456789abcdef");
+  headers.set("Cache-Control", "no-cache");
+  headers.set("Connection", "keep-alive");
+  for (auto _ : state) {
+    benchmark::DoNotOptimize(headers.get("cache-control"));
+    benchmark::DoNotOptimize(headers.get("X-Missing"));
+    benchmark::DoNotOptimize(headers.get(http::EHeader::Connection));
+  }
+}
+BENCHMARK(BM_HeadersGet);
+
+void BM_WriteResponse(benchmark::State &state) {
+  const std::string body(static_cast<size_t>(state.range(0)), 'x');
+  for (auto _ : state) {
+    http::detail::WireQueue out;
+    http::Response resp(200, body);
+    resp.headers.set(http::EHeader::Connection, "keep-alive");
+    resp.headers.set(http::EHeader::ContentType, "application/json");
+    http::detail::write_response(out, std::move(resp));
+    benchmark::DoNotOptimize(out.pending_bytes());
+  }
+}
+BENCHMARK(BM_WriteResponse)->Arg(0)->Arg(1024)->Arg(64 * 1024);
+
+void BM_RouterLookup(benchmark::State &state) {
+  http::detail::Router router;
+  size_t index = 0;
+  // Roughly the shape of a mid-sized REST service.
+  for (std::string resource : {"users", "orders", "products", "invoices",
+                               "customers", "shipments", "reviews", "carts"}) {
+    for (auto method : {http::EMethod::GET, http::EMethod::POST}) {
+      (void)router.add("/api/v1/" + resource, method, index++);
+      (void)router.add("/api/v1/" + resource + "/:id", method, index++);
+      (void)router.add("/api/v1/" + resource + "/:id/history", method,
+                       index++);
+    }
+  }
+  (void)router.add("/static/*path", http::EMethod::GET, index++);
+  http::RouteParams params;
+  for (auto _ : state) {
+    benchmark::DoNotOptimize(
+        router.find("/api/v1/shipments/12345/history", http::EMethod::GET,
+                    params));
+    benchmark::DoNotOptimize(
+        router.find("/static/js/app.js", http::EMethod::GET, params));
+  }
+}
+BENCHMARK(BM_RouterLookup);
+
+void BM_StaticRouterLookup(benchmark::State &state) {
+  auto ok = [](const http::Request &) { return http::Response(200, "ok"); };
+  http::StaticRouter router{
+      http::static_route<"/health", http::EMethod::GET>(ok),
+      http::static_route<"/ready", http::EMethod::GET>(ok),
+      http::static_route<"/version", http::EMethod::GET>(ok),
+      http::static_route<"/api/v1/users", http::EMethod::GET>(ok),
+      http::static_route<"/api/v1/users", http::EMethod::POST>(ok),
+      http::static_route<"/api/v1/orders", http::EMethod::GET>(ok),
+      http::static_route<"/api/v1/orders", http::EMethod::POST>(ok),
+      http::static_route<"/api/v1/carts", http::EMethod::GET>(ok)};
+  size_t route = 0;
+  u32 allowed = 0;
+  for (auto _ : state) {
+    benchmark::DoNotOptimize(router.find("/api/v1/orders", http::EMethod::POST,
+                                         route, allowed));
+    benchmark::DoNotOptimize(
+        router.find("/api/v1/missing", http::EMethod::GET, route, allowed));
+  }
+}
+BENCHMARK(BM_StaticRouterLookup);
+
+void BM_StringToMethod(benchmark::State &state) {
+  std::string_view methods[] = {"GET", "POST", "DELETE", "OPTIONS"};
+  for (auto _ : state) {
+    for (auto method : methods)
+      benchmark::DoNotOptimize(http::string_to_method(method));
+  }
+}
+BENCHMARK(BM_StringToMethod);
+
+} // namespace
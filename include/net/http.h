@@ -3,53 +3,156 @@
 #include "result.h"
 #include "types.h"
 #include <algorithm>
+#include <array>
+#include <bit>
 #include <chrono>
+#include <condition_variable>
+#include <coroutine>
+#include <cstdint>
+#include <exception>
+#include <functional>
 #include <future>
 #include <map>
-#include <sstream>
+#include <memory>
+#include <memory_resource>
+#include <mutex>
+#include <optional>
+#include <span>
 #include <string>
 #include <string_view>
+#include <tuple>
+#include <type_traits>
+#include <utility>
 #include <vector>
 namespace http {
 
 enum class EMethod { GET, POST, PUT, DELETE, HEAD, PATCH, OPTIONS };
 
+namespace detail {
+inline constexpr size_t k_MethodCount = 7;
+
+inline constexpr u32 method_bit(EMethod m) {
+  return 1u << static_cast<u32>(m);
+}
+
+// Indexed by EMethod.
+inline constexpr std::array<std::string_view, k_MethodCount> k_MethodNames{
+    "GET", "POST", "PUT", "DELETE", "HEAD", "PATCH", "OPTIONS"};
+
+// 64-bit FNV-1a, usable at compile time.
+constexpr std::uint64_t fnv1a(std::string_view text) {
+  std::uint64_t hash = 0xcbf29ce484222325;
+  for (char c : text) {
+    hash ^= static_cast<unsigned char>(c);
+    hash *= 0x100000001b3;
+  }
+  return hash;
+}
+
+// Perfect hash over up to N distinct strings, built at compile time by hash
+// and displace: keys are spread over buckets by their hash, then each
+// bucket, largest first, gets the displacement that moves all of its keys
+// to free slots. A lookup is one hash of the key and one comparison.
+template <size_t N> class PerfectHash {
+public:
+  // Over the first `count` of `keys`, which must all differ.
+  constexpr PerfectHash(const std::array<std::string_view, N> &keys,
+                        size_t count = N)
+      : m_Keys(keys), m_Count(count) {
+    m_Slots.fill(N);
+    std::array<size_t, k_Buckets> sizes{};
+    for (size_t i = 0; i < m_Count; ++i)
+      ++sizes[bucket_of(fnv1a(m_Keys[i]))];
+    std::array<bool, k_Buckets> placed{};
+    for (size_t round = 0; round < k_Buckets; ++round) {
+      size_t bucket = 0;
+      while (placed[bucket])
+        ++bucket;
+      for (size_t b = bucket + 1; b < k_Buckets; ++b) {
+        if (!placed[b] && sizes[b] > sizes[bucket])
+          bucket = b;
+      }
+      if (sizes[bucket] == 0)
+        break;
+      placed[bucket] = true;
+      place(bucket);
+    }
+  }
+
+  // Index of `key` among the keys, or N when it is none of them.
+  constexpr size_t find(std::string_view key) const {
+    auto hash = fnv1a(key);
+    size_t index = m_Slots[slot_of(hash, m_Displace[bucket_of(hash)])];
+    return index < N && m_Keys[index] == key ? index : N;
+  }
+
+private:
+  static constexpr size_t k_Buckets = std::bit_ceil(std::max<size_t>(N, 1));
+  static constexpr size_t k_Slots = std::bit_ceil(std::max<size_t>(2 * N, 1));
+
+  static constexpr size_t bucket_of(std::uint64_t hash) {
+    return static_cast<size_t>(hash >> 40) & (k_Buckets - 1);
+  }
+  // The murmur3 finalizer, so each displacement scatters keys anew.
+  static constexpr size_t slot_of(std::uint64_t hash, std::uint64_t displace) {
+    hash ^= displace * 0x9e3779b97f4a7c15;
+    hash ^= hash >> 33;
+    hash *= 0xff51afd7ed558ccd;
+    hash ^= hash >> 33;
+    hash *= 0xc4ceb9fe1a85ec53;
+    hash ^= hash >> 33;
+    return static_cast<size_t>(hash) & (k_Slots - 1);
+  }
+
+  constexpr void place(size_t bucket) {
+    std::array<size_t, N> members{};
+    size_t count = 0;
+    for (size_t i = 0; i < m_Count; ++i) {
+      if (bucket_of(fnv1a(m_Keys[i])) == bucket)
+        members[count++] = i;
+    }
+    // Distinct keys always fit eventually; slots are at most half full.
+    for (std::uint64_t displace = 1;; ++displace) {
+      std::array<size_t, N> slots{};
+      bool fits = true;
+      for (size_t k = 0; k < count && fits; ++k) {
+        slots[k] = slot_of(fnv1a(m_Keys[members[k]]), displace);
+        fits = m_Slots[slots[k]] == N;
+        for (size_t j = 0; j < k && fits; ++j)
+          fits = slots[j] != slots[k];
+      }
+      if (!fits)
+        continue;
+      m_Displace[bucket] = displace;
+      for (size_t k = 0; k < count; ++k)
+        m_Slots[slots[k]] = members[k];
+      return;
+    }
+  }
+
+  std::array<std::string_view, N> m_Keys{};
+  size_t m_Count;
+  std::array<std::uint64_t, k_Buckets> m_Displace{};
+  std::array<size_t, k_Slots> m_Slots{};
+};
+
+inline constexpr PerfectHash<k_MethodCount> k_MethodLookup{k_MethodNames};
+} // namespace detail
+
+constexpr std::string_view method_name(EMethod m) {
+  auto index = static_cast<size_t>(m);
+  return index < detail::k_MethodCount ? detail::k_MethodNames[index] : "GET";
+}
+
 inline std::string method_to_string(EMethod m) {
-  switch (m) {
-  case EMethod::GET:
-    return "GET";
-  case EMethod::POST:
-    return "POST";
-  case EMethod::PUT:
-    return "PUT";
-  case EMethod::DELETE:
-    return "DELETE";
-  case EMethod::HEAD:
-    return "HEAD";
-  case EMethod::PATCH:
-    return "PATCH";
-  case EMethod::OPTIONS:
-    return "OPTIONS";
-  }
-  return "GET";
+  return std::string(method_name(m));
 }
 
-inline EMethod string_to_method(std::string_view s) {
-  if (s == "GET")
-    return EMethod::GET;
-  if (s == "POST")
-    return EMethod::POST;
-  if (s == "PUT")
-    return EMethod::PUT;
-  if (s == "DELETE")
-    return EMethod::DELETE;
-  if (s == "HEAD")
-    return EMethod::HEAD;
-  if (s == "PATCH")
-    return EMethod::PATCH;
-  if (s == "OPTIONS")
-    return EMethod::OPTIONS;
-  return EMethod::GET;
+// Unknown methods read as GET.
+constexpr EMethod string_to_method(std::string_view s) {
+  size_t index = detail::k_MethodLookup.find(s);
+  return index < detail::k_MethodCount ? static_cast<EMethod>(index)
+                                       : EMethod::GET;
 }
 
 struct URL {
@@ -64,12 +167,118 @@ struct URL {
   static URL from_path(std::string_view path_and_query);
 };
 
-struct Headers {
-  std::map<std::string, std::string> data;
+// Headers every exchange touches; they are found through a fixed slot rather
+// than a scan.
+enum class EHeader : u8 {
+  ContentLength,
+  ContentType,
+  Host,
+  Connection,
+  TransferEncoding,
+  Accept,
+  UserAgent,
+};
+
+inline constexpr size_t k_KnownHeaderCount = 7;
+
+// Allocator-aware so fields placed in a Headers built on a memory resource
+// keep their strings in that resource too.
+struct HeaderField {
+  using allocator_type = std::pmr::polymorphic_allocator<char>;
+
+  std::pmr::string name;
+  std::pmr::string value;
+
+  HeaderField() = default;
+  explicit HeaderField(const allocator_type &alloc)
+      : name(alloc), value(alloc) {}
+  HeaderField(const HeaderField &other, const allocator_type &alloc = {})
+      : name(other.name, alloc), value(other.value, alloc) {}
+  HeaderField(HeaderField &&other) noexcept = default;
+  HeaderField(HeaderField &&other, const allocator_type &alloc)
+      : name(std::move(other.name), alloc),
+        value(std::move(other.value), alloc) {}
+  HeaderField &operator=(const HeaderField &) = default;
+  HeaderField &operator=(HeaderField &&) noexcept = default;
+};
+
+// Header fields as a flat list in insertion order. Names are stored
+// lowercased and looked up case-insensitively without allocating; setting
+// an existing name replaces its value.
+class Headers {
+public:
+  Headers() = default;
+  // Field storage comes from `resource`, which must outlive the fields.
+  // Copies of these headers use the default resource again.
+  explicit Headers(std::pmr::memory_resource *resource);
 
   void set(std::string_view key, std::string_view value);
-  std::string get(std::string_view key) const;
+  void set(EHeader key, std::string_view value);
+  // Empty when the field is absent.
+  std::string_view get(std::string_view key) const;
+  std::string_view get(EHeader key) const;
   bool has(std::string_view key) const;
+  bool has(EHeader key) const;
+  bool remove(std::string_view key);
+  bool remove(EHeader key);
+  void clear();
+
+  size_t size() const { return m_Fields.size(); }
+  bool empty() const { return m_Fields.empty(); }
+  std::pmr::vector<HeaderField>::const_iterator begin() const {
+    return m_Fields.begin();
+  }
+  std::pmr::vector<HeaderField>::const_iterator end() const {
+    return m_Fields.end();
+  }
+
+  // Lowercase wire name of a well-known header.
+  static std::string_view name_of(EHeader key);
+
+private:
+  static constexpr size_t k_NoField = SIZE_MAX;
+
+  size_t find(std::string_view key) const;
+  // Same, with `known` already worked out as by known_index().
+  size_t find(std::string_view key, i32 known) const;
+  void assign(size_t index, std::string_view key, std::string_view value,
+              i32 known);
+  void erase(size_t index);
+
+  std::pmr::vector<HeaderField> m_Fields;
+  // Index + 1 into m_Fields for each EHeader; 0 when absent.
+  std::array<u32, k_KnownHeaderCount> m_Slots{};
+};
+
+struct RouteParam {
+  std::string_view name;
+  std::string_view value;
+};
+
+// Path parameters captured by the router, e.g. `id` for `/users/:id`. Names
+// point into the server's route table and values into `Request::url.path`,
+// so nothing is allocated. Copying or moving a Request leaves the values
+// pointing into the old path; rebase() moves them onto the new one.
+class RouteParams {
+public:
+  static constexpr size_t k_Capacity = 16;
+
+  std::string_view get(std::string_view name) const;
+  bool has(std::string_view name) const;
+  // Returns false when all slots are taken.
+  bool set(std::string_view name, std::string_view value);
+  void clear() { m_Size = 0; }
+  // Repoints values that lie inside `from` at the same offsets in `to`.
+  void rebase(std::string_view from, std::string_view to);
+
+  size_t size() const { return m_Size; }
+  bool empty() const { return m_Size == 0; }
+  const RouteParam *begin() const { return m_Params; }
+  const RouteParam *end() const { return m_Params + m_Size; }
+
+private:
+  RouteParam m_Params[k_Capacity];
+  size_t m_Size{0};
 };
 
 struct Request {
@@ -77,23 +286,57 @@ struct Request {
   URL url;
   Headers headers;
   std::string body;
+  // Limits for the client, each as an error naming what timed out. The
+  // whole exchange, from connecting to the last body byte, must finish
+  // within `timeout`; connecting (including a TLS handshake) within
+  // `connect_timeout`; and no single wait for the peer to take or send
+  // bytes may exceed `write_timeout` or `read_timeout`. Zero means no limit.
   std::chrono::milliseconds timeout{30000};
+  std::chrono::milliseconds connect_timeout{10000};
+  std::chrono::milliseconds read_timeout{30000};
+  std::chrono::milliseconds write_timeout{30000};
 
   // Optional: route params extracted by server routing (e.g., /users/:id)
-  std::map<std::string, std::string> params;
+  RouteParams params;
+
+  // Optional: receives the response body piece by piece as it is decoded.
+  // When set, Response::body stays empty, so large downloads never have to
+  // fit in memory at once.
+  std::function<void(std::string_view)> on_body_chunk;
+
+  // Unless the request sets Accept-Encoding itself, the client asks for
+  // every coding it can decode and hands back the decoded body, without
+  // Content-Encoding or Content-Length. Clear this to get raw bytes.
+  bool decompress{true};
 
   Request() = default;
   Request(http::EMethod m, http::URL u);
+  // Header storage comes from `resource`; see Headers.
+  Request(http::EMethod m, http::URL u, std::pmr::memory_resource *resource);
 
   void set_header(std::string_view key, std::string_view value);
   void set_body(std::string data);
 };
 
+namespace detail {
+class FileHandle;
+}
+
+// Part of an open file sent as a response body in place of
+// Response::body, without copying it through userspace where the
+// platform allows. Content-Length must be set to `length`.
+struct FileBody {
+  std::shared_ptr<const detail::FileHandle> handle;
+  std::uint64_t offset{0};
+  std::uint64_t length{0};
+};
+
 struct Response {
   i32 status_code{0};
   std::string status_text;
   Headers headers;
   std::string body;
+  std::optional<FileBody> file;
   Response() = default;
   Response(i32 code, std::string body_content = "");
   inline bool is_success() const {
@@ -101,61 +344,1246 @@ struct Response {
   }
 };
 
+enum class EParseStatus { Complete, NeedMore, Error };
+
+struct HeaderView {
+  std::string_view name;
+  std::string_view value;
+};
+
+// Resumable HTTP/1.x head parser (start line plus header fields). Hand it the
+// unconsumed connection buffer after every read: each call continues where
+// the previous one stopped and reports NeedMore until the blank line that
+// ends the head arrives. The buffer may be reallocated between calls as long
+// as its leading bytes stay the same; every view returned points into the
+// buffer given to the latest parse() call.
+class MessageParser {
+public:
+  enum class EKind { Request, Response };
+
+  explicit MessageParser(EKind kind = EKind::Request) : m_Kind(kind) {}
+
+  EParseStatus parse(std::string_view data);
+  void reset();
+  void set_max_head_size(size_t bytes) { m_MaxHeadSize = bytes; }
+
+  EKind kind() const { return m_Kind; }
+  // Bytes taken by the head, including the terminating empty line.
+  size_t head_size() const { return m_Pos; }
+  bool is_complete() const { return m_State == EState::Done; }
+  bool is_too_large() const { return m_TooLarge; }
+  const std::string &error() const { return m_Error; }
+
+  std::string_view method() const { return view(m_Method); }
+  std::string_view target() const { return view(m_Target); }
+  std::string_view version() const { return view(m_Version); }
+  i32 status_code() const { return m_StatusCode; }
+  std::string_view reason() const { return view(m_Reason); }
+
+  size_t header_count() const { return m_Fields.size(); }
+  HeaderView header_at(size_t i) const {
+    return {view(m_Fields[i].name), view(m_Fields[i].value)};
+  }
+  // Case-insensitive lookup of the first field called `name`; empty when the
+  // field is absent.
+  std::string_view header(std::string_view name) const;
+  bool has_header(std::string_view name) const;
+  // True when `Connection` lists `token` (case-insensitive).
+  bool has_connection_token(std::string_view token) const;
+  // Whether the connection persists after this message: HTTP/1.1 unless
+  // `Connection: close`, HTTP/1.0 only with `Connection: keep-alive`.
+  bool keep_alive() const;
+
+private:
+  enum class EState { StartLine, Fields, Done, Failed };
+  struct Span {
+    u32 offset{0};
+    u32 length{0};
+  };
+  struct Field {
+    Span name;
+    Span value;
+  };
+
+  std::string_view view(Span s) const {
+    return m_Data.substr(s.offset, s.length);
+  }
+  bool parse_start_line(size_t begin, size_t end);
+  bool parse_field(size_t begin, size_t end);
+  EParseStatus fail(std::string message);
+
+  EKind m_Kind;
+  EState m_State{EState::StartLine};
+  std::string_view m_Data;
+  size_t m_Pos{0};
+  size_t m_Scan{0};
+  size_t m_MaxHeadSize{64 * 1024};
+  bool m_TooLarge{false};
+  Span m_Method, m_Target, m_Version, m_Reason;
+  i32 m_StatusCode{0};
+  std::vector<Field> m_Fields;
+  std::string m_Error;
+};
+
+// Incremental decoder for a message body framed by Content-Length, chunked
+// transfer coding, or (responses only) the end of the connection. Feed it
+// raw bytes as they arrive: decoded bytes go to the sink and `consumed`
+// reports how much input was used, so the caller can drop it right away.
+class BodyDecoder {
+public:
+  enum class EMode { None, Length, Chunked, UntilClose };
+  using Sink = std::function<void(std::string_view)>;
+
+  // Picks the framing from a complete head. Returns false (see error()) for
+  // framing that can't be decoded safely, e.g. both Content-Length and
+  // Transfer-Encoding. `no_body` marks responses that never carry one
+  // (to HEAD, 1xx, 204 and 304).
+  bool start(const MessageParser &head, bool no_body = false);
+  void reset(EMode mode, size_t content_length = 0);
+  void set_max_body_size(size_t bytes) { m_MaxBodySize = bytes; }
+
+  EParseStatus decode(std::string_view data, size_t &consumed,
+                      const Sink &sink);
+  // Signals end of input; completes an UntilClose body.
+  EParseStatus finish();
+
+  EMode mode() const { return m_Mode; }
+  bool is_complete() const { return m_State == EState::Done; }
+  bool is_too_large() const { return m_TooLarge; }
+  // Declared Content-Length, or decoded bytes so far for other framings.
+  size_t body_size() const { return m_BodySize; }
+  const std::string &error() const { return m_Error; }
+
+private:
+  enum class EState {
+    Data,
+    ChunkSize,
+    ChunkData,
+    ChunkEnd,
+    Trailer,
+    Done,
+    Failed
+  };
+
+  EParseStatus fail(std::string message);
+  bool account(size_t bytes);
+
+  EMode m_Mode{EMode::None};
+  EState m_State{EState::Done};
+  size_t m_Remaining{0};
+  size_t m_BodySize{0};
+  size_t m_MaxBodySize{SIZE_MAX};
+  bool m_TooLarge{false};
+  std::string m_Error;
+};
+
+template <typename T = void> class Task;
+
+namespace detail {
+class EventLoop;
+
+// While one is alive, socket waits in coroutines on this thread block in
+// place instead of suspending into the thread's event loop. See sync_wait().
+class BlockingScope {
+public:
+  BlockingScope();
+  ~BlockingScope();
+  BlockingScope(const BlockingScope &) = delete;
+  BlockingScope &operator=(const BlockingScope &) = delete;
+
+private:
+  EventLoop *m_Saved;
+};
+
+class TaskPromiseBase {
+public:
+  std::suspend_always initial_suspend() noexcept { return {}; }
+
+  // Hands control to whoever awaits the task, without growing the stack.
+  struct FinalAwaiter {
+    bool await_ready() noexcept { return false; }
+    template <typename Promise>
+    std::coroutine_handle<>
+    await_suspend(std::coroutine_handle<Promise> handle) noexcept {
+      auto next = handle.promise().m_Continuation;
+      return next ? next : std::noop_coroutine();
+    }
+    void await_resume() noexcept {}
+  };
+  FinalAwaiter final_suspend() noexcept { return {}; }
+  void unhandled_exception() { m_Exception = std::current_exception(); }
+
+  std::coroutine_handle<> m_Continuation;
+  std::exception_ptr m_Exception;
+  bool m_Started{false};
+};
+
+template <typename T> class TaskPromise : public TaskPromiseBase {
+public:
+  Task<T> get_return_object();
+  template <typename U> void return_value(U &&value) {
+    m_Value.emplace(std::forward<U>(value));
+  }
+  T take() {
+    if (m_Exception)
+      std::rethrow_exception(m_Exception);
+    return std::move(*m_Value);
+  }
+
+private:
+  std::optional<T> m_Value;
+};
+
+template <> class TaskPromise<void> : public TaskPromiseBase {
+public:
+  Task<void> get_return_object();
+  void return_void() {}
+  void take() {
+    if (m_Exception)
+      std::rethrow_exception(m_Exception);
+  }
+};
+} // namespace detail
+
+// A coroutine producing a T, started lazily and owned by this handle. Inside
+// another coroutine, `co_await task` runs it and resumes the caller once it
+// completes. Socket waits inside suspend into the current thread's event
+// loop when there is one (a server in event-loop mode) and block in place
+// otherwise, so the same code runs in every server mode.
+template <typename T> class [[nodiscard]] Task {
+public:
+  using promise_type = detail::TaskPromise<T>;
+
+  Task(Task &&other) noexcept
+      : m_Handle(std::exchange(other.m_Handle, nullptr)) {}
+  Task &operator=(Task &&other) noexcept {
+    if (this != &other) {
+      if (m_Handle)
+        m_Handle.destroy();
+      m_Handle = std::exchange(other.m_Handle, nullptr);
+    }
+    return *this;
+  }
+  // Destroying a suspended task abandons it; its locals are destroyed, which
+  // closes any socket it was waiting on.
+  ~Task() {
+    if (m_Handle)
+      m_Handle.destroy();
+  }
+
+  // Runs the coroutine up to its first suspension, for callers that are not
+  // coroutines themselves.
+  void start() {
+    auto &promise = m_Handle.promise();
+    if (!promise.m_Started) {
+      promise.m_Started = true;
+      m_Handle.resume();
+    }
+  }
+  bool is_done() const { return m_Handle.done(); }
+  // The result of a finished task; rethrows what the coroutine threw.
+  T get() { return m_Handle.promise().take(); }
+
+  bool await_ready() const noexcept { return m_Handle.done(); }
+  std::coroutine_handle<>
+  await_suspend(std::coroutine_handle<> awaiting) noexcept {
+    auto &promise = m_Handle.promise();
+    promise.m_Continuation = awaiting;
+    // A task already start()ed resumes its awaiter when it finishes.
+    if (std::exchange(promise.m_Started, true))
+      return std::noop_coroutine();
+    return m_Handle;
+  }
+  T await_resume() { return get(); }
+
+private:
+  friend promise_type;
+  explicit Task(std::coroutine_handle<promise_type> handle)
+      : m_Handle(handle) {}
+
+  std::coroutine_handle<promise_type> m_Handle;
+};
+
+template <typename T> Task<T> detail::TaskPromise<T>::get_return_object() {
+  return Task<T>(std::coroutine_handle<TaskPromise>::from_promise(*this));
+}
+
+inline Task<void> detail::TaskPromise<void>::get_return_object() {
+  return Task<void>(std::coroutine_handle<TaskPromise>::from_promise(*this));
+}
+
+// Runs `task` to completion on the calling thread, blocking on its socket
+// waits, and returns its result. Usable from plain threads and synchronous
+// handlers alike.
+template <typename T> T sync_wait(Task<T> task) {
+  detail::BlockingScope blocking;
+  task.start();
+  return task.get();
+}
+
+struct ClientExecutorConfig {
+  // Threads running asynchronous requests; 0 picks twice the hardware
+  // concurrency (at least 4). Requests beyond that wait in a queue.
+  u32 threads{0};
+};
+
+struct DnsCacheConfig {
+  std::chrono::milliseconds ttl{30000};
+  // How long a failed lookup is remembered before it is retried.
+  std::chrono::milliseconds negative_ttl{5000};
+  // Zero disables caching.
+  size_t max_entries{1024};
+};
+
+// Client side of https. Needs a build with SAP_HTTP_WITH_TLS.
+struct ClientTlsConfig {
+  // Trusted CA certificates in PEM form; with both empty the system store
+  // is used.
+  std::string ca_file;
+  std::string ca_path;
+  bool verify_peer{true};
+  // Keep the latest session ticket per host:port so new connections resume
+  // instead of running the full handshake.
+  bool resume_sessions{true};
+  size_t session_cache_size{256};
+  // Let the kernel encrypt (Linux kTLS) where OpenSSL and the kernel can.
+  bool ktls{true};
+};
+
+// HTTP/2 connection settings, for ServerConfig and ClientPoolConfig
+// alike. Windows are per stream; the connection window is kept at the same
+// size, so a single stream can use all of it.
+struct Http2Config {
+  // Streams the peer may have open at once; more are refused.
+  u32 max_concurrent_streams{100};
+  u32 initial_window_size{1024 * 1024};
+  // Largest frame payload the peer may send (16384 to 16777215).
+  u32 max_frame_size{16384};
+  // The HPACK dynamic table the peer's encoder may use.
+  u32 header_table_size{4096};
+  // Largest header list (names, values and 32 bytes per field) accepted;
+  // requests over it are answered with 431.
+  u32 max_header_list_size{64 * 1024};
+};
+
+namespace detail {
+class TlsStream;
+class Deadline;
+class H2ClientSession;
+class WireQueue;
+
+// A connected, non-blocking client socket and, for https, the TLS session
+// over it.
+struct Link {
+  i32 sock{-1};
+  std::shared_ptr<TlsStream> tls{};
+};
+} // namespace detail
+
+// How the time of one Client request was spent, handed to a ClientObserver
+// once the request completes. Phases the request skipped stay at the
+// epoch: there is no lookup or connect on a reused connection, and no TLS
+// for http. When a pooled connection turned out to be closed and the
+// request was sent again, the phases are those of the last attempt.
+struct ClientTrace {
+  using Clock = std::chrono::steady_clock;
+  using TimePoint = Clock::time_point;
+
+  EMethod method{EMethod::GET};
+  URL url;
+  TimePoint start{};
+  TimePoint dns_start{};
+  TimePoint dns_end{};
+  TimePoint connect_start{};
+  TimePoint connect_end{};
+  TimePoint tls_start{};
+  TimePoint tls_end{};
+  // The request written, up to its last byte leaving for the socket.
+  TimePoint write_start{};
+  TimePoint write_end{};
+  TimePoint first_byte{};
+  TimePoint end{};
+  // The wall clock at `start`, to place the steady timestamps in time.
+  std::chrono::system_clock::time_point wall_start{};
+  // The connection came from the pool, or an HTTP/2 session already open.
+  bool reused{false};
+  bool dns_cached{false};
+  bool http2{false};
+  u32 attempts{0};
+  // Request and response bytes on the wire; body bytes only over HTTP/2.
+  size_t bytes_sent{0};
+  size_t bytes_received{0};
+  // 0 when the request failed, with `error` saying why.
+  i32 status_code{0};
+  std::string error;
+  // W3C trace context, as lowercase hex. A request carrying a
+  // `traceparent` header continues its trace as a child of its parent-id;
+  // others start a trace of their own. The header is sent unchanged, and
+  // none is added.
+  std::string trace_id;
+  std::string span_id;
+  std::string parent_span_id;
+
+  // The span of a phase; zero for one that did not happen.
+  static std::chrono::nanoseconds between(TimePoint from, TimePoint to) {
+    if (from == TimePoint{} || to == TimePoint{})
+      return std::chrono::nanoseconds{0};
+    return to - from;
+  }
+  // This request as an OpenTelemetry client span in OTLP/JSON form, one
+  // entry for the `spans` array of an export request. Phases become span
+  // events.
+  std::string to_otlp_json() const;
+};
+
+// Receives the trace of every request once it completes, on the thread
+// that completed it. Requests pay for tracing only while one is installed.
+using ClientObserver = std::function<void(const ClientTrace &)>;
+
+struct ClientPoolConfig {
+  // Idle sockets kept per host:port; extra ones are closed on release.
+  u32 max_idle_per_host{8};
+  std::chrono::milliseconds idle_timeout{30000};
+  // Multiplex all requests to a host:port over one HTTP/2 connection
+  // instead of keeping several HTTP/1.1 ones. https connections offer h2
+  // through ALPN and stay on HTTP/1.1 when the server declines; plain http
+  // assumes the server speaks HTTP/2 (prior knowledge).
+  std::optional<Http2Config> http2{};
+  // Traces the pool's requests instead of the observer set with
+  // Client::observe().
+  ClientObserver observer{};
+};
+
+// Keeps idle keep-alive connections keyed by scheme, host and port so
+// repeated requests to the same upstream skip name resolution and the TCP
+// (and TLS) handshake. Safe to
+// share between threads; each socket is used by one request at a time.
+class ClientPool {
+public:
+  ClientPool() = default;
+  explicit ClientPool(ClientPoolConfig config)
+      : m_Config(std::move(config)) {}
+  ~ClientPool();
+
+  ClientPool(const ClientPool &) = delete;
+  ClientPool &operator=(const ClientPool &) = delete;
+
+  // Closes idle sockets and HTTP/2 connections older than `idle_timeout`.
+  void evict_idle();
+  void clear();
+  size_t idle_count() const;
+  size_t idle_count(const URL &u) const;
+
+private:
+  friend class Client;
+
+  struct IdleSocket {
+    detail::Link link;
+    std::chrono::steady_clock::time_point since;
+  };
+
+  static std::string key_for(const URL &u);
+  // Returns a healthy idle connection for `u`, or one with a negative
+  // socket when none is available.
+  detail::Link acquire(const URL &u);
+  void release(const URL &u, detail::Link link);
+  // The HTTP/2 session for `u`, and whether the caller just created it and
+  // has to connect it. Requests that find it declined use HTTP/1.1.
+  std::pair<std::shared_ptr<detail::H2ClientSession>, bool>
+  session_for(const URL &u);
+  // Drops `session` once it can take no more streams, so the next request
+  // opens a new connection.
+  void forget(const URL &u,
+              const std::shared_ptr<detail::H2ClientSession> &session);
+
+  ClientPoolConfig m_Config;
+  mutable std::mutex m_Mutex;
+  std::map<std::string, std::vector<IdleSocket>> m_Idle;
+  std::map<std::string, std::shared_ptr<detail::H2ClientSession>> m_Sessions;
+};
+
 class Client {
+public:
+  // Receives the result for the request at `index` of a send_all() batch.
+  using Completion = std::function<void(size_t index, stl::result<Response>)>;
+
 private:
-  static stl::result<i32> connect_socket(const URL &u);
-  static stl::result<> send_request(i32 sock, const Request &req);
-  static stl::result<Response> read_response(i32 sock);
+  // Whether the connection can carry another request once the response has
+  // been read.
+  struct Exchange {
+    bool reusable{false};
+    bool received{false};
+    // A request that ran out of time is not replayed.
+    bool timed_out{false};
+  };
+
+  // Sockets are non-blocking throughout, so every wait honours `deadline`.
+  static stl::result<i32>
+  connect_socket(const URL &u, const detail::Deadline &deadline,
+                 std::chrono::steady_clock::time_point until);
+  // Connects and, for https, completes the TLS handshake, offering h2
+  // through ALPN with `offer_h2`.
+  static stl::result<detail::Link> open_link(const URL &u,
+                                             const detail::Deadline &deadline,
+                                             bool offer_h2 = false);
+  static stl::result<> send_request(const detail::Link &link,
+                                    const Request &req,
+                                    const detail::Deadline &deadline,
+                                    bool keep_alive = false);
+  static stl::result<> send_queued(const detail::Link &link,
+                                   detail::WireQueue &out,
+                                   const detail::Deadline &deadline);
+  // With `carry`, bytes already read start the response and those read
+  // past its end are left there, for requests pipelined behind it.
+  static stl::result<Response> read_response(const detail::Link &link,
+                                             const Request &req,
+                                             const detail::Deadline &deadline,
+                                             Exchange &exchange,
+                                             std::string *carry = nullptr);
+  // Traced entry points over the exchanges below, which stamp the trace
+  // `deadline` carries.
+  static stl::result<Response> perform(const Request &req);
+  static stl::result<Response> perform(const Request &req,
+                                       const detail::Deadline &deadline);
+  static stl::result<Response> perform(const Request &req, ClientPool &pool,
+                                       const detail::Deadline &deadline);
+  // Sends `req` over the pool's HTTP/2 connection to its origin; nullopt
+  // when the server declined HTTP/2 and HTTP/1.1 is to be used instead.
+  static std::optional<stl::result<Response>>
+  send_h2(const Request &req, ClientPool &pool,
+          const detail::Deadline &deadline);
+  // Writes the requests `batch` indexes back to back on one connection from
+  // `pool` and reads their responses in order, handing each to `on_done`.
+  // Returns how many were answered; the rest are the caller's to send.
+  static size_t pipeline(std::span<const Request> requests,
+                         const std::vector<size_t> &batch, ClientPool &pool,
+                         const Completion &on_done);
+  static Task<stl::result<detail::Link>>
+  co_connect(const URL &u, const detail::Deadline &deadline);
+  static Task<stl::result<Response>>
+  co_perform(const Request &req, const detail::Deadline &deadline);
+  static Task<stl::result<Response>>
+  co_perform(const Request &req, ClientPool &pool,
+             const detail::Deadline &deadline);
+  static Task<stl::result<Response>>
+  co_exchange(const detail::Link &link, const Request &req,
+              const detail::Deadline &deadline, bool keep_alive,
+              Exchange &exchange);
 
 public:
+  // Runs on the shared client executor; no thread is created per request.
   static std::future<stl::result<Response>> async_send(Request req);
+  // Performs the exchange on the calling thread.
   static stl::result<Response> send(const Request &req);
   static std::future<stl::result<Response>> get(std::string_view url_str);
   static std::future<stl::result<Response>> post(std::string_view url_str,
                                                  std::string body);
+
+  // Same as above, but connections are taken from and returned to `pool`.
+  // The pool must outlive any pending future.
+  static std::future<stl::result<Response>> async_send(Request req,
+                                                        ClientPool &pool);
+  static stl::result<Response> send(const Request &req, ClientPool &pool);
+  static std::future<stl::result<Response>> get(std::string_view url_str,
+                                                ClientPool &pool);
+  static std::future<stl::result<Response>>
+  post(std::string_view url_str, std::string body, ClientPool &pool);
+
+  // Sends every request in `requests` and returns the results in the same
+  // order, using at most `max_in_flight` connections at once. Requests
+  // without a body and with an idempotent method are grouped by host and
+  // pipelined over keep-alive connections; the others are sent one to a
+  // connection. Requests a pipeline could not complete are sent again on
+  // their own. The calling thread works through the batch along with the
+  // shared executor.
+  static std::vector<stl::result<Response>>
+  send_all(std::span<const Request> requests, ClientPool &pool,
+           size_t max_in_flight = 8);
+  // As above, handing each result to `on_done` as it arrives, on any of the
+  // threads; returns once all are done.
+  static void send_all(std::span<const Request> requests, ClientPool &pool,
+                       size_t max_in_flight, const Completion &on_done);
+  // With a pool of its own, closed when the batch is done.
+  static std::vector<stl::result<Response>>
+  send_all(std::span<const Request> requests, size_t max_in_flight = 8);
+
+  // Awaitable forms of send(). In handlers of an event-loop server the
+  // awaiting coroutine suspends while the socket is not ready, so no thread
+  // is held for the length of the call. Name lookups still go through the
+  // DNS cache and block on a miss.
+  static Task<stl::result<Response>> co_send(Request req);
+  // `pool` must outlive the task.
+  static Task<stl::result<Response>> co_send(Request req, ClientPool &pool);
+
+  // Resizes the shared executor. Call it before issuing requests; work
+  // already queued on the old executor still completes.
+  static void configure_executor(ClientExecutorConfig config);
+
+  // Name lookups are cached process-wide. Reconfiguring drops all entries.
+  static void configure_dns_cache(DnsCacheConfig config);
+  static void clear_dns_cache();
+  // Resolves host:port in the background so the first request to it skips
+  // the lookup.
+  static std::future<stl::result<>> pre_resolve(std::string host,
+                                                std::string port = "80");
+
+  // Replaces the trust store and session settings for https requests.
+  // Sessions cached so far are dropped.
+  static stl::result<> configure_tls(ClientTlsConfig config);
+
+  // Traces every request, except those of a pool with an observer of its
+  // own. An empty observer stops tracing. Requests already in flight keep
+  // the observer they started with.
+  static void observe(ClientObserver observer);
+};
+
+namespace detail {
+class AtomicHistogram;
+}
+
+// Latency distribution in nanoseconds. Each power of two is split into
+// k_SubBuckets linear buckets, so any reported quantile is within 12.5% of
+// the true value; samples above ~68s land in the last bucket.
+class LatencyHistogram {
+public:
+  static constexpr size_t k_SubBuckets = 8;
+  static constexpr size_t k_BucketCount = 272;
+
+  static size_t bucket_of(std::uint64_t ns);
+  // Largest value, in nanoseconds, that falls into `bucket`.
+  static std::uint64_t bucket_upper(size_t bucket);
+
+  void record(std::uint64_t ns);
+  void merge(const LatencyHistogram &other);
+
+  std::uint64_t count() const { return m_Count; }
+  std::chrono::nanoseconds sum() const;
+  std::chrono::nanoseconds max() const;
+  std::chrono::nanoseconds mean() const;
+  // Upper bound of the bucket holding quantile `q` (0..1), capped at max().
+  std::chrono::nanoseconds quantile(double q) const;
+  // Samples whose bucket lies entirely at or below `ns`.
+  std::uint64_t count_at_or_below(std::uint64_t ns) const;
+  std::uint64_t bucket_count(size_t bucket) const { return m_Buckets[bucket]; }
+
+private:
+  friend class detail::AtomicHistogram;
+
+  std::array<std::uint64_t, k_BucketCount> m_Buckets{};
+  std::uint64_t m_Count{0};
+  std::uint64_t m_Sum{0};
+  std::uint64_t m_Max{0};
+};
+
+struct RouteMetrics {
+  std::string path;
+  EMethod method;
+  std::uint64_t requests{0};
+  // Responses with a 5xx status, including handler exceptions.
+  std::uint64_t errors{0};
+  LatencyHistogram latency;
+};
+
+// Point-in-time totals from Server::metrics(). Phase histograms cover
+// parsing a request (head and body), running its handler, and serializing
+// and sending responses; the event loop records one write sample per batch
+// of pipelined responses it drains.
+struct ServerMetrics {
+  std::uint64_t connections_accepted{0};
+  std::uint64_t connections_active{0};
+  // Connections answered with 503 because the worker queue was full or a
+  // connection limit was reached.
+  std::uint64_t connections_rejected{0};
+  // Connections dropped for a slow handshake, request head, body or write.
+  std::uint64_t connections_timed_out{0};
+  std::uint64_t requests{0};
+  std::uint64_t parse_errors{0};
+  std::uint64_t not_found{0};
+  std::uint64_t method_not_allowed{0};
+  std::uint64_t handler_exceptions{0};
+  // TLS handshakes completed, how many of them resumed a session, and
+  // handshakes that failed.
+  std::uint64_t tls_handshakes{0};
+  std::uint64_t tls_resumed{0};
+  std::uint64_t tls_handshake_errors{0};
+  // Connections that switched to HTTP/2.
+  std::uint64_t http2_connections{0};
+  // GET requests answered from the response cache, and those that went on
+  // to a handler although the cache could have answered them.
+  std::uint64_t cache_hits{0};
+  std::uint64_t cache_misses{0};
+  LatencyHistogram parse;
+  LatencyHistogram handler;
+  LatencyHistogram write;
+  // One entry per registered route, in registration order.
+  std::vector<RouteMetrics> routes;
+
+  // Prometheus text exposition format, version 0.0.4.
+  std::string to_prometheus() const;
+};
+
+// Lets a handler send its response while still producing it. start() sends
+// the status line and headers. If they include Content-Length the body must
+// be exactly that long; otherwise it is sent chunked (to HTTP/1.0 clients,
+// delimited by closing the connection). write() queues body bytes and, once
+// k_HighWater bytes are waiting, blocks until the client has taken them, so
+// a fast producer never gets far ahead of a slow reader. On HTTP/2
+// connections the response is collected instead and sent once the handler
+// returns.
+class ResponseWriter {
+public:
+  static constexpr size_t k_HighWater = 64 * 1024;
+
+  ResponseWriter(const ResponseWriter &) = delete;
+  ResponseWriter &operator=(const ResponseWriter &) = delete;
+
+  // Sends the head; write() without it starts a 200 response.
+  bool start(i32 status, Headers headers = {});
+  bool write(std::string_view data);
+  // Sends everything queued so far, e.g. to get the head out early.
+  bool flush();
+  // Ends the body. Done automatically once the handler returns.
+  bool finish();
+
+  bool is_started() const { return m_Started; }
+  // False once the client went away or the body broke its declared length.
+  bool is_ok() const { return !m_Failed; }
+
+private:
+  friend class Server;
+
+  ResponseWriter(detail::WireQueue &out, i32 sock, detail::TlsStream *tls,
+                 bool keep_alive, bool head_only, bool accepts_chunked,
+                 std::chrono::milliseconds timeout);
+
+  bool fail();
+
+  detail::WireQueue &m_Out;
+  i32 m_Socket;
+  detail::TlsStream *m_Tls;
+  std::chrono::milliseconds m_Timeout;
+  bool m_KeepAlive;
+  bool m_HeadOnly;
+  bool m_AcceptsChunked;
+  i32 m_Status{0};
+  bool m_Started{false};
+  bool m_Finished{false};
+  bool m_Failed{false};
+  bool m_Chunked{false};
+  bool m_HasLength{false};
+  std::uint64_t m_Remaining{0};
+  size_t m_Queued{0};
+  // Collects the response instead of writing it, for HTTP/2 streams.
+  Response *m_Buffer{nullptr};
 };
 
 using RouteHandler = std::function<Response(const Request &)>;
+using StreamHandler = std::function<void(const Request &, ResponseWriter &)>;
+using AsyncHandler = std::function<Task<Response>(const Request &)>;
 
 struct Route {
   std::string path;
   EMethod method;
   RouteHandler handler;
+  // Set instead of `handler` for handlers taking a ResponseWriter.
+  StreamHandler stream;
+  // Set instead of `handler` for coroutine handlers.
+  AsyncHandler async;
   bool is_regex{false};
+  // Served by a mounted StaticRouter; listed for metrics only.
+  bool is_static{false};
+};
+
+// A string literal as a template argument.
+template <size_t N> struct FixedString {
+  char data[N]{};
+
+  constexpr FixedString(const char (&text)[N]) {
+    std::copy_n(text, N, data);
+  }
+  constexpr std::string_view view() const { return {data, N - 1}; }
+};
+
+// A route of a StaticRouter: `Path` matches literally, without parameters.
+template <FixedString Path, EMethod Method, typename Handler>
+struct StaticRoute {
+  static_assert(
+      std::is_invocable_r_v<Response, const Handler &, const Request &>,
+      "static route handlers take a Request and return a Response");
+  static constexpr std::string_view k_Path = Path.view();
+  static constexpr EMethod k_Method = Method;
+  Handler handler;
+};
+
+template <FixedString Path, EMethod Method, typename Handler>
+StaticRoute<Path, Method, Handler> static_route(Handler handler) {
+  return {std::move(handler)};
+}
+
+namespace detail {
+// What Server needs of a StaticRouter, whatever its routes.
+class StaticRoutes {
+public:
+  virtual ~StaticRoutes() = default;
+  virtual size_t size() const = 0;
+  virtual std::string_view path(size_t route) const = 0;
+  virtual EMethod method(size_t route) const = 0;
+  // Finds the route for `path` under `method`. `allowed` gets the
+  // method_bit() mask of the methods `path` has, even when `method` is
+  // not one of them.
+  virtual bool find(std::string_view path, EMethod method, size_t &route,
+                    u32 &allowed) const = 0;
+  virtual Response call(size_t route, const Request &req) const = 0;
+};
+
+// The distinct paths of N static routes and, per path and method, the
+// route serving it (N for none). The first route for a path and method
+// wins, as with Server::route().
+template <size_t N> struct StaticPaths {
+  std::array<std::string_view, N> paths{};
+  size_t count{0};
+  std::array<std::array<size_t, k_MethodCount>, N> routes{};
+  std::array<u32, N> allowed{};
+};
+
+template <size_t N>
+constexpr StaticPaths<N>
+static_paths(const std::array<std::string_view, N> &paths,
+             const std::array<EMethod, N> &methods) {
+  StaticPaths<N> table;
+  for (auto &routes : table.routes)
+    routes.fill(N);
+  for (size_t i = 0; i < N; ++i) {
+    size_t path = 0;
+    while (path < table.count && table.paths[path] != paths[i])
+      ++path;
+    if (path == table.count)
+      table.paths[table.count++] = paths[i];
+    auto &route = table.routes[path][static_cast<size_t>(methods[i])];
+    if (route == N)
+      route = i;
+    table.allowed[path] |= method_bit(methods[i]);
+  }
+  return table;
+}
+} // namespace detail
+
+// Routes known at compile time, for Server::mount(). Paths are looked up in
+// a perfect hash the compiler builds, and handlers are called directly
+// instead of through std::function:
+//
+//   http::StaticRouter routes{
+//       http::static_route<"/health", http::EMethod::GET>(
+//           [](const http::Request &) { return http::Response(200, "ok"); }),
+//       http::static_route<"/version", http::EMethod::GET>(version)};
+//   server.mount(std::move(routes));
+//
+// Handlers are called concurrently, so they must be safe to call on a
+// const object from several threads.
+template <typename... Routes>
+class StaticRouter final : public detail::StaticRoutes {
+public:
+  explicit StaticRouter(Routes... routes) : m_Routes(std::move(routes)...) {}
+
+  size_t size() const override { return k_Count; }
+  std::string_view path(size_t route) const override {
+    return k_Paths[route];
+  }
+  EMethod method(size_t route) const override { return k_Methods[route]; }
+
+  bool find(std::string_view path, EMethod method, size_t &route,
+            u32 &allowed) const override {
+    size_t index = k_Lookup.find(path);
+    if (index == k_Count)
+      return false;
+    allowed = k_Table.allowed[index];
+    route = k_Table.routes[index][static_cast<size_t>(method)];
+    return route != k_Count;
+  }
+
+  Response call(size_t route, const Request &req) const override {
+    return call(route, req, std::index_sequence_for<Routes...>{});
+  }
+
+private:
+  static constexpr size_t k_Count = sizeof...(Routes);
+  static constexpr std::array<std::string_view, k_Count> k_Paths{
+      Routes::k_Path...};
+  static constexpr std::array<EMethod, k_Count> k_Methods{Routes::k_Method...};
+  static constexpr detail::StaticPaths<k_Count> k_Table =
+      detail::static_paths(k_Paths, k_Methods);
+  static constexpr detail::PerfectHash<k_Count> k_Lookup{k_Table.paths,
+                                                         k_Table.count};
+
+  template <size_t... I>
+  Response call(size_t route, const Request &req,
+                std::index_sequence<I...>) const {
+    std::optional<Response> resp;
+    (void)((I == route &&
+            (resp.emplace(std::get<I>(m_Routes).handler(req)), true)) ||
+           ...);
+    return std::move(*resp);
+  }
+
+  std::tuple<Routes...> m_Routes;
+};
+
+// Runs after a handler on the response it returned, before it is sent.
+// Streamed responses bypass it.
+using Middleware = std::function<void(const Request &, Response &)>;
+
+struct CompressionConfig {
+  // Smaller bodies are sent as they are: the bytes saved would not pay for
+  // the CPU time.
+  size_t min_size{1024};
+  // Content-Type prefixes worth compressing.
+  std::vector<std::string> content_types{
+      "text/", "application/json", "application/javascript",
+      "application/xml", "image/svg+xml"};
+  // Codings offered, where the build has them (brotli and zlib are optional
+  // dependencies); the server prefers br, then gzip, then deflate.
+  bool brotli{true};
+  bool gzip{true};
+  bool deflate{true};
+  i32 zlib_level{6};
+  i32 brotli_quality{5};
+  // Compressed bodies kept by content hash, so a body sent again verbatim is
+  // compressed only once. The originals are kept to confirm each hit and
+  // count towards the budget. Zero disables the cache.
+  size_t cache_bytes{16 * 1024 * 1024};
+};
+
+// Middleware compressing response bodies for clients whose Accept-Encoding
+// allows it. Sets Vary, and weakens a strong ETag on compressed responses.
+Middleware compress_responses(CompressionConfig config = {});
+
+struct StaticFileConfig {
+  // Files kept open with their metadata and validators, least recently
+  // used first out. Each entry holds one descriptor.
+  size_t max_cached_files{256};
+  // How long cached metadata is trusted before the file is checked again;
+  // within it, conditional requests are answered without any syscall.
+  std::chrono::milliseconds revalidate_after{1000};
+  // Served for paths that end in '/'.
+  std::string index_file{"index.html"};
+};
+
+struct ResponseCacheConfig {
+  // Memory for cached responses, split evenly over `shards`; each has its
+  // own lock and evicts its least recently used responses first.
+  size_t max_bytes{64 * 1024 * 1024};
+  size_t shards{16};
+  // Larger responses are not cached.
+  size_t max_entry_bytes{1024 * 1024};
+  // How long a response is kept when its Cache-Control has neither
+  // s-maxage nor max-age.
+  std::chrono::milliseconds default_ttl{1000};
+  // Request headers whose values key the cache besides the host, path and
+  // query, such as Accept-Encoding when responses are compressed. A
+  // response whose Vary names any other header is not cached.
+  std::vector<std::string> vary_headers;
+};
+
+// Server side of https. Needs a build with SAP_HTTP_WITH_TLS.
+struct TlsConfig {
+  // PEM certificate chain (leaf first) and its private key.
+  std::string certificate_file;
+  std::string private_key_file;
+  // Protocols offered through ALPN, most preferred first.
+  std::vector<std::string> alpn{"http/1.1"};
+  // Resumption: stateless session tickets, and the server-side session
+  // cache for clients that resume by session id.
+  bool session_tickets{true};
+  size_t session_cache_size{20 * 1024};
+  // Let the kernel encrypt (Linux kTLS) where OpenSSL and the kernel can,
+  // so static files keep going out with sendfile.
+  bool ktls{true};
 };
 
 struct ServerConfig {
+  // A listening socket to serve instead of opening one, such as one from
+  // inherited_listeners() or receive_listeners(); -1 opens one. It is
+  // closed by stop() but never shut down, so processes sharing it keep
+  // accepting.
   i32 server_socket{-1};
   u16 port{8080};
   bool is_multithreaded{false};
+  // Worker threads serving accepted sockets in multithreaded mode; 0 picks
+  // std::thread::hardware_concurrency().
+  u32 worker_threads{0};
+  // Accepted sockets waiting for a worker. Once full, new connections are
+  // answered with 503 and closed.
+  u32 max_pending_connections{1024};
+  // Persistent HTTP/1.1 connections: how long an idle connection is kept
+  // and how many requests it may serve (0 = unlimited) before it is closed.
+  bool keep_alive{true};
+  std::chrono::milliseconds keep_alive_timeout{5000};
+  u32 max_keep_alive_requests{100};
+  // Largest request body accepted (Content-Length or decoded chunked size);
+  // bigger uploads are answered with 413 and the connection is closed.
+  size_t max_body_size{8 * 1024 * 1024};
+  // Multiplex all connections over non-blocking sockets (epoll on Linux,
+  // kqueue on BSD/macOS) instead of handling one blocking socket at a time.
+  bool use_event_loop{false};
+  // Number of event-loop threads when use_event_loop is set.
+  u32 event_loop_threads{1};
+  // Allocate parsed request headers from a per-connection arena that is
+  // reset after every request, instead of the global heap. Handlers must
+  // not keep references to request headers past their return.
+  bool use_request_arena{false};
+  size_t request_arena_size{16 * 1024};
+  // How long a response write may wait for a client that is not reading
+  // before the connection is dropped.
+  std::chrono::milliseconds write_timeout{30000};
+  // Slow clients: a request head must be complete within `header_timeout`
+  // of its first byte (a TLS handshake within the same time of accept), and
+  // a request body may stall for at most `body_timeout` between reads.
+  // keep_alive_timeout still bounds the wait for the next request.
+  std::chrono::milliseconds header_timeout{10000};
+  std::chrono::milliseconds body_timeout{30000};
+  // Connections open at once, in total and from one client address (0 =
+  // unlimited). Connections past a limit are answered with 503 and closed.
+  u32 max_connections{0};
+  u32 max_connections_per_ip{0};
+  // Per-thread counters and latency histograms read by Server::metrics().
+  bool collect_metrics{true};
+  // IPv4 or IPv6 address (or host name) to listen on; empty means every
+  // interface. "::" accepts both IPv6 and IPv4 clients.
+  std::string bind_address{"127.0.0.1"};
+  // Connections the kernel queues for accept() before dropping SYNs.
+  i32 listen_backlog{1024};
+  // Event-loop mode: open one SO_REUSEPORT listening socket per loop so the
+  // kernel spreads new connections across loops instead of every loop
+  // accepting from one queue.
+  bool reuse_port{false};
+  // More listening sockets to serve, after server_socket if that is set:
+  // every one receive_listeners() returns from a reuse_port server. Loop i
+  // accepts from socket i modulo their number, and there are never fewer
+  // loops than sockets. More than one socket requires use_event_loop.
+  std::vector<i32> server_sockets{};
+  // Event-loop mode: pin loop thread i to CPU i (mod core count). Linux only.
+  bool pin_threads{false};
+  // Terminate TLS on every accepted connection.
+  std::optional<TlsConfig> tls{};
+  // Also speak HTTP/2: to TLS clients choosing h2 through ALPN (offered
+  // ahead of tls->alpn) and, without TLS, to clients opening with the
+  // connection preface (prior knowledge; there is no Upgrade from
+  // HTTP/1.1). Streams go to the same routes. The event loop runs a
+  // connection's streams concurrently; the blocking modes answer them in
+  // turn. Request arenas are not used for HTTP/2 requests.
+  std::optional<Http2Config> http2{};
 };
 
+namespace detail {
+class Router;
+class MetricsRegistry;
+class MetricsShard;
+class TlsContext;
+class ConnectionLimiter;
+class ResponseCache;
+} // namespace detail
+
 class Server {
 public:
-  Server() = default;
+  Server();
   Server(ServerConfig cfg);
   ~Server();
   stl::result<> start();
   void run();
   void stop();
+  // Drains the server for a restart or exit: stops accepting, answers the
+  // requests in progress with `Connection: close` and closes connections
+  // that are between requests. Connections still busy after `grace` are
+  // dropped; handlers are not interrupted. Returns once run() has, true
+  // when nothing had to be dropped. Not to be called from a handler.
+  bool shutdown(std::chrono::milliseconds grace = std::chrono::seconds(30));
+  // Sends the listening sockets to the process waiting in
+  // receive_listeners() at the Unix socket `path`, so it can take over
+  // accepting before this one shuts down. New connections queue on the
+  // shared socket meanwhile instead of being refused. The receiver serves
+  // all of them through ServerConfig::server_sockets. POSIX only; call
+  // after start().
+  stl::result<> hand_off(std::string_view path);
 
+  // Paths may contain `:name` segments, which match one segment, and a
+  // trailing `*name`, which matches the rest of the path. Both are exposed
+  // through Request::params. Routes are frozen into a lookup tree by
+  // start(); routes added afterwards are ignored.
+  //
+  // Handlers either return a Response or, to stream it, take a
+  // ResponseWriter as their second argument and return nothing. Coroutine
+  // handlers return Task<Response>; in event-loop mode the connection waits
+  // while they are suspended, and the loop serves other connections.
   template <typename Handler>
   void route(std::string_view path, EMethod method, Handler &&handler) {
+    if (m_Router)
+      return;
     Route r;
     r.path = path;
     r.method = method;
-    r.handler = std::forward<Handler>(handler);
+    if constexpr (std::is_invocable_v<Handler &, const Request &,
+                                      ResponseWriter &>) {
+      r.stream = std::forward<Handler>(handler);
+    } else if constexpr (std::is_same_v<
+                             std::invoke_result_t<Handler &, const Request &>,
+                             Task<Response>>) {
+      r.async = std::forward<Handler>(handler);
+    } else {
+      r.handler = std::forward<Handler>(handler);
+    }
     m_Routes.push_back(std::move(r));
   }
 
+  // Serves the routes of `router`. They are matched before those added with
+  // route(), which still serve the paths and methods it lacks; a path both
+  // have answers 405 only when neither has the method. Call before start(),
+  // like route().
+  template <typename... Routes> void mount(StaticRouter<Routes...> router) {
+    if (m_Router)
+      return;
+    auto routes =
+        std::make_unique<StaticRouter<Routes...>>(std::move(router));
+    size_t first = m_Routes.size();
+    for (size_t i = 0; i < routes->size(); ++i) {
+      Route r;
+      r.path = routes->path(i);
+      r.method = routes->method(i);
+      r.is_static = true;
+      m_Routes.push_back(std::move(r));
+    }
+    m_Static.emplace_back(first, std::move(routes));
+  }
+
+  // Serves files under `directory` for GET and HEAD requests below
+  // `prefix`, with ETag/Last-Modified validators and single byte ranges.
+  // Call before start(), like route().
+  void serve_static(std::string_view prefix, std::string directory,
+                    StaticFileConfig config = {});
+
+  // Aggregates the per-thread counters. Cheap enough to poll, but it takes
+  // a lock shared with threads that start serving for the first time.
+  ServerMetrics metrics() const;
+  // Serves metrics() in Prometheus text format at `path`. Call before
+  // start(), like route().
+  void expose_metrics(std::string_view path = "/metrics");
+
+  // Adds middleware run on every handler response, in the order added. Call
+  // before start(), like route().
+  void use(Middleware middleware);
+
+  // Answers repeated GET requests from memory with the bytes stored for the
+  // first one, after middleware ran on it. Responses are kept for their
+  // Cache-Control s-maxage or max-age, or config.default_ttl; no-store,
+  // no-cache, private, Set-Cookie and file bodies keep them out, as do
+  // requests with Authorization or no-store. Concurrent misses for one key
+  // wait for a single handler call. Hits skip routing and the per-route
+  // metrics. Call before start(), like route().
+  void cache_responses(ResponseCacheConfig config = {});
+
 private:
+  class Connection;
+  class Reactor;
+
   void handle_client(i32 client_socket);
+  // Blocking modes: serves an HTTP/2 connection, answering its streams in
+  // turn. `in` holds what was read ahead.
+  void serve_h2(i32 sock, detail::TlsStream *tls, std::string &in,
+                detail::MetricsShard *metrics);
+  // A coroutine handler that suspended, with the request it reads.
+  struct Deferred;
+  // One request being answered on a connection. `keep_alive` is set by
+  // process_request().
+  struct Exchange {
+    detail::WireQueue &out;
+    i32 sock;
+    detail::TlsStream *tls;
+    detail::MetricsShard *metrics;
+    u32 served;
+    bool wants_keep_alive;
+    bool accepts_chunked;
+    bool keep_alive{false};
+    // Event-loop connections can wait for a suspended coroutine handler,
+    // which process_request() then leaves in `deferred`.
+    bool can_defer{false};
+    std::unique_ptr<Deferred> deferred{};
+    // Set by event-loop connections, which must not block waiting for a
+    // response another request is producing for the cache. The request is
+    // handed back in `parked` instead, to be retried once `wake` is called.
+    const std::function<void()> *wake{nullptr};
+    std::optional<Request> parked{};
+    // An HTTP/2 stream: streaming handlers write into the returned
+    // Response instead of `out`.
+    bool multiplexed{false};
+  };
+
+  // The calling thread's shard, or nullptr when metrics are off.
+  detail::MetricsShard *local_metrics() const;
+  std::optional<Response> dispatch(Request &req, Exchange &exchange,
+                                   ResponseWriter &writer) const;
+  std::optional<Response> start_async(Request &req, size_t route,
+                                      Exchange &exchange) const;
+  Task<Response> run_async(Deferred &deferred,
+                           detail::MetricsShard *metrics) const;
+  // Returns the response to queue on `exchange.out`, or nothing when a
+  // streaming handler already wrote it there or the handler was deferred.
+  std::optional<Response> process_request(Request req,
+                                          Exchange &exchange) const;
+  void apply_middleware(const Request &req, Response &resp) const;
+  void run_event_loops();
+  // The blocking modes' accept loop.
+  void accept_clients();
+  void close_listeners();
+  // Stopped, or draining: responses say `Connection: close`.
+  bool is_closing() const;
+  // The blocking modes' wait for a client, in loop ticks so a drain is
+  // noticed. `idle` connections, between requests, give up as it starts;
+  // others at its deadline.
+  bool wait_client(i32 sock, detail::TlsStream *tls,
+                   std::chrono::milliseconds timeout, bool idle) const;
 
 private:
   ServerConfig m_Config;
   std::vector<Route> m_Routes;
+  // Mounted routers, each with the index in m_Routes of its first route.
+  std::vector<std::pair<size_t, std::unique_ptr<detail::StaticRoutes>>>
+      m_Static;
+  std::vector<Middleware> m_Middleware;
+  // Listening sockets. Closed under m_ServeMutex by stop(), or by run() on
+  // its way out when stop() came while it was serving.
+  std::vector<i32> m_Listeners;
+  std::unique_ptr<detail::Router> m_Router;
+  std::unique_ptr<detail::MetricsRegistry> m_Metrics;
+  // Set in start() when m_Config.tls is.
+  std::shared_ptr<detail::TlsContext> m_Tls;
+  // Set in start() when a connection limit is.
+  std::unique_ptr<detail::ConnectionLimiter> m_Limiter;
+  // Set by cache_responses().
+  std::unique_ptr<detail::ResponseCache> m_Cache;
   std::atomic<bool> m_IsRunning{false};
   std::vector<std::thread> m_WorkerThreads;
+  // Listeners adopted through server_socket or handed off: other processes
+  // may accept from them too.
+  std::atomic<bool> m_SharesListeners{false};
+  // Set by shutdown(); m_DrainDeadline is written before m_IsDraining.
+  std::atomic<bool> m_IsDraining{false};
+  std::chrono::steady_clock::time_point m_DrainDeadline{};
+  // Whether a drain had to drop a connection that was busy.
+  mutable std::atomic<bool> m_Dropped{false};
+  // run() in progress, for shutdown() to wait on.
+  std::mutex m_ServeMutex;
+  std::condition_variable m_Served;
+  bool m_IsServing{false};
 };
 
+// Listening sockets passed in by systemd socket activation (LISTEN_PID and
+// LISTEN_FDS), ready for ServerConfig::server_socket; empty when there are
+// none. The variables are cleared so that child processes ignore them.
+std::vector<i32> inherited_listeners();
+
+// Waits up to `timeout` at the Unix socket `path` for a server's
+// hand_off() and returns the listening sockets it sent. POSIX only.
+stl::result<std::vector<i32>>
+receive_listeners(std::string_view path,
+                  std::chrono::milliseconds timeout = std::chrono::seconds(30));
+
 } // namespace http
\ No newline at end of file
@@ -0,0 +1,33 @@
+#pragma once
+
+#include <cstddef>
+#include <memory>
+#include <memory_resource>
+
+namespace http::detail {
+
+// Monotonic per-connection allocator for parsed request state. Allocation is
+// a pointer bump into an inline block (spilling to the heap when it is
+// exhausted) and reset() frees everything in one step, so request headers
+// never go through the global allocator, and worker threads do not contend
+// on it.
+class RequestArena {
+public:
+  explicit RequestArena(size_t initial_size)
+      : m_Buffer(new std::byte[initial_size]),
+        m_Resource(m_Buffer.get(), initial_size,
+                   std::pmr::new_delete_resource()) {}
+
+  RequestArena(const RequestArena &) = delete;
+  RequestArena &operator=(const RequestArena &) = delete;
+
+  std::pmr::memory_resource *resource() { return &m_Resource; }
+  // Everything allocated from the arena must already be destroyed.
+  void reset() { m_Resource.release(); }
+
+private:
+  std::unique_ptr<std::byte[]> m_Buffer;
+  std::pmr::monotonic_buffer_resource m_Resource;
+};
+
+} // namespace http::detail
@@ -0,0 +1,81 @@
+#pragma once
+
+#include "event_loop.h"
+#include <algorithm>
+#include <coroutine>
+
+namespace http::detail {
+
+// `co_await SocketReady(sock, IO_READ)` suspends the coroutine until `sock`
+// is ready on the calling thread's event loop. Without a loop (or inside a
+// BlockingScope) it polls in place. Resolves to false when the wait itself
+// failed or `until` passed first; errors on the socket are left for the
+// next send or recv.
+class SocketReady : public IoHandler {
+public:
+  using Clock = std::chrono::steady_clock;
+
+  SocketReady(i32 sock, u32 events,
+              Clock::time_point until = Clock::time_point::max())
+      : m_Socket(sock), m_Events(events), m_Until(until) {}
+  SocketReady(const SocketReady &) = delete;
+  SocketReady &operator=(const SocketReady &) = delete;
+  // A coroutine destroyed while suspended here must not leave the poller
+  // pointing into its frame.
+  ~SocketReady() override { detach(); }
+
+  bool await_ready() {
+    if (EventLoop::current())
+      return false;
+    std::chrono::milliseconds timeout{-1};
+    if (m_Until != Clock::time_point::max()) {
+      timeout = std::max(std::chrono::milliseconds{0},
+                         std::chrono::ceil<std::chrono::milliseconds>(
+                             m_Until - Clock::now()));
+    }
+    m_Ready = (m_Events & IO_READ) ? wait_readable(m_Socket, timeout)
+                                   : wait_writable(m_Socket, timeout);
+    return true;
+  }
+  bool await_suspend(std::coroutine_handle<> awaiting) {
+    auto *loop = EventLoop::current();
+    if (!loop->poller().add(m_Socket, m_Events, this))
+      return false;
+    m_Loop = loop;
+    m_Awaiting = awaiting;
+    if (m_Until != Clock::time_point::max()) {
+      m_Timer = loop->add_timer(m_Until, [this]() { wake(false); });
+      m_HasTimer = true;
+    }
+    return true;
+  }
+  bool await_resume() const { return m_Ready; }
+
+  void on_io(u32) override { wake(true); }
+
+private:
+  void detach() {
+    if (!m_Loop)
+      return;
+    m_Loop->poller().remove(m_Socket);
+    if (m_HasTimer)
+      m_Loop->cancel_timer(m_Timer);
+    m_Loop = nullptr;
+  }
+  void wake(bool ready) {
+    detach();
+    m_Ready = ready;
+    m_Awaiting.resume();
+  }
+
+  i32 m_Socket;
+  u32 m_Events;
+  Clock::time_point m_Until;
+  EventLoop *m_Loop{nullptr};
+  EventLoop::TimerKey m_Timer{};
+  bool m_HasTimer{false};
+  std::coroutine_handle<> m_Awaiting;
+  bool m_Ready{false};
+};
+
+} // namespace http::detail
@@ -0,0 +1,68 @@
+#pragma once
+
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <optional>
+
+namespace http::detail {
+
+// Fixed-capacity multi-producer/multi-consumer queue. Producers never block:
+// try_push fails once the queue is full so the caller can shed load.
+template <typename T> class BoundedQueue {
+public:
+  explicit BoundedQueue(size_t capacity) : m_Capacity(capacity) {}
+
+  bool try_push(T value) {
+    {
+      std::lock_guard lock(m_Mutex);
+      if (m_Closed || m_Items.size() >= m_Capacity)
+        return false;
+      m_Items.push_back(std::move(value));
+    }
+    m_NotEmpty.notify_one();
+    return true;
+  }
+
+  // Blocks until an item is available; empty once the queue is closed and
+  // nothing is left.
+  std::optional<T> pop() {
+    std::unique_lock lock(m_Mutex);
+    m_NotEmpty.wait(lock, [this] { return m_Closed || !m_Items.empty(); });
+    if (m_Items.empty())
+      return std::nullopt;
+    T value = std::move(m_Items.front());
+    m_Items.pop_front();
+    return value;
+  }
+
+  // Wakes every consumer and hands back whatever was still queued.
+  std::deque<T> close() {
+    std::deque<T> rest;
+    {
+      std::lock_guard lock(m_Mutex);
+      m_Closed = true;
+      rest.swap(m_Items);
+    }
+    m_NotEmpty.notify_all();
+    return rest;
+  }
+
+  // Takes no more items but lets consumers pop those already queued.
+  void finish() {
+    {
+      std::lock_guard lock(m_Mutex);
+      m_Closed = true;
+    }
+    m_NotEmpty.notify_all();
+  }
+
+private:
+  size_t m_Capacity;
+  std::mutex m_Mutex;
+  std::condition_variable m_NotEmpty;
+  std::deque<T> m_Items;
+  bool m_Closed{false};
+};
+
+} // namespace http::detail
@@ -1,194 +1,549 @@
 #include "net/http.h"
-#include <cstring>
-
-#ifdef _WIN32
-#include <winsock2.h>
-#include <ws2tcpip.h>
-#pragma comment(lib, "ws2_32.lib")
-#else
-#include <arpa/inet.h>
-#include <netdb.h>
-#include <sys/socket.h>
-#include <unistd.h>
-#endif
+#include "async_io.h"
+#include "compression.h"
+#include "deadline.h"
+#include "executor.h"
+#include "h2.h"
+#include "resolver.h"
+#include "scan.h"
+#include "socket.h"
+#include "tls.h"
+#include "trace.h"
+#include "wire.h"
+#include <charconv>
+#include <condition_variable>
 
 namespace http {
 
-stl::result<int> Client::connect_socket(const URL &u) {
-  struct addrinfo hints{}, *res = nullptr;
-  std::memset(&hints, 0, sizeof(hints));
-  hints.ai_family = AF_UNSPEC;
-  hints.ai_socktype = SOCK_STREAM;
-  i32 gai_result = getaddrinfo(u.host.c_str(), u.port.c_str(), &hints, &res);
-  if (gai_result != 0) {
-#ifdef _WIN32
-    return stl::make_error<i32>("Failed to resolve host " + u.host + ": " +
-                                std::to_string(WSAGetLastError()));
-#else
-    return stl::make_error<i32>("Failed to resolve host " + u.host + ": " +
-                                std::string(gai_strerror(gai_result)));
-#endif
-  }
-  i32 sock = -1;
-  struct addrinfo *rp = nullptr;
-  for (rp = res; rp != nullptr; rp = rp->ai_next) {
-    sock = socket(rp->ai_family, rp->ai_socktype, rp->ai_protocol);
-    if (sock < 0) {
+using detail::close_socket;
+using Clock = detail::Deadline::Clock;
+
+// Waits for `events` on a non-blocking socket; false on error or once
+// `until` passes.
+static bool wait_for(i32 sock, u32 events, Clock::time_point until) {
+  auto timeout = detail::Deadline::remaining(until);
+  return (events & detail::IO_READ) ? detail::wait_readable(sock, timeout)
+                                    : detail::wait_writable(sock, timeout);
+}
+
+// Completes a non-blocking connect(): 0 once connected, k_TimedOut when
+// `until` passed first, or the error it failed with.
+static i32 finish_connect(i32 sock, Clock::time_point until) {
+  if (wait_for(sock, detail::IO_WRITE, until))
+    return detail::pending_socket_error(sock);
+  i32 err = detail::pending_socket_error(sock);
+  return err != 0 ? err : detail::k_TimedOut;
+}
+
+static bool is_idempotent(EMethod m) {
+  return m != EMethod::POST && m != EMethod::PATCH;
+}
+
+static bool asks_to_close(const Request &req) {
+  return detail::has_member(req.headers.get(EHeader::Connection), "close");
+}
+
+stl::result<int> Client::connect_socket(const URL &u,
+                                        const detail::Deadline &deadline,
+                                        Clock::time_point until) {
+  auto *trace = deadline.trace();
+  auto &cache = detail::DnsCache::instance();
+  detail::mark(trace, &ClientTrace::dns_start);
+  auto resolved =
+      cache.resolve(u.host, u.port, trace ? &trace->dns_cached : nullptr);
+  detail::mark(trace, &ClientTrace::dns_end);
+  if (!resolved) {
+    return stl::make_error<i32>(resolved.error());
+  }
+  // Fall through the cached addresses in order; remember the one that
+  // worked so the next connection does not retry a dead address first.
+  const auto &endpoints = *resolved.value();
+  detail::mark(trace, &ClientTrace::connect_start);
+  i32 err = 0;
+  for (size_t i = 0; i < endpoints.size(); ++i) {
+    const auto &endpoint = endpoints[i];
+    i32 sock = static_cast<i32>(
+        socket(endpoint.family, endpoint.socktype, endpoint.protocol));
+    if (sock < 0 || !detail::set_nonblocking(sock)) {
+      err = detail::last_socket_error();
+      if (sock >= 0)
+        close_socket(sock);
       continue;
     }
-    if (connect(sock, rp->ai_addr, rp->ai_addrlen) == 0) {
-      break;
+    err = connect(sock, reinterpret_cast<const sockaddr *>(&endpoint.address),
+                  endpoint.length) == 0
+              ? 0
+              : detail::last_socket_error();
+    if (detail::is_in_progress(err))
+      err = finish_connect(sock, until);
+    if (err == 0) {
+      if (i > 0)
+        cache.prefer(u.host, u.port, endpoint);
+      detail::mark(trace, &ClientTrace::connect_end);
+      return sock;
+    }
+    close_socket(sock);
+    if (err == detail::k_TimedOut)
+      return stl::make_error<i32>(deadline.timed_out(until, "Connecting to"));
+  }
+  return stl::make_error<i32>("Failed to connect to " + u.host + ":" + u.port +
+                              " - " + detail::socket_error_string(err));
+}
+
+namespace {
+bool is_https(const URL &u) { return u.scheme == "https"; }
+
+// The client TLS context for https URLs, nullptr for plain ones. Checked
+// before connecting so a build without TLS fails without touching the
+// network.
+stl::result<std::shared_ptr<detail::TlsContext>> tls_context(const URL &u) {
+  if (!is_https(u))
+    return std::shared_ptr<detail::TlsContext>();
+  return detail::TlsContext::client();
+}
+
+// A client TLS stream over the connected `sock`, handshake not yet run.
+stl::result<std::shared_ptr<detail::TlsStream>>
+open_tls(detail::TlsContext &context, i32 sock, const URL &u,
+         bool offer_h2 = false) {
+  using Result = std::shared_ptr<detail::TlsStream>;
+  auto stream = context.open(sock, u.host, u.port, offer_h2);
+  if (!stream)
+    return stl::make_error<Result>(stream.error());
+  return Result(std::move(stream.value()));
+}
+
+std::string handshake_error(const URL &u, const std::string &error) {
+  return error + " (" + u.host + ":" + u.port + ")";
+}
+
+// The pool's own observer, else the installed one. The pool outlives its
+// requests, so its observer is referred to rather than copied.
+std::shared_ptr<const ClientObserver>
+observer_of(const ClientPoolConfig &config) {
+  if (config.observer) {
+    return std::shared_ptr<const ClientObserver>(
+        std::shared_ptr<const ClientObserver>(), &config.observer);
+  }
+  return detail::installed_observer();
+}
+
+// Whether the client negotiates the content coding on the caller's behalf,
+// and so owns decoding it.
+bool negotiates_coding(const Request &req) {
+  return req.decompress && !req.headers.has("accept-encoding") &&
+         !req.headers.has("range") &&
+         detail::supported_codings() !=
+             detail::coding_bit(detail::ECoding::Identity);
+}
+
+const std::string &accept_encoding() {
+  static const std::string value = []() {
+    std::string codings;
+    for (auto coding : {detail::ECoding::Brotli, detail::ECoding::Gzip,
+                        detail::ECoding::Deflate}) {
+      if (!(detail::supported_codings() & detail::coding_bit(coding)))
+        continue;
+      if (!codings.empty())
+        codings.append(", ");
+      codings.append(detail::coding_name(coding));
+    }
+    return codings;
+  }();
+  return value;
+}
+
+// Returns the number of bytes queued.
+size_t queue_request(detail::WireQueue &out, const Request &req,
+                     bool keep_alive) {
+  std::string head;
+  head.reserve(256);
+  head.append(method_to_string(req.method));
+  head.push_back(' ');
+  head.append(req.url.full_path());
+  head.append(" HTTP/1.1\r\nHost: ");
+  head.append(req.url.host);
+  head.append("\r\n");
+  // Unpooled sockets carry a single exchange, so let the server hang up.
+  if (!keep_alive && !req.headers.has(EHeader::Connection)) {
+    head.append("Connection: close\r\n");
+  }
+  if (negotiates_coding(req)) {
+    head.append("Accept-Encoding: ");
+    head.append(accept_encoding());
+    head.append("\r\n");
+  }
+  for (const auto &[key, value] : req.headers) {
+    head.append(key);
+    head.append(": ");
+    head.append(value);
+    head.append("\r\n");
+  }
+  head.append("\r\n");
+  size_t size = head.size() + req.body.size();
+  out.push(std::move(head));
+  // The body goes out straight from the request, next to the head.
+  out.push_view(req.body);
+  return size;
+}
+
+// Builds a response from its head and body bytes, decoding a content coding
+// the client negotiated and handing the body to on_body_chunk when set.
+class ResponseAssembler {
+public:
+  explicit ResponseAssembler(const Request &req)
+      : m_Request(req), m_Append([this](std::string_view data) {
+          m_Response.body.append(data);
+        }),
+        m_Inflate([this](std::string_view data) {
+          if (!m_Decompressor->decode(data, output()))
+            m_DecodeFailed = true;
+        }) {}
+  ResponseAssembler(const ResponseAssembler &) = delete;
+  ResponseAssembler &operator=(const ResponseAssembler &) = delete;
+
+  Response &response() { return m_Response; }
+  // Once the status and headers are set. `size` is the body length when
+  // the head gives it.
+  void begin(bool no_body, std::optional<size_t> size) {
+    if (!m_Request.on_body_chunk && size)
+      m_Response.body.reserve(*size);
+    if (!negotiates_coding(m_Request) || no_body)
+      return;
+    auto coding =
+        detail::coding_from_name(m_Response.headers.get("content-encoding"));
+    m_Decompressor = detail::Decompressor::create(coding);
+    if (m_Decompressor) {
+      // They describe the bytes on the wire, not the body handed back.
+      m_Response.headers.remove("content-encoding");
+      m_Response.headers.remove(EHeader::ContentLength);
+    }
+  }
+  // Where body bytes go as they arrive.
+  const BodyDecoder::Sink &sink() const {
+    return m_Decompressor ? m_Inflate : output();
+  }
+  bool decode_failed() const { return m_DecodeFailed; }
+  // False when the encoded body ended early.
+  bool finish() { return !m_Decompressor || m_Decompressor->finish(); }
+  Response take() { return std::move(m_Response); }
+
+private:
+  const BodyDecoder::Sink &output() const {
+    return m_Request.on_body_chunk ? m_Request.on_body_chunk : m_Append;
+  }
+
+  const Request &m_Request;
+  BodyDecoder::Sink m_Append;
+  // Feeds the encoded body through m_Decompressor.
+  BodyDecoder::Sink m_Inflate;
+  std::unique_ptr<detail::Decompressor> m_Decompressor;
+  bool m_DecodeFailed{false};
+  Response m_Response;
+};
+
+// Parses one response from bytes as they arrive, for both the blocking and
+// the coroutine exchanges.
+class ResponseReader {
+public:
+  enum class EStatus { NeedMore, Complete, Failed };
+
+  explicit ResponseReader(const Request &req)
+      : m_Request(req), m_Assembler(req) {}
+  ResponseReader(const ResponseReader &) = delete;
+  ResponseReader &operator=(const ResponseReader &) = delete;
+
+  EStatus on_data(const char *data, size_t size) {
+    m_Received = true;
+    m_Buffer.append(data, size);
+    while (!m_HeadersDone) {
+      auto status = m_Head.parse(m_Buffer);
+      if (status == EParseStatus::Error)
+        return fail("Failed to parse response headers: " + m_Head.error());
+      if (status == EParseStatus::NeedMore)
+        return EStatus::NeedMore;
+      // Interim 1xx responses precede the real one; skip them.
+      if (m_Head.status_code() >= 100 && m_Head.status_code() < 200) {
+        m_Buffer.erase(0, m_Head.head_size());
+        m_Head.reset();
+        continue;
+      }
+      if (!start_body())
+        return EStatus::Failed;
+    }
+    size_t consumed = 0;
+    auto status = m_Body.decode(m_Buffer, consumed, m_Assembler.sink());
+    m_Buffer.erase(0, consumed);
+    if (status == EParseStatus::Error)
+      return fail("Failed to read response body: " + m_Body.error());
+    if (m_Assembler.decode_failed())
+      return fail("Failed to decode response body");
+    if (status == EParseStatus::NeedMore)
+      return EStatus::NeedMore;
+    return finish_decoding();
+  }
+
+  // The peer closed the connection.
+  EStatus on_close() {
+    if (!m_HeadersDone)
+      return fail("Failed to parse response headers");
+    if (m_Body.finish() == EParseStatus::Error)
+      return fail("Failed to read response body: " + m_Body.error());
+    return finish_decoding();
+  }
+
+  Response take() { return m_Assembler.take(); }
+  const std::string &error() const { return m_Error; }
+  // Whether the connection can carry another request.
+  bool reusable() const { return m_Reusable && m_Buffer.empty(); }
+  // Whether the connection stays open for the responses of requests
+  // pipelined behind this one, which begin with rest().
+  bool keeps_alive() const { return m_Reusable; }
+  std::string take_rest() { return std::move(m_Buffer); }
+  // Whether any response bytes arrived at all.
+  bool received() const { return m_Received; }
+
+private:
+  EStatus finish_decoding() {
+    if (!m_Assembler.finish())
+      return fail("Failed to decode response body: stream is truncated");
+    return EStatus::Complete;
+  }
+
+  bool start_body() {
+    auto &response = m_Assembler.response();
+    response.status_code = m_Head.status_code();
+    response.status_text = m_Head.reason();
+    for (size_t i = 0; i < m_Head.header_count(); ++i) {
+      auto field = m_Head.header_at(i);
+      response.headers.set(field.name, field.value);
+    }
+    bool no_body = m_Request.method == EMethod::HEAD ||
+                   response.status_code == 204 || response.status_code == 304;
+    if (!m_Body.start(m_Head, no_body)) {
+      fail("Failed to parse response headers: " + m_Body.error());
+      return false;
+    }
+    // Only a self-delimited body leaves the connection usable; anything
+    // read past it would belong to no request.
+    m_Reusable = m_Head.keep_alive() && !asks_to_close(m_Request) &&
+                 m_Body.mode() != BodyDecoder::EMode::UntilClose;
+    std::optional<size_t> size;
+    if (m_Body.mode() == BodyDecoder::EMode::Length)
+      size = m_Body.body_size();
+    m_Assembler.begin(no_body, size);
+    m_Buffer.erase(0, m_Head.head_size());
+    m_HeadersDone = true;
+    return true;
+  }
+
+  EStatus fail(std::string error) {
+    m_Error = std::move(error);
+    return EStatus::Failed;
+  }
+
+  const Request &m_Request;
+  ResponseAssembler m_Assembler;
+  std::string m_Buffer;
+  MessageParser m_Head{MessageParser::EKind::Response};
+  BodyDecoder m_Body;
+  bool m_HeadersDone{false};
+  bool m_Reusable{false};
+  bool m_Received{false};
+  std::string m_Error;
+};
+
+// Closes the connection unless released, including when a coroutine is
+// destroyed while it waits on it.
+class OwnedLink {
+public:
+  explicit OwnedLink(detail::Link link = {}) : m_Link(std::move(link)) {}
+  ~OwnedLink() { reset(); }
+  OwnedLink(const OwnedLink &) = delete;
+  OwnedLink &operator=(const OwnedLink &) = delete;
+
+  detail::Link &get() { return m_Link; }
+  i32 sock() const { return m_Link.sock; }
+  detail::Link release() { return std::exchange(m_Link, {}); }
+  void reset(detail::Link link = {}) {
+    if (m_Link.sock >= 0)
+      close_socket(m_Link.sock);
+    m_Link = std::move(link);
+  }
+
+private:
+  detail::Link m_Link;
+};
+} // namespace
+
+stl::result<detail::Link> Client::open_link(const URL &u,
+                                            const detail::Deadline &deadline,
+                                            bool offer_h2) {
+  auto context = tls_context(u);
+  if (!context) {
+    return stl::make_error<detail::Link>(context.error());
+  }
+  // Connecting and the TLS handshake share one budget.
+  auto until = deadline.until(deadline.request().connect_timeout);
+  auto sock_result = connect_socket(u, deadline, until);
+  if (!sock_result) {
+    return stl::make_error<detail::Link>(sock_result.error());
+  }
+  OwnedLink link(detail::Link{sock_result.value()});
+  if (!context.value())
+    return link.release();
+  detail::mark(deadline.trace(), &ClientTrace::tls_start);
+  auto tls = open_tls(*context.value(), link.sock(), u, offer_h2);
+  if (!tls) {
+    return stl::make_error<detail::Link>(tls.error());
+  }
+  auto &stream = *tls.value();
+  auto status = stream.handshake();
+  while (status == detail::TlsStream::EHandshake::WantRead ||
+         status == detail::TlsStream::EHandshake::WantWrite) {
+    u32 wait = status == detail::TlsStream::EHandshake::WantRead
+                   ? detail::IO_READ
+                   : detail::IO_WRITE;
+    if (!wait_for(link.sock(), wait, until)) {
+      return stl::make_error<detail::Link>(
+          detail::Deadline::passed(until)
+              ? deadline.timed_out(until, "TLS handshake with")
+              : handshake_error(u, "TLS handshake failed"));
     }
-#ifdef _WIN32
-    closesocket(sock);
-#else
-    close(sock);
-#endif
-    sock = -1;
-  }
-  freeaddrinfo(res);
-  if (sock < 0) {
-#ifdef _WIN32
-    i32 err = WSAGetLastError();
-    return stl::make_error<i32>("Failed to connect to " + u.host + ":" +
-                                u.port + " - " + std::to_string(err));
-#else
-    return stl::make_error<i32>("Failed to connect to " + u.host + ":" +
-                                u.port + " - " + std::string(strerror(errno)));
-#endif
-  }
-  return sock;
-}
-
-stl::result<> Client::send_request(int sock, const Request &req) {
-  std::ostringstream ss;
-  ss << method_to_string(req.method) << " " << req.url.full_path()
-     << " HTTP/1.1\r\n";
-  ss << "Host: " << req.url.host << "\r\n";
-  for (const auto &[key, value] : req.headers.data) {
-    ss << key << ": " << value << "\r\n";
-  }
-  ss << "\r\n";
-  if (!req.body.empty()) {
-    ss << req.body;
-  }
-  std::string request_str = ss.str();
-  size_t sent = 0;
-  while (sent < request_str.size()) {
-    i32 n =
-        ::send(sock, request_str.c_str() + sent, request_str.size() - sent, 0);
-    if (n <= 0) {
-      return stl::make_error<>("Failed to send request");
-    }
-    sent += n;
-  }
-  return stl::result_success();
-}
-
-stl::result<Response> Client::read_response(int sock) {
-  Response resp;
-  std::string buffer;
-  char chunk[4096];
-  bool headers_done = false;
-  size_t content_length = 0;
-  bool is_chunked = false;
+    status = stream.handshake();
+  }
+  if (status == detail::TlsStream::EHandshake::Failed) {
+    return stl::make_error<detail::Link>(handshake_error(u, stream.error()));
+  }
+  detail::mark(deadline.trace(), &ClientTrace::tls_end);
+  link.get().tls = std::move(tls.value());
+  return link.release();
+}
+
+stl::result<> Client::send_request(const detail::Link &link,
+                                   const Request &req,
+                                   const detail::Deadline &deadline,
+                                   bool keep_alive) {
+  detail::WireQueue out;
+  size_t size = queue_request(out, req, keep_alive);
+  if (auto *trace = deadline.trace())
+    trace->bytes_sent += size;
+  return send_queued(link, out, deadline);
+}
+
+stl::result<> Client::send_queued(const detail::Link &link,
+                                  detail::WireQueue &out,
+                                  const detail::Deadline &deadline) {
+  detail::mark(deadline.trace(), &ClientTrace::write_start);
   while (true) {
-    int n = recv(sock, chunk, sizeof(chunk), 0);
-    if (n <= 0)
+    auto flushed = out.flush(link.sock, link.tls.get());
+    if (flushed == detail::EFlush::Done) {
+      detail::mark(deadline.trace(), &ClientTrace::write_end);
+      return stl::result_success();
+    }
+    if (flushed == detail::EFlush::Failed)
       break;
-    buffer.append(chunk, n);
-    if (!headers_done) {
-      auto header_end = buffer.find("\r\n\r\n");
-      if (header_end != std::string::npos) {
-        std::string header_section = buffer.substr(0, header_end);
-        std::istringstream iss(header_section);
-        std::string line;
-        // Parse status line
-        if (std::getline(iss, line)) {
-          std::istringstream status_stream(line);
-          std::string http_version;
-          status_stream >> http_version >> resp.status_code;
-          std::getline(status_stream, resp.status_text);
-          if (!resp.status_text.empty() && resp.status_text[0] == ' ') {
-            resp.status_text.erase(0, 1);
-          }
-        }
-        // Parse headers
-        while (std::getline(iss, line) && !line.empty() && line != "\r") {
-          if (line.back() == '\r')
-            line.pop_back();
-          auto colon = line.find(':');
-          if (colon != std::string::npos) {
-            auto key = line.substr(0, colon);
-            auto value = line.substr(colon + 1);
-            if (!value.empty() && value[0] == ' ')
-              value.erase(0, 1);
-            resp.headers.set(key, value);
-          }
-        }
-        buffer.erase(0, header_end + 4);
-        headers_done = true;
-        auto cl = resp.headers.get("content-length");
-        if (!cl.empty()) {
-          content_length = std::stoull(cl);
-        }
-        auto te = resp.headers.get("transfer-encoding");
-        if (te.find("chunked") != std::string::npos) {
-          is_chunked = true;
-        }
+    auto until = deadline.until(deadline.request().write_timeout);
+    if (!wait_for(link.sock, detail::IO_WRITE, until)) {
+      if (detail::Deadline::passed(until)) {
+        return stl::make_error<>(
+            deadline.timed_out(until, "Sending request to"));
       }
+      break;
     }
-    if (headers_done && !is_chunked && content_length > 0) {
-      if (buffer.size() >= content_length) {
-        resp.body = buffer.substr(0, content_length);
-        break;
+  }
+  return stl::make_error<>("Failed to send request");
+}
+
+stl::result<Response> Client::read_response(const detail::Link &link,
+                                            const Request &req,
+                                            const detail::Deadline &deadline,
+                                            Exchange &exchange,
+                                            std::string *carry) {
+  ResponseReader reader(req);
+  char chunk[16384];
+  auto *tls = link.tls.get();
+  auto *trace = deadline.trace();
+  auto status = ResponseReader::EStatus::NeedMore;
+  if (carry && !carry->empty()) {
+    // Read along with an earlier response.
+    detail::mark(trace, &ClientTrace::first_byte);
+    status = reader.on_data(carry->data(), carry->size());
+  }
+  while (status == ResponseReader::EStatus::NeedMore) {
+    auto n = detail::read_some(link.sock, tls, chunk, sizeof(chunk));
+    if (n < 0) {
+      i32 err = detail::last_socket_error();
+      if (detail::is_interrupted(err))
+        continue;
+      if (detail::is_would_block(err)) {
+        // A TLS read can need the socket writable, e.g. to answer a key
+        // update.
+        u32 wait =
+            tls && tls->wants_write() ? detail::IO_WRITE : detail::IO_READ;
+        auto until = deadline.until(req.read_timeout);
+        if (wait_for(link.sock, wait, until))
+          continue;
+        if (detail::Deadline::passed(until)) {
+          exchange.received = reader.received();
+          exchange.timed_out = true;
+          return stl::make_error<Response>(
+              deadline.timed_out(until, "Waiting for response from"));
+        }
       }
+      // Unlike a close, a failed read says nothing about where the body
+      // ends.
+      exchange.received = reader.received();
+      return stl::make_error<Response>("Failed to read response");
     }
+    if (trace && n > 0) {
+      if (trace->first_byte == ClientTrace::TimePoint{})
+        detail::mark(trace, &ClientTrace::first_byte);
+      trace->bytes_received += static_cast<size_t>(n);
+    }
+    status = n == 0 ? reader.on_close()
+                    : reader.on_data(chunk, static_cast<size_t>(n));
   }
-  if (!headers_done) {
-    return stl::make_error<Response>("Failed to parse response headers");
+  exchange.reusable = carry ? reader.keeps_alive() : reader.reusable();
+  exchange.received = reader.received();
+  if (carry)
+    *carry = reader.take_rest();
+  if (status == ResponseReader::EStatus::Failed) {
+    return stl::make_error<Response>(reader.error());
   }
-  if (!is_chunked && content_length == 0 && !buffer.empty()) {
-    resp.body = buffer;
-  } else if (!is_chunked && content_length > 0) {
-    resp.body = buffer.substr(0, content_length);
+  return reader.take();
+}
+
+stl::result<Response> Client::perform(const Request &req) {
+  detail::RequestTrace trace(req, detail::installed_observer());
+  detail::Deadline deadline(req, trace.get());
+  return trace.finish(perform(req, deadline));
+}
+
+stl::result<Response> Client::perform(const Request &req,
+                                      const detail::Deadline &deadline) {
+  if (auto *trace = deadline.trace())
+    trace->attempts = 1;
+  auto link_result = open_link(req.url, deadline);
+  if (!link_result) {
+    return stl::make_error<Response>(link_result.error());
+  }
+  OwnedLink link(std::move(link_result.value()));
+  auto send_result = send_request(link.get(), req, deadline);
+  if (!send_result) {
+    return stl::make_error<Response>(send_result.error());
   }
-  return resp;
+  Exchange exchange;
+  return read_response(link.get(), req, deadline, exchange);
 }
 
 std::future<stl::result<Response>> Client::async_send(Request req) {
-  return std::async(std::launch::async,
-                    [req = std::move(req)]() -> stl::result<Response> {
-                      auto sock_result = connect_socket(req.url);
-                      if (!sock_result) {
-                        return stl::make_error<Response>(sock_result.error());
-                      }
-                      int sock = sock_result.value();
-                      auto send_result = send_request(sock, req);
-                      if (!send_result) {
-#ifdef _WIN32
-                        closesocket(sock);
-#else
-            close(sock);
-#endif
-                        return stl::make_error<Response>(send_result.error());
-                      }
-                      auto resp_result = read_response(sock);
-
-#ifdef _WIN32
-                      closesocket(sock);
-#else
-        close(sock);
-#endif
-                      return resp_result;
-                    });
-}
-
-stl::result<Response> Client::send(const Request &req) {
-  auto future = async_send(Request(req));
-  return future.get();
+  return detail::Executor::client()->submit(
+      [req = std::move(req)]() { return perform(req); });
 }
 
+stl::result<Response> Client::send(const Request &req) { return perform(req); }
+
 std::future<stl::result<Response>> Client::get(std::string_view url_str) {
   auto url_result = URL::parse(url_str);
   if (!url_result) {
@@ -212,4 +567,605 @@ std::future<stl::result<Response>> Client::post(std::string_view url_str,
   return async_send(std::move(req));
 }
 
-} // namespace http
\ No newline at end of file
+// The body length an HTTP/2 response head announces, if any.
+static std::optional<size_t> announced_length(const Headers &headers) {
+  auto value = headers.get(EHeader::ContentLength);
+  size_t length = 0;
+  auto [end, ec] =
+      std::from_chars(value.data(), value.data() + value.size(), length);
+  if (value.empty() || ec != std::errc() || end != value.data() + value.size())
+    return std::nullopt;
+  return length;
+}
+
+std::optional<stl::result<Response>>
+Client::send_h2(const Request &req, ClientPool &pool,
+                const detail::Deadline &deadline) {
+  using EState = detail::H2ClientSession::EState;
+  Headers extra;
+  if (negotiates_coding(req))
+    extra.set("accept-encoding", accept_encoding());
+  // A stream the server refused, or one lost with its connection before
+  // any of the response, is sent once more on a new connection; the second
+  // only when the method is idempotent.
+  auto *trace = deadline.trace();
+  for (i32 attempt = 0; attempt < 2; ++attempt) {
+    auto [session, created] = pool.session_for(req.url);
+    if (trace) {
+      ++trace->attempts;
+      trace->reused = !created;
+    }
+    if (created) {
+      auto link = open_link(req.url, deadline, true);
+      if (!link) {
+        session->fail(link.error());
+        pool.forget(req.url, session);
+        return stl::make_error<Response>(link.error());
+      }
+      auto &tls = link.value().tls;
+      if (tls && tls->alpn() != "h2") {
+        session->decline();
+        pool.release(req.url, std::move(link.value()));
+        return std::nullopt;
+      }
+      session->attach(std::move(link.value()));
+    }
+    detail::H2Update update;
+    auto until = deadline.until(req.connect_timeout);
+    detail::mark(trace, &ClientTrace::write_start);
+    u32 id = session->open(req, extra, until, update);
+    if (id == 0 && session->state() == EState::Declined)
+      return std::nullopt;
+    if (trace && id != 0) {
+      // Frames go out as the session writes them; this is when the stream
+      // was handed over.
+      detail::mark(trace, &ClientTrace::write_end);
+      trace->http2 = true;
+      trace->bytes_sent += req.body.size();
+    }
+    if (id == 0 && update.error.empty()) {
+      return stl::make_error<Response>(
+          deadline.timed_out(until, "Connecting to"));
+    }
+    ResponseAssembler assembler(req);
+    bool head_seen = false;
+    while (id != 0) {
+      until = deadline.until(req.read_timeout);
+      if (!session->next(id, update, until)) {
+        session->cancel(id);
+        return stl::make_error<Response>(
+            deadline.timed_out(until, "Waiting for response from"));
+      }
+      if (!update.error.empty())
+        break;
+      if (update.has_head) {
+        head_seen = true;
+        detail::mark(trace, &ClientTrace::first_byte);
+        auto &response = assembler.response();
+        response.status_code = update.status;
+        response.status_text = std::string(detail::status_text(update.status));
+        response.headers = std::move(update.headers);
+        bool no_body = req.method == EMethod::HEAD ||
+                       update.status == 204 || update.status == 304;
+        assembler.begin(no_body, announced_length(response.headers));
+      }
+      if (trace)
+        trace->bytes_received += update.data.size();
+      if (!update.data.empty())
+        assembler.sink()(update.data);
+      if (assembler.decode_failed()) {
+        session->cancel(id);
+        return stl::make_error<Response>("Failed to decode response body");
+      }
+      if (update.done) {
+        if (!assembler.finish()) {
+          return stl::make_error<Response>(
+              "Failed to decode response body: stream is truncated");
+        }
+        return assembler.take();
+      }
+    }
+    if (!session->accepts_streams())
+      pool.forget(req.url, session);
+    bool retry =
+        update.refused || (!head_seen && is_idempotent(req.method));
+    if (!retry || attempt == 1)
+      return stl::make_error<Response>(update.error);
+  }
+  return stl::make_error<Response>("Failed to send request");
+}
+
+stl::result<Response> Client::send(const Request &req, ClientPool &pool) {
+  detail::RequestTrace trace(req, observer_of(pool.m_Config));
+  detail::Deadline deadline(req, trace.get());
+  return trace.finish(perform(req, pool, deadline));
+}
+
+stl::result<Response> Client::perform(const Request &req, ClientPool &pool,
+                                      const detail::Deadline &deadline) {
+  if (pool.m_Config.http2) {
+    if (auto result = send_h2(req, pool, deadline))
+      return std::move(*result);
+  }
+  // What a declined HTTP/2 attempt recorded does not describe this one.
+  auto *trace = deadline.trace();
+  if (trace) {
+    trace->http2 = false;
+    trace->attempts = 0;
+  }
+  // A pooled socket can be closed by the server just as we reuse it. When
+  // that happens before any response bytes arrive, an idempotent request is
+  // safe to replay once on a fresh connection.
+  for (i32 attempt = 0; attempt < 2; ++attempt) {
+    OwnedLink link(attempt == 0 ? pool.acquire(req.url) : detail::Link{});
+    bool reused = link.sock() >= 0;
+    if (trace) {
+      ++trace->attempts;
+      trace->reused = reused;
+    }
+    if (!reused) {
+      auto link_result = open_link(req.url, deadline);
+      if (!link_result) {
+        return stl::make_error<Response>(link_result.error());
+      }
+      link.reset(std::move(link_result.value()));
+    }
+    Exchange exchange;
+    auto send_result = send_request(link.get(), req, deadline, true);
+    auto resp_result =
+        send_result ? read_response(link.get(), req, deadline, exchange)
+                    : stl::make_error<Response>(send_result.error());
+    if (resp_result && exchange.reusable) {
+      pool.release(req.url, link.release());
+    }
+    if (resp_result || !reused || exchange.received || exchange.timed_out ||
+        !is_idempotent(req.method)) {
+      return resp_result;
+    }
+  }
+  return stl::make_error<Response>("Failed to send request");
+}
+
+std::future<stl::result<Response>> Client::async_send(Request req,
+                                                       ClientPool &pool) {
+  return detail::Executor::client()->submit(
+      [req = std::move(req), &pool]() { return send(req, pool); });
+}
+
+std::future<stl::result<Response>> Client::get(std::string_view url_str,
+                                               ClientPool &pool) {
+  auto url_result = URL::parse(url_str);
+  if (!url_result) {
+    std::promise<stl::result<Response>> p;
+    p.set_value(stl::make_error<Response>(url_result.error()));
+    return p.get_future();
+  }
+  return async_send(Request(EMethod::GET, std::move(url_result.value())),
+                    pool);
+}
+
+std::future<stl::result<Response>>
+Client::post(std::string_view url_str, std::string body, ClientPool &pool) {
+  auto url_result = URL::parse(url_str);
+  if (!url_result) {
+    std::promise<stl::result<Response>> p;
+    p.set_value(stl::make_error<Response>(url_result.error()));
+    return p.get_future();
+  }
+  Request req(EMethod::POST, std::move(url_result.value()));
+  req.set_body(std::move(body));
+  return async_send(std::move(req), pool);
+}
+
+namespace {
+// Only requests without a body are pipelined: all of their heads fit in the
+// socket buffers, so writing them never waits on responses not yet read.
+constexpr size_t k_PipelineDepth = 16;
+
+bool can_pipeline(const Request &req) {
+  return is_idempotent(req.method) && req.body.empty() &&
+         !asks_to_close(req);
+}
+
+// Shared by the threads working through one send_all(). Executor tasks
+// that start after it returned find no job left and touch nothing else.
+struct Batch {
+  std::mutex mutex;
+  std::condition_variable finished;
+  // Request indexes: several to one host to pipeline, or a single one.
+  std::vector<std::vector<size_t>> jobs;
+  size_t next_job{0};
+  size_t remaining{0};
+};
+} // namespace
+
+size_t Client::pipeline(std::span<const Request> requests,
+                        const std::vector<size_t> &batch, ClientPool &pool,
+                        const Completion &on_done) {
+  const auto &first = requests[batch.front()];
+  // Every request's time runs from the start, as if sent on its own.
+  // Requests left unanswered are traced again when sent on their own.
+  auto observer = observer_of(pool.m_Config);
+  std::vector<detail::RequestTrace> traces;
+  std::vector<detail::Deadline> deadlines;
+  traces.reserve(batch.size());
+  deadlines.reserve(batch.size());
+  for (auto index : batch) {
+    traces.emplace_back(requests[index], observer);
+    deadlines.emplace_back(requests[index], traces.back().get());
+  }
+  OwnedLink link(pool.acquire(first.url));
+  bool reused = link.sock() >= 0;
+  if (!reused) {
+    auto link_result = open_link(first.url, deadlines.front());
+    if (!link_result) {
+      for (size_t i = 0; i < batch.size(); ++i) {
+        on_done(batch[i], traces[i].finish(
+                              stl::make_error<Response>(link_result.error())));
+      }
+      return batch.size();
+    }
+    link.reset(std::move(link_result.value()));
+  }
+  detail::WireQueue out;
+  for (size_t i = 0; i < batch.size(); ++i) {
+    size_t size = queue_request(out, requests[batch[i]], true);
+    if (auto *trace = traces[i].get()) {
+      trace->attempts = 1;
+      trace->reused = reused || i > 0;
+      trace->bytes_sent = size;
+    }
+  }
+  if (!send_queued(link.get(), out, deadlines.front()))
+    return 0;
+  // The heads went out together.
+  if (auto *sent = traces.front().get()) {
+    for (auto &trace : traces) {
+      trace.get()->write_start = sent->write_start;
+      trace.get()->write_end = sent->write_end;
+    }
+  }
+  // Bytes read past one response begin the next.
+  std::string carry;
+  Exchange exchange;
+  size_t answered = 0;
+  while (answered < batch.size()) {
+    auto index = batch[answered];
+    auto resp_result = read_response(link.get(), requests[index],
+                                     deadlines[answered], exchange, &carry);
+    // A request that ran out of time is not replayed; neither is one the
+    // connection failed part way through the response of.
+    if (!resp_result && !exchange.timed_out && !exchange.received)
+      break;
+    bool ok = resp_result.has_value();
+    on_done(index, traces[answered].finish(std::move(resp_result)));
+    ++answered;
+    if (!ok || !exchange.reusable)
+      break;
+  }
+  if (answered == batch.size() && exchange.reusable && carry.empty())
+    pool.release(first.url, link.release());
+  return answered;
+}
+
+void Client::send_all(std::span<const Request> requests, ClientPool &pool,
+                      size_t max_in_flight, const Completion &on_done) {
+  if (requests.empty())
+    return;
+  max_in_flight = std::max<size_t>(max_in_flight, 1);
+  auto batch = std::make_shared<Batch>();
+  // HTTP/2 multiplexes requests by itself; a pipeline would only hold
+  // them back.
+  std::map<std::string, std::vector<size_t>> by_host;
+  for (size_t i = 0; i < requests.size(); ++i) {
+    if (!pool.m_Config.http2 && can_pipeline(requests[i]))
+      by_host[ClientPool::key_for(requests[i].url)].push_back(i);
+    else
+      batch->jobs.push_back({i});
+  }
+  // Spread each host's requests over the connections allowed.
+  for (auto &[key, indexes] : by_host) {
+    size_t depth = std::clamp<size_t>(
+        (indexes.size() + max_in_flight - 1) / max_in_flight, 1,
+        k_PipelineDepth);
+    for (size_t at = 0; at < indexes.size(); at += depth) {
+      auto end = indexes.begin() +
+                 static_cast<std::ptrdiff_t>(
+                     std::min(at + depth, indexes.size()));
+      batch->jobs.emplace_back(
+          indexes.begin() + static_cast<std::ptrdiff_t>(at), end);
+    }
+  }
+  batch->remaining = batch->jobs.size();
+
+  auto work = [batch, requests, &pool, &on_done]() {
+    while (true) {
+      std::vector<size_t> job;
+      {
+        std::lock_guard lock(batch->mutex);
+        if (batch->next_job == batch->jobs.size())
+          return;
+        job = std::move(batch->jobs[batch->next_job++]);
+      }
+      size_t answered =
+          job.size() > 1 ? pipeline(requests, job, pool, on_done) : 0;
+      // What the pipeline left, or a request sent on its own.
+      for (size_t i = answered; i < job.size(); ++i)
+        on_done(job[i], send(requests[job[i]], pool));
+      std::lock_guard lock(batch->mutex);
+      if (--batch->remaining == 0)
+        batch->finished.notify_all();
+    }
+  };
+  // The calling thread takes jobs too, so the batch completes even when
+  // every executor thread is busy, including with its caller.
+  size_t workers = std::min(max_in_flight, batch->jobs.size());
+  for (size_t i = 1; i < workers; ++i)
+    detail::Executor::client()->submit(work);
+  work();
+  std::unique_lock lock(batch->mutex);
+  batch->finished.wait(lock, [&batch]() { return batch->remaining == 0; });
+}
+
+std::vector<stl::result<Response>>
+Client::send_all(std::span<const Request> requests, ClientPool &pool,
+                 size_t max_in_flight) {
+  std::vector<std::optional<stl::result<Response>>> slots(requests.size());
+  send_all(requests, pool, max_in_flight,
+           [&slots](size_t index, stl::result<Response> result) {
+             slots[index].emplace(std::move(result));
+           });
+  std::vector<stl::result<Response>> results;
+  results.reserve(slots.size());
+  for (auto &slot : slots)
+    results.push_back(std::move(*slot));
+  return results;
+}
+
+std::vector<stl::result<Response>>
+Client::send_all(std::span<const Request> requests, size_t max_in_flight) {
+  ClientPool pool;
+  return send_all(requests, pool, max_in_flight);
+}
+
+Task<stl::result<detail::Link>>
+Client::co_connect(const URL &u, const detail::Deadline &deadline) {
+  using Result = detail::Link;
+  auto context = tls_context(u);
+  if (!context) {
+    co_return stl::make_error<Result>(context.error());
+  }
+  auto *trace = deadline.trace();
+  auto &cache = detail::DnsCache::instance();
+  detail::mark(trace, &ClientTrace::dns_start);
+  auto resolved =
+      cache.resolve(u.host, u.port, trace ? &trace->dns_cached : nullptr);
+  detail::mark(trace, &ClientTrace::dns_end);
+  if (!resolved) {
+    co_return stl::make_error<Result>(resolved.error());
+  }
+  // Held by value: the cache may drop its entry while we wait.
+  auto endpoints = resolved.value();
+  auto until = deadline.until(deadline.request().connect_timeout);
+  detail::mark(trace, &ClientTrace::connect_start);
+  OwnedLink link;
+  i32 err = 0;
+  for (size_t i = 0; i < endpoints->size() && link.sock() < 0; ++i) {
+    const auto &endpoint = (*endpoints)[i];
+    OwnedLink sock(detail::Link{static_cast<i32>(
+        socket(endpoint.family, endpoint.socktype, endpoint.protocol))});
+    if (sock.sock() < 0 || !detail::set_nonblocking(sock.sock())) {
+      err = detail::last_socket_error();
+      continue;
+    }
+    i32 rc = connect(sock.sock(),
+                     reinterpret_cast<const sockaddr *>(&endpoint.address),
+                     endpoint.length);
+    err = rc == 0 ? 0 : detail::last_socket_error();
+    if (rc != 0 && detail::is_in_progress(err)) {
+      bool ready =
+          co_await detail::SocketReady(sock.sock(), detail::IO_WRITE, until);
+      err = detail::pending_socket_error(sock.sock());
+      if (!ready && err == 0)
+        err = detail::k_TimedOut;
+    }
+    if (err == 0) {
+      if (i > 0)
+        cache.prefer(u.host, u.port, endpoint);
+      detail::mark(trace, &ClientTrace::connect_end);
+      link.reset(sock.release());
+    } else if (err == detail::k_TimedOut) {
+      co_return stl::make_error<Result>(
+          deadline.timed_out(until, "Connecting to"));
+    }
+  }
+  if (link.sock() < 0) {
+    co_return stl::make_error<Result>("Failed to connect to " + u.host + ":" +
+                                      u.port + " - " +
+                                      detail::socket_error_string(err));
+  }
+  if (!context.value())
+    co_return link.release();
+  detail::mark(trace, &ClientTrace::tls_start);
+  auto tls = open_tls(*context.value(), link.sock(), u);
+  if (!tls) {
+    co_return stl::make_error<Result>(tls.error());
+  }
+  auto &stream = *tls.value();
+  while (true) {
+    auto status = stream.handshake();
+    if (status == detail::TlsStream::EHandshake::Done)
+      break;
+    if (status == detail::TlsStream::EHandshake::Failed) {
+      co_return stl::make_error<Result>(handshake_error(u, stream.error()));
+    }
+    u32 wait = status == detail::TlsStream::EHandshake::WantRead
+                   ? detail::IO_READ
+                   : detail::IO_WRITE;
+    if (!co_await detail::SocketReady(link.sock(), wait, until)) {
+      co_return stl::make_error<Result>(
+          detail::Deadline::passed(until)
+              ? deadline.timed_out(until, "TLS handshake with")
+              : handshake_error(u, "TLS handshake failed"));
+    }
+  }
+  detail::mark(trace, &ClientTrace::tls_end);
+  link.get().tls = std::move(tls.value());
+  co_return link.release();
+}
+
+Task<stl::result<Response>>
+Client::co_exchange(const detail::Link &link, const Request &req,
+                    const detail::Deadline &deadline, bool keep_alive,
+                    Exchange &exchange) {
+  i32 sock = link.sock;
+  auto *tls = link.tls.get();
+  auto *trace = deadline.trace();
+  detail::WireQueue out;
+  size_t size = queue_request(out, req, keep_alive);
+  if (trace)
+    trace->bytes_sent += size;
+  detail::mark(trace, &ClientTrace::write_start);
+  while (true) {
+    auto flushed = out.flush(sock, tls);
+    if (flushed == detail::EFlush::Done)
+      break;
+    auto until = deadline.until(req.write_timeout);
+    if (flushed == detail::EFlush::Failed ||
+        !co_await detail::SocketReady(sock, detail::IO_WRITE, until)) {
+      co_return stl::make_error<Response>(
+          flushed != detail::EFlush::Failed && detail::Deadline::passed(until)
+              ? deadline.timed_out(until, "Sending request to")
+              : "Failed to send request");
+    }
+  }
+  detail::mark(trace, &ClientTrace::write_end);
+  ResponseReader reader(req);
+  char chunk[16384];
+  auto status = ResponseReader::EStatus::NeedMore;
+  while (status == ResponseReader::EStatus::NeedMore) {
+    auto n = detail::read_some(sock, tls, chunk, sizeof(chunk));
+    if (n < 0) {
+      i32 err = detail::last_socket_error();
+      if (detail::is_interrupted(err))
+        continue;
+      // A TLS read can need the socket writable, e.g. to answer a key update.
+      u32 wait = tls && tls->wants_write() ? detail::IO_WRITE : detail::IO_READ;
+      auto until = deadline.until(req.read_timeout);
+      if (detail::is_would_block(err)) {
+        if (co_await detail::SocketReady(sock, wait, until))
+          continue;
+        if (detail::Deadline::passed(until)) {
+          exchange.received = reader.received();
+          exchange.timed_out = true;
+          co_return stl::make_error<Response>(
+              deadline.timed_out(until, "Waiting for response from"));
+        }
+      }
+      exchange.received = reader.received();
+      co_return stl::make_error<Response>("Failed to read response");
+    }
+    if (trace && n > 0) {
+      if (trace->first_byte == ClientTrace::TimePoint{})
+        detail::mark(trace, &ClientTrace::first_byte);
+      trace->bytes_received += static_cast<size_t>(n);
+    }
+    status = n == 0 ? reader.on_close()
+                    : reader.on_data(chunk, static_cast<size_t>(n));
+  }
+  exchange.reusable = reader.reusable();
+  exchange.received = reader.received();
+  if (status == ResponseReader::EStatus::Failed) {
+    co_return stl::make_error<Response>(reader.error());
+  }
+  co_return reader.take();
+}
+
+Task<stl::result<Response>> Client::co_send(Request req) {
+  detail::RequestTrace trace(req, detail::installed_observer());
+  detail::Deadline deadline(req, trace.get());
+  co_return trace.finish(co_await co_perform(req, deadline));
+}
+
+Task<stl::result<Response>>
+Client::co_perform(const Request &req, const detail::Deadline &deadline) {
+  if (auto *trace = deadline.trace())
+    trace->attempts = 1;
+  auto connected = co_await co_connect(req.url, deadline);
+  if (!connected) {
+    co_return stl::make_error<Response>(connected.error());
+  }
+  OwnedLink link(std::move(connected.value()));
+  Exchange exchange;
+  co_return co_await co_exchange(link.get(), req, deadline, false, exchange);
+}
+
+Task<stl::result<Response>> Client::co_send(Request req, ClientPool &pool) {
+  detail::RequestTrace trace(req, observer_of(pool.m_Config));
+  detail::Deadline deadline(req, trace.get());
+  co_return trace.finish(co_await co_perform(req, pool, deadline));
+}
+
+Task<stl::result<Response>>
+Client::co_perform(const Request &req, ClientPool &pool,
+                   const detail::Deadline &deadline) {
+  // Same replay rule as the blocking send().
+  for (i32 attempt = 0; attempt < 2; ++attempt) {
+    OwnedLink link(attempt == 0 ? pool.acquire(req.url) : detail::Link{});
+    bool reused = link.sock() >= 0;
+    if (auto *trace = deadline.trace()) {
+      ++trace->attempts;
+      trace->reused = reused;
+    }
+    if (!reused) {
+      auto connected = co_await co_connect(req.url, deadline);
+      if (!connected) {
+        co_return stl::make_error<Response>(connected.error());
+      }
+      link.reset(std::move(connected.value()));
+    }
+    Exchange exchange;
+    auto resp_result =
+        co_await co_exchange(link.get(), req, deadline, true, exchange);
+    if (resp_result && exchange.reusable) {
+      pool.release(req.url, link.release());
+    }
+    if (resp_result || !reused || exchange.received || exchange.timed_out ||
+        !is_idempotent(req.method)) {
+      co_return std::move(resp_result);
+    }
+  }
+  co_return stl::make_error<Response>("Failed to send request");
+}
+
+void Client::configure_executor(ClientExecutorConfig config) {
+  detail::Executor::configure_client(config.threads);
+}
+
+void Client::configure_dns_cache(DnsCacheConfig config) {
+  detail::DnsCache::instance().configure(config);
+}
+
+void Client::clear_dns_cache() { detail::DnsCache::instance().clear(); }
+
+stl::result<> Client::configure_tls(ClientTlsConfig config) {
+  return detail::TlsContext::configure_client(config);
+}
+
+void Client::observe(ClientObserver observer) {
+  detail::install_observer(std::move(observer));
+}
+
+std::future<stl::result<>> Client::pre_resolve(std::string host,
+                                               std::string port) {
+  return detail::Executor::client()->submit(
+      [host = std::move(host), port = std::move(port)]() -> stl::result<> {
+        auto resolved = detail::DnsCache::instance().resolve(host, port);
+        if (!resolved) {
+          return stl::make_error<>(resolved.error());
+        }
+        return stl::result_success();
+      });
+}
+
+} // namespace http
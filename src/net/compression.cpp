@@ -0,0 +1,406 @@
+#include "compression.h"
+#include "scan.h"
+
+#ifdef SAP_HTTP_ZLIB
+#include <zlib.h>
+#endif
+#ifdef SAP_HTTP_BROTLI
+#include <brotli/decode.h>
+#include <brotli/encode.h>
+#endif
+
+namespace http::detail {
+
+namespace {
+constexpr size_t k_OutChunk = 16 * 1024;
+
+// Parses the q parameter of one Accept-Encoding member; 1 when absent.
+double quality_of(std::string_view params) {
+  while (!params.empty()) {
+    auto semi = params.find(';');
+    auto param = trim_ows(params.substr(0, semi));
+    params = semi == std::string_view::npos ? std::string_view()
+                                            : params.substr(semi + 1);
+    if (param.size() < 2 || (param[0] != 'q' && param[0] != 'Q') ||
+        param[1] != '=')
+      continue;
+    double q = 0;
+    double scale = 1;
+    bool fraction = false;
+    for (char c : param.substr(2)) {
+      if (c == '.') {
+        fraction = true;
+      } else if (c >= '0' && c <= '9') {
+        if (fraction) {
+          scale /= 10;
+          q += (c - '0') * scale;
+        } else {
+          q = q * 10 + (c - '0');
+        }
+      } else {
+        return 0;
+      }
+    }
+    return q;
+  }
+  return 1;
+}
+
+#ifdef SAP_HTTP_ZLIB
+class ZlibDecompressor : public Decompressor {
+public:
+  explicit ZlibDecompressor(bool gzip) : m_Gzip(gzip) { init(15 + 32); }
+  ~ZlibDecompressor() override { inflateEnd(&m_Stream); }
+
+  bool decode(std::string_view data, const Sink &sink) override {
+    if (m_Failed)
+      return false;
+    m_Stream.next_in =
+        reinterpret_cast<Bytef *>(const_cast<char *>(data.data()));
+    m_Stream.avail_in = static_cast<uInt>(data.size());
+    char out[k_OutChunk];
+    while (true) {
+      if (m_Done) {
+        if (m_Stream.avail_in == 0)
+          return true;
+        // Only gzip allows several members back to back.
+        if (!m_Gzip || inflateReset(&m_Stream) != Z_OK)
+          return fail();
+        m_Done = false;
+      }
+      m_Stream.next_out = reinterpret_cast<Bytef *>(out);
+      m_Stream.avail_out = sizeof(out);
+      i32 rc = inflate(&m_Stream, Z_NO_FLUSH);
+      if (rc == Z_DATA_ERROR && !m_Gzip && !m_Raw && m_Stream.total_out == 0) {
+        // Some servers send "deflate" without the zlib wrapper.
+        inflateEnd(&m_Stream);
+        m_Raw = true;
+        init(-15);
+        return decode(data, sink);
+      }
+      if (rc != Z_OK && rc != Z_STREAM_END && rc != Z_BUF_ERROR)
+        return fail();
+      size_t produced = sizeof(out) - m_Stream.avail_out;
+      if (produced > 0)
+        sink(std::string_view(out, produced));
+      if (rc == Z_STREAM_END) {
+        m_Done = true;
+        continue;
+      }
+      // A full output buffer may leave more output pending inside zlib.
+      if (rc == Z_BUF_ERROR ||
+          (m_Stream.avail_in == 0 && m_Stream.avail_out > 0))
+        return true;
+    }
+  }
+
+  bool finish() override { return m_Done && !m_Failed; }
+
+private:
+  void init(i32 window_bits) {
+    m_Stream = z_stream{};
+    m_Failed = inflateInit2(&m_Stream, window_bits) != Z_OK;
+  }
+  bool fail() {
+    m_Failed = true;
+    return false;
+  }
+
+  z_stream m_Stream{};
+  bool m_Gzip;
+  bool m_Raw{false};
+  bool m_Done{false};
+  bool m_Failed{false};
+};
+#endif
+
+#ifdef SAP_HTTP_BROTLI
+class BrotliDecompressor : public Decompressor {
+public:
+  BrotliDecompressor()
+      : m_State(BrotliDecoderCreateInstance(nullptr, nullptr, nullptr)) {}
+  ~BrotliDecompressor() override { BrotliDecoderDestroyInstance(m_State); }
+
+  bool decode(std::string_view data, const Sink &sink) override {
+    if (!m_State || m_Failed)
+      return false;
+    size_t available_in = data.size();
+    auto *next_in = reinterpret_cast<const uint8_t *>(data.data());
+    uint8_t out[k_OutChunk];
+    while (true) {
+      size_t available_out = sizeof(out);
+      uint8_t *next_out = out;
+      auto rc = BrotliDecoderDecompressStream(m_State, &available_in, &next_in,
+                                              &available_out, &next_out,
+                                              nullptr);
+      size_t produced = sizeof(out) - available_out;
+      if (produced > 0)
+        sink(std::string_view(reinterpret_cast<char *>(out), produced));
+      if (rc == BROTLI_DECODER_RESULT_ERROR ||
+          (rc == BROTLI_DECODER_RESULT_SUCCESS && available_in > 0)) {
+        m_Failed = true;
+        return false;
+      }
+      if (rc != BROTLI_DECODER_RESULT_NEEDS_MORE_OUTPUT)
+        return true;
+    }
+  }
+
+  bool finish() override {
+    return m_State && !m_Failed && BrotliDecoderIsFinished(m_State);
+  }
+
+private:
+  BrotliDecoderState *m_State;
+  bool m_Failed{false};
+};
+#endif
+} // namespace
+
+std::string_view coding_name(ECoding coding) {
+  switch (coding) {
+  case ECoding::Brotli:
+    return "br";
+  case ECoding::Gzip:
+    return "gzip";
+  case ECoding::Deflate:
+    return "deflate";
+  case ECoding::Identity:
+    break;
+  }
+  return "identity";
+}
+
+ECoding coding_from_name(std::string_view name) {
+  name = trim_ows(name);
+  ECoding coding = ECoding::Identity;
+  if (iequals(name, "br"))
+    coding = ECoding::Brotli;
+  else if (iequals(name, "gzip") || iequals(name, "x-gzip"))
+    coding = ECoding::Gzip;
+  else if (iequals(name, "deflate"))
+    coding = ECoding::Deflate;
+  return (supported_codings() & coding_bit(coding)) ? coding
+                                                    : ECoding::Identity;
+}
+
+u32 supported_codings() {
+  u32 codings = coding_bit(ECoding::Identity);
+#ifdef SAP_HTTP_ZLIB
+  codings |= coding_bit(ECoding::Gzip) | coding_bit(ECoding::Deflate);
+#endif
+#ifdef SAP_HTTP_BROTLI
+  codings |= coding_bit(ECoding::Brotli);
+#endif
+  return codings;
+}
+
+ECoding negotiate(std::string_view accept_encoding, u32 allowed) {
+  constexpr size_t k_Count = static_cast<size_t>(ECoding::Identity);
+  std::array<double, k_Count> quality{};
+  std::array<bool, k_Count> listed{};
+  double wildcard = -1;
+  for_each_member(accept_encoding, [&](std::string_view member) {
+    auto semi = member.find(';');
+    auto name = trim_ows(member.substr(0, semi));
+    double q = semi == std::string_view::npos
+                   ? 1
+                   : quality_of(member.substr(semi + 1));
+    if (name == "*") {
+      wildcard = q;
+      return;
+    }
+    auto coding = coding_from_name(name);
+    if (coding == ECoding::Identity)
+      return;
+    auto index = static_cast<size_t>(coding);
+    quality[index] = q;
+    listed[index] = true;
+  });
+  ECoding best = ECoding::Identity;
+  double best_q = 0;
+  for (size_t i = 0; i < k_Count; ++i) {
+    auto coding = static_cast<ECoding>(i);
+    if (!(allowed & coding_bit(coding)))
+      continue;
+    double q = listed[i] ? quality[i] : std::max(wildcard, 0.0);
+    if (q > best_q) {
+      best = coding;
+      best_q = q;
+    }
+  }
+  return best;
+}
+
+stl::result<std::string> compress(ECoding coding, std::string_view data,
+                                  i32 level) {
+  using Result = std::string;
+  switch (coding) {
+#ifdef SAP_HTTP_ZLIB
+  case ECoding::Gzip:
+  case ECoding::Deflate: {
+    z_stream stream{};
+    i32 window_bits = coding == ECoding::Gzip ? 15 + 16 : 15;
+    if (deflateInit2(&stream, level, Z_DEFLATED, window_bits, 8,
+                     Z_DEFAULT_STRATEGY) != Z_OK)
+      return stl::make_error<Result>("Failed to initialize zlib");
+    std::string out(deflateBound(&stream, static_cast<uLong>(data.size())),
+                    '\0');
+    stream.next_in = reinterpret_cast<Bytef *>(const_cast<char *>(data.data()));
+    stream.avail_in = static_cast<uInt>(data.size());
+    stream.next_out = reinterpret_cast<Bytef *>(out.data());
+    stream.avail_out = static_cast<uInt>(out.size());
+    i32 rc = deflate(&stream, Z_FINISH);
+    out.resize(stream.total_out);
+    deflateEnd(&stream);
+    if (rc != Z_STREAM_END)
+      return stl::make_error<Result>("Failed to compress body");
+    return out;
+  }
+#endif
+#ifdef SAP_HTTP_BROTLI
+  case ECoding::Brotli: {
+    size_t size = BrotliEncoderMaxCompressedSize(data.size());
+    std::string out(size, '\0');
+    if (!BrotliEncoderCompress(
+            level, BROTLI_DEFAULT_WINDOW, BROTLI_MODE_GENERIC, data.size(),
+            reinterpret_cast<const uint8_t *>(data.data()), &size,
+            reinterpret_cast<uint8_t *>(out.data())))
+      return stl::make_error<Result>("Failed to compress body");
+    out.resize(size);
+    return out;
+  }
+#endif
+  default:
+    break;
+  }
+  return stl::make_error<Result>("Unsupported content coding " +
+                                 std::string(coding_name(coding)));
+}
+
+std::unique_ptr<Decompressor> Decompressor::create(ECoding coding) {
+  switch (coding) {
+#ifdef SAP_HTTP_ZLIB
+  case ECoding::Gzip:
+    return std::make_unique<ZlibDecompressor>(true);
+  case ECoding::Deflate:
+    return std::make_unique<ZlibDecompressor>(false);
+#endif
+#ifdef SAP_HTTP_BROTLI
+  case ECoding::Brotli:
+    return std::make_unique<BrotliDecompressor>();
+#endif
+  default:
+    return nullptr;
+  }
+}
+
+CompressionCache::Key CompressionCache::key_of(std::string_view body,
+                                               ECoding coding) {
+  return {std::hash<std::string_view>{}(body), body.size(), coding};
+}
+
+std::shared_ptr<const std::string>
+CompressionCache::find(std::string_view body, ECoding coding) {
+  auto key = key_of(body, coding);
+  std::lock_guard lock(m_Mutex);
+  auto it = m_Index.find(key);
+  if (it == m_Index.end() || it->second->body != body)
+    return nullptr;
+  m_Lru.splice(m_Lru.begin(), m_Lru, it->second);
+  return it->second->compressed;
+}
+
+void CompressionCache::insert(std::string_view body, ECoding coding,
+                              std::shared_ptr<const std::string> compressed) {
+  size_t bytes = body.size() + compressed->size();
+  if (bytes > m_Capacity)
+    return;
+  auto key = key_of(body, coding);
+  std::lock_guard lock(m_Mutex);
+  // A colliding body keeps the slot it already has.
+  if (m_Index.count(key))
+    return;
+  m_Bytes += bytes;
+  m_Lru.push_front({key, std::string(body), std::move(compressed)});
+  m_Index.emplace(key, m_Lru.begin());
+  while (m_Bytes > m_Capacity) {
+    auto &oldest = m_Lru.back();
+    m_Bytes -= oldest.body.size() + oldest.compressed->size();
+    m_Index.erase(oldest.key);
+    m_Lru.pop_back();
+  }
+}
+
+size_t CompressionCache::size_bytes() const {
+  std::lock_guard lock(m_Mutex);
+  return m_Bytes;
+}
+
+} // namespace http::detail
+
+namespace http {
+
+Middleware compress_responses(CompressionConfig config) {
+  using namespace detail;
+  u32 allowed = 0;
+  if (config.brotli)
+    allowed |= coding_bit(ECoding::Brotli);
+  if (config.gzip)
+    allowed |= coding_bit(ECoding::Gzip);
+  if (config.deflate)
+    allowed |= coding_bit(ECoding::Deflate);
+  allowed &= supported_codings();
+  std::shared_ptr<CompressionCache> cache;
+  if (config.cache_bytes > 0)
+    cache = std::make_shared<CompressionCache>(config.cache_bytes);
+  return [config = std::move(config), allowed,
+          cache](const Request &req, Response &resp) {
+    if (allowed == 0 || resp.file || req.method == EMethod::HEAD ||
+        resp.status_code < 200 || resp.status_code == 204 ||
+        resp.status_code == 304 || resp.headers.has("content-encoding"))
+      return;
+    auto type = resp.headers.get(EHeader::ContentType);
+    bool compressible = std::any_of(
+        config.content_types.begin(), config.content_types.end(),
+        [type](const std::string &prefix) { return type.starts_with(prefix); });
+    if (!compressible)
+      return;
+    // The representation now depends on the request, even when it is small
+    // enough to be sent as it is.
+    auto vary = resp.headers.get("vary");
+    if (vary.empty())
+      resp.headers.set("Vary", "Accept-Encoding");
+    else if (vary != "*" && !has_member(vary, "accept-encoding"))
+      resp.headers.set("Vary", std::string(vary) + ", Accept-Encoding");
+    if (resp.body.size() < config.min_size)
+      return;
+    auto coding = negotiate(req.headers.get("accept-encoding"), allowed);
+    if (coding == ECoding::Identity)
+      return;
+    std::shared_ptr<const std::string> compressed =
+        cache ? cache->find(resp.body, coding) : nullptr;
+    if (!compressed) {
+      i32 level =
+          coding == ECoding::Brotli ? config.brotli_quality : config.zlib_level;
+      auto result = compress(coding, resp.body, level);
+      if (!result)
+        return;
+      compressed = std::make_shared<const std::string>(
+          std::move(result.value()));
+      if (cache)
+        cache->insert(resp.body, coding, compressed);
+    }
+    if (compressed->size() >= resp.body.size())
+      return;
+    resp.body.assign(*compressed);
+    resp.headers.set("Content-Encoding", coding_name(coding));
+    resp.headers.set(EHeader::ContentLength, std::to_string(resp.body.size()));
+    // A strong validator names exact bytes, which just changed.
+    auto etag = resp.headers.get("etag");
+    if (!etag.empty() && !etag.starts_with("W/"))
+      resp.headers.set("ETag", "W/" + std::string(etag));
+  };
+}
+
+} // namespace http
@@ -0,0 +1,87 @@
+#pragma once
+
+#include "net/http.h"
+#include <list>
+#include <unordered_map>
+
+namespace http::detail {
+
+// Content codings, in the order the server prefers them.
+enum class ECoding : u8 { Brotli, Gzip, Deflate, Identity };
+
+inline constexpr u32 coding_bit(ECoding coding) {
+  return 1u << static_cast<u32>(coding);
+}
+
+std::string_view coding_name(ECoding coding);
+// Identity for codings this build cannot produce or decode.
+ECoding coding_from_name(std::string_view name);
+// Codings compiled in, as a bitmask of coding_bit().
+u32 supported_codings();
+
+// Picks the best of `allowed` that an Accept-Encoding value admits, by its
+// q-values and then by server preference. Identity when none is acceptable.
+ECoding negotiate(std::string_view accept_encoding, u32 allowed);
+
+// One-shot compression; `level` is the zlib level or the brotli quality.
+stl::result<std::string> compress(ECoding coding, std::string_view data,
+                                  i32 level);
+
+// Streaming decoder for one response body.
+class Decompressor {
+public:
+  using Sink = std::function<void(std::string_view)>;
+
+  // nullptr for Identity and unsupported codings.
+  static std::unique_ptr<Decompressor> create(ECoding coding);
+  virtual ~Decompressor() = default;
+
+  // Decodes `data` and passes the output to `sink`; false on corrupt input.
+  virtual bool decode(std::string_view data, const Sink &sink) = 0;
+  // Whether everything fed so far forms a complete stream.
+  virtual bool finish() = 0;
+};
+
+// Compressed bodies keyed by a hash of the original and the coding, least
+// recently used first out once `capacity` bytes are held. Entries keep the
+// original too, since the hash is not collision resistant and a hit for a
+// different body would hand one client another's response.
+class CompressionCache {
+public:
+  explicit CompressionCache(size_t capacity) : m_Capacity(capacity) {}
+
+  std::shared_ptr<const std::string> find(std::string_view body,
+                                          ECoding coding);
+  void insert(std::string_view body, ECoding coding,
+              std::shared_ptr<const std::string> compressed);
+  size_t size_bytes() const;
+
+private:
+  struct Key {
+    std::uint64_t hash;
+    size_t size;
+    ECoding coding;
+    bool operator==(const Key &other) const = default;
+  };
+  struct KeyHash {
+    size_t operator()(const Key &key) const {
+      return key.hash ^ (key.size * 31) ^ static_cast<size_t>(key.coding);
+    }
+  };
+  struct Entry {
+    Key key;
+    std::string body;
+    std::shared_ptr<const std::string> compressed;
+  };
+  using Lru = std::list<Entry>;
+
+  static Key key_of(std::string_view body, ECoding coding);
+
+  size_t m_Capacity;
+  size_t m_Bytes{0};
+  mutable std::mutex m_Mutex;
+  Lru m_Lru;
+  std::unordered_map<Key, Lru::iterator, KeyHash> m_Index;
+};
+
+} // namespace http::detail
@@ -0,0 +1,61 @@
+#pragma once
+
+#include "net/http.h"
+#include <algorithm>
+#include <chrono>
+
+namespace http::detail {
+
+// The time budget of one client request. Every wait on the socket ends at
+// its own step limit or at the request's deadline, whichever comes first,
+// and a wait that runs out reports which of the two it hit. It also carries
+// the request's trace, the steps stamp their phases in.
+class Deadline {
+public:
+  using Clock = std::chrono::steady_clock;
+
+  explicit Deadline(const Request &req, ClientTrace *trace = nullptr)
+      : m_Request(req),
+        m_End(req.timeout.count() > 0 ? Clock::now() + req.timeout
+                                      : Clock::time_point::max()),
+        m_Trace(trace) {}
+
+  const Request &request() const { return m_Request; }
+  // nullptr unless the request is observed.
+  ClientTrace *trace() const { return m_Trace; }
+
+  // When a wait limited to `step` gives up; max() without any limit.
+  Clock::time_point until(std::chrono::milliseconds step) const {
+    if (step.count() <= 0)
+      return m_End;
+    return std::min(m_End, Clock::now() + step);
+  }
+
+  // The poll() timeout for a wait ending at `until`.
+  static std::chrono::milliseconds remaining(Clock::time_point until) {
+    if (until == Clock::time_point::max())
+      return std::chrono::milliseconds{-1};
+    return std::max(std::chrono::milliseconds{0},
+                    std::chrono::ceil<std::chrono::milliseconds>(
+                        until - Clock::now()));
+  }
+
+  static bool passed(Clock::time_point until) { return Clock::now() >= until; }
+
+  // The error for a wait that ran out at `until` while doing `step`.
+  std::string timed_out(Clock::time_point until, std::string_view step) const {
+    std::string target = m_Request.url.host + ":" + m_Request.url.port;
+    if (until == m_End) {
+      return "Request to " + target + " timed out after " +
+             std::to_string(m_Request.timeout.count()) + " ms";
+    }
+    return std::string(step) + " " + target + " timed out";
+  }
+
+private:
+  const Request &m_Request;
+  Clock::time_point m_End;
+  ClientTrace *m_Trace;
+};
+
+} // namespace http::detail
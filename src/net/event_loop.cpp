@@ -0,0 +1,371 @@
+#include "event_loop.h"
+#include "net/http.h"
+#include <algorithm>
+
+#if defined(SAP_HTTP_EPOLL)
+#include <sys/epoll.h>
+#elif defined(SAP_HTTP_KQUEUE)
+#include <sys/event.h>
+#include <sys/time.h>
+#endif
+
+namespace http::detail {
+
+namespace {
+thread_local EventLoop *t_CurrentLoop = nullptr;
+constexpr i32 k_MaxEvents = 256;
+} // namespace
+
+#if defined(SAP_HTTP_EPOLL)
+
+static u32 to_epoll(u32 events) {
+  u32 ev = 0;
+  if (events & IO_READ)
+    ev |= EPOLLIN | EPOLLRDHUP;
+  if (events & IO_WRITE)
+    ev |= EPOLLOUT;
+  return ev;
+}
+
+Poller::~Poller() {
+  if (m_Fd >= 0)
+    close(m_Fd);
+}
+
+stl::result<> Poller::open() {
+  m_Fd = epoll_create1(EPOLL_CLOEXEC);
+  if (m_Fd < 0) {
+    return stl::make_error<>("Failed to create epoll instance: " +
+                             std::string(strerror(errno)));
+  }
+  return stl::result_success();
+}
+
+bool Poller::add(i32 fd, u32 events, IoHandler *handler) {
+  epoll_event ev{};
+  ev.events = to_epoll(events);
+#ifdef EPOLLEXCLUSIVE
+  if (events & IO_EXCLUSIVE)
+    ev.events = (ev.events & ~EPOLLRDHUP) | EPOLLEXCLUSIVE;
+#endif
+  ev.data.ptr = handler;
+  return epoll_ctl(m_Fd, EPOLL_CTL_ADD, fd, &ev) == 0;
+}
+
+bool Poller::modify(i32 fd, u32 events, IoHandler *handler) {
+  epoll_event ev{};
+  ev.events = to_epoll(events);
+  ev.data.ptr = handler;
+  return epoll_ctl(m_Fd, EPOLL_CTL_MOD, fd, &ev) == 0;
+}
+
+void Poller::remove(i32 fd) { epoll_ctl(m_Fd, EPOLL_CTL_DEL, fd, nullptr); }
+
+i32 Poller::wait(std::chrono::milliseconds timeout) {
+  epoll_event events[k_MaxEvents];
+  i32 n = epoll_wait(m_Fd, events, k_MaxEvents,
+                     static_cast<i32>(timeout.count()));
+  if (n < 0)
+    return errno == EINTR ? 0 : -1;
+  for (i32 i = 0; i < n; ++i) {
+    u32 ready = 0;
+    if (events[i].events & (EPOLLIN | EPOLLRDHUP))
+      ready |= IO_READ;
+    if (events[i].events & EPOLLOUT)
+      ready |= IO_WRITE;
+    if (events[i].events & (EPOLLERR | EPOLLHUP))
+      ready |= IO_CLOSED;
+    static_cast<IoHandler *>(events[i].data.ptr)->on_io(ready);
+  }
+  return n;
+}
+
+#elif defined(SAP_HTTP_KQUEUE)
+
+Poller::~Poller() {
+  if (m_Fd >= 0)
+    close(m_Fd);
+}
+
+stl::result<> Poller::open() {
+  m_Fd = kqueue();
+  if (m_Fd < 0) {
+    return stl::make_error<>("Failed to create kqueue: " +
+                             std::string(strerror(errno)));
+  }
+  return stl::result_success();
+}
+
+bool Poller::apply(i32 fd, u32 events, IoHandler *handler) {
+  u32 previous = 0;
+  if (auto it = m_Interest.find(fd); it != m_Interest.end())
+    previous = it->second;
+  struct kevent changes[2];
+  i32 n = 0;
+  auto change = [&](i16 filter, u32 bit) {
+    if (events & bit) {
+      EV_SET(&changes[n++], fd, filter, EV_ADD | EV_ENABLE, 0, 0, handler);
+    } else if (previous & bit) {
+      EV_SET(&changes[n++], fd, filter, EV_DELETE, 0, 0, nullptr);
+    }
+  };
+  change(EVFILT_READ, IO_READ);
+  change(EVFILT_WRITE, IO_WRITE);
+  if (n > 0 && kevent(m_Fd, changes, n, nullptr, 0, nullptr) < 0)
+    return false;
+  m_Interest[fd] = events & (IO_READ | IO_WRITE);
+  return true;
+}
+
+bool Poller::add(i32 fd, u32 events, IoHandler *handler) {
+  return apply(fd, events, handler);
+}
+
+bool Poller::modify(i32 fd, u32 events, IoHandler *handler) {
+  return apply(fd, events, handler);
+}
+
+void Poller::remove(i32 fd) {
+  apply(fd, 0, nullptr);
+  m_Interest.erase(fd);
+}
+
+i32 Poller::wait(std::chrono::milliseconds timeout) {
+  struct kevent events[k_MaxEvents];
+  timespec ts{};
+  ts.tv_sec = timeout.count() / 1000;
+  ts.tv_nsec = (timeout.count() % 1000) * 1000000;
+  i32 n = kevent(m_Fd, nullptr, 0, events, k_MaxEvents, &ts);
+  if (n < 0)
+    return errno == EINTR ? 0 : -1;
+  for (i32 i = 0; i < n; ++i) {
+    u32 ready = 0;
+    if (events[i].filter == EVFILT_READ)
+      ready |= IO_READ;
+    if (events[i].filter == EVFILT_WRITE)
+      ready |= IO_WRITE;
+    if ((events[i].flags & EV_ERROR) ||
+        (events[i].filter == EVFILT_WRITE && (events[i].flags & EV_EOF)))
+      ready |= IO_CLOSED;
+    static_cast<IoHandler *>(events[i].udata)->on_io(ready);
+  }
+  return n;
+}
+
+#else
+
+Poller::~Poller() = default;
+
+stl::result<> Poller::open() { return stl::result_success(); }
+
+static short to_poll(u32 events) {
+  short ev = 0;
+  if (events & IO_READ)
+    ev |= POLLIN;
+  if (events & IO_WRITE)
+    ev |= POLLOUT;
+  return ev;
+}
+
+bool Poller::add(i32 fd, u32 events, IoHandler *handler) {
+  if (m_Index.count(fd))
+    return false;
+  pollfd p{};
+  p.fd = fd;
+  p.events = to_poll(events);
+  m_Index[fd] = m_Fds.size();
+  m_Fds.push_back(p);
+  m_Handlers.push_back(handler);
+  return true;
+}
+
+bool Poller::modify(i32 fd, u32 events, IoHandler *handler) {
+  auto it = m_Index.find(fd);
+  if (it == m_Index.end())
+    return false;
+  m_Fds[it->second].events = to_poll(events);
+  m_Handlers[it->second] = handler;
+  return true;
+}
+
+void Poller::remove(i32 fd) {
+  auto it = m_Index.find(fd);
+  if (it == m_Index.end())
+    return;
+  size_t idx = it->second;
+  m_Index.erase(it);
+  if (idx != m_Fds.size() - 1) {
+    m_Fds[idx] = m_Fds.back();
+    m_Handlers[idx] = m_Handlers.back();
+    m_Index[static_cast<i32>(m_Fds[idx].fd)] = idx;
+  }
+  m_Fds.pop_back();
+  m_Handlers.pop_back();
+}
+
+i32 Poller::wait(std::chrono::milliseconds timeout) {
+#ifdef _WIN32
+  i32 n = WSAPoll(m_Fds.data(), static_cast<ULONG>(m_Fds.size()),
+                  static_cast<i32>(timeout.count()));
+#else
+  i32 n = ::poll(m_Fds.data(), m_Fds.size(), static_cast<i32>(timeout.count()));
+#endif
+  if (n < 0)
+    return is_interrupted(last_socket_error()) ? 0 : -1;
+  // Handlers may add or remove registrations while being dispatched, so
+  // collect the ready set before calling any of them.
+  std::vector<std::pair<IoHandler *, u32>> ready;
+  for (size_t i = 0; i < m_Fds.size() && ready.size() < static_cast<size_t>(n);
+       ++i) {
+    short revents = m_Fds[i].revents;
+    if (revents == 0)
+      continue;
+    u32 ev = 0;
+    if (revents & POLLIN)
+      ev |= IO_READ;
+    if (revents & POLLOUT)
+      ev |= IO_WRITE;
+    if (revents & (POLLERR | POLLHUP | POLLNVAL))
+      ev |= IO_CLOSED;
+    ready.emplace_back(m_Handlers[i], ev);
+  }
+  for (auto &[handler, ev] : ready)
+    handler->on_io(ev);
+  return static_cast<i32>(ready.size());
+}
+
+#endif
+
+EventLoop::~EventLoop() {
+#ifndef _WIN32
+  if (m_Wakeup.fd >= 0) {
+    close(m_Wakeup.fd);
+    close(m_WakeFd);
+  }
+#endif
+}
+
+stl::result<> EventLoop::open() {
+  auto result = m_Poller.open();
+  if (!result)
+    return result;
+#ifndef _WIN32
+  i32 fds[2];
+  if (pipe(fds) != 0) {
+    return stl::make_error<>("Failed to create wake-up pipe: " +
+                             std::string(strerror(errno)));
+  }
+  m_Wakeup.fd = fds[0];
+  m_WakeFd = fds[1];
+  for (i32 fd : fds) {
+    fcntl(fd, F_SETFD, FD_CLOEXEC);
+    if (!set_nonblocking(fd))
+      return stl::make_error<>("Failed to set up wake-up pipe");
+  }
+  if (!m_Poller.add(m_Wakeup.fd, IO_READ, &m_Wakeup))
+    return stl::make_error<>("Failed to register wake-up pipe");
+#endif
+  return stl::result_success();
+}
+
+void EventLoop::Wakeup::on_io(u32) {
+#ifndef _WIN32
+  char buffer[64];
+  while (read(fd, buffer, sizeof(buffer)) > 0) {
+  }
+#endif
+}
+
+void EventLoop::post_external(std::function<void()> fn) {
+  bool idle;
+  {
+    std::lock_guard lock(m_InboxMutex);
+    idle = m_Inbox.empty();
+    m_Inbox.push_back(std::move(fn));
+  }
+#ifndef _WIN32
+  // One byte per batch: the loop drains the pipe before it takes the inbox.
+  char byte = 0;
+  if (idle && m_WakeFd >= 0 && write(m_WakeFd, &byte, 1) < 0) {
+    // A full pipe has a wake-up pending already.
+  }
+#else
+  (void)idle;
+#endif
+}
+
+void EventLoop::run(const std::atomic<bool> &running,
+                    std::chrono::milliseconds tick) {
+  t_CurrentLoop = this;
+  auto next_tick = std::chrono::steady_clock::now() + tick;
+  while (running.load()) {
+    if (m_Poller.wait(next_wait(tick)) < 0)
+      break;
+    {
+      std::lock_guard lock(m_InboxMutex);
+      for (auto &fn : m_Inbox)
+        m_Posted.push_back(std::move(fn));
+      m_Inbox.clear();
+    }
+    run_timers();
+    auto now = std::chrono::steady_clock::now();
+    if (m_OnTick && now >= next_tick) {
+      m_OnTick();
+      next_tick = now + tick;
+    }
+    run_posted();
+    m_Retired.clear();
+  }
+  run_posted();
+  m_Retired.clear();
+  t_CurrentLoop = nullptr;
+}
+
+void EventLoop::run_posted() {
+  // Callbacks may post more; those run in the same pass.
+  while (!m_Posted.empty()) {
+    auto batch = std::move(m_Posted);
+    m_Posted.clear();
+    for (auto &fn : batch)
+      fn();
+  }
+}
+
+EventLoop::TimerKey EventLoop::add_timer(Clock::time_point when,
+                                         std::function<void()> fn) {
+  TimerKey key{when, m_NextTimer++};
+  m_Timers.emplace(key, std::move(fn));
+  return key;
+}
+
+void EventLoop::run_timers() {
+  // One at a time: a timer may cancel or add others.
+  auto now = Clock::now();
+  while (!m_Timers.empty() && m_Timers.begin()->first.first <= now) {
+    auto fn = std::move(m_Timers.begin()->second);
+    m_Timers.erase(m_Timers.begin());
+    fn();
+  }
+}
+
+std::chrono::milliseconds
+EventLoop::next_wait(std::chrono::milliseconds tick) const {
+  if (m_Timers.empty())
+    return tick;
+  auto due = std::chrono::ceil<std::chrono::milliseconds>(
+      m_Timers.begin()->first.first - Clock::now());
+  return std::clamp(due, std::chrono::milliseconds{0}, tick);
+}
+
+void EventLoop::retire(std::unique_ptr<IoHandler> handler) {
+  m_Retired.push_back(std::move(handler));
+}
+
+EventLoop *EventLoop::current() { return t_CurrentLoop; }
+
+BlockingScope::BlockingScope()
+    : m_Saved(std::exchange(t_CurrentLoop, nullptr)) {}
+
+BlockingScope::~BlockingScope() { t_CurrentLoop = m_Saved; }
+
+} // namespace http::detail
@@ -0,0 +1,142 @@
+#pragma once
+
+#include "result.h"
+#include "socket.h"
+#include "types.h"
+#include <atomic>
+#include <chrono>
+#include <functional>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <unordered_map>
+#include <vector>
+
+#if defined(__linux__)
+#define SAP_HTTP_EPOLL 1
+#elif defined(__APPLE__) || defined(__FreeBSD__) || defined(__NetBSD__) ||    \
+    defined(__OpenBSD__) || defined(__DragonFly__)
+#define SAP_HTTP_KQUEUE 1
+#else
+#define SAP_HTTP_POLL 1
+#ifndef _WIN32
+#include <poll.h>
+#endif
+#endif
+
+namespace http::detail {
+
+enum EIoEvent : u32 {
+  IO_READ = 1 << 0,
+  IO_WRITE = 1 << 1,
+  // Peer hung up or the socket errored; always reported, never requested.
+  IO_CLOSED = 1 << 2,
+  // Registration hint: wake only one waiter for a shared fd (epoll only).
+  IO_EXCLUSIVE = 1 << 3,
+};
+
+class IoHandler {
+public:
+  virtual ~IoHandler() = default;
+  virtual void on_io(u32 events) = 0;
+};
+
+// Readiness notification: epoll on Linux, kqueue on BSD/macOS, and
+// poll/WSAPoll everywhere else.
+class Poller {
+public:
+  Poller() = default;
+  ~Poller();
+  Poller(const Poller &) = delete;
+  Poller &operator=(const Poller &) = delete;
+
+  stl::result<> open();
+  bool add(i32 fd, u32 events, IoHandler *handler);
+  bool modify(i32 fd, u32 events, IoHandler *handler);
+  void remove(i32 fd);
+  // Waits up to `timeout` and dispatches every ready handler. Returns the
+  // number of dispatched events, or -1 on error.
+  i32 wait(std::chrono::milliseconds timeout);
+
+private:
+#if defined(SAP_HTTP_EPOLL) || defined(SAP_HTTP_KQUEUE)
+  i32 m_Fd{-1};
+#endif
+#if defined(SAP_HTTP_KQUEUE)
+  bool apply(i32 fd, u32 events, IoHandler *handler);
+  // Filters currently installed per fd, so modify() only deletes live ones.
+  std::unordered_map<i32, u32> m_Interest;
+#endif
+#if defined(SAP_HTTP_POLL)
+  std::vector<pollfd> m_Fds;
+  std::vector<IoHandler *> m_Handlers;
+  std::unordered_map<i32, size_t> m_Index;
+#endif
+};
+
+// A Poller plus deferred destruction of handlers, so a handler that closes
+// itself mid-dispatch is never freed while later events in the same round
+// still point at it.
+class EventLoop {
+public:
+  using Clock = std::chrono::steady_clock;
+  // Identifies a pending timer; ordered by deadline, then creation.
+  using TimerKey = std::pair<Clock::time_point, std::uint64_t>;
+
+  EventLoop() = default;
+  ~EventLoop();
+  EventLoop(const EventLoop &) = delete;
+  EventLoop &operator=(const EventLoop &) = delete;
+
+  stl::result<> open();
+  Poller &poller() { return m_Poller; }
+
+  // Dispatches events until `running` turns false, waking at least once per
+  // `tick` to run the tick callback.
+  void run(const std::atomic<bool> &running, std::chrono::milliseconds tick);
+  void set_tick(std::function<void()> on_tick) {
+    m_OnTick = std::move(on_tick);
+  }
+  void retire(std::unique_ptr<IoHandler> handler);
+  // Runs `fn` once the current round of events has been dispatched, before
+  // retired handlers are freed. Only call it from the loop's own thread.
+  void post(std::function<void()> fn) { m_Posted.push_back(std::move(fn)); }
+  // Like post(), but from any thread. The loop wakes for it at once through
+  // a pipe, except on Windows, where it runs by the next tick.
+  void post_external(std::function<void()> fn);
+  // Runs `fn` on the loop's thread at the first wake-up at or past `when`.
+  // Only call these from the loop's own thread.
+  TimerKey add_timer(Clock::time_point when, std::function<void()> fn);
+  void cancel_timer(const TimerKey &key) { m_Timers.erase(key); }
+
+  // The loop dispatching on this thread, or nullptr (also inside a
+  // BlockingScope).
+  static EventLoop *current();
+
+private:
+  // Drains the wake-up pipe; what it woke the loop for is in m_Inbox.
+  class Wakeup : public IoHandler {
+  public:
+    i32 fd{-1};
+    void on_io(u32 events) override;
+  };
+
+  void run_posted();
+  void run_timers();
+  // How long the poller may sleep: `tick`, or less when a timer is due.
+  std::chrono::milliseconds next_wait(std::chrono::milliseconds tick) const;
+
+  Poller m_Poller;
+  std::function<void()> m_OnTick;
+  std::vector<std::function<void()>> m_Posted;
+  // Callbacks from other threads, moved to m_Posted every round.
+  std::mutex m_InboxMutex;
+  std::vector<std::function<void()>> m_Inbox;
+  Wakeup m_Wakeup;
+  i32 m_WakeFd{-1};
+  std::map<TimerKey, std::function<void()>> m_Timers;
+  std::uint64_t m_NextTimer{0};
+  std::vector<std::unique_ptr<IoHandler>> m_Retired;
+};
+
+} // namespace http::detail
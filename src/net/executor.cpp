@@ -0,0 +1,65 @@
+#include "executor.h"
+#include <algorithm>
+#include <mutex>
+#include <utility>
+
+namespace http::detail {
+
+namespace {
+std::mutex g_ClientMutex;
+std::shared_ptr<Executor> g_Client;
+
+u32 default_threads() {
+  // Workers mostly wait on the network, so oversubscribe the cores.
+  return std::max(4u, 2 * std::thread::hardware_concurrency());
+}
+} // namespace
+
+Executor::Executor(u32 threads) : m_Tasks(SIZE_MAX) {
+  m_Threads.reserve(threads);
+  for (u32 i = 0; i < threads; ++i) {
+    m_Threads.emplace_back([this]() {
+      // An empty task is the stop signal.
+      while (auto task = m_Tasks.pop()) {
+        if (!*task)
+          break;
+        (*task)();
+      }
+    });
+  }
+}
+
+Executor::~Executor() {
+  // The queue is FIFO, so one stop signal per thread lets everything that
+  // was already submitted finish first.
+  for (size_t i = 0; i < m_Threads.size(); ++i)
+    m_Tasks.try_push(nullptr);
+  for (auto &thread : m_Threads)
+    thread.join();
+  m_Tasks.close();
+}
+
+void Executor::post(std::function<void()> task) {
+  m_Tasks.try_push(std::move(task));
+}
+
+std::shared_ptr<Executor> Executor::client() {
+  std::lock_guard lock(g_ClientMutex);
+  if (!g_Client)
+    g_Client = std::make_shared<Executor>(default_threads());
+  return g_Client;
+}
+
+void Executor::configure_client(u32 threads) {
+  auto replacement =
+      std::make_shared<Executor>(threads == 0 ? default_threads() : threads);
+  std::shared_ptr<Executor> previous;
+  {
+    std::lock_guard lock(g_ClientMutex);
+    previous = std::exchange(g_Client, std::move(replacement));
+  }
+  // The old executor drains its queue and joins once the last caller
+  // holding it lets go.
+}
+
+} // namespace http::detail
@@ -0,0 +1,46 @@
+#pragma once
+
+#include "bounded_queue.h"
+#include "types.h"
+#include <functional>
+#include <future>
+#include <memory>
+#include <thread>
+#include <vector>
+
+namespace http::detail {
+
+// Fixed set of threads draining a shared task queue. Client requests are
+// blocking exchanges, so running them here caps the number of threads a
+// fan-out can create at the pool size; extra work waits in the queue.
+class Executor {
+public:
+  explicit Executor(u32 threads);
+  ~Executor();
+
+  Executor(const Executor &) = delete;
+  Executor &operator=(const Executor &) = delete;
+
+  template <typename F> auto submit(F &&fn) {
+    using R = std::invoke_result_t<F>;
+    // std::function needs a copyable target, so share the packaged task.
+    auto task = std::make_shared<std::packaged_task<R()>>(std::forward<F>(fn));
+    auto future = task->get_future();
+    post([task]() { (*task)(); });
+    return future;
+  }
+
+  size_t thread_count() const { return m_Threads.size(); }
+
+  // Executor shared by every asynchronous Client call.
+  static std::shared_ptr<Executor> client();
+  static void configure_client(u32 threads);
+
+private:
+  void post(std::function<void()> task);
+
+  BoundedQueue<std::function<void()>> m_Tasks;
+  std::vector<std::thread> m_Threads;
+};
+
+} // namespace http::detail
@@ -0,0 +1,103 @@
+#include "file.h"
+#include "socket.h"
+
+namespace http::detail {
+
+namespace {
+#ifdef _WIN32
+using StatBuffer = struct _stat64;
+#else
+using StatBuffer = struct stat;
+#endif
+
+FileInfo to_info(const StatBuffer &st) {
+  FileInfo info;
+  info.size = static_cast<std::uint64_t>(st.st_size);
+  info.inode = static_cast<std::uint64_t>(st.st_ino);
+#if defined(_WIN32)
+  info.mtime_ns = static_cast<std::int64_t>(st.st_mtime) * 1000000000;
+  info.is_regular = (st.st_mode & _S_IFREG) != 0;
+  info.is_directory = (st.st_mode & _S_IFDIR) != 0;
+#else
+#if defined(__APPLE__)
+  const auto &mtime = st.st_mtimespec;
+#else
+  const auto &mtime = st.st_mtim;
+#endif
+  info.mtime_ns =
+      static_cast<std::int64_t>(mtime.tv_sec) * 1000000000 + mtime.tv_nsec;
+  info.is_regular = S_ISREG(st.st_mode);
+  info.is_directory = S_ISDIR(st.st_mode);
+#endif
+  return info;
+}
+} // namespace
+
+stl::result<std::shared_ptr<const FileHandle>>
+FileHandle::open(const std::string &path) {
+  using Result = std::shared_ptr<const FileHandle>;
+#ifdef _WIN32
+  i32 fd = ::_open(path.c_str(), _O_RDONLY | _O_BINARY);
+#else
+  i32 fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+#endif
+  if (fd < 0) {
+    return stl::make_error<Result>("Failed to open " + path + ": " +
+                                   std::string(strerror(errno)));
+  }
+  StatBuffer st{};
+#ifdef _WIN32
+  i32 rc = ::_fstat64(fd, &st);
+#else
+  i32 rc = ::fstat(fd, &st);
+#endif
+  if (rc != 0) {
+    std::string error = "Failed to stat " + path + ": " + strerror(errno);
+#ifdef _WIN32
+    ::_close(fd);
+#else
+    ::close(fd);
+#endif
+    return stl::make_error<Result>(error);
+  }
+  return Result(new FileHandle(fd, to_info(st)));
+}
+
+stl::result<FileInfo> FileHandle::stat(const std::string &path) {
+  StatBuffer st{};
+#ifdef _WIN32
+  i32 rc = ::_stat64(path.c_str(), &st);
+#else
+  i32 rc = ::stat(path.c_str(), &st);
+#endif
+  if (rc != 0) {
+    return stl::make_error<FileInfo>("Failed to stat " + path + ": " +
+                                     std::string(strerror(errno)));
+  }
+  return to_info(st);
+}
+
+FileHandle::~FileHandle() {
+#ifdef _WIN32
+  ::_close(m_Fd);
+#else
+  ::close(m_Fd);
+#endif
+}
+
+std::ptrdiff_t FileHandle::read_at(char *buffer, size_t size,
+                                   std::uint64_t offset) const {
+#ifdef _WIN32
+  // The CRT has no pread, and one cached descriptor may be read by several
+  // senders at once, so seek and read together under a lock.
+  static std::mutex mutex;
+  std::lock_guard lock(mutex);
+  if (::_lseeki64(m_Fd, static_cast<__int64>(offset), SEEK_SET) < 0)
+    return -1;
+  return ::_read(m_Fd, buffer, static_cast<unsigned>(size));
+#else
+  return ::pread(m_Fd, buffer, size, static_cast<off_t>(offset));
+#endif
+}
+
+} // namespace http::detail
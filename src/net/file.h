@@ -0,0 +1,55 @@
+#pragma once
+
+#include "net/http.h"
+#include <string>
+
+#ifdef _WIN32
+#include <fcntl.h>
+#include <io.h>
+#include <sys/stat.h>
+#else
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+namespace http::detail {
+
+// Metadata of a regular file, as used for validators and Content-Length.
+struct FileInfo {
+  std::uint64_t size{0};
+  // Modification time in nanoseconds since the epoch.
+  std::int64_t mtime_ns{0};
+  std::uint64_t inode{0};
+  bool is_regular{false};
+  bool is_directory{false};
+};
+
+// Read-only descriptor closed on destruction. Shared between the static
+// file cache and any response still sending from it, so evicting a cache
+// entry never cuts off a download in progress.
+class FileHandle {
+public:
+  static stl::result<std::shared_ptr<const FileHandle>>
+  open(const std::string &path);
+  static stl::result<FileInfo> stat(const std::string &path);
+
+  ~FileHandle();
+  FileHandle(const FileHandle &) = delete;
+  FileHandle &operator=(const FileHandle &) = delete;
+
+  i32 fd() const { return m_Fd; }
+  const FileInfo &info() const { return m_Info; }
+
+  // Reads up to `size` bytes at `offset`; used where there is no sendfile.
+  std::ptrdiff_t read_at(char *buffer, size_t size,
+                         std::uint64_t offset) const;
+
+private:
+  FileHandle(i32 fd, FileInfo info) : m_Fd(fd), m_Info(info) {}
+
+  i32 m_Fd;
+  FileInfo m_Info;
+};
+
+} // namespace http::detail
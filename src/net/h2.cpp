@@ -0,0 +1,1148 @@
+#include "h2.h"
+#include "scan.h"
+#include "deadline.h"
+#include "tls.h"
+#include <charconv>
+
+namespace http::detail {
+
+namespace {
+constexpr u8 k_EndStream = 0x1;
+constexpr u8 k_Ack = 0x1;
+constexpr u8 k_EndHeaders = 0x4;
+constexpr u8 k_Padded = 0x8;
+constexpr u8 k_Priority = 0x20;
+
+constexpr u16 k_HeaderTableSize = 0x1;
+constexpr u16 k_EnablePush = 0x2;
+constexpr u16 k_MaxConcurrentStreams = 0x3;
+constexpr u16 k_InitialWindowSize = 0x4;
+constexpr u16 k_MaxFrameSize = 0x5;
+constexpr u16 k_MaxHeaderListSize = 0x6;
+
+constexpr size_t k_FrameHeadSize = 9;
+constexpr std::int64_t k_MaxWindow = 0x7fffffff;
+constexpr u32 k_DefaultWindow = 65535;
+
+u32 read_u32(std::string_view data, size_t pos) {
+  return static_cast<u32>(static_cast<u8>(data[pos])) << 24 |
+         static_cast<u32>(static_cast<u8>(data[pos + 1])) << 16 |
+         static_cast<u32>(static_cast<u8>(data[pos + 2])) << 8 |
+         static_cast<u32>(static_cast<u8>(data[pos + 3]));
+}
+
+void write_u32(std::string &out, u32 value) {
+  out.push_back(static_cast<char>(value >> 24));
+  out.push_back(static_cast<char>(value >> 16));
+  out.push_back(static_cast<char>(value >> 8));
+  out.push_back(static_cast<char>(value));
+}
+
+// Fields HTTP/2 has no use for: it frames messages and manages the
+// connection itself (RFC 9113 section 8.2.2).
+bool is_connection_header(std::string_view name) {
+  return name == "connection" || name == "keep-alive" ||
+         name == "proxy-connection" || name == "transfer-encoding" ||
+         name == "upgrade" || name == "te";
+}
+
+std::string describe(EH2Error code) {
+  switch (code) {
+  case EH2Error::NoError:
+    return "no error";
+  case EH2Error::Protocol:
+    return "protocol error";
+  case EH2Error::Internal:
+    return "internal error";
+  case EH2Error::FlowControl:
+    return "flow-control error";
+  case EH2Error::StreamClosed:
+    return "stream closed";
+  case EH2Error::FrameSize:
+    return "frame size error";
+  case EH2Error::RefusedStream:
+    return "stream refused";
+  case EH2Error::Cancel:
+    return "stream cancelled";
+  case EH2Error::Compression:
+    return "compression error";
+  case EH2Error::EnhanceYourCalm:
+    return "enhance your calm";
+  }
+  return "error " + std::to_string(static_cast<u32>(code));
+}
+} // namespace
+
+EPreface match_preface(std::string_view in) {
+  auto n = std::min(in.size(), k_H2Preface.size());
+  if (in.substr(0, n) != k_H2Preface.substr(0, n))
+    return EPreface::Absent;
+  return n == k_H2Preface.size() ? EPreface::Present : EPreface::Partial;
+}
+
+H2Session::H2Session(ERole role, const Http2Config &config,
+                     size_t max_body_size)
+    : m_Role(role), m_Config(config), m_MaxBodySize(max_body_size),
+      m_Decoder(config.header_table_size) {
+  m_Config.max_frame_size =
+      std::clamp<u32>(m_Config.max_frame_size, 16384, 16777215);
+  m_Config.initial_window_size = static_cast<u32>(
+      std::min<std::int64_t>(m_Config.initial_window_size, k_MaxWindow));
+  m_PrefaceSeen = role == ERole::Client;
+}
+
+void H2Session::start() {
+  std::string settings;
+  auto add = [&settings](u16 id, u32 value) {
+    settings.push_back(static_cast<char>(id >> 8));
+    settings.push_back(static_cast<char>(id));
+    write_u32(settings, value);
+  };
+  if (m_Config.header_table_size != 4096)
+    add(k_HeaderTableSize, m_Config.header_table_size);
+  if (m_Role == ERole::Client)
+    add(k_EnablePush, 0);
+  add(k_MaxConcurrentStreams, m_Config.max_concurrent_streams);
+  add(k_InitialWindowSize, m_Config.initial_window_size);
+  add(k_MaxFrameSize, m_Config.max_frame_size);
+  add(k_MaxHeaderListSize, m_Config.max_header_list_size);
+
+  auto frame = m_Out.take_buffer();
+  if (m_Role == ERole::Client)
+    frame.append(k_H2Preface);
+  write_frame_head(frame, settings.size(), EFrame::Settings, 0, 0);
+  frame += settings;
+  // The connection window only grows through WINDOW_UPDATE.
+  if (m_Config.initial_window_size > k_DefaultWindow) {
+    u32 increment = m_Config.initial_window_size - k_DefaultWindow;
+    write_frame_head(frame, 4, EFrame::WindowUpdate, 0, 0);
+    write_u32(frame, increment);
+    m_RecvWindow += increment;
+  }
+  m_Out.push(std::move(frame));
+}
+
+bool H2Session::feed(std::string &in) {
+  size_t pos = 0;
+  if (!m_Failed && !m_PrefaceSeen) {
+    auto preface = match_preface(in);
+    if (preface == EPreface::Partial)
+      return true;
+    if (preface == EPreface::Absent)
+      connection_error(EH2Error::Protocol, "Invalid connection preface");
+    m_PrefaceSeen = true;
+    pos = k_H2Preface.size();
+  }
+  while (!m_Failed && in.size() - pos >= k_FrameHeadSize) {
+    std::string_view head(in.data() + pos, k_FrameHeadSize);
+    size_t length = read_u32(head, 0) >> 8;
+    auto type = static_cast<EFrame>(head[3]);
+    auto flags = static_cast<u8>(head[4]);
+    u32 id = read_u32(head, 5) & 0x7fffffff;
+    if (length > m_Config.max_frame_size) {
+      connection_error(EH2Error::FrameSize, "Frame too large");
+      break;
+    }
+    if (in.size() - pos - k_FrameHeadSize < length)
+      break;
+    std::string_view payload(in.data() + pos + k_FrameHeadSize, length);
+    pos += k_FrameHeadSize + length;
+    on_frame(type, flags, id, payload);
+  }
+  if (m_Failed) {
+    in.clear();
+    return false;
+  }
+  in.erase(0, pos);
+  pump();
+  return true;
+}
+
+void H2Session::fail(std::string error) {
+  if (m_Failed)
+    return;
+  m_Failed = true;
+  m_Error = std::move(error);
+  m_Sending.clear();
+  m_Ready.clear();
+  if (m_Role == ERole::Client) {
+    for (auto &[id, stream] : m_Streams) {
+      if (!stream.over)
+        fail_stream(stream, m_Error, false);
+    }
+  }
+}
+
+void H2Session::go_away() {
+  if (!m_SentGoAway && !m_Failed)
+    queue_goaway(EH2Error::NoError, {});
+}
+
+bool H2Session::is_open() const {
+  return !m_Failed && !m_PeerGoingAway && !m_SentGoAway &&
+         m_NextStream < k_MaxWindow;
+}
+
+bool H2Session::is_finished() const {
+  return m_Failed ||
+         ((m_PeerGoingAway || m_SentGoAway) && m_Streams.empty());
+}
+
+bool H2Session::on_frame(EFrame type, u8 flags, u32 id,
+                         std::string_view payload) {
+  if (m_HeaderStream != 0 &&
+      (type != EFrame::Continuation || id != m_HeaderStream))
+    return connection_error(EH2Error::Protocol, "Expected CONTINUATION");
+  switch (type) {
+  case EFrame::Data:
+    return on_data(flags, id, payload);
+  case EFrame::Headers:
+    return on_headers(flags, id, payload);
+  case EFrame::Continuation:
+    if (m_HeaderStream == 0)
+      return connection_error(EH2Error::Protocol, "Unexpected CONTINUATION");
+    return append_block(flags, payload);
+  case EFrame::Priority:
+    // Parsed for validity only: every stream gets the same share.
+    if (id == 0)
+      return connection_error(EH2Error::Protocol, "PRIORITY on stream 0");
+    if (payload.size() != 5)
+      stream_error(id, EH2Error::FrameSize);
+    return true;
+  case EFrame::RstStream:
+    return on_rst_stream(id, payload);
+  case EFrame::Settings:
+    if (id != 0)
+      return connection_error(EH2Error::Protocol, "SETTINGS on a stream");
+    return on_settings(flags, payload);
+  case EFrame::PushPromise:
+    // Clients turn push off; servers never receive it.
+    return connection_error(EH2Error::Protocol, "Unexpected PUSH_PROMISE");
+  case EFrame::Ping:
+    if (id != 0)
+      return connection_error(EH2Error::Protocol, "PING on a stream");
+    if (payload.size() != 8)
+      return connection_error(EH2Error::FrameSize, "Malformed PING");
+    if (!(flags & k_Ack))
+      queue_frame(EFrame::Ping, k_Ack, 0, payload);
+    return true;
+  case EFrame::GoAway:
+    if (id != 0)
+      return connection_error(EH2Error::Protocol, "GOAWAY on a stream");
+    return on_goaway(payload);
+  case EFrame::WindowUpdate:
+    return on_window_update(id, payload);
+  }
+  // Frames of unknown type are ignored.
+  return true;
+}
+
+bool H2Session::unpad(u8 flags, std::string_view &payload) {
+  if (!(flags & k_Padded))
+    return true;
+  if (payload.empty())
+    return false;
+  size_t padding = static_cast<u8>(payload[0]);
+  if (padding >= payload.size())
+    return false;
+  payload = payload.substr(1, payload.size() - 1 - padding);
+  return true;
+}
+
+bool H2Session::is_idle(u32 id) const {
+  return m_Role == ERole::Server ? id > m_LastPeerStream : id >= m_NextStream;
+}
+
+bool H2Session::on_data(u8 flags, u32 id, std::string_view payload) {
+  if (id == 0)
+    return connection_error(EH2Error::Protocol, "DATA on stream 0");
+  // Padding counts against the windows too.
+  std::uint64_t flow = payload.size();
+  if (static_cast<std::int64_t>(flow) > m_RecvWindow)
+    return connection_error(EH2Error::FlowControl, "Window exceeded");
+  m_RecvWindow -= flow;
+  consume(0, m_Unacked, m_RecvWindow, flow);
+  if (!unpad(flags, payload))
+    return connection_error(EH2Error::Protocol, "Malformed padding");
+
+  auto it = m_Streams.find(id);
+  if (it == m_Streams.end() || it->second.over) {
+    if (is_idle(id))
+      return connection_error(EH2Error::Protocol, "DATA on an idle stream");
+    // A stream reset or cancelled moments ago.
+    return true;
+  }
+  auto &stream = it->second;
+  if (stream.remote_closed || (m_Role == ERole::Client && !stream.head_seen)) {
+    stream_error(id, stream.remote_closed ? EH2Error::StreamClosed
+                                          : EH2Error::Protocol);
+    return true;
+  }
+  if (static_cast<std::int64_t>(flow) > stream.recv_window) {
+    stream_error(id, EH2Error::FlowControl);
+    return true;
+  }
+  stream.recv_window -= flow;
+  bool end_stream = flags & k_EndStream;
+  if (m_Role == ERole::Server) {
+    if (stream.request->body.size() + payload.size() > m_MaxBodySize) {
+      refuse(id, 413);
+      return true;
+    }
+    stream.request->body.append(payload);
+    if (!end_stream)
+      consume(id, stream.unacked, stream.recv_window, flow);
+  } else {
+    stream.update.data.append(payload);
+    stream.changed = true;
+    // Only padding is credited now; the data once it is taken.
+    if (!end_stream)
+      consume(id, stream.unacked, stream.recv_window, flow - payload.size());
+  }
+  if (end_stream)
+    on_remote_end(id, stream);
+  return true;
+}
+
+bool H2Session::on_headers(u8 flags, u32 id, std::string_view payload) {
+  if (id == 0)
+    return connection_error(EH2Error::Protocol, "HEADERS on stream 0");
+  if (!unpad(flags, payload))
+    return connection_error(EH2Error::Protocol, "Malformed padding");
+  if (flags & k_Priority) {
+    if (payload.size() < 5)
+      return connection_error(EH2Error::FrameSize, "Malformed HEADERS");
+    payload.remove_prefix(5);
+  }
+  m_HeaderBlock.clear();
+  m_HeaderEndStream = flags & k_EndStream;
+  m_HeaderStream = id;
+  return append_block(flags, payload);
+}
+
+bool H2Session::append_block(u8 flags, std::string_view fragment) {
+  // A compressed block is no larger than the list it decodes to, give or
+  // take a little; far beyond that the peer is wasting our memory.
+  if (m_HeaderBlock.size() + fragment.size() >
+      2 * static_cast<size_t>(m_Config.max_header_list_size) + 16384)
+    return connection_error(EH2Error::EnhanceYourCalm, "Header too large");
+  m_HeaderBlock.append(fragment);
+  if (!(flags & k_EndHeaders))
+    return true;
+  u32 id = std::exchange(m_HeaderStream, 0);
+  m_Fields.clear();
+  m_FieldsTooLarge = false;
+  // Decoded even for streams that are gone: the table has to keep up. A
+  // small block can reference one large table entry over and over, so
+  // fields are only kept while the list stays within its limit.
+  size_t list_size = 0;
+  bool decoded = m_Decoder.decode(
+      m_HeaderBlock, [this, &list_size](std::string_view name,
+                                        std::string_view value) {
+        if (m_FieldsTooLarge)
+          return;
+        list_size += HpackTable::entry_size(name, value);
+        if (list_size > m_Config.max_header_list_size) {
+          m_FieldsTooLarge = true;
+          m_Fields.clear();
+          return;
+        }
+        m_Fields.emplace_back(name, value);
+      });
+  m_HeaderBlock.clear();
+  if (!decoded)
+    return connection_error(EH2Error::Compression, "Malformed header block");
+  if (m_Role == ERole::Server)
+    return on_request_head(id, m_HeaderEndStream);
+  auto it = m_Streams.find(id);
+  if (it == m_Streams.end() || it->second.over) {
+    if (is_idle(id))
+      return connection_error(EH2Error::Protocol, "HEADERS on an idle stream");
+    return true;
+  }
+  return on_response_head(id, it->second, m_HeaderEndStream);
+}
+
+bool H2Session::on_request_head(u32 id, bool end_stream) {
+  auto it = m_Streams.find(id);
+  if (it != m_Streams.end()) {
+    // Trailers, which have to end the request; their fields are dropped.
+    if (!end_stream || it->second.remote_closed) {
+      stream_error(id, EH2Error::Protocol);
+      return true;
+    }
+    on_remote_end(id, it->second);
+    return true;
+  }
+  if (id % 2 == 0 || id <= m_LastPeerStream)
+    return connection_error(EH2Error::Protocol, "Invalid stream id");
+  m_LastPeerStream = id;
+  if (m_SentGoAway)
+    return true;
+  if (m_Streams.size() >= m_Config.max_concurrent_streams) {
+    queue_rst(id, EH2Error::RefusedStream);
+    return true;
+  }
+  if (m_FieldsTooLarge) {
+    open_stream(id).remote_closed = end_stream;
+    refuse(id, 431);
+    return true;
+  }
+
+  std::string_view method, path, authority;
+  Headers headers;
+  bool regular = false;
+  bool malformed = false;
+  for (const auto &[name, value] : m_Fields) {
+    if (!name.empty() && name[0] == ':') {
+      if (regular)
+        malformed = true;
+      else if (name == ":method")
+        method = value;
+      else if (name == ":path")
+        path = value;
+      else if (name == ":authority")
+        authority = value;
+      else if (name != ":scheme")
+        malformed = true;
+      continue;
+    }
+    regular = true;
+    if (is_connection_header(name))
+      continue;
+    // Cookies may be split into several fields (RFC 9113 section 8.2.3).
+    if (name == "cookie" && headers.has(name)) {
+      std::string joined(headers.get(name));
+      joined += "; ";
+      joined += value;
+      headers.set(name, joined);
+      continue;
+    }
+    headers.set(name, value);
+  }
+  if (malformed || method.empty() || path.empty()) {
+    queue_rst(id, EH2Error::Protocol);
+    return true;
+  }
+
+  auto &stream = open_stream(id);
+  stream.request.emplace(string_to_method(method), URL::from_path(path));
+  stream.request->headers = std::move(headers);
+  if (!authority.empty())
+    stream.request->headers.set(EHeader::Host, authority);
+  stream.remote_closed = end_stream;
+  if (end_stream)
+    m_Ready.push_back(id);
+  return true;
+}
+
+bool H2Session::on_response_head(u32 id, Stream &stream, bool end_stream) {
+  if (stream.head_seen) {
+    // Trailers; their fields are dropped.
+    if (!end_stream)
+      stream_error(id, EH2Error::Protocol);
+    else
+      on_remote_end(id, stream);
+    return true;
+  }
+  if (m_FieldsTooLarge) {
+    queue_rst(id, EH2Error::Cancel);
+    fail_stream(stream, "HTTP/2 response head exceeds max_header_list_size",
+                false);
+    unqueue(id);
+    return true;
+  }
+  std::string_view status;
+  Headers headers;
+  bool regular = false;
+  bool malformed = false;
+  for (const auto &[name, value] : m_Fields) {
+    if (!name.empty() && name[0] == ':') {
+      if (regular || name != ":status")
+        malformed = true;
+      status = value;
+      continue;
+    }
+    regular = true;
+    if (!is_connection_header(name))
+      headers.set(name, value);
+  }
+  i32 code = 0;
+  auto parsed = std::from_chars(status.data(), status.data() + status.size(),
+                                code);
+  if (malformed || status.size() != 3 || parsed.ec != std::errc{} ||
+      parsed.ptr != status.data() + status.size() || code < 100) {
+    stream_error(id, EH2Error::Protocol);
+    return true;
+  }
+  // Interim responses are skipped.
+  if (code < 200) {
+    if (end_stream)
+      stream_error(id, EH2Error::Protocol);
+    return true;
+  }
+  stream.head_seen = true;
+  stream.update.has_head = true;
+  stream.update.status = code;
+  stream.update.headers = std::move(headers);
+  stream.changed = true;
+  if (end_stream)
+    on_remote_end(id, stream);
+  return true;
+}
+
+void H2Session::on_remote_end(u32 id, Stream &stream) {
+  stream.remote_closed = true;
+  if (m_Role == ERole::Server) {
+    m_Ready.push_back(id);
+    return;
+  }
+  stream.update.done = true;
+  stream.changed = true;
+  stream.over = true;
+  // A response can complete before the request body went out; the rest
+  // is not wanted.
+  if (!stream.local_closed) {
+    queue_rst(id, EH2Error::NoError);
+    stream.local_closed = true;
+    unqueue(id);
+  }
+}
+
+bool H2Session::on_settings(u8 flags, std::string_view payload) {
+  if (flags & k_Ack) {
+    if (!payload.empty())
+      return connection_error(EH2Error::FrameSize, "Malformed SETTINGS");
+    m_SettingsAcked = true;
+    return true;
+  }
+  if (payload.size() % 6 != 0)
+    return connection_error(EH2Error::FrameSize, "Malformed SETTINGS");
+  for (size_t pos = 0; pos < payload.size(); pos += 6) {
+    auto key = static_cast<u16>(static_cast<u8>(payload[pos]) << 8 |
+                                static_cast<u8>(payload[pos + 1]));
+    u32 value = read_u32(payload, pos + 2);
+    switch (key) {
+    case k_HeaderTableSize:
+      m_Encoder.set_peer_capacity(value);
+      break;
+    case k_EnablePush:
+      if (value > 1)
+        return connection_error(EH2Error::Protocol, "Invalid ENABLE_PUSH");
+      break;
+    case k_MaxConcurrentStreams:
+      m_PeerMaxStreams = value;
+      break;
+    case k_InitialWindowSize: {
+      if (value > k_MaxWindow)
+        return connection_error(EH2Error::FlowControl, "Window too large");
+      // Applies to the open streams as well (RFC 9113 section 6.9.2).
+      std::int64_t delta =
+          static_cast<std::int64_t>(value) - m_PeerInitialWindow;
+      for (auto &[id, stream] : m_Streams) {
+        stream.send_window += delta;
+        if (stream.send_window > k_MaxWindow)
+          return connection_error(EH2Error::FlowControl, "Window overflow");
+      }
+      m_PeerInitialWindow = value;
+      break;
+    }
+    case k_MaxFrameSize:
+      if (value < 16384 || value > 16777215)
+        return connection_error(EH2Error::Protocol, "Invalid MAX_FRAME_SIZE");
+      m_PeerMaxFrame = value;
+      break;
+    default:
+      // MAX_HEADER_LIST_SIZE is advisory; unknown settings are ignored.
+      break;
+    }
+  }
+  queue_frame(EFrame::Settings, k_Ack, 0, {});
+  return true;
+}
+
+bool H2Session::on_window_update(u32 id, std::string_view payload) {
+  if (payload.size() != 4)
+    return connection_error(EH2Error::FrameSize, "Malformed WINDOW_UPDATE");
+  std::int64_t increment = read_u32(payload, 0) & 0x7fffffff;
+  if (id == 0) {
+    if (increment == 0)
+      return connection_error(EH2Error::Protocol, "Empty WINDOW_UPDATE");
+    m_SendWindow += increment;
+    if (m_SendWindow > k_MaxWindow)
+      return connection_error(EH2Error::FlowControl, "Window overflow");
+    return true;
+  }
+  auto it = m_Streams.find(id);
+  if (it == m_Streams.end()) {
+    if (is_idle(id))
+      return connection_error(EH2Error::Protocol, "Update of an idle stream");
+    return true;
+  }
+  auto &window = it->second.send_window;
+  window += increment;
+  if (increment == 0 || window > k_MaxWindow)
+    stream_error(id,
+                 increment == 0 ? EH2Error::Protocol : EH2Error::FlowControl);
+  return true;
+}
+
+bool H2Session::on_rst_stream(u32 id, std::string_view payload) {
+  if (id == 0)
+    return connection_error(EH2Error::Protocol, "RST_STREAM on stream 0");
+  if (payload.size() != 4)
+    return connection_error(EH2Error::FrameSize, "Malformed RST_STREAM");
+  auto it = m_Streams.find(id);
+  if (it == m_Streams.end()) {
+    if (is_idle(id))
+      return connection_error(EH2Error::Protocol, "Reset of an idle stream");
+    return true;
+  }
+  if (m_Role == ERole::Server) {
+    erase(id);
+    return true;
+  }
+  if (it->second.over)
+    return true;
+  auto code = static_cast<EH2Error>(read_u32(payload, 0));
+  fail_stream(it->second, "Stream reset by server: " + describe(code),
+              code == EH2Error::RefusedStream);
+  unqueue(id);
+  return true;
+}
+
+bool H2Session::on_goaway(std::string_view payload) {
+  if (payload.size() < 8)
+    return connection_error(EH2Error::FrameSize, "Malformed GOAWAY");
+  m_PeerGoingAway = true;
+  u32 last = read_u32(payload, 0) & 0x7fffffff;
+  if (m_Role == ERole::Client) {
+    // Streams above the last one the server processed never ran.
+    for (auto &[id, stream] : m_Streams) {
+      if (id > last && !stream.over) {
+        fail_stream(stream, "Connection is going away", true);
+        unqueue(id);
+      }
+    }
+  }
+  return true;
+}
+
+bool H2Session::connection_error(EH2Error code, std::string error) {
+  if (!m_Failed)
+    queue_goaway(code, error);
+  fail(std::move(error));
+  return false;
+}
+
+void H2Session::stream_error(u32 id, EH2Error code) {
+  queue_rst(id, code);
+  auto it = m_Streams.find(id);
+  if (it == m_Streams.end())
+    return;
+  if (m_Role == ERole::Server) {
+    erase(id);
+    return;
+  }
+  if (!it->second.over)
+    fail_stream(it->second, "HTTP/2 stream failed: " + describe(code), false);
+  unqueue(id);
+}
+
+void H2Session::fail_stream(Stream &stream, std::string error, bool refused) {
+  stream.update.error = std::move(error);
+  stream.update.refused = refused;
+  stream.local_closed = true;
+  stream.remote_closed = true;
+  stream.changed = true;
+  stream.over = true;
+}
+
+void H2Session::refuse(u32 id, i32 status) {
+  bool uploading = !m_Streams.at(id).remote_closed;
+  respond(id, Response(status), false);
+  // Ends the upload without failing the response (RFC 9113 section 8.1).
+  if (uploading && m_Streams.count(id)) {
+    queue_rst(id, EH2Error::NoError);
+    erase(id);
+  }
+}
+
+H2Session::Stream &H2Session::open_stream(u32 id) {
+  auto &stream = m_Streams[id];
+  stream.send_window = m_PeerInitialWindow;
+  // Until our SETTINGS are acknowledged the peer may still go by the
+  // default window.
+  stream.recv_window = m_SettingsAcked ? m_Config.initial_window_size
+                                       : std::max(m_Config.initial_window_size,
+                                                  k_DefaultWindow);
+  return stream;
+}
+
+void H2Session::unqueue(u32 id) {
+  auto it = std::find(m_Sending.begin(), m_Sending.end(), id);
+  if (it != m_Sending.end())
+    m_Sending.erase(it);
+}
+
+void H2Session::erase(u32 id) {
+  m_Streams.erase(id);
+  unqueue(id);
+}
+
+void H2Session::close_if_done(u32 id) {
+  auto it = m_Streams.find(id);
+  if (m_Role == ERole::Server && it != m_Streams.end() &&
+      it->second.local_closed && it->second.remote_closed)
+    m_Streams.erase(it);
+}
+
+void H2Session::consume(u32 id, std::uint64_t &unacked, std::int64_t &window,
+                        std::uint64_t bytes) {
+  unacked += bytes;
+  std::uint64_t target =
+      id == 0 ? std::max(m_Config.initial_window_size, k_DefaultWindow)
+              : m_Config.initial_window_size;
+  // Credit in batches of half a window rather than frame by frame.
+  if (unacked == 0 || unacked < target / 2)
+    return;
+  auto frame = m_Out.take_buffer();
+  write_frame_head(frame, 4, EFrame::WindowUpdate, 0, id);
+  write_u32(frame, static_cast<u32>(unacked));
+  m_Out.push(std::move(frame));
+  window += static_cast<std::int64_t>(unacked);
+  unacked = 0;
+}
+
+bool H2Session::next_request(u32 &stream, Request &req) {
+  while (!m_Ready.empty()) {
+    u32 id = m_Ready.front();
+    m_Ready.pop_front();
+    auto it = m_Streams.find(id);
+    if (it == m_Streams.end() || !it->second.request)
+      continue;
+    stream = id;
+    req = std::move(*it->second.request);
+    it->second.request.reset();
+    return true;
+  }
+  return false;
+}
+
+void H2Session::respond(u32 id, Response resp, bool head_only) {
+  auto it = m_Streams.find(id);
+  if (m_Failed || it == m_Streams.end() || it->second.local_closed)
+    return;
+  auto &stream = it->second;
+  i32 code = resp.status_code;
+  bool no_body = head_only || code < 200 || code == 204 || code == 304;
+  if (!no_body && !resp.file)
+    resp.headers.set(EHeader::ContentLength, std::to_string(resp.body.size()));
+  std::uint64_t length = resp.file ? resp.file->length : resp.body.size();
+
+  m_Block.clear();
+  m_Encoder.begin(m_Block);
+  m_Encoder.encode(":status", std::to_string(code), m_Block);
+  encode_fields(resp.headers);
+  bool end_stream = no_body || length == 0;
+  queue_headers(id, end_stream);
+  if (end_stream) {
+    stream.local_closed = true;
+    close_if_done(id);
+    return;
+  }
+  if (resp.file) {
+    stream.file = std::move(resp.file);
+  } else {
+    stream.owned = std::move(resp.body);
+    stream.pending = stream.owned;
+  }
+  m_Sending.push_back(id);
+  pump();
+}
+
+void H2Session::reset(u32 stream, EH2Error code) {
+  if (m_Streams.count(stream))
+    stream_error(stream, code);
+}
+
+bool H2Session::can_submit() const {
+  if (!is_open())
+    return false;
+  size_t active = 0;
+  for (const auto &[id, stream] : m_Streams)
+    active += stream.over ? 0 : 1;
+  return active < m_PeerMaxStreams;
+}
+
+u32 H2Session::submit(const Request &req, const Headers &extra) {
+  if (!can_submit())
+    return 0;
+  u32 id = m_NextStream;
+  m_NextStream += 2;
+
+  const auto &url = req.url;
+  std::string_view scheme = url.scheme;
+  if (scheme.empty())
+    scheme = "http";
+  std::string authority = url.host;
+  if (!url.port.empty() && url.port != (scheme == "https" ? "443" : "80"))
+    authority += ":" + url.port;
+  std::string path = url.path.empty() ? "/" : url.path;
+  path += url.query;
+
+  m_Block.clear();
+  m_Encoder.begin(m_Block);
+  m_Encoder.encode(":method", method_to_string(req.method), m_Block);
+  m_Encoder.encode(":scheme", scheme, m_Block);
+  m_Encoder.encode(":authority", authority, m_Block);
+  m_Encoder.encode(":path", path, m_Block);
+  encode_fields(extra);
+  encode_fields(req.headers);
+  bool end_stream = req.body.empty();
+  queue_headers(id, end_stream);
+
+  auto &stream = open_stream(id);
+  stream.local_closed = end_stream;
+  if (!end_stream) {
+    stream.pending = req.body;
+    m_Sending.push_back(id);
+    pump();
+  }
+  return id;
+}
+
+bool H2Session::take_update(u32 id, H2Update &update) {
+  auto it = m_Streams.find(id);
+  if (it == m_Streams.end()) {
+    update = {};
+    update.error = m_Failed ? m_Error : "Stream closed";
+    return true;
+  }
+  auto &stream = it->second;
+  if (!stream.changed)
+    return false;
+  update = std::move(stream.update);
+  stream.update = {};
+  stream.changed = false;
+  if (stream.over) {
+    erase(id);
+    return true;
+  }
+  consume(id, stream.unacked, stream.recv_window, update.data.size());
+  return true;
+}
+
+void H2Session::cancel(u32 id) {
+  auto it = m_Streams.find(id);
+  if (it == m_Streams.end())
+    return;
+  if (!it->second.over && !m_Failed)
+    queue_rst(id, EH2Error::Cancel);
+  erase(id);
+}
+
+void H2Session::encode_fields(const Headers &headers) {
+  for (const auto &field : headers) {
+    m_Name.resize(field.name.size());
+    ascii_lower(field.name, m_Name.data());
+    // The host travels as :authority.
+    if (!is_connection_header(m_Name) && m_Name != "host")
+      m_Encoder.encode(m_Name, field.value, m_Block);
+  }
+}
+
+void H2Session::write_frame_head(std::string &out, size_t length, EFrame type,
+                                 u8 flags, u32 id) {
+  out.push_back(static_cast<char>(length >> 16));
+  out.push_back(static_cast<char>(length >> 8));
+  out.push_back(static_cast<char>(length));
+  out.push_back(static_cast<char>(type));
+  out.push_back(static_cast<char>(flags));
+  write_u32(out, id & 0x7fffffff);
+}
+
+void H2Session::queue_frame(EFrame type, u8 flags, u32 id,
+                            std::string_view payload) {
+  auto frame = m_Out.take_buffer();
+  write_frame_head(frame, payload.size(), type, flags, id);
+  frame += payload;
+  m_Out.push(std::move(frame));
+}
+
+void H2Session::queue_headers(u32 id, bool end_stream) {
+  auto frames = m_Out.take_buffer();
+  size_t pos = 0;
+  do {
+    size_t n = std::min<size_t>(m_PeerMaxFrame, m_Block.size() - pos);
+    u8 flags = pos + n == m_Block.size() ? k_EndHeaders : 0;
+    if (pos == 0 && end_stream)
+      flags |= k_EndStream;
+    write_frame_head(frames, n,
+                     pos == 0 ? EFrame::Headers : EFrame::Continuation, flags,
+                     id);
+    frames.append(m_Block, pos, n);
+    pos += n;
+  } while (pos < m_Block.size());
+  m_Out.push(std::move(frames));
+}
+
+void H2Session::queue_rst(u32 id, EH2Error code) {
+  std::string payload;
+  write_u32(payload, static_cast<u32>(code));
+  queue_frame(EFrame::RstStream, 0, id, payload);
+}
+
+void H2Session::queue_goaway(EH2Error code, std::string_view debug) {
+  std::string payload;
+  write_u32(payload, m_LastPeerStream);
+  write_u32(payload, static_cast<u32>(code));
+  payload += debug;
+  queue_frame(EFrame::GoAway, 0, 0, payload);
+  m_SentGoAway = true;
+}
+
+void H2Session::pump() {
+  size_t stalled = 0;
+  while (!m_Sending.empty() && m_SendWindow > 0 &&
+         stalled < m_Sending.size()) {
+    u32 id = m_Sending.front();
+    m_Sending.pop_front();
+    auto &stream = m_Streams.at(id);
+    if (stream.send_window <= 0) {
+      m_Sending.push_back(id);
+      ++stalled;
+      continue;
+    }
+    stalled = 0;
+    std::uint64_t left =
+        stream.file ? stream.file->length : stream.pending.size();
+    auto n = std::min<std::uint64_t>(
+        {left, m_PeerMaxFrame, static_cast<std::uint64_t>(m_SendWindow),
+         static_cast<std::uint64_t>(stream.send_window)});
+    bool last = n == left;
+    auto frame = m_Out.take_buffer();
+    write_frame_head(frame, n, EFrame::Data, last ? k_EndStream : 0, id);
+    if (stream.file) {
+      m_Out.push(std::move(frame));
+      m_Out.push_file(stream.file->handle, stream.file->offset, n);
+      stream.file->offset += n;
+      stream.file->length -= n;
+    } else {
+      // Copied: the stream may be gone before the frame is flushed.
+      frame += stream.pending.substr(0, n);
+      stream.pending.remove_prefix(n);
+      m_Out.push(std::move(frame));
+    }
+    m_SendWindow -= static_cast<std::int64_t>(n);
+    stream.send_window -= static_cast<std::int64_t>(n);
+    if (!last) {
+      m_Sending.push_back(id);
+      continue;
+    }
+    stream.local_closed = true;
+    stream.file.reset();
+    stream.owned = {};
+    close_if_done(id);
+  }
+}
+
+H2ClientSession::H2ClientSession(const Http2Config &config)
+    : m_Session(H2Session::ERole::Client, config),
+      m_LastActive(Clock::now()) {}
+
+H2ClientSession::~H2ClientSession() {
+  if (m_Link.sock < 0)
+    return;
+  if (m_State == EState::Open) {
+    m_Session.go_away();
+    m_Session.out().flush(m_Link.sock, m_Link.tls.get());
+  }
+  close_socket(m_Link.sock);
+}
+
+void H2ClientSession::attach(Link link) {
+  std::lock_guard lock(m_Mutex);
+  m_Link = std::move(link);
+  set_no_delay(m_Link.sock);
+  m_State = EState::Open;
+  m_LastActive = Clock::now();
+  m_Session.start();
+  if (!flush())
+    lose("Failed to send connection preface");
+  m_Changed.notify_all();
+}
+
+void H2ClientSession::decline() {
+  std::lock_guard lock(m_Mutex);
+  m_State = EState::Declined;
+  m_Changed.notify_all();
+}
+
+void H2ClientSession::fail(std::string error) {
+  std::lock_guard lock(m_Mutex);
+  m_State = EState::Closed;
+  m_Error = std::move(error);
+  m_Changed.notify_all();
+}
+
+H2ClientSession::EState H2ClientSession::state() const {
+  std::lock_guard lock(m_Mutex);
+  return m_State;
+}
+
+bool H2ClientSession::accepts_streams() const {
+  std::lock_guard lock(m_Mutex);
+  return m_State == EState::Connecting ||
+         (m_State == EState::Open && m_Session.is_open());
+}
+
+bool H2ClientSession::is_idle_since(Clock::time_point since) const {
+  std::lock_guard lock(m_Mutex);
+  return m_State == EState::Open && m_Session.stream_count() == 0 &&
+         m_LastActive < since;
+}
+
+// condition_variable::wait_until() with the "no limit" of Deadline.
+static bool wait_changed(std::condition_variable &changed,
+                         std::unique_lock<std::mutex> &lock,
+                         H2ClientSession::Clock::time_point until) {
+  if (until == H2ClientSession::Clock::time_point::max()) {
+    changed.wait(lock);
+    return true;
+  }
+  return changed.wait_until(lock, until) == std::cv_status::no_timeout;
+}
+
+u32 H2ClientSession::open(const Request &req, const Headers &extra,
+                          Clock::time_point until, H2Update &failure) {
+  std::unique_lock lock(m_Mutex);
+  while (true) {
+    if (m_State == EState::Open) {
+      if (!m_Session.is_open()) {
+        failure.error = m_Session.is_failed() ? m_Session.error()
+                                              : "Connection is going away";
+        failure.refused = true;
+        return 0;
+      }
+      // Otherwise wait for a stream to finish.
+      if (m_Session.can_submit()) {
+        u32 id = m_Session.submit(req, extra);
+        m_LastActive = Clock::now();
+        if (!flush())
+          lose("Failed to send request");
+        return id;
+      }
+    } else if (m_State != EState::Connecting) {
+      failure.error = m_State == EState::Declined ? "HTTP/2 not negotiated"
+                                                  : m_Error;
+      failure.refused = true;
+      return 0;
+    }
+    if (!wait_changed(m_Changed, lock, until) && Deadline::passed(until))
+      return 0;
+  }
+}
+
+bool H2ClientSession::next(u32 id, H2Update &update, Clock::time_point until) {
+  std::unique_lock lock(m_Mutex);
+  while (true) {
+    if (m_Session.take_update(id, update)) {
+      m_LastActive = Clock::now();
+      // A finished stream frees a slot for open().
+      if (update.done || !update.error.empty())
+        m_Changed.notify_all();
+      // Taking data may have queued a WINDOW_UPDATE.
+      if (m_State == EState::Open && !flush())
+        lose("Failed to send request");
+      return true;
+    }
+    if (!flush()) {
+      lose("Failed to send request");
+      continue;
+    }
+    auto *tls = m_Link.tls.get();
+    bool writing = !m_Session.out().empty() || (tls && tls->wants_write());
+    if (m_Polling && !writing) {
+      // The poller reads for us.
+      if (!wait_changed(m_Changed, lock, until) && Deadline::passed(until))
+        return m_Session.take_update(id, update);
+      continue;
+    }
+    bool reading = !m_Polling;
+    bool ready = reading && tls && tls->has_pending();
+    if (!ready) {
+      m_Polling |= reading;
+      i32 sock = m_Link.sock;
+      lock.unlock();
+      ready = wait_ready(sock, reading, writing, Deadline::remaining(until));
+      lock.lock();
+      if (reading) {
+        m_Polling = false;
+        m_Changed.notify_all();
+      }
+    }
+    if (ready && reading)
+      read_available();
+    if (!ready && Deadline::passed(until))
+      return m_Session.take_update(id, update);
+  }
+}
+
+void H2ClientSession::cancel(u32 id) {
+  std::lock_guard lock(m_Mutex);
+  m_Session.cancel(id);
+  if (m_State == EState::Open && !flush())
+    lose("Failed to send request");
+  m_Changed.notify_all();
+}
+
+bool H2ClientSession::flush() {
+  if (m_State != EState::Open)
+    return true;
+  return m_Session.out().flush(m_Link.sock, m_Link.tls.get()) !=
+         EFlush::Failed;
+}
+
+void H2ClientSession::read_available() {
+  if (m_State != EState::Open)
+    return;
+  char buffer[16384];
+  auto *tls = m_Link.tls.get();
+  std::string lost;
+  while (true) {
+    auto n = read_some(m_Link.sock, tls, buffer, sizeof(buffer));
+    if (n > 0) {
+      m_In.append(buffer, static_cast<size_t>(n));
+      continue;
+    }
+    i32 err = last_socket_error();
+    if (n < 0 && is_interrupted(err))
+      continue;
+    if (n < 0 && is_would_block(err))
+      break;
+    lost = n == 0 ? "Connection closed by server" : "Failed to read response";
+    break;
+  }
+  m_LastActive = Clock::now();
+  if (!m_In.empty() && !m_Session.feed(m_In)) {
+    // Best effort for the GOAWAY saying what went wrong.
+    m_Session.out().flush(m_Link.sock, tls);
+    lose(m_Session.error());
+    return;
+  }
+  if (!lost.empty())
+    lose(std::move(lost));
+  m_Changed.notify_all();
+}
+
+void H2ClientSession::lose(std::string error) {
+  m_Session.fail(std::move(error));
+  if (m_State == EState::Open) {
+    m_State = EState::Closed;
+    m_Error = m_Session.error();
+  }
+  m_Changed.notify_all();
+}
+
+} // namespace http::detail
@@ -0,0 +1,291 @@
+#pragma once
+
+#include "hpack.h"
+#include "net/http.h"
+#include "wire.h"
+#include <condition_variable>
+#include <deque>
+#include <unordered_map>
+
+namespace http::detail {
+
+// What every HTTP/2 client sends first (RFC 9113 section 3.4).
+inline constexpr std::string_view k_H2Preface =
+    "PRI * HTTP/2.0\r\n\r\nSM\r\n\r\n";
+
+enum class EPreface { Absent, Partial, Present };
+// Whether a plaintext connection whose first bytes are `in` speaks HTTP/2
+// with prior knowledge; Partial until enough of them are in to tell.
+EPreface match_preface(std::string_view in);
+
+enum class EH2Error : u32 {
+  NoError = 0x0,
+  Protocol = 0x1,
+  Internal = 0x2,
+  FlowControl = 0x3,
+  StreamClosed = 0x5,
+  FrameSize = 0x6,
+  RefusedStream = 0x7,
+  Cancel = 0x8,
+  Compression = 0x9,
+  EnhanceYourCalm = 0xb,
+};
+
+// What one client stream received since it was last asked.
+struct H2Update {
+  // The final (non-1xx) head, reported once.
+  bool has_head{false};
+  i32 status{0};
+  Headers headers;
+  std::string data;
+  // The response is complete.
+  bool done{false};
+  // The stream failed; `refused` when the server never processed it, so it
+  // is safe to send again.
+  std::string error;
+  bool refused{false};
+};
+
+// Framing, HPACK state, streams and flow control of one HTTP/2 connection,
+// for either end. It does no I/O itself: feed() takes the bytes read, and
+// frames to send collect in out() for the owner to flush.
+//
+// Outgoing bodies are cut into DATA frames only as far as the peer's
+// connection and stream windows allow; the rest waits for WINDOW_UPDATE.
+// Incoming data is credited back once consumed: at once on the server,
+// which keeps request bodies whole, and as the caller takes it on the
+// client, so a stream nobody reads stops at its window.
+class H2Session {
+public:
+  enum class ERole { Server, Client };
+
+  // Request bodies beyond `max_body_size` are answered with 413.
+  H2Session(ERole role, const Http2Config &config,
+            size_t max_body_size = SIZE_MAX);
+
+  // Queues the opening of the connection: the client preface, then our
+  // SETTINGS.
+  void start();
+  // Consumes every complete frame at the front of `in`. False once the
+  // connection failed; a GOAWAY saying why is then queued.
+  bool feed(std::string &in);
+  WireQueue &out() { return m_Out; }
+
+  // The connection was lost: every stream fails with `error`.
+  void fail(std::string error);
+  // Asks the peer to open no more streams; the open ones still complete.
+  void go_away();
+
+  bool is_failed() const { return m_Failed; }
+  // New streams may still be opened, by either side.
+  bool is_open() const;
+  const std::string &error() const { return m_Error; }
+  // Nothing is left to do: the connection failed, or a GOAWAY was
+  // exchanged and every stream is over.
+  bool is_finished() const;
+  size_t stream_count() const { return m_Streams.size(); }
+  // Body bytes waiting for the peer to open its flow-control window.
+  bool has_blocked_data() const { return !m_Sending.empty(); }
+
+  // Server side. Yields the streams whose request is complete, in the
+  // order they completed.
+  bool next_request(u32 &stream, Request &req);
+  void respond(u32 stream, Response resp, bool head_only);
+  void reset(u32 stream, EH2Error code = EH2Error::Internal);
+
+  // Client side. Opens a stream for `req`, with `extra` fields ahead of its
+  // own, and returns its id; 0 when no stream can be opened now. The body
+  // is read from `req` until the stream is over or cancelled.
+  u32 submit(const Request &req, const Headers &extra);
+  bool can_submit() const;
+  // Moves what arrived for `stream` into `update`; false when nothing did.
+  // The stream is forgotten once its update is done or failed.
+  bool take_update(u32 stream, H2Update &update);
+  void cancel(u32 stream);
+
+private:
+  enum class EFrame : u8 {
+    Data = 0x0,
+    Headers = 0x1,
+    Priority = 0x2,
+    RstStream = 0x3,
+    Settings = 0x4,
+    PushPromise = 0x5,
+    Ping = 0x6,
+    GoAway = 0x7,
+    WindowUpdate = 0x8,
+    Continuation = 0x9,
+  };
+
+  struct Stream {
+    // Signed: a smaller SETTINGS_INITIAL_WINDOW_SIZE can take a send
+    // window below zero.
+    std::int64_t send_window{0};
+    std::int64_t recv_window{0};
+    // Bytes consumed but not yet credited back with WINDOW_UPDATE.
+    std::uint64_t unacked{0};
+    bool remote_closed{false};
+    bool local_closed{false};
+    // Server: the request being received.
+    std::optional<Request> request;
+    // The body still to send: `pending` views `owned`, or the request body
+    // on the client; or a file range.
+    std::string owned;
+    std::string_view pending;
+    std::optional<FileBody> file;
+    // Client: what arrived since the last take_update().
+    H2Update update;
+    bool head_seen{false};
+    bool changed{false};
+    bool over{false};
+  };
+
+  bool on_frame(EFrame type, u8 flags, u32 id, std::string_view payload);
+  bool on_data(u8 flags, u32 id, std::string_view payload);
+  bool on_headers(u8 flags, u32 id, std::string_view payload);
+  bool append_block(u8 flags, std::string_view fragment);
+  bool on_header_block(u32 id, bool end_stream);
+  bool on_request_head(u32 id, bool end_stream);
+  bool on_response_head(u32 id, Stream &stream, bool end_stream);
+  bool on_settings(u8 flags, std::string_view payload);
+  bool on_window_update(u32 id, std::string_view payload);
+  bool on_rst_stream(u32 id, std::string_view payload);
+  bool on_goaway(std::string_view payload);
+  void on_remote_end(u32 id, Stream &stream);
+  // Strips the padding of a PADDED frame; false when it is malformed.
+  static bool unpad(u8 flags, std::string_view &payload);
+
+  // A stream id neither side has used yet.
+  bool is_idle(u32 id) const;
+
+  bool connection_error(EH2Error code, std::string error);
+  // Ends one stream with RST_STREAM, leaving the connection up.
+  void stream_error(u32 id, EH2Error code);
+  // Client: ends a stream with `error` for its caller.
+  static void fail_stream(Stream &stream, std::string error, bool refused);
+  // Server: answers a request that will not be served with `status`, and
+  // stops its upload if that is still running.
+  void refuse(u32 id, i32 status);
+  Stream &open_stream(u32 id);
+  void unqueue(u32 id);
+  void erase(u32 id);
+  void close_if_done(u32 id);
+  // Credits `bytes` consumed back to the peer once enough add up.
+  void consume(u32 id, std::uint64_t &unacked, std::int64_t &window,
+               std::uint64_t bytes);
+
+  // Appends the fields to m_Block, lowercased and without the ones that
+  // only mean something to HTTP/1.1.
+  void encode_fields(const Headers &headers);
+  static void write_frame_head(std::string &out, size_t length, EFrame type,
+                               u8 flags, u32 id);
+  void queue_frame(EFrame type, u8 flags, u32 id, std::string_view payload);
+  // m_Block as HEADERS and as many CONTINUATION frames as it takes.
+  void queue_headers(u32 id, bool end_stream);
+  void queue_rst(u32 id, EH2Error code);
+  void queue_goaway(EH2Error code, std::string_view debug);
+  // Cuts DATA frames from pending bodies as far as the windows allow,
+  // a frame per stream in turn.
+  void pump();
+
+  ERole m_Role;
+  Http2Config m_Config;
+  size_t m_MaxBodySize;
+  WireQueue m_Out;
+  HpackEncoder m_Encoder;
+  HpackDecoder m_Decoder;
+  std::unordered_map<u32, Stream> m_Streams;
+  // Server: streams whose request is complete.
+  std::deque<u32> m_Ready;
+  // Streams with body bytes left to send.
+  std::deque<u32> m_Sending;
+
+  bool m_PrefaceSeen{false};
+  bool m_SettingsAcked{false};
+  bool m_Failed{false};
+  bool m_SentGoAway{false};
+  bool m_PeerGoingAway{false};
+  std::string m_Error;
+
+  // The peer's settings.
+  u32 m_PeerMaxFrame{16384};
+  u32 m_PeerInitialWindow{65535};
+  u32 m_PeerMaxStreams{UINT32_MAX};
+  // Connection-level windows.
+  std::int64_t m_SendWindow{65535};
+  std::int64_t m_RecvWindow{65535};
+  std::uint64_t m_Unacked{0};
+
+  // Highest stream the peer opened, and the next one we open (client).
+  u32 m_LastPeerStream{0};
+  u32 m_NextStream{1};
+  // Streams above this, from the peer's GOAWAY, will not be processed.
+  u32 m_PeerLastStream{UINT32_MAX};
+
+  // A header block arriving over HEADERS and CONTINUATION frames.
+  std::string m_HeaderBlock;
+  u32 m_HeaderStream{0};
+  bool m_HeaderEndStream{false};
+  std::vector<std::pair<std::string, std::string>> m_Fields;
+  // The decoded list passed max_header_list_size, so m_Fields stopped
+  // collecting it; the rest was decoded only to keep the table in sync.
+  bool m_FieldsTooLarge{false};
+  // Scratch space for outgoing header blocks.
+  std::string m_Block;
+  std::string m_Name;
+};
+
+// An HTTP/2 connection shared by the requests of a ClientPool. Whichever
+// thread holds the lock writes; one waiting thread at a time sits in poll()
+// on the socket and reads for all of them, handing each stream what came in
+// for it. With TLS, reads and writes never overlap.
+class H2ClientSession {
+public:
+  using Clock = std::chrono::steady_clock;
+  enum class EState { Connecting, Open, Declined, Closed };
+
+  explicit H2ClientSession(const Http2Config &config);
+  ~H2ClientSession();
+  H2ClientSession(const H2ClientSession &) = delete;
+  H2ClientSession &operator=(const H2ClientSession &) = delete;
+
+  // Settle a session created in Connecting state: it got its connection,
+  // the server picked HTTP/1.1 through ALPN, or connecting failed.
+  void attach(Link link);
+  void decline();
+  void fail(std::string error);
+
+  EState state() const;
+  // Whether requests can still start on this session.
+  bool accepts_streams() const;
+  // Open with no stream in flight since `since`.
+  bool is_idle_since(Clock::time_point since) const;
+
+  // Opens a stream for `req`, waiting until `until` for the connection
+  // and for the server's stream limit. 0 when none was opened: `failure`
+  // then has the error, or none when `until` passed first.
+  u32 open(const Request &req, const Headers &extra, Clock::time_point until,
+           H2Update &failure);
+  // Waits until stream `id` has news; false when `until` passed first.
+  bool next(u32 id, H2Update &update, Clock::time_point until);
+  void cancel(u32 id);
+
+private:
+  // Called with the lock held.
+  bool flush();
+  void read_available();
+  void lose(std::string error);
+
+  mutable std::mutex m_Mutex;
+  std::condition_variable m_Changed;
+  H2Session m_Session;
+  Link m_Link;
+  EState m_State{EState::Connecting};
+  std::string m_Error;
+  // A thread is waiting in poll() and will read what arrives.
+  bool m_Polling{false};
+  std::string m_In;
+  Clock::time_point m_LastActive;
+};
+
+} // namespace http::detail
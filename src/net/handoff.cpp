@@ -0,0 +1,189 @@
+#include "handoff.h"
+#include "socket.h"
+#include <cstdlib>
+
+#ifndef _WIN32
+#include <sys/un.h>
+#endif
+
+namespace http {
+
+namespace {
+// The most one hand-off carries; a server has one listener per event loop
+// at most.
+constexpr size_t k_MaxSockets = 64;
+// systemd passes its sockets from this descriptor up (sd_listen_fds(3)).
+constexpr i32 k_ListenFdsStart = 3;
+
+#ifndef _WIN32
+stl::result<sockaddr_un> unix_address(std::string_view path) {
+  sockaddr_un addr{};
+  addr.sun_family = AF_UNIX;
+  if (path.empty() || path.size() >= sizeof(addr.sun_path)) {
+    return stl::make_error<sockaddr_un>("Invalid Unix socket path: " +
+                                        std::string(path));
+  }
+  std::memcpy(addr.sun_path, path.data(), path.size());
+  return addr;
+}
+
+// Received descriptors must not leak into processes this one starts.
+void set_close_on_exec(i32 fd) { fcntl(fd, F_SETFD, FD_CLOEXEC); }
+#endif
+} // namespace
+
+std::vector<i32> inherited_listeners() {
+  std::vector<i32> sockets;
+#ifndef _WIN32
+  const char *pid = std::getenv("LISTEN_PID");
+  const char *fds = std::getenv("LISTEN_FDS");
+  // The variables are meant for the process systemd started, not for a
+  // child that inherited them.
+  bool ours = pid && fds && std::strtol(pid, nullptr, 10) == getpid();
+  i32 count = ours ? std::atoi(fds) : 0;
+  unsetenv("LISTEN_PID");
+  unsetenv("LISTEN_FDS");
+  unsetenv("LISTEN_FDNAMES");
+  for (i32 i = 0; i < count; ++i) {
+    set_close_on_exec(k_ListenFdsStart + i);
+    sockets.push_back(k_ListenFdsStart + i);
+  }
+#endif
+  return sockets;
+}
+
+stl::result<std::vector<i32>>
+receive_listeners(std::string_view path, std::chrono::milliseconds timeout) {
+  using Sockets = std::vector<i32>;
+#ifdef _WIN32
+  return stl::make_error<Sockets>("Listener hand-off needs Unix sockets");
+#else
+  auto addr = unix_address(path);
+  if (!addr)
+    return stl::make_error<Sockets>(addr.error());
+  std::string name(path);
+  i32 listener = static_cast<i32>(socket(AF_UNIX, SOCK_STREAM, 0));
+  if (listener < 0) {
+    return stl::make_error<Sockets>(
+        "Failed to create socket: " +
+        detail::socket_error_string(detail::last_socket_error()));
+  }
+  // A socket file left by an earlier run would fail the bind.
+  unlink(name.c_str());
+  auto fail = [&](std::string error, i32 sock) {
+    if (sock >= 0)
+      detail::close_socket(sock);
+    return stl::make_error<Sockets>(error);
+  };
+  auto failed = [](std::string what) {
+    return what + detail::socket_error_string(detail::last_socket_error());
+  };
+  if (bind(listener, reinterpret_cast<const sockaddr *>(&addr.value()),
+           sizeof(sockaddr_un)) < 0)
+    return fail(failed("Failed to bind to " + name + ": "), listener);
+  std::string error;
+  i32 conn = -1;
+  if (listen(listener, 1) < 0)
+    error = failed("Failed to listen: ");
+  else if (!detail::wait_readable(listener, timeout))
+    error = "Timed out waiting for a hand-off at " + name;
+  else if ((conn = static_cast<i32>(accept(listener, nullptr, nullptr))) < 0)
+    error = failed("Failed to accept a hand-off: ");
+  detail::close_socket(listener);
+  unlink(name.c_str());
+  if (conn < 0)
+    return fail(error, -1);
+  detail::set_io_timeouts(conn, timeout, timeout);
+
+  char count = 0;
+  iovec iov{&count, 1};
+  alignas(cmsghdr) char control[CMSG_SPACE(sizeof(i32) * k_MaxSockets)];
+  msghdr msg{};
+  msg.msg_iov = &iov;
+  msg.msg_iovlen = 1;
+  msg.msg_control = control;
+  msg.msg_controllen = sizeof(control);
+  ssize_t n;
+  do {
+    n = recvmsg(conn, &msg, 0);
+  } while (n < 0 && errno == EINTR);
+  if (n <= 0)
+    return fail(failed("Failed to receive listening sockets: "), conn);
+  detail::close_socket(conn);
+  Sockets sockets;
+  for (cmsghdr *c = CMSG_FIRSTHDR(&msg); c; c = CMSG_NXTHDR(&msg, c)) {
+    if (c->cmsg_level != SOL_SOCKET || c->cmsg_type != SCM_RIGHTS)
+      continue;
+    size_t received = (c->cmsg_len - CMSG_LEN(0)) / sizeof(i32);
+    for (size_t i = 0; i < received; ++i) {
+      i32 fd;
+      std::memcpy(&fd, CMSG_DATA(c) + i * sizeof(i32), sizeof(fd));
+      set_close_on_exec(fd);
+      sockets.push_back(fd);
+    }
+  }
+  if (sockets.size() != static_cast<size_t>(count) ||
+      (msg.msg_flags & MSG_CTRUNC)) {
+    for (i32 fd : sockets)
+      detail::close_socket(fd);
+    return stl::make_error<Sockets>("Incomplete hand-off at " + name);
+  }
+  return sockets;
+#endif
+}
+
+namespace detail {
+
+stl::result<> send_sockets(std::string_view path,
+                           std::span<const i32> sockets) {
+#ifdef _WIN32
+  return stl::make_error<>("Listener hand-off needs Unix sockets");
+#else
+  if (sockets.empty() || sockets.size() > k_MaxSockets)
+    return stl::make_error<>("Cannot hand off " +
+                             std::to_string(sockets.size()) + " sockets");
+  auto addr = unix_address(path);
+  if (!addr)
+    return stl::make_error<>(addr.error());
+  i32 sock = static_cast<i32>(socket(AF_UNIX, SOCK_STREAM, 0));
+  auto fail = [&sock](std::string what) {
+    std::string error = what + socket_error_string(last_socket_error());
+    if (sock >= 0)
+      close_socket(sock);
+    return stl::make_error<>(error);
+  };
+  if (sock < 0)
+    return fail("Failed to create socket: ");
+  if (connect(sock, reinterpret_cast<const sockaddr *>(&addr.value()),
+              sizeof(sockaddr_un)) < 0)
+    return fail("Failed to connect to " + std::string(path) + ": ");
+
+  // The payload byte is the count, so the receiver can tell a truncated
+  // hand-off from a complete one.
+  char count = static_cast<char>(sockets.size());
+  iovec iov{&count, 1};
+  alignas(cmsghdr) char control[CMSG_SPACE(sizeof(i32) * k_MaxSockets)]{};
+  msghdr msg{};
+  msg.msg_iov = &iov;
+  msg.msg_iovlen = 1;
+  msg.msg_control = control;
+  msg.msg_controllen = CMSG_SPACE(sizeof(i32) * sockets.size());
+  cmsghdr *c = CMSG_FIRSTHDR(&msg);
+  c->cmsg_level = SOL_SOCKET;
+  c->cmsg_type = SCM_RIGHTS;
+  c->cmsg_len = CMSG_LEN(sizeof(i32) * sockets.size());
+  std::memcpy(CMSG_DATA(c), sockets.data(), sizeof(i32) * sockets.size());
+  ssize_t n;
+  do {
+    n = sendmsg(sock, &msg, k_SendFlags);
+  } while (n < 0 && errno == EINTR);
+  if (n != 1)
+    return fail("Failed to send listening sockets: ");
+  close_socket(sock);
+  return stl::result_success();
+#endif
+}
+
+} // namespace detail
+
+} // namespace http
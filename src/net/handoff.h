@@ -0,0 +1,14 @@
+#pragma once
+
+#include "net/http.h"
+#include <span>
+
+namespace http::detail {
+
+// Passes `sockets` to the process listening at the Unix socket `path`
+// (SCM_RIGHTS), which receives descriptors of its own for them. The
+// receiving end is receive_listeners().
+stl::result<> send_sockets(std::string_view path,
+                           std::span<const i32> sockets);
+
+} // namespace http::detail
@@ -1,26 +1,143 @@
 #include "net/http.h"
+#include "scan.h"
 
 namespace http {
 
+namespace {
+// Indexed by EHeader.
+constexpr std::string_view k_KnownNames[k_KnownHeaderCount] = {
+    "content-length",
+    "content-type",
+    "host",
+    "connection",
+    "transfer-encoding",
+    "accept",
+    "user-agent",
+};
+
+// `stored` is already lowercase. Folded the way ascii_lower() stores names,
+// so the C locale cannot make a lookup miss.
+bool matches(std::string_view stored, std::string_view key) {
+  if (stored.size() != key.size())
+    return false;
+  for (size_t i = 0; i < key.size(); ++i) {
+    if (stored[i] != detail::ascii_lower(key[i]))
+      return false;
+  }
+  return true;
+}
+
+// Index into k_KnownNames, or -1.
+i32 known_index(std::string_view key) {
+  for (size_t i = 0; i < k_KnownHeaderCount; ++i) {
+    if (matches(k_KnownNames[i], key))
+      return static_cast<i32>(i);
+  }
+  return -1;
+}
+} // namespace
+
+Headers::Headers(std::pmr::memory_resource *resource) : m_Fields(resource) {}
+
+std::string_view Headers::name_of(EHeader key) {
+  return k_KnownNames[static_cast<size_t>(key)];
+}
+
+size_t Headers::find(std::string_view key) const {
+  return find(key, known_index(key));
+}
+
+size_t Headers::find(std::string_view key, i32 known) const {
+  if (known >= 0) {
+    u32 slot = m_Slots[known];
+    return slot == 0 ? k_NoField : slot - 1;
+  }
+  for (size_t i = 0; i < m_Fields.size(); ++i) {
+    if (matches(m_Fields[i].name, key))
+      return i;
+  }
+  return k_NoField;
+}
+
+void Headers::assign(size_t index, std::string_view key,
+                     std::string_view value, i32 known) {
+  if (index != k_NoField) {
+    m_Fields[index].value = value;
+    return;
+  }
+  if (m_Fields.empty())
+    m_Fields.reserve(8);
+  // Built in place so the strings pick up the vector's resource.
+  auto &field = m_Fields.emplace_back();
+  if (known >= 0) {
+    field.name = k_KnownNames[known];
+  } else {
+    field.name.resize(key.size());
+    detail::ascii_lower(key, field.name.data());
+  }
+  field.value = value;
+  if (known >= 0)
+    m_Slots[known] = static_cast<u32>(m_Fields.size());
+}
+
+void Headers::erase(size_t index) {
+  m_Fields.erase(m_Fields.begin() + static_cast<std::ptrdiff_t>(index));
+  for (auto &slot : m_Slots) {
+    if (slot == index + 1)
+      slot = 0;
+    else if (slot > index + 1)
+      --slot;
+  }
+}
+
 void Headers::set(std::string_view key, std::string_view value) {
-  std::string lower_key(key);
-  std::transform(lower_key.begin(), lower_key.end(), lower_key.begin(),
-                 ::tolower);
-  data[lower_key] = value;
+  i32 known = known_index(key);
+  assign(find(key, known), key, value, known);
+}
+
+void Headers::set(EHeader key, std::string_view value) {
+  auto known = static_cast<i32>(key);
+  u32 slot = m_Slots[known];
+  assign(slot == 0 ? k_NoField : slot - 1, name_of(key), value, known);
 }
 
-std::string Headers::get(std::string_view key) const {
-  std::string lower_key(key);
-  std::transform(lower_key.begin(), lower_key.end(), lower_key.begin(),
-                 ::tolower);
-  auto it = data.find(lower_key);
-  return (it != data.end()) ? it->second : "";
+std::string_view Headers::get(std::string_view key) const {
+  size_t index = find(key);
+  return index == k_NoField ? std::string_view() : m_Fields[index].value;
+}
+
+std::string_view Headers::get(EHeader key) const {
+  u32 slot = m_Slots[static_cast<size_t>(key)];
+  return slot == 0 ? std::string_view() : m_Fields[slot - 1].value;
 }
 
 bool Headers::has(std::string_view key) const {
-  std::string lower_key(key);
-  std::transform(lower_key.begin(), lower_key.end(), lower_key.begin(),
-                 ::tolower);
-  return data.find(lower_key) != data.end();
+  return find(key) != k_NoField;
+}
+
+bool Headers::has(EHeader key) const {
+  return m_Slots[static_cast<size_t>(key)] != 0;
 }
-} // namespace http
\ No newline at end of file
+
+bool Headers::remove(std::string_view key) {
+  size_t index = find(key);
+  if (index == k_NoField)
+    return false;
+  erase(index);
+  return true;
+}
+
+bool Headers::remove(EHeader key) {
+  u32 slot = m_Slots[static_cast<size_t>(key)];
+  if (slot == 0)
+    return false;
+  erase(slot - 1);
+  return true;
+}
+
+void Headers::clear() {
+  m_Fields.clear();
+  m_Slots.fill(0);
+}
+
+} // namespace http
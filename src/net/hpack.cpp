@@ -0,0 +1,428 @@
+#include "hpack.h"
+#include <array>
+
+namespace http::detail {
+
+namespace {
+// RFC 7541 Appendix A.
+constexpr std::array<std::pair<std::string_view, std::string_view>, 61>
+    k_StaticTable{{
+        {":authority", ""},
+        {":method", "GET"},
+        {":method", "POST"},
+        {":path", "/"},
+        {":path", "/index.html"},
+        {":scheme", "http"},
+        {":scheme", "https"},
+        {":status", "200"},
+        {":status", "204"},
+        {":status", "206"},
+        {":status", "304"},
+        {":status", "400"},
+        {":status", "404"},
+        {":status", "500"},
+        {"accept-charset", ""},
+        {"accept-encoding", "gzip, deflate"},
+        {"accept-language", ""},
+        {"accept-ranges", ""},
+        {"accept", ""},
+        {"access-control-allow-origin", ""},
+        {"age", ""},
+        {"allow", ""},
+        {"authorization", ""},
+        {"cache-control", ""},
+        {"content-disposition", ""},
+        {"content-encoding", ""},
+        {"content-language", ""},
+        {"content-length", ""},
+        {"content-location", ""},
+        {"content-range", ""},
+        {"content-type", ""},
+        {"cookie", ""},
+        {"date", ""},
+        {"etag", ""},
+        {"expect", ""},
+        {"expires", ""},
+        {"from", ""},
+        {"host", ""},
+        {"if-match", ""},
+        {"if-modified-since", ""},
+        {"if-none-match", ""},
+        {"if-range", ""},
+        {"if-unmodified-since", ""},
+        {"last-modified", ""},
+        {"link", ""},
+        {"location", ""},
+        {"max-forwards", ""},
+        {"proxy-authenticate", ""},
+        {"proxy-authorization", ""},
+        {"range", ""},
+        {"referer", ""},
+        {"refresh", ""},
+        {"retry-after", ""},
+        {"server", ""},
+        {"set-cookie", ""},
+        {"strict-transport-security", ""},
+        {"transfer-encoding", ""},
+        {"user-agent", ""},
+        {"vary", ""},
+        {"via", ""},
+        {"www-authenticate", ""},
+    }};
+
+// Code lengths of RFC 7541 Appendix B, for bytes 0-255 and EOS. The code
+// is canonical, so the codes themselves follow from the lengths.
+constexpr std::array<u8, 257> k_HuffmanLengths{{
+    13, 23, 28, 28, 28, 28, 28, 28, 28, 24, 30, 28, 28, 30, 28, 28, 28, 28, 28,
+    28, 28, 28, 30, 28, 28, 28, 28, 28, 28, 28, 28, 28, 6, 10, 10, 12, 13, 6, 8,
+    11, 10, 10, 8, 11, 8, 6, 6, 6, 5, 5, 5, 6, 6, 6, 6, 6, 6, 6, 7, 8, 15, 6,
+    12, 10, 13, 6, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7,
+    7, 7, 8, 7, 8, 13, 19, 13, 14, 6, 15, 5, 6, 5, 6, 5, 6, 6, 6, 5, 7, 7, 6, 6,
+    6, 5, 6, 7, 6, 5, 5, 6, 7, 7, 7, 7, 7, 15, 11, 14, 13, 28, 20, 22, 20, 20,
+    22, 22, 22, 23, 22, 23, 23, 23, 23, 23, 24, 23, 24, 24, 22, 23, 24, 23, 23,
+    23, 23, 21, 22, 23, 22, 23, 23, 24, 22, 21, 20, 22, 22, 23, 23, 21, 23, 22,
+    22, 24, 21, 22, 23, 23, 21, 21, 22, 21, 23, 22, 23, 23, 20, 22, 22, 22, 23,
+    22, 22, 23, 26, 26, 20, 19, 22, 23, 22, 25, 26, 26, 26, 27, 27, 26, 24, 25,
+    19, 21, 26, 27, 27, 26, 27, 24, 21, 21, 26, 26, 28, 27, 27, 27, 20, 24, 20,
+    21, 22, 21, 21, 23, 22, 22, 25, 25, 24, 24, 26, 23, 26, 27, 26, 26, 27, 27,
+    27, 27, 27, 28, 27, 27, 27, 27, 27, 26, 30,
+}};
+
+constexpr u32 k_MaxCodeLength = 30;
+constexpr u32 k_Eos = 256;
+
+struct HuffmanCode {
+  std::array<u32, 257> codes{};
+  // Codes of each length, and the symbols ordered by length then value:
+  // what canonical decoding walks.
+  std::array<u16, k_MaxCodeLength + 1> counts{};
+  std::array<u16, 257> symbols{};
+};
+
+const HuffmanCode &huffman() {
+  static const HuffmanCode code = []() {
+    HuffmanCode c;
+    for (u8 length : k_HuffmanLengths)
+      ++c.counts[length];
+    std::array<u32, k_MaxCodeLength + 2> next{};
+    std::array<u16, k_MaxCodeLength + 2> offset{};
+    for (u32 length = 1; length <= k_MaxCodeLength; ++length) {
+      next[length + 1] = (next[length] + c.counts[length]) << 1;
+      offset[length + 1] = static_cast<u16>(offset[length] + c.counts[length]);
+    }
+    for (u32 symbol = 0; symbol < k_HuffmanLengths.size(); ++symbol) {
+      u8 length = k_HuffmanLengths[symbol];
+      c.codes[symbol] = next[length]++;
+      c.symbols[offset[length]++] = static_cast<u16>(symbol);
+    }
+    return c;
+  }();
+  return code;
+}
+
+// Names whose values rarely repeat, or that are better not kept around;
+// indexing them would only push useful entries out of the table.
+bool is_volatile(std::string_view name) {
+  return name == ":path" || name == "content-length" ||
+         name == "content-range" || name == "etag" ||
+         name == "last-modified" || name == "date";
+}
+
+// Never indexed, so intermediaries do not either (RFC 7541 section 7.1).
+bool is_sensitive(std::string_view name, std::string_view value) {
+  return name == "authorization" || name == "proxy-authorization" ||
+         name == "set-cookie" || (name == "cookie" && value.size() < 20);
+}
+
+constexpr size_t k_MaxIndexedValue = 256;
+} // namespace
+
+size_t huffman_size(std::string_view data) {
+  const auto &lengths = k_HuffmanLengths;
+  size_t bits = 0;
+  for (unsigned char c : data)
+    bits += lengths[c];
+  return (bits + 7) / 8;
+}
+
+void huffman_encode(std::string_view data, std::string &out) {
+  const auto &code = huffman();
+  std::uint64_t bits = 0;
+  u32 count = 0;
+  for (unsigned char c : data) {
+    u32 length = k_HuffmanLengths[c];
+    bits = (bits << length) | code.codes[c];
+    count += length;
+    while (count >= 8) {
+      count -= 8;
+      out.push_back(static_cast<char>(bits >> count));
+    }
+  }
+  // Padded with the most significant bits of EOS, all ones.
+  if (count > 0) {
+    u32 pad = 8 - count;
+    out.push_back(static_cast<char>((bits << pad) | ((1u << pad) - 1)));
+  }
+}
+
+bool huffman_decode(std::string_view data, std::string &out) {
+  const auto &code = huffman();
+  i32 value = 0, first = 0, index = 0;
+  u32 length = 0;
+  bool all_ones = true;
+  for (unsigned char byte : data) {
+    for (i32 shift = 7; shift >= 0; --shift) {
+      i32 bit = (byte >> shift) & 1;
+      value |= bit;
+      all_ones = all_ones && bit;
+      ++length;
+      i32 count = code.counts[length];
+      if (value - count < first) {
+        u16 symbol = code.symbols[index + (value - first)];
+        if (symbol == k_Eos)
+          return false;
+        out.push_back(static_cast<char>(symbol));
+        value = first = index = 0;
+        length = 0;
+        all_ones = true;
+        continue;
+      }
+      if (length == k_MaxCodeLength)
+        return false;
+      index += count;
+      first = (first + count) << 1;
+      value <<= 1;
+    }
+  }
+  return length <= 7 && all_ones;
+}
+
+void hpack_write_int(std::uint64_t value, u32 prefix_bits, u8 first,
+                     std::string &out) {
+  std::uint64_t max = (1u << prefix_bits) - 1;
+  if (value < max) {
+    out.push_back(static_cast<char>(first | value));
+    return;
+  }
+  out.push_back(static_cast<char>(first | max));
+  value -= max;
+  while (value >= 128) {
+    out.push_back(static_cast<char>((value & 127) | 128));
+    value >>= 7;
+  }
+  out.push_back(static_cast<char>(value));
+}
+
+bool hpack_read_int(std::string_view data, size_t &pos, u32 prefix_bits,
+                    std::uint64_t &value) {
+  if (pos >= data.size())
+    return false;
+  std::uint64_t max = (1u << prefix_bits) - 1;
+  value = static_cast<u8>(data[pos++]) & max;
+  if (value < max)
+    return true;
+  // Nothing HPACK encodes comes near 2^32; longer integers are an attack.
+  for (u32 shift = 0; shift <= 28; shift += 7) {
+    if (pos >= data.size())
+      return false;
+    u8 byte = static_cast<u8>(data[pos++]);
+    value += static_cast<std::uint64_t>(byte & 127) << shift;
+    if (!(byte & 128))
+      return true;
+  }
+  return false;
+}
+
+const HpackTable::Entry *HpackTable::at(size_t index) const {
+  static const auto k_Static = []() {
+    std::array<Entry, k_StaticTable.size()> entries;
+    for (size_t i = 0; i < entries.size(); ++i) {
+      entries[i].name = k_StaticTable[i].first;
+      entries[i].value = k_StaticTable[i].second;
+    }
+    return entries;
+  }();
+  if (index == 0)
+    return nullptr;
+  if (index <= k_Static.size())
+    return &k_Static[index - 1];
+  index -= k_Static.size() + 1;
+  return index < m_Entries.size() ? &m_Entries[index] : nullptr;
+}
+
+size_t HpackTable::find(std::string_view name, std::string_view value,
+                        bool &exact) const {
+  exact = false;
+  size_t by_name = 0;
+  for (size_t i = 0; i < k_StaticTable.size(); ++i) {
+    if (k_StaticTable[i].first != name)
+      continue;
+    if (k_StaticTable[i].second == value) {
+      exact = true;
+      return i + 1;
+    }
+    if (by_name == 0)
+      by_name = i + 1;
+  }
+  for (size_t i = 0; i < m_Entries.size(); ++i) {
+    if (m_Entries[i].name != name)
+      continue;
+    if (m_Entries[i].value == value) {
+      exact = true;
+      return k_StaticTable.size() + 1 + i;
+    }
+    if (by_name == 0)
+      by_name = k_StaticTable.size() + 1 + i;
+  }
+  return by_name;
+}
+
+void HpackTable::add(std::string_view name, std::string_view value) {
+  size_t size = entry_size(name, value);
+  // An entry larger than the table empties it and is not added.
+  if (size > m_Capacity) {
+    m_Entries.clear();
+    m_Size = 0;
+    return;
+  }
+  evict(size);
+  m_Entries.push_front({std::string(name), std::string(value)});
+  m_Size += size;
+}
+
+void HpackTable::set_capacity(size_t capacity) {
+  m_Capacity = capacity;
+  evict(0);
+}
+
+void HpackTable::evict(size_t room) {
+  while (!m_Entries.empty() && m_Size + room > m_Capacity) {
+    m_Size -= entry_size(m_Entries.back().name, m_Entries.back().value);
+    m_Entries.pop_back();
+  }
+}
+
+HpackEncoder::HpackEncoder(size_t limit)
+    : m_Limit(limit), m_Table(std::min<size_t>(limit, 4096)) {
+  // The peer starts out assuming the default 4096 bytes.
+  m_PendingUpdate = m_Table.capacity() != 4096;
+  m_SmallestUpdate = m_Table.capacity();
+}
+
+void HpackEncoder::set_peer_capacity(size_t capacity) {
+  capacity = std::min(capacity, m_Limit);
+  if (capacity == m_Table.capacity() && !m_PendingUpdate)
+    return;
+  m_SmallestUpdate =
+      m_PendingUpdate ? std::min(m_SmallestUpdate, capacity) : capacity;
+  m_PendingUpdate = true;
+  m_Table.set_capacity(capacity);
+}
+
+void HpackEncoder::begin(std::string &out) {
+  if (!m_PendingUpdate)
+    return;
+  m_PendingUpdate = false;
+  if (m_SmallestUpdate < m_Table.capacity())
+    hpack_write_int(m_SmallestUpdate, 5, 0x20, out);
+  hpack_write_int(m_Table.capacity(), 5, 0x20, out);
+}
+
+void HpackEncoder::encode(std::string_view name, std::string_view value,
+                          std::string &out) {
+  bool sensitive = is_sensitive(name, value);
+  bool exact = false;
+  size_t index = m_Table.find(name, value, exact);
+  if (exact && !sensitive) {
+    hpack_write_int(index, 7, 0x80, out);
+    return;
+  }
+  bool indexed = !sensitive && !is_volatile(name) &&
+                 value.size() <= k_MaxIndexedValue &&
+                 HpackTable::entry_size(name, value) <= m_Table.capacity();
+  if (indexed)
+    hpack_write_int(index, 6, 0x40, out);
+  else
+    hpack_write_int(index, 4, sensitive ? 0x10 : 0x00, out);
+  if (index == 0)
+    write_string(name, out);
+  write_string(value, out);
+  if (indexed)
+    m_Table.add(name, value);
+}
+
+void HpackEncoder::write_string(std::string_view data, std::string &out) {
+  size_t packed = huffman_size(data);
+  if (packed < data.size()) {
+    hpack_write_int(packed, 7, 0x80, out);
+    huffman_encode(data, out);
+    return;
+  }
+  hpack_write_int(data.size(), 7, 0x00, out);
+  out.append(data);
+}
+
+bool HpackDecoder::decode(std::string_view block, const Field &on_field) {
+  size_t pos = 0;
+  bool any_field = false;
+  while (pos < block.size()) {
+    u8 first = static_cast<u8>(block[pos]);
+    std::uint64_t index = 0;
+    if (first & 0x80) {
+      if (!hpack_read_int(block, pos, 7, index))
+        return false;
+      const auto *entry = m_Table.at(index);
+      if (!entry)
+        return false;
+      on_field(entry->name, entry->value);
+      any_field = true;
+      continue;
+    }
+    if ((first & 0xe0) == 0x20) {
+      // Size updates only lead a block.
+      std::uint64_t capacity = 0;
+      if (any_field || !hpack_read_int(block, pos, 5, capacity) ||
+          capacity > m_Limit)
+        return false;
+      m_Table.set_capacity(capacity);
+      continue;
+    }
+    bool indexed = (first & 0xc0) == 0x40;
+    if (!hpack_read_int(block, pos, indexed ? 6 : 4, index))
+      return false;
+    if (index != 0) {
+      const auto *entry = m_Table.at(index);
+      if (!entry)
+        return false;
+      m_Name = entry->name;
+    } else if (!read_string(block, pos, m_Name)) {
+      return false;
+    }
+    if (!read_string(block, pos, m_Value))
+      return false;
+    on_field(m_Name, m_Value);
+    any_field = true;
+    if (indexed)
+      m_Table.add(m_Name, m_Value);
+  }
+  return true;
+}
+
+bool HpackDecoder::read_string(std::string_view block, size_t &pos,
+                               std::string &out) {
+  if (pos >= block.size())
+    return false;
+  bool packed = static_cast<u8>(block[pos]) & 0x80;
+  std::uint64_t length = 0;
+  if (!hpack_read_int(block, pos, 7, length) || length > block.size() - pos)
+    return false;
+  auto data = block.substr(pos, length);
+  pos += length;
+  out.clear();
+  if (packed)
+    return huffman_decode(data, out);
+  out.assign(data);
+  return true;
+}
+
+} // namespace http::detail
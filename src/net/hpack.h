@@ -0,0 +1,113 @@
+#pragma once
+
+#include "types.h"
+#include <algorithm>
+#include <deque>
+#include <functional>
+#include <string>
+#include <string_view>
+
+namespace http::detail {
+
+// HPACK (RFC 7541) header compression for HTTP/2. Each direction of a
+// connection has its own dynamic table, kept in step by the encoder on one
+// side and the decoder on the other, so a connection needs one of each.
+
+// Static Huffman code of RFC 7541 Appendix B.
+size_t huffman_size(std::string_view data);
+void huffman_encode(std::string_view data, std::string &out);
+// False for input that is not a valid encoding: EOS inside it, or padding
+// longer than 7 bits or not made of ones.
+bool huffman_decode(std::string_view data, std::string &out);
+
+class HpackTable {
+public:
+  struct Entry {
+    std::string name;
+    std::string value;
+  };
+
+  explicit HpackTable(size_t capacity) : m_Capacity(capacity) {}
+
+  // Entries by HPACK index: 1..61 are the static table, the dynamic table
+  // follows newest first. nullptr past the end.
+  const Entry *at(size_t index) const;
+  // Index of an exact match (`exact` set) or else of the first entry with
+  // the same name; 0 when there is neither.
+  size_t find(std::string_view name, std::string_view value,
+              bool &exact) const;
+
+  void add(std::string_view name, std::string_view value);
+  void set_capacity(size_t capacity);
+  size_t capacity() const { return m_Capacity; }
+  size_t size() const { return m_Size; }
+
+  // The accounting size of an entry: its bytes plus 32.
+  static size_t entry_size(std::string_view name, std::string_view value) {
+    return name.size() + value.size() + 32;
+  }
+
+private:
+  void evict(size_t room);
+
+  std::deque<Entry> m_Entries;
+  size_t m_Capacity;
+  size_t m_Size{0};
+};
+
+class HpackEncoder {
+public:
+  // `limit` caps the dynamic table whatever the peer allows.
+  explicit HpackEncoder(size_t limit = 4096);
+
+  // The peer's SETTINGS_HEADER_TABLE_SIZE; announced in the next block.
+  void set_peer_capacity(size_t capacity);
+
+  // Starts a header block in `out` with any pending table size update.
+  void begin(std::string &out);
+  // Appends the representation of one field to the block. Names must be
+  // lowercase.
+  void encode(std::string_view name, std::string_view value,
+              std::string &out);
+
+private:
+  void write_string(std::string_view data, std::string &out);
+
+  size_t m_Limit;
+  HpackTable m_Table;
+  // A capacity change not yet announced, and the smallest capacity it went
+  // through, which the peer has to hear about first.
+  bool m_PendingUpdate{false};
+  size_t m_SmallestUpdate{0};
+};
+
+class HpackDecoder {
+public:
+  using Field = std::function<void(std::string_view, std::string_view)>;
+
+  // `limit` is the largest table the peer may have us keep, our
+  // SETTINGS_HEADER_TABLE_SIZE.
+  explicit HpackDecoder(size_t limit = 4096)
+      : m_Limit(std::max<size_t>(limit, 4096)), m_Table(4096) {}
+
+  // Decodes one complete header block, handing every field to `on_field`
+  // in order. False on a malformed block, which is a connection error: the
+  // table can no longer be trusted.
+  bool decode(std::string_view block, const Field &on_field);
+
+private:
+  bool read_string(std::string_view block, size_t &pos, std::string &out);
+
+  size_t m_Limit;
+  HpackTable m_Table;
+  std::string m_Name;
+  std::string m_Value;
+};
+
+// An integer with an N-bit prefix; `first` holds the bits above the prefix.
+void hpack_write_int(std::uint64_t value, u32 prefix_bits, u8 first,
+                     std::string &out);
+bool hpack_read_int(std::string_view data, size_t &pos, u32 prefix_bits,
+                    std::uint64_t &value);
+
+} // namespace http::detail
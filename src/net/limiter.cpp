@@ -0,0 +1,61 @@
+#include "limiter.h"
+#include <cstring>
+
+namespace http::detail {
+
+size_t ConnectionLimiter::PeerHash::operator()(const PeerKey &key) const {
+  std::uint64_t high, low;
+  std::memcpy(&high, key.data(), sizeof(high));
+  std::memcpy(&low, key.data() + sizeof(high), sizeof(low));
+  return static_cast<size_t>(high * 0x9e3779b97f4a7c15ull ^ low);
+}
+
+ConnectionLimiter::PeerKey
+ConnectionLimiter::key_of(const sockaddr_storage &peer) {
+  PeerKey key{};
+  if (peer.ss_family == AF_INET) {
+    const auto &v4 = reinterpret_cast<const sockaddr_in &>(peer);
+    key[10] = 0xff;
+    key[11] = 0xff;
+    std::memcpy(key.data() + 12, &v4.sin_addr, 4);
+  } else if (peer.ss_family == AF_INET6) {
+    const auto &v6 = reinterpret_cast<const sockaddr_in6 &>(peer);
+    std::memcpy(key.data(), &v6.sin6_addr, key.size());
+  }
+  return key;
+}
+
+bool ConnectionLimiter::admit(i32 sock, const sockaddr_storage &peer) {
+  if (m_Total.fetch_add(1) >= m_MaxTotal && m_MaxTotal > 0) {
+    m_Total.fetch_sub(1);
+    return false;
+  }
+  if (m_MaxPerPeer == 0)
+    return true;
+  auto key = key_of(peer);
+  std::lock_guard lock(m_Mutex);
+  auto &count = m_PerPeer[key];
+  if (count >= m_MaxPerPeer) {
+    m_Total.fetch_sub(1);
+    return false;
+  }
+  ++count;
+  m_Peers[sock] = key;
+  return true;
+}
+
+void ConnectionLimiter::release(i32 sock) {
+  m_Total.fetch_sub(1);
+  if (m_MaxPerPeer == 0)
+    return;
+  std::lock_guard lock(m_Mutex);
+  auto it = m_Peers.find(sock);
+  if (it == m_Peers.end())
+    return;
+  auto count = m_PerPeer.find(it->second);
+  if (--count->second == 0)
+    m_PerPeer.erase(count);
+  m_Peers.erase(it);
+}
+
+} // namespace http::detail
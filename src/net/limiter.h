@@ -0,0 +1,43 @@
+#pragma once
+
+#include "socket.h"
+#include "types.h"
+#include <array>
+#include <atomic>
+#include <mutex>
+#include <unordered_map>
+
+namespace http::detail {
+
+// Caps the connections open across the server and per client address,
+// shared by every accepting thread. A limit of 0 is no limit.
+class ConnectionLimiter {
+public:
+  ConnectionLimiter(u32 max_total, u32 max_per_peer)
+      : m_MaxTotal(max_total), m_MaxPerPeer(max_per_peer) {}
+
+  // Takes a slot for `sock`, accepted from `peer`; false when a limit is
+  // reached and the connection should be refused.
+  bool admit(i32 sock, const sockaddr_storage &peer);
+  // Gives back the slot of an admitted socket. Call it before closing the
+  // socket: the descriptor may be handed to the next accept right after.
+  void release(i32 sock);
+
+private:
+  // IPv6 bytes; IPv4 addresses are mapped so both families share a count.
+  using PeerKey = std::array<u8, 16>;
+  struct PeerHash {
+    size_t operator()(const PeerKey &key) const;
+  };
+
+  static PeerKey key_of(const sockaddr_storage &peer);
+
+  u32 m_MaxTotal;
+  u32 m_MaxPerPeer;
+  std::atomic<u32> m_Total{0};
+  std::mutex m_Mutex;
+  std::unordered_map<PeerKey, u32, PeerHash> m_PerPeer;
+  std::unordered_map<i32, PeerKey> m_Peers;
+};
+
+} // namespace http::detail
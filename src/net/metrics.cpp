@@ -0,0 +1,301 @@
+#include "metrics.h"
+#include <algorithm>
+#include <bit>
+#include <cmath>
+#include <cstdio>
+
+namespace http {
+
+namespace {
+constexpr size_t k_SubBits = 3;
+static_assert(LatencyHistogram::k_SubBuckets == 1u << k_SubBits);
+
+// Bucket bounds exported to Prometheus, in nanoseconds.
+constexpr std::uint64_t k_ExportBounds[] = {
+    1'000,         5'000,         10'000,        25'000,
+    50'000,        100'000,       250'000,       500'000,
+    1'000'000,     2'500'000,     5'000'000,     10'000'000,
+    25'000'000,    50'000'000,    100'000'000,   250'000'000,
+    500'000'000,   1'000'000'000, 2'500'000'000, 5'000'000'000,
+    10'000'000'000};
+
+std::string seconds(std::uint64_t ns) {
+  char buffer[32];
+  std::snprintf(buffer, sizeof(buffer), "%.9g", static_cast<double>(ns) / 1e9);
+  return buffer;
+}
+
+std::string escape_label(std::string_view value) {
+  std::string escaped;
+  escaped.reserve(value.size());
+  for (char c : value) {
+    if (c == '\\' || c == '"')
+      escaped.push_back('\\');
+    if (c == '\n') {
+      escaped.append("\\n");
+      continue;
+    }
+    escaped.push_back(c);
+  }
+  return escaped;
+}
+
+void write_family(std::string &out, std::string_view name,
+                  std::string_view type, std::string_view help) {
+  out.append("# HELP ").append(name).append(" ").append(help).append("\n");
+  out.append("# TYPE ").append(name).append(" ").append(type).append("\n");
+}
+
+void write_sample(std::string &out, std::string_view name,
+                  std::string_view labels, std::string_view value) {
+  out.append(name);
+  if (!labels.empty())
+    out.append("{").append(labels).append("}");
+  out.append(" ").append(value).append("\n");
+}
+
+void write_scalar(std::string &out, std::string_view name,
+                  std::string_view type, std::string_view help,
+                  std::uint64_t value) {
+  write_family(out, name, type, help);
+  write_sample(out, name, {}, std::to_string(value));
+}
+
+// `labels` is a comma-terminated prefix such as `phase="parse",`.
+void write_histogram(std::string &out, std::string_view name,
+                     const std::string &labels,
+                     const LatencyHistogram &histogram) {
+  std::string bucket = std::string(name) + "_bucket";
+  for (std::uint64_t bound : k_ExportBounds) {
+    write_sample(out, bucket, labels + "le=\"" + seconds(bound) + "\"",
+                 std::to_string(histogram.count_at_or_below(bound)));
+  }
+  write_sample(out, bucket, labels + "le=\"+Inf\"",
+               std::to_string(histogram.count()));
+  std::string plain = labels.empty() ? "" : labels.substr(0, labels.size() - 1);
+  write_sample(out, std::string(name) + "_sum", plain,
+               seconds(static_cast<std::uint64_t>(histogram.sum().count())));
+  write_sample(out, std::string(name) + "_count", plain,
+               std::to_string(histogram.count()));
+}
+} // namespace
+
+size_t LatencyHistogram::bucket_of(std::uint64_t ns) {
+  if (ns < k_SubBuckets)
+    return static_cast<size_t>(ns);
+  size_t exponent = std::bit_width(ns) - 1;
+  size_t bucket = (exponent - k_SubBits + 1) * k_SubBuckets +
+                  ((ns >> (exponent - k_SubBits)) & (k_SubBuckets - 1));
+  return std::min(bucket, k_BucketCount - 1);
+}
+
+std::uint64_t LatencyHistogram::bucket_upper(size_t bucket) {
+  if (bucket < k_SubBuckets)
+    return bucket;
+  size_t shift = bucket / k_SubBuckets - 1;
+  std::uint64_t lower = (k_SubBuckets + bucket % k_SubBuckets) << shift;
+  return lower + (std::uint64_t{1} << shift) - 1;
+}
+
+void LatencyHistogram::record(std::uint64_t ns) {
+  ++m_Buckets[bucket_of(ns)];
+  ++m_Count;
+  m_Sum += ns;
+  m_Max = std::max(m_Max, ns);
+}
+
+void LatencyHistogram::merge(const LatencyHistogram &other) {
+  for (size_t i = 0; i < k_BucketCount; ++i)
+    m_Buckets[i] += other.m_Buckets[i];
+  m_Count += other.m_Count;
+  m_Sum += other.m_Sum;
+  m_Max = std::max(m_Max, other.m_Max);
+}
+
+std::chrono::nanoseconds LatencyHistogram::sum() const {
+  return std::chrono::nanoseconds(m_Sum);
+}
+
+std::chrono::nanoseconds LatencyHistogram::max() const {
+  return std::chrono::nanoseconds(m_Max);
+}
+
+std::chrono::nanoseconds LatencyHistogram::mean() const {
+  return std::chrono::nanoseconds(m_Count == 0 ? 0 : m_Sum / m_Count);
+}
+
+std::chrono::nanoseconds LatencyHistogram::quantile(double q) const {
+  if (m_Count == 0)
+    return std::chrono::nanoseconds(0);
+  q = std::clamp(q, 0.0, 1.0);
+  auto rank = std::max<std::uint64_t>(
+      1, static_cast<std::uint64_t>(std::ceil(q * m_Count)));
+  std::uint64_t seen = 0;
+  for (size_t i = 0; i < k_BucketCount; ++i) {
+    seen += m_Buckets[i];
+    if (seen >= rank)
+      return std::chrono::nanoseconds(std::min(bucket_upper(i), m_Max));
+  }
+  return max();
+}
+
+std::uint64_t LatencyHistogram::count_at_or_below(std::uint64_t ns) const {
+  std::uint64_t count = 0;
+  for (size_t i = 0; i < k_BucketCount && bucket_upper(i) <= ns; ++i)
+    count += m_Buckets[i];
+  return count;
+}
+
+std::string ServerMetrics::to_prometheus() const {
+  std::string out;
+  write_scalar(out, "sap_http_connections_accepted_total", "counter",
+               "Connections accepted.", connections_accepted);
+  write_scalar(out, "sap_http_connections_active", "gauge",
+               "Connections currently open.", connections_active);
+  write_scalar(out, "sap_http_connections_rejected_total", "counter",
+               "Connections refused by the worker queue or connection limits.",
+               connections_rejected);
+  write_scalar(out, "sap_http_connections_timed_out_total", "counter",
+               "Connections dropped for a slow client.", connections_timed_out);
+  write_scalar(out, "sap_http_requests_total", "counter",
+               "Requests answered.", requests);
+  write_scalar(out, "sap_http_parse_errors_total", "counter",
+               "Requests rejected as malformed or too large.", parse_errors);
+  write_scalar(out, "sap_http_not_found_total", "counter",
+               "Requests that matched no route.", not_found);
+  write_scalar(out, "sap_http_method_not_allowed_total", "counter",
+               "Requests whose path matched but method did not.",
+               method_not_allowed);
+  write_scalar(out, "sap_http_handler_exceptions_total", "counter",
+               "Handlers that threw.", handler_exceptions);
+  write_scalar(out, "sap_http_tls_handshakes_total", "counter",
+               "TLS handshakes completed.", tls_handshakes);
+  write_scalar(out, "sap_http_tls_resumed_total", "counter",
+               "TLS handshakes that resumed a session.", tls_resumed);
+  write_scalar(out, "sap_http_tls_handshake_errors_total", "counter",
+               "TLS handshakes that failed or timed out.",
+               tls_handshake_errors);
+  write_scalar(out, "sap_http_http2_connections_total", "counter",
+               "Connections served over HTTP/2.", http2_connections);
+  write_scalar(out, "sap_http_cache_hits_total", "counter",
+               "Requests answered from the response cache.", cache_hits);
+  write_scalar(out, "sap_http_cache_misses_total", "counter",
+               "Cacheable requests that ran their handler.", cache_misses);
+
+  write_family(out, "sap_http_phase_duration_seconds", "histogram",
+               "Time spent parsing, handling and writing requests.");
+  write_histogram(out, "sap_http_phase_duration_seconds", "phase=\"parse\",",
+                  parse);
+  write_histogram(out, "sap_http_phase_duration_seconds",
+                  "phase=\"handler\",", handler);
+  write_histogram(out, "sap_http_phase_duration_seconds", "phase=\"write\",",
+                  write);
+
+  if (routes.empty())
+    return out;
+  auto route_labels = [](const RouteMetrics &route) {
+    return "method=\"" + method_to_string(route.method) + "\",route=\"" +
+           escape_label(route.path) + "\"";
+  };
+  write_family(out, "sap_http_route_requests_total", "counter",
+               "Requests dispatched to each route.");
+  for (auto &route : routes) {
+    write_sample(out, "sap_http_route_requests_total", route_labels(route),
+                 std::to_string(route.requests));
+  }
+  write_family(out, "sap_http_route_errors_total", "counter",
+               "5xx responses from each route.");
+  for (auto &route : routes) {
+    write_sample(out, "sap_http_route_errors_total", route_labels(route),
+                 std::to_string(route.errors));
+  }
+  write_family(out, "sap_http_route_duration_seconds", "histogram",
+               "Handler latency of each route.");
+  for (auto &route : routes) {
+    write_histogram(out, "sap_http_route_duration_seconds",
+                    route_labels(route) + ",", route.latency);
+  }
+  return out;
+}
+
+namespace detail {
+
+namespace {
+std::atomic<std::uint64_t> g_NextRegistryId{1};
+
+struct LocalShard {
+  std::uint64_t registry{0};
+  MetricsShard *shard{nullptr};
+};
+thread_local LocalShard t_Shard;
+} // namespace
+
+void AtomicHistogram::merge_into(LatencyHistogram &out) const {
+  for (size_t i = 0; i < LatencyHistogram::k_BucketCount; ++i)
+    out.m_Buckets[i] += m_Buckets[i].load();
+  out.m_Count += m_Count.load();
+  out.m_Sum += m_Sum.load();
+  out.m_Max = std::max(out.m_Max, m_Max.load(std::memory_order_relaxed));
+}
+
+MetricsRegistry::MetricsRegistry(size_t route_count)
+    : m_Id(g_NextRegistryId.fetch_add(1)), m_RouteCount(route_count) {}
+
+MetricsShard &MetricsRegistry::local() {
+  if (t_Shard.registry == m_Id)
+    return *t_Shard.shard;
+  MetricsShard &shard = register_thread();
+  t_Shard = {m_Id, &shard};
+  return shard;
+}
+
+MetricsShard &MetricsRegistry::register_thread() {
+  // A thread that alternates between servers keeps its shard in each.
+  auto id = std::this_thread::get_id();
+  std::lock_guard lock(m_Mutex);
+  for (auto &[owner, shard] : m_Shards) {
+    if (owner == id)
+      return *shard;
+  }
+  m_Shards.emplace_back(id, std::make_unique<MetricsShard>(m_RouteCount));
+  return *m_Shards.back().second;
+}
+
+void MetricsRegistry::collect(ServerMetrics &out) const {
+  std::uint64_t closed = 0;
+  std::lock_guard lock(m_Mutex);
+  for (auto &[owner, shard] : m_Shards) {
+    out.connections_accepted += shard->connections_accepted.load();
+    closed += shard->connections_closed.load();
+    out.connections_rejected += shard->connections_rejected.load();
+    out.connections_timed_out += shard->connections_timed_out.load();
+    out.requests += shard->requests.load();
+    out.parse_errors += shard->parse_errors.load();
+    out.not_found += shard->not_found.load();
+    out.method_not_allowed += shard->method_not_allowed.load();
+    out.handler_exceptions += shard->handler_exceptions.load();
+    out.tls_handshakes += shard->tls_handshakes.load();
+    out.tls_resumed += shard->tls_resumed.load();
+    out.tls_handshake_errors += shard->tls_handshake_errors.load();
+    out.http2_connections += shard->http2_connections.load();
+    out.cache_hits += shard->cache_hits.load();
+    out.cache_misses += shard->cache_misses.load();
+    shard->parse.merge_into(out.parse);
+    shard->handler.merge_into(out.handler);
+    shard->write.merge_into(out.write);
+    for (size_t i = 0; i < out.routes.size() && i < m_RouteCount; ++i) {
+      const RouteShard &route = shard->route(i);
+      out.routes[i].requests += route.requests.load();
+      out.routes[i].errors += route.errors.load();
+      route.latency.merge_into(out.routes[i].latency);
+    }
+  }
+  // Shards are read one after another, so a close can be seen before the
+  // matching accept.
+  out.connections_active =
+      out.connections_accepted > closed ? out.connections_accepted - closed : 0;
+}
+
+} // namespace detail
+
+} // namespace http
@@ -0,0 +1,120 @@
+#pragma once
+
+#include "net/http.h"
+#include <atomic>
+#include <chrono>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace http::detail {
+
+using MetricsClock = std::chrono::steady_clock;
+
+inline std::uint64_t elapsed_ns(MetricsClock::time_point since) {
+  auto elapsed = MetricsClock::now() - since;
+  return static_cast<std::uint64_t>(
+      std::chrono::duration_cast<std::chrono::nanoseconds>(elapsed).count());
+}
+
+// Counter written by exactly one thread and read by any. The update is a
+// plain load and store, so the hot path never issues a locked instruction;
+// readers only need each value to be untorn, not a consistent snapshot.
+class Counter {
+public:
+  void add(std::uint64_t n = 1) {
+    m_Value.store(m_Value.load(std::memory_order_relaxed) + n,
+                  std::memory_order_relaxed);
+  }
+  std::uint64_t load() const { return m_Value.load(std::memory_order_relaxed); }
+
+private:
+  std::atomic<std::uint64_t> m_Value{0};
+};
+
+// Single-writer counterpart of LatencyHistogram.
+class AtomicHistogram {
+public:
+  void record(std::uint64_t ns) {
+    m_Buckets[LatencyHistogram::bucket_of(ns)].add();
+    m_Count.add();
+    m_Sum.add(ns);
+    if (ns > m_Max.load(std::memory_order_relaxed))
+      m_Max.store(ns, std::memory_order_relaxed);
+  }
+  void merge_into(LatencyHistogram &out) const;
+
+private:
+  std::array<Counter, LatencyHistogram::k_BucketCount> m_Buckets;
+  Counter m_Count;
+  Counter m_Sum;
+  std::atomic<std::uint64_t> m_Max{0};
+};
+
+struct RouteShard {
+  Counter requests;
+  Counter errors;
+  AtomicHistogram latency;
+};
+
+// Metrics recorded by one thread. Shards are never shared between writers,
+// which is what makes the relaxed single-writer updates above safe.
+class MetricsShard {
+public:
+  explicit MetricsShard(size_t route_count)
+      : m_Routes(std::make_unique<RouteShard[]>(route_count)) {}
+
+  RouteShard &route(size_t index) { return m_Routes[index]; }
+  const RouteShard &route(size_t index) const { return m_Routes[index]; }
+
+  Counter connections_accepted;
+  Counter connections_closed;
+  Counter connections_rejected;
+  Counter connections_timed_out;
+  Counter requests;
+  Counter parse_errors;
+  Counter not_found;
+  Counter method_not_allowed;
+  Counter handler_exceptions;
+  Counter tls_handshakes;
+  Counter tls_resumed;
+  Counter tls_handshake_errors;
+  Counter http2_connections;
+  Counter cache_hits;
+  Counter cache_misses;
+  AtomicHistogram parse;
+  AtomicHistogram handler;
+  AtomicHistogram write;
+
+private:
+  std::unique_ptr<RouteShard[]> m_Routes;
+};
+
+// Owns every shard of one Server. Each thread finds its own shard through
+// a thread-local cache, so recording never takes a lock; only the first
+// use on a thread registers (or re-finds) a shard under m_Mutex.
+class MetricsRegistry {
+public:
+  explicit MetricsRegistry(size_t route_count);
+
+  MetricsRegistry(const MetricsRegistry &) = delete;
+  MetricsRegistry &operator=(const MetricsRegistry &) = delete;
+
+  MetricsShard &local();
+  // Sums every shard into `out`, whose routes must already be listed.
+  void collect(ServerMetrics &out) const;
+
+private:
+  MetricsShard &register_thread();
+
+  // Distinguishes registries in the thread-local cache: a freed registry's
+  // address may be reused, its id never is.
+  std::uint64_t m_Id;
+  size_t m_RouteCount;
+  mutable std::mutex m_Mutex;
+  std::vector<std::pair<std::thread::id, std::unique_ptr<MetricsShard>>>
+      m_Shards;
+};
+
+} // namespace http::detail
@@ -0,0 +1,398 @@
+#include "net/http.h"
+#include "scan.h"
+#include <charconv>
+
+namespace http {
+
+namespace {
+using detail::for_each_member;
+using detail::iequals;
+using detail::is_ows;
+using detail::trim_ows;
+
+bool is_hex(char c) {
+  return (c >= '0' && c <= '9') || (c >= 'a' && c <= 'f') ||
+         (c >= 'A' && c <= 'F');
+}
+
+// Longest chunk-size or trailer line accepted before giving up on the peer.
+constexpr size_t k_MaxChunkLine = 4096;
+
+bool is_http1_version(std::string_view v) {
+  return v.size() == 8 && v.substr(0, 7) == "HTTP/1." &&
+         (v[7] == '0' || v[7] == '1');
+}
+} // namespace
+
+void MessageParser::reset() {
+  m_State = EState::StartLine;
+  m_Data = {};
+  m_Pos = 0;
+  m_Scan = 0;
+  m_Method = m_Target = m_Version = m_Reason = Span{};
+  m_StatusCode = 0;
+  m_TooLarge = false;
+  m_Fields.clear();
+  m_Error.clear();
+}
+
+EParseStatus MessageParser::fail(std::string message) {
+  m_State = EState::Failed;
+  m_Error = std::move(message);
+  return EParseStatus::Error;
+}
+
+EParseStatus MessageParser::parse(std::string_view data) {
+  m_Data = data;
+  if (m_State == EState::Done)
+    return EParseStatus::Complete;
+  if (m_State == EState::Failed)
+    return EParseStatus::Error;
+  while (true) {
+    // m_Pos is the start of the current line, m_Scan the first byte not yet
+    // searched for its terminator, so no byte is ever scanned twice.
+    size_t lf = data.find('\n', m_Scan);
+    if (lf == std::string_view::npos) {
+      m_Scan = data.size();
+      if (data.size() > m_MaxHeadSize) {
+        m_TooLarge = true;
+        return fail("Message head too large");
+      }
+      return EParseStatus::NeedMore;
+    }
+    if (lf >= m_MaxHeadSize) {
+      m_TooLarge = true;
+      return fail("Message head too large");
+    }
+    size_t begin = m_Pos;
+    size_t end = lf;
+    if (end > begin && data[end - 1] == '\r')
+      --end;
+    m_Pos = m_Scan = lf + 1;
+    if (m_State == EState::StartLine) {
+      // Tolerate stray empty lines before the start line (RFC 9112 2.2).
+      if (end == begin)
+        continue;
+      if (!parse_start_line(begin, end))
+        return EParseStatus::Error;
+      m_State = EState::Fields;
+      continue;
+    }
+    if (end == begin) {
+      m_State = EState::Done;
+      return EParseStatus::Complete;
+    }
+    if (!parse_field(begin, end))
+      return EParseStatus::Error;
+  }
+}
+
+bool MessageParser::parse_start_line(size_t begin, size_t end) {
+  auto line = m_Data.substr(begin, end - begin);
+  auto span = [begin](size_t from, size_t to) {
+    return Span{static_cast<u32>(begin + from), static_cast<u32>(to - from)};
+  };
+  auto sp1 = line.find(' ');
+  if (sp1 == std::string_view::npos) {
+    fail("Malformed start line");
+    return false;
+  }
+  auto sp2 = line.find(' ', sp1 + 1);
+  if (m_Kind == EKind::Request) {
+    if (sp2 == std::string_view::npos ||
+        line.find(' ', sp2 + 1) != std::string_view::npos) {
+      fail("Malformed request line");
+      return false;
+    }
+    m_Method = span(0, sp1);
+    m_Target = span(sp1 + 1, sp2);
+    m_Version = span(sp2 + 1, line.size());
+    if (!detail::is_token(method()) || m_Target.length == 0 ||
+        !is_http1_version(version())) {
+      fail("Malformed request line");
+      return false;
+    }
+    return true;
+  }
+  if (sp2 == std::string_view::npos)
+    sp2 = line.size();
+  m_Version = span(0, sp1);
+  auto code = line.substr(sp1 + 1, sp2 - sp1 - 1);
+  if (!is_http1_version(version()) || code.size() != 3 ||
+      !std::all_of(code.begin(), code.end(),
+                   [](char c) { return c >= '0' && c <= '9'; })) {
+    fail("Malformed status line");
+    return false;
+  }
+  m_StatusCode =
+      (code[0] - '0') * 100 + (code[1] - '0') * 10 + (code[2] - '0');
+  m_Reason = sp2 < line.size() ? span(sp2 + 1, line.size()) : Span{};
+  return true;
+}
+
+bool MessageParser::parse_field(size_t begin, size_t end) {
+  auto line = m_Data.substr(begin, end - begin);
+  // The name ends at the first byte that is no token character, which has
+  // to be the colon. That rejects obsolete line folding and whitespace
+  // before the colon too.
+  size_t colon = detail::token_length(line);
+  if (colon == 0 || colon == line.size() || line[colon] != ':') {
+    fail("Malformed header field");
+    return false;
+  }
+  size_t value_begin = colon + 1;
+  size_t value_end = line.size();
+  while (value_begin < value_end && is_ows(line[value_begin]))
+    ++value_begin;
+  while (value_end > value_begin && is_ows(line[value_end - 1]))
+    --value_end;
+  Field field;
+  field.name = Span{static_cast<u32>(begin), static_cast<u32>(colon)};
+  field.value = Span{static_cast<u32>(begin + value_begin),
+                     static_cast<u32>(value_end - value_begin)};
+  m_Fields.push_back(field);
+  return true;
+}
+
+std::string_view MessageParser::header(std::string_view name) const {
+  for (const auto &field : m_Fields) {
+    if (iequals(view(field.name), name))
+      return view(field.value);
+  }
+  return {};
+}
+
+bool MessageParser::has_header(std::string_view name) const {
+  for (const auto &field : m_Fields) {
+    if (iequals(view(field.name), name))
+      return true;
+  }
+  return false;
+}
+
+bool MessageParser::has_connection_token(std::string_view token) const {
+  for (const auto &field : m_Fields) {
+    if (!iequals(view(field.name), "connection"))
+      continue;
+    if (detail::has_member(view(field.value), token))
+      return true;
+  }
+  return false;
+}
+
+bool MessageParser::keep_alive() const {
+  if (has_connection_token("close"))
+    return false;
+  if (version() == "HTTP/1.0")
+    return has_connection_token("keep-alive");
+  return true;
+}
+
+bool BodyDecoder::start(const MessageParser &head, bool no_body) {
+  m_Error.clear();
+  m_TooLarge = false;
+  if (no_body) {
+    reset(EMode::None);
+    return true;
+  }
+  bool is_response = head.kind() == MessageParser::EKind::Response;
+  auto te = head.header("transfer-encoding");
+  if (!te.empty()) {
+    // Both framings at once is the classic request smuggling vector.
+    if (head.has_header("content-length")) {
+      fail("Both Content-Length and Transfer-Encoding present");
+      return false;
+    }
+    auto last = te.rfind(',');
+    auto coding = trim_ows(last == std::string_view::npos
+                               ? te
+                               : te.substr(last + 1));
+    if (iequals(coding, "chunked")) {
+      reset(EMode::Chunked);
+      return true;
+    }
+    if (!is_response) {
+      fail("Unsupported transfer coding");
+      return false;
+    }
+    reset(EMode::UntilClose);
+    return true;
+  }
+  if (head.has_header("content-length")) {
+    // Repeated fields, or a list in one, are fine only while every value
+    // is the same; otherwise peers may disagree on where the body ends.
+    std::string_view cl;
+    bool conflicting = false;
+    for (size_t i = 0; i < head.header_count() && !conflicting; ++i) {
+      auto field = head.header_at(i);
+      if (!iequals(field.name, "content-length"))
+        continue;
+      conflicting = for_each_member(field.value, [&cl](std::string_view v) {
+        if (cl.empty())
+          cl = v;
+        return v != cl;
+      });
+    }
+    size_t length = 0;
+    auto [end, ec] =
+        std::from_chars(cl.data(), cl.data() + cl.size(), length);
+    if (conflicting || cl.empty() || ec != std::errc() ||
+        end != cl.data() + cl.size()) {
+      fail("Invalid Content-Length");
+      return false;
+    }
+    if (length > m_MaxBodySize) {
+      m_TooLarge = true;
+      fail("Body too large");
+      return false;
+    }
+    reset(EMode::Length, length);
+    return true;
+  }
+  reset(is_response ? EMode::UntilClose : EMode::None);
+  return true;
+}
+
+void BodyDecoder::reset(EMode mode, size_t content_length) {
+  m_Mode = mode;
+  m_Remaining = content_length;
+  m_BodySize = mode == EMode::Length ? content_length : 0;
+  m_TooLarge = false;
+  m_Error.clear();
+  switch (mode) {
+  case EMode::None:
+    m_State = EState::Done;
+    break;
+  case EMode::Length:
+    m_State = content_length == 0 ? EState::Done : EState::Data;
+    break;
+  case EMode::Chunked:
+    m_State = EState::ChunkSize;
+    break;
+  case EMode::UntilClose:
+    m_State = EState::Data;
+    break;
+  }
+}
+
+EParseStatus BodyDecoder::fail(std::string message) {
+  m_State = EState::Failed;
+  m_Error = std::move(message);
+  return EParseStatus::Error;
+}
+
+bool BodyDecoder::account(size_t bytes) {
+  m_BodySize += bytes;
+  if (m_BodySize > m_MaxBodySize) {
+    m_TooLarge = true;
+    fail("Body too large");
+    return false;
+  }
+  return true;
+}
+
+EParseStatus BodyDecoder::decode(std::string_view data, size_t &consumed,
+                                 const Sink &sink) {
+  consumed = 0;
+  while (true) {
+    size_t available = data.size() - consumed;
+    switch (m_State) {
+    case EState::Done:
+      return EParseStatus::Complete;
+    case EState::Failed:
+      return EParseStatus::Error;
+    case EState::Data: {
+      size_t n = m_Mode == EMode::Length ? std::min(m_Remaining, available)
+                                         : available;
+      if (n == 0)
+        return EParseStatus::NeedMore;
+      if (m_Mode == EMode::UntilClose && !account(n))
+        return EParseStatus::Error;
+      sink(data.substr(consumed, n));
+      consumed += n;
+      if (m_Mode == EMode::UntilClose)
+        return EParseStatus::NeedMore;
+      m_Remaining -= n;
+      if (m_Remaining == 0)
+        m_State = EState::Done;
+      break;
+    }
+    case EState::ChunkSize: {
+      auto lf = data.find('\n', consumed);
+      if (lf == std::string_view::npos) {
+        if (available > k_MaxChunkLine)
+          return fail("Chunk size line too long");
+        return EParseStatus::NeedMore;
+      }
+      auto line = data.substr(consumed, lf - consumed);
+      if (!line.empty() && line.back() == '\r')
+        line.remove_suffix(1);
+      line = trim_ows(line.substr(0, line.find(';')));
+      // 15 hex digits keep the size well inside size_t.
+      if (line.empty() || line.size() > 15 ||
+          !std::all_of(line.begin(), line.end(), is_hex))
+        return fail("Malformed chunk size");
+      size_t size = 0;
+      std::from_chars(line.data(), line.data() + line.size(), size, 16);
+      consumed = lf + 1;
+      if (size == 0) {
+        m_State = EState::Trailer;
+        break;
+      }
+      if (!account(size))
+        return EParseStatus::Error;
+      m_Remaining = size;
+      m_State = EState::ChunkData;
+      break;
+    }
+    case EState::ChunkData: {
+      size_t n = std::min(m_Remaining, available);
+      if (n == 0)
+        return EParseStatus::NeedMore;
+      sink(data.substr(consumed, n));
+      consumed += n;
+      m_Remaining -= n;
+      if (m_Remaining == 0)
+        m_State = EState::ChunkEnd;
+      break;
+    }
+    case EState::ChunkEnd: {
+      if (available == 0 || (available == 1 && data[consumed] == '\r'))
+        return EParseStatus::NeedMore;
+      if (data[consumed] == '\r')
+        ++consumed;
+      if (data[consumed] != '\n')
+        return fail("Malformed chunk terminator");
+      ++consumed;
+      m_State = EState::ChunkSize;
+      break;
+    }
+    case EState::Trailer: {
+      // Trailer fields are skipped; the body ends at the empty line.
+      auto lf = data.find('\n', consumed);
+      if (lf == std::string_view::npos) {
+        if (available > k_MaxChunkLine)
+          return fail("Trailer line too long");
+        return EParseStatus::NeedMore;
+      }
+      auto line = data.substr(consumed, lf - consumed);
+      consumed = lf + 1;
+      if (line.empty() || line == "\r")
+        m_State = EState::Done;
+      break;
+    }
+    }
+  }
+}
+
+EParseStatus BodyDecoder::finish() {
+  if (m_State == EState::Data && m_Mode == EMode::UntilClose)
+    m_State = EState::Done;
+  if (m_State == EState::Done)
+    return EParseStatus::Complete;
+  if (m_State != EState::Failed)
+    fail("Connection closed before the body ended");
+  return EParseStatus::Error;
+}
+
+} // namespace http
@@ -0,0 +1,149 @@
+#include "net/http.h"
+#include "h2.h"
+#include "socket.h"
+#include "tls.h"
+
+namespace http {
+
+ClientPool::~ClientPool() { clear(); }
+
+std::string ClientPool::key_for(const URL &u) {
+  return u.scheme + "://" + u.host + ":" + u.port;
+}
+
+// An idle keep-alive socket must have nothing to read. Readability means
+// the peer hung up or sent bytes no request asked for; over TLS it may
+// also be a session ticket or other record that carries no data.
+static bool is_healthy(detail::Link &link) {
+  if (!detail::wait_readable(link.sock, std::chrono::milliseconds(0)))
+    return true;
+  return link.tls && link.tls->check_idle();
+}
+
+detail::Link ClientPool::acquire(const URL &u) {
+  auto now = std::chrono::steady_clock::now();
+  std::vector<detail::Link> stale;
+  detail::Link link;
+  {
+    std::lock_guard lock(m_Mutex);
+    auto it = m_Idle.find(key_for(u));
+    if (it == m_Idle.end())
+      return link;
+    auto &idle = it->second;
+    // Most recently used first: it is the least likely to have been closed.
+    while (!idle.empty()) {
+      IdleSocket entry = std::move(idle.back());
+      idle.pop_back();
+      if (now - entry.since >= m_Config.idle_timeout ||
+          !is_healthy(entry.link)) {
+        stale.push_back(std::move(entry.link));
+        continue;
+      }
+      link = std::move(entry.link);
+      break;
+    }
+  }
+  for (auto &s : stale)
+    detail::close_socket(s.sock);
+  return link;
+}
+
+void ClientPool::release(const URL &u, detail::Link link) {
+  {
+    std::lock_guard lock(m_Mutex);
+    auto &idle = m_Idle[key_for(u)];
+    if (idle.size() < m_Config.max_idle_per_host) {
+      idle.push_back({std::move(link), std::chrono::steady_clock::now()});
+      return;
+    }
+  }
+  detail::close_socket(link.sock);
+}
+
+std::pair<std::shared_ptr<detail::H2ClientSession>, bool>
+ClientPool::session_for(const URL &u) {
+  using EState = detail::H2ClientSession::EState;
+  // Outlives the lock: a session closes its connection when destroyed.
+  std::shared_ptr<detail::H2ClientSession> spent;
+  std::lock_guard lock(m_Mutex);
+  auto &session = m_Sessions[key_for(u)];
+  // A declined session stays, remembering the server's answer.
+  if (session && !session->accepts_streams() &&
+      session->state() != EState::Declined)
+    spent = std::move(session);
+  if (session)
+    return {session, false};
+  session = std::make_shared<detail::H2ClientSession>(*m_Config.http2);
+  return {session, true};
+}
+
+void ClientPool::forget(
+    const URL &u, const std::shared_ptr<detail::H2ClientSession> &session) {
+  std::shared_ptr<detail::H2ClientSession> spent;
+  std::lock_guard lock(m_Mutex);
+  auto it = m_Sessions.find(key_for(u));
+  if (it != m_Sessions.end() && it->second == session) {
+    spent = std::move(it->second);
+    m_Sessions.erase(it);
+  }
+}
+
+void ClientPool::evict_idle() {
+  auto now = std::chrono::steady_clock::now();
+  std::vector<detail::Link> stale;
+  std::vector<std::shared_ptr<detail::H2ClientSession>> sessions;
+  {
+    std::lock_guard lock(m_Mutex);
+    for (auto it = m_Sessions.begin(); it != m_Sessions.end();) {
+      if (!it->second->is_idle_since(now - m_Config.idle_timeout)) {
+        ++it;
+        continue;
+      }
+      sessions.push_back(std::move(it->second));
+      it = m_Sessions.erase(it);
+    }
+    for (auto it = m_Idle.begin(); it != m_Idle.end();) {
+      auto &idle = it->second;
+      auto keep = std::remove_if(idle.begin(), idle.end(), [&](auto &entry) {
+        if (now - entry.since < m_Config.idle_timeout)
+          return false;
+        stale.push_back(std::move(entry.link));
+        return true;
+      });
+      idle.erase(keep, idle.end());
+      it = idle.empty() ? m_Idle.erase(it) : std::next(it);
+    }
+  }
+  for (auto &s : stale)
+    detail::close_socket(s.sock);
+}
+
+void ClientPool::clear() {
+  std::map<std::string, std::vector<IdleSocket>> idle;
+  std::map<std::string, std::shared_ptr<detail::H2ClientSession>> sessions;
+  {
+    std::lock_guard lock(m_Mutex);
+    idle.swap(m_Idle);
+    sessions.swap(m_Sessions);
+  }
+  for (auto &[key, sockets] : idle) {
+    for (auto &entry : sockets)
+      detail::close_socket(entry.link.sock);
+  }
+}
+
+size_t ClientPool::idle_count() const {
+  std::lock_guard lock(m_Mutex);
+  size_t count = 0;
+  for (auto &[key, sockets] : m_Idle)
+    count += sockets.size();
+  return count;
+}
+
+size_t ClientPool::idle_count(const URL &u) const {
+  std::lock_guard lock(m_Mutex);
+  auto it = m_Idle.find(key_for(u));
+  return it == m_Idle.end() ? 0 : it->second.size();
+}
+
+} // namespace http
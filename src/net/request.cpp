@@ -5,20 +5,64 @@ namespace http {
 Request::Request(http::EMethod m, http::URL u) : method(m), url(std::move(u)) {
   // Set default headers for client requests if scheme/host are present
   if (!url.host.empty()) {
-    headers.set("User-Agent", "cpp-http/1.0");
-    headers.set("Accept", "*/*");
+    headers.set(EHeader::UserAgent, "cpp-http/1.0");
+    headers.set(EHeader::Accept, "*/*");
   }
 }
 
+Request::Request(http::EMethod m, http::URL u,
+                 std::pmr::memory_resource *resource)
+    : method(m), url(std::move(u)), headers(resource) {}
+
 void Request::set_header(std::string_view key, std::string_view value) {
   headers.set(key, value);
 }
 
 void Request::set_body(std::string data) {
   body = std::move(data);
-  if (!headers.has("Content-Length")) {
-    headers.set("Content-Length", std::to_string(body.size()));
+  if (!headers.has(EHeader::ContentLength)) {
+    headers.set(EHeader::ContentLength, std::to_string(body.size()));
+  }
+}
+
+std::string_view RouteParams::get(std::string_view name) const {
+  for (const auto &param : *this) {
+    if (param.name == name)
+      return param.value;
+  }
+  return {};
+}
+
+bool RouteParams::has(std::string_view name) const {
+  for (const auto &param : *this) {
+    if (param.name == name)
+      return true;
+  }
+  return false;
+}
+
+bool RouteParams::set(std::string_view name, std::string_view value) {
+  for (size_t i = 0; i < m_Size; ++i) {
+    if (m_Params[i].name == name) {
+      m_Params[i].value = value;
+      return true;
+    }
+  }
+  if (m_Size == k_Capacity)
+    return false;
+  m_Params[m_Size++] = {name, value};
+  return true;
+}
+
+void RouteParams::rebase(std::string_view from, std::string_view to) {
+  auto begin = reinterpret_cast<std::uintptr_t>(from.data());
+  for (size_t i = 0; i < m_Size; ++i) {
+    auto &value = m_Params[i].value;
+    auto at = reinterpret_cast<std::uintptr_t>(value.data());
+    if (value.empty() || at < begin || at + value.size() > begin + from.size())
+      continue;
+    value = to.substr(at - begin, value.size());
   }
 }
 
-} // namespace http
\ No newline at end of file
+} // namespace http
@@ -0,0 +1,139 @@
+#include "resolver.h"
+#include <cstring>
+
+namespace http::detail {
+
+// Alternates address families, starting with the one the resolver ranked
+// first, so a broken IPv6 (or IPv4) path only costs one attempt before the
+// other family is tried.
+static Endpoints interleave(Endpoints endpoints) {
+  if (endpoints.empty())
+    return endpoints;
+  i32 first_family = endpoints.front().family;
+  Endpoints primary, secondary, ordered;
+  for (auto &endpoint : endpoints) {
+    (endpoint.family == first_family ? primary : secondary)
+        .push_back(endpoint);
+  }
+  ordered.reserve(endpoints.size());
+  for (size_t i = 0; i < primary.size() || i < secondary.size(); ++i) {
+    if (i < primary.size())
+      ordered.push_back(primary[i]);
+    if (i < secondary.size())
+      ordered.push_back(secondary[i]);
+  }
+  return ordered;
+}
+
+static bool same_address(const Endpoint &a, const Endpoint &b) {
+  return a.length == b.length &&
+         std::memcmp(&a.address, &b.address, a.length) == 0;
+}
+
+DnsCache &DnsCache::instance() {
+  static DnsCache cache;
+  return cache;
+}
+
+void DnsCache::configure(DnsCacheConfig config) {
+  std::lock_guard lock(m_Mutex);
+  m_Config = config;
+  m_Entries.clear();
+}
+
+void DnsCache::clear() {
+  std::lock_guard lock(m_Mutex);
+  m_Entries.clear();
+}
+
+size_t DnsCache::size() const {
+  std::lock_guard lock(m_Mutex);
+  return m_Entries.size();
+}
+
+stl::result<std::shared_ptr<const Endpoints>>
+DnsCache::resolve(const std::string &host, const std::string &port,
+                  bool *cached) {
+  using Result = std::shared_ptr<const Endpoints>;
+  std::string key = host + ":" + port;
+  {
+    std::lock_guard lock(m_Mutex);
+    auto it = m_Entries.find(key);
+    if (it != m_Entries.end() && Clock::now() < it->second.expires) {
+      if (cached)
+        *cached = true;
+      if (it->second.endpoints)
+        return it->second.endpoints;
+      return stl::make_error<Result>(it->second.error);
+    }
+  }
+
+  // Resolve outside the lock so a slow lookup does not stall other hosts.
+  struct addrinfo hints{}, *res = nullptr;
+  std::memset(&hints, 0, sizeof(hints));
+  hints.ai_family = AF_UNSPEC;
+  hints.ai_socktype = SOCK_STREAM;
+  i32 gai_result = getaddrinfo(host.c_str(), port.c_str(), &hints, &res);
+  if (gai_result != 0) {
+#ifdef _WIN32
+    std::string error = "Failed to resolve host " + host + ": " +
+                        std::to_string(WSAGetLastError());
+#else
+    std::string error = "Failed to resolve host " + host + ": " +
+                        std::string(gai_strerror(gai_result));
+#endif
+    store(std::move(key), {nullptr, error, {}});
+    return stl::make_error<Result>(error);
+  }
+  Endpoints endpoints;
+  for (auto *rp = res; rp != nullptr; rp = rp->ai_next) {
+    if (rp->ai_addrlen > sizeof(sockaddr_storage))
+      continue;
+    Endpoint endpoint;
+    std::memcpy(&endpoint.address, rp->ai_addr, rp->ai_addrlen);
+    endpoint.length = static_cast<socklen_t>(rp->ai_addrlen);
+    endpoint.family = rp->ai_family;
+    endpoint.socktype = rp->ai_socktype;
+    endpoint.protocol = rp->ai_protocol;
+    endpoints.push_back(endpoint);
+  }
+  freeaddrinfo(res);
+  auto shared =
+      std::make_shared<const Endpoints>(interleave(std::move(endpoints)));
+  store(std::move(key), {shared, {}, {}});
+  return shared;
+}
+
+void DnsCache::prefer(const std::string &host, const std::string &port,
+                      const Endpoint &endpoint) {
+  std::lock_guard lock(m_Mutex);
+  auto it = m_Entries.find(host + ":" + port);
+  if (it == m_Entries.end() || !it->second.endpoints)
+    return;
+  Endpoints reordered{endpoint};
+  for (auto &other : *it->second.endpoints) {
+    if (!same_address(other, endpoint))
+      reordered.push_back(other);
+  }
+  it->second.endpoints =
+      std::make_shared<const Endpoints>(std::move(reordered));
+}
+
+void DnsCache::store(std::string key, Entry entry) {
+  std::lock_guard lock(m_Mutex);
+  if (m_Config.max_entries == 0)
+    return;
+  auto now = Clock::now();
+  entry.expires =
+      now + (entry.endpoints ? m_Config.ttl : m_Config.negative_ttl);
+  if (m_Entries.size() >= m_Config.max_entries && !m_Entries.count(key)) {
+    for (auto it = m_Entries.begin(); it != m_Entries.end();) {
+      it = now >= it->second.expires ? m_Entries.erase(it) : std::next(it);
+    }
+    if (m_Entries.size() >= m_Config.max_entries)
+      m_Entries.erase(m_Entries.begin());
+  }
+  m_Entries[std::move(key)] = std::move(entry);
+}
+
+} // namespace http::detail
@@ -0,0 +1,57 @@
+#pragma once
+
+#include "net/http.h"
+#include "socket.h"
+#include <memory>
+#include <unordered_map>
+
+namespace http::detail {
+
+struct Endpoint {
+  sockaddr_storage address{};
+  socklen_t length{0};
+  i32 family{0};
+  i32 socktype{0};
+  i32 protocol{0};
+};
+
+using Endpoints = std::vector<Endpoint>;
+
+// Process-wide cache of getaddrinfo results keyed by host:port. Entries are
+// immutable snapshots, so callers can iterate them without holding the lock.
+class DnsCache {
+public:
+  static DnsCache &instance();
+
+  void configure(DnsCacheConfig config);
+  void clear();
+  size_t size() const;
+
+  // Sets `*cached` when the answer came from the cache.
+  stl::result<std::shared_ptr<const Endpoints>>
+  resolve(const std::string &host, const std::string &port,
+          bool *cached = nullptr);
+
+  // Moves `endpoint` to the front of the cached list after an earlier
+  // address failed to connect, so later lookups try it first.
+  void prefer(const std::string &host, const std::string &port,
+              const Endpoint &endpoint);
+
+private:
+  using Clock = std::chrono::steady_clock;
+
+  struct Entry {
+    std::shared_ptr<const Endpoints> endpoints;
+    std::string error;
+    Clock::time_point expires;
+  };
+
+  // Stamps the expiry from the current config; failures use negative_ttl.
+  void store(std::string key, Entry entry);
+
+  DnsCacheConfig m_Config;
+  mutable std::mutex m_Mutex;
+  std::unordered_map<std::string, Entry> m_Entries;
+};
+
+} // namespace http::detail
@@ -3,7 +3,7 @@
 namespace http {
 Response::Response(i32 code, std::string body_content)
     : status_code(code), body(std::move(body_content)) {
-  headers.set("Content-Length", std::to_string(body.size()));
-  headers.set("Content-Type", "text/plain");
+  headers.set(EHeader::ContentLength, std::to_string(body.size()));
+  headers.set(EHeader::ContentType, "text/plain");
 }
 } // namespace http
\ No newline at end of file
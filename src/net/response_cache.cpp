@@ -0,0 +1,236 @@
+#include "response_cache.h"
+#include "scan.h"
+#include "wire.h"
+#include <charconv>
+
+namespace http::detail {
+
+namespace {
+constexpr std::int64_t k_MaxAge = std::int64_t{1} << 31;
+
+// The Cache-Control directives the cache acts on (RFC 9111 section 5.2).
+struct CacheControl {
+  bool no_store{false};
+  bool no_cache{false};
+  bool is_private{false};
+  std::optional<std::int64_t> max_age;
+  std::optional<std::int64_t> s_maxage;
+};
+
+// A malformed delta-seconds counts as zero, which makes the response
+// stale at once.
+std::int64_t delta_seconds(std::string_view text) {
+  if (text.size() >= 2 && text.front() == '"' && text.back() == '"')
+    text = text.substr(1, text.size() - 2);
+  std::int64_t seconds = 0;
+  auto [end, ec] =
+      std::from_chars(text.data(), text.data() + text.size(), seconds);
+  if (ec != std::errc{} || end != text.data() + text.size() || seconds < 0)
+    return 0;
+  return seconds;
+}
+
+CacheControl parse_cache_control(std::string_view value) {
+  CacheControl control;
+  for_each_member(value, [&control](std::string_view directive) {
+    size_t eq = std::min(directive.find('='), directive.size());
+    auto name = trim_ows(directive.substr(0, eq));
+    auto argument = eq < directive.size()
+                        ? trim_ows(directive.substr(eq + 1))
+                        : std::string_view{};
+    // The qualified forms, such as no-cache="Set-Cookie", are taken to
+    // cover the whole response.
+    if (iequals(name, "no-store"))
+      control.no_store = true;
+    else if (iequals(name, "no-cache"))
+      control.no_cache = true;
+    else if (iequals(name, "private"))
+      control.is_private = true;
+    else if (iequals(name, "max-age"))
+      control.max_age = delta_seconds(argument);
+    else if (iequals(name, "s-maxage"))
+      control.s_maxage = delta_seconds(argument);
+  });
+  return control;
+}
+
+// Statuses that may be cached without explicit freshness (RFC 9110
+// section 15.1), less those about the request rather than the resource.
+bool is_cacheable_status(i32 status) {
+  switch (status) {
+  case 200:
+  case 203:
+  case 204:
+  case 300:
+  case 301:
+  case 308:
+  case 404:
+  case 410:
+    return true;
+  default:
+    return false;
+  }
+}
+} // namespace
+
+ResponseCache::ResponseCache(ResponseCacheConfig config)
+    : m_Config(std::move(config)),
+      m_ShardCount(std::max<size_t>(m_Config.shards, 1)),
+      m_ShardBytes(m_Config.max_bytes / m_ShardCount),
+      m_Shards(std::make_unique<Shard[]>(m_ShardCount)) {}
+
+std::string ResponseCache::key_of(const Request &req, bool &lookup) const {
+  // A shared cache must not answer one user with another's response
+  // (RFC 9111 section 3.5).
+  if (req.method != EMethod::GET || req.headers.has("authorization"))
+    return {};
+  auto control = parse_cache_control(req.headers.get("cache-control"));
+  if (control.no_store)
+    return {};
+  lookup = !control.no_cache && control.max_age.value_or(1) != 0;
+  std::string key;
+  key.append(req.headers.get(EHeader::Host));
+  key.push_back(' ');
+  key.append(req.url.path);
+  key.append(req.url.query);
+  for (const auto &name : m_Config.vary_headers) {
+    key.push_back('\n');
+    key.append(req.headers.get(name));
+  }
+  return key;
+}
+
+ResponseCache::Shard &ResponseCache::shard_of(const std::string &key) const {
+  return m_Shards[std::hash<std::string>{}(key) % m_ShardCount];
+}
+
+ResponseCache::Entry ResponseCache::claim(Shard &shard,
+                                          const std::string &key, bool lookup,
+                                          bool &lead,
+                                          std::shared_ptr<Flight> &flight) {
+  lead = false;
+  if (lookup) {
+    auto it = shard.index.find(key);
+    if (it != shard.index.end()) {
+      if (it->second->second->expires > Clock::now()) {
+        shard.lru.splice(shard.lru.begin(), shard.lru, it->second);
+        return it->second->second;
+      }
+      erase(shard, it->second);
+    }
+  }
+  auto found = shard.flights.find(key);
+  if (found == shard.flights.end()) {
+    shard.flights.emplace(key, std::make_shared<Flight>());
+    lead = true;
+    return nullptr;
+  }
+  // Someone is producing a response already; a request that wants a fresh
+  // one runs its own handler rather than waiting for it.
+  if (lookup)
+    flight = found->second;
+  return nullptr;
+}
+
+ResponseCache::Entry ResponseCache::acquire(const std::string &key,
+                                            bool lookup, bool &lead) {
+  auto &shard = shard_of(key);
+  std::unique_lock lock(shard.mutex);
+  std::shared_ptr<Flight> waiting;
+  auto entry = claim(shard, key, lookup, lead, waiting);
+  if (!waiting)
+    return entry;
+  shard.landed.wait(lock, [&waiting]() { return waiting->done; });
+  return waiting->entry;
+}
+
+ResponseCache::Entry ResponseCache::acquire(const std::string &key,
+                                            bool lookup, bool &lead,
+                                            const std::function<void()> &wake,
+                                            bool &parked) {
+  auto &shard = shard_of(key);
+  std::lock_guard lock(shard.mutex);
+  std::shared_ptr<Flight> waiting;
+  auto entry = claim(shard, key, lookup, lead, waiting);
+  parked = waiting != nullptr;
+  if (parked)
+    waiting->parked.push_back(wake);
+  return entry;
+}
+
+void ResponseCache::complete(const std::string &key, const Response *resp) {
+  Entry entry;
+  if (resp && resp->body.size() <= m_Config.max_entry_bytes) {
+    auto ttl = ttl_of(*resp);
+    if (ttl > Clock::duration::zero()) {
+      auto cached = std::make_shared<CachedResponse>();
+      append_head(cached->head, *resp);
+      cached->response = *resp;
+      cached->expires = Clock::now() + ttl;
+      if (cached->size() <= std::min(m_Config.max_entry_bytes, m_ShardBytes))
+        entry = std::move(cached);
+    }
+  }
+  auto &shard = shard_of(key);
+  std::vector<std::function<void()>> parked;
+  {
+    std::lock_guard lock(shard.mutex);
+    if (entry)
+      insert(shard, key, entry);
+    auto flight = shard.flights.find(key);
+    if (flight != shard.flights.end()) {
+      flight->second->done = true;
+      flight->second->entry = std::move(entry);
+      parked.swap(flight->second->parked);
+      shard.flights.erase(flight);
+    }
+  }
+  shard.landed.notify_all();
+  for (auto &wake : parked)
+    wake();
+}
+
+ResponseCache::Clock::duration
+ResponseCache::ttl_of(const Response &resp) const {
+  if (!is_cacheable_status(resp.status_code) || resp.file ||
+      resp.headers.has("set-cookie") || resp.headers.has(EHeader::Connection))
+    return {};
+  auto control = parse_cache_control(resp.headers.get("cache-control"));
+  if (control.no_store || control.no_cache || control.is_private)
+    return {};
+  // Only the request headers in the key can tell the variants apart.
+  bool unkeyed =
+      for_each_member(resp.headers.get("vary"), [&](std::string_view name) {
+        return std::none_of(m_Config.vary_headers.begin(),
+                            m_Config.vary_headers.end(),
+                            [name](const std::string &header) {
+                              return iequals(header, name);
+                            });
+      });
+  if (unkeyed)
+    return {};
+  auto age = control.s_maxage ? control.s_maxage : control.max_age;
+  if (!age)
+    return m_Config.default_ttl;
+  // RFC 9111 section 1.2.2 caps delta-seconds at 2^31.
+  return std::chrono::seconds(std::min<std::int64_t>(*age, k_MaxAge));
+}
+
+void ResponseCache::insert(Shard &shard, const std::string &key,
+                           Entry entry) {
+  if (auto it = shard.index.find(key); it != shard.index.end())
+    erase(shard, it->second);
+  shard.bytes += entry->size();
+  shard.lru.emplace_front(key, std::move(entry));
+  shard.index.emplace(key, shard.lru.begin());
+  while (shard.bytes > m_ShardBytes)
+    erase(shard, std::prev(shard.lru.end()));
+}
+
+void ResponseCache::erase(Shard &shard, Lru::iterator it) {
+  shard.bytes -= it->second->size();
+  shard.index.erase(it->first);
+  shard.lru.erase(it);
+}
+
+} // namespace http::detail
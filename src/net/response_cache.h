@@ -0,0 +1,92 @@
+#pragma once
+
+#include "net/http.h"
+#include <condition_variable>
+#include <functional>
+#include <list>
+#include <unordered_map>
+
+namespace http::detail {
+
+// A response as the cache keeps it. `head` is its status line and fields,
+// serialized; only Connection and the empty line after it are missing,
+// since they depend on the exchange. HTTP/2 streams are answered from
+// `response`.
+struct CachedResponse {
+  std::string head;
+  Response response;
+  std::chrono::steady_clock::time_point expires;
+
+  size_t size() const { return head.size() + response.body.size(); }
+};
+
+// Responses to GET requests by host, path, query and the configured request
+// headers. Keys are spread over shards, each with its own lock, byte budget
+// and least recently used order.
+//
+// A miss makes the request the one to produce the response for its key:
+// others arriving for the key meanwhile wait for it instead of running the
+// handler too, then share the stored response or, if it could not be
+// stored, run the handler themselves. Event-loop threads must not block on
+// a handler running elsewhere, so they park the request instead and retry
+// it once woken.
+class ResponseCache {
+public:
+  using Clock = std::chrono::steady_clock;
+  using Entry = std::shared_ptr<const CachedResponse>;
+
+  explicit ResponseCache(ResponseCacheConfig config);
+
+  // The key of `req`, or an empty string when it bypasses the cache.
+  // `lookup` is cleared for requests that want a fresh response
+  // (no-cache, max-age=0), which may still be stored.
+  std::string key_of(const Request &req, bool &lookup) const;
+
+  // The fresh response stored for `key`, waiting for one in the making.
+  // nullptr when there is none; `lead` is then set if the caller is to
+  // produce it, and must call complete() once it has.
+  Entry acquire(const std::string &key, bool lookup, bool &lead);
+  // As acquire(), but rather than waiting returns nullptr with `parked`
+  // set. `wake` is then called, from the thread completing the response,
+  // and the caller acquires again.
+  Entry acquire(const std::string &key, bool lookup, bool &lead,
+                const std::function<void()> &wake, bool &parked);
+  // Stores `resp`, when it may be cached, and releases the requests
+  // waiting for `key`. `resp` is nullptr when there was nothing to store.
+  void complete(const std::string &key, const Response *resp);
+
+private:
+  // A response being produced for a key.
+  struct Flight {
+    bool done{false};
+    Entry entry;
+    std::vector<std::function<void()>> parked;
+  };
+  using Lru = std::list<std::pair<std::string, Entry>>;
+  struct Shard {
+    mutable std::mutex mutex;
+    std::condition_variable landed;
+    size_t bytes{0};
+    Lru lru;
+    std::unordered_map<std::string, Lru::iterator> index;
+    std::unordered_map<std::string, std::shared_ptr<Flight>> flights;
+  };
+
+  Shard &shard_of(const std::string &key) const;
+  // The stored response; else the caller leads, or `flight` is set to the
+  // one to wait for. Called with the shard's lock held.
+  Entry claim(Shard &shard, const std::string &key, bool lookup, bool &lead,
+              std::shared_ptr<Flight> &flight);
+  // How long `resp` may be kept; zero when it may not be stored at all.
+  Clock::duration ttl_of(const Response &resp) const;
+  // Called with the shard's lock held.
+  void insert(Shard &shard, const std::string &key, Entry entry);
+  void erase(Shard &shard, Lru::iterator it);
+
+  ResponseCacheConfig m_Config;
+  size_t m_ShardCount;
+  size_t m_ShardBytes;
+  std::unique_ptr<Shard[]> m_Shards;
+};
+
+} // namespace http::detail
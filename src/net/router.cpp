@@ -0,0 +1,188 @@
+#include "router.h"
+
+namespace http::detail {
+
+namespace {
+constexpr i32 k_NoRoute = -1;
+
+size_t common_prefix(std::string_view a, std::string_view b) {
+  size_t n = 0;
+  while (n < a.size() && n < b.size() && a[n] == b[n])
+    ++n;
+  return n;
+}
+} // namespace
+
+struct Router::Node {
+  // Static text matched on entry; empty for the root and parameter nodes.
+  std::string prefix;
+  // Parameter name for `:name` and `*name` nodes.
+  std::string name;
+  // First character of each static child, in the same order as `children`.
+  std::string indices;
+  std::vector<std::unique_ptr<Node>> children;
+  std::unique_ptr<Node> param;
+  std::unique_ptr<Node> wildcard;
+  std::array<i32, k_MethodCount> routes;
+  u32 allowed{0};
+
+  Node() { routes.fill(k_NoRoute); }
+};
+
+struct Router::Lookup {
+  EMethod method{EMethod::GET};
+  RouteParam captures[RouteParams::k_Capacity];
+  size_t depth{0};
+  i32 route{k_NoRoute};
+  // Methods of the first path match that lacked the requested method.
+  u32 allowed{0};
+};
+
+Router::Router() : m_Root(std::make_unique<Node>()) {}
+
+Router::~Router() = default;
+
+stl::result<> Router::add(std::string_view pattern, EMethod method,
+                          size_t route) {
+  if (pattern.empty() || pattern.front() != '/') {
+    return stl::make_error<>("Route must start with '/': " +
+                             std::string(pattern));
+  }
+  Node *node = m_Root.get();
+  size_t params = 0;
+  std::string_view rest = pattern;
+  while (!rest.empty()) {
+    // Static text runs up to a ':' or '*' that opens a segment.
+    size_t pos = 0;
+    while (pos < rest.size() &&
+           !((rest[pos] == ':' || rest[pos] == '*') && pos > 0 &&
+             rest[pos - 1] == '/')) {
+      ++pos;
+    }
+    node = descend(node, rest.substr(0, pos));
+    rest.remove_prefix(pos);
+    if (rest.empty())
+      break;
+    bool is_wildcard = rest.front() == '*';
+    size_t end = std::min(rest.find('/'), rest.size());
+    std::string_view name = rest.substr(1, end - 1);
+    if (name.empty()) {
+      return stl::make_error<>("Route parameter needs a name: " +
+                               std::string(pattern));
+    }
+    if (is_wildcard && end != rest.size()) {
+      return stl::make_error<>("Wildcard must end the route: " +
+                               std::string(pattern));
+    }
+    if (++params > RouteParams::k_Capacity) {
+      return stl::make_error<>("Too many route parameters: " +
+                               std::string(pattern));
+    }
+    auto &slot = is_wildcard ? node->wildcard : node->param;
+    if (!slot) {
+      slot = std::make_unique<Node>();
+      slot->name = name;
+    } else if (slot->name != name) {
+      return stl::make_error<>("Conflicting parameter name in route: " +
+                               std::string(pattern));
+    }
+    node = slot.get();
+    rest.remove_prefix(end);
+  }
+  auto index = static_cast<size_t>(method);
+  if (node->routes[index] == k_NoRoute) {
+    node->routes[index] = static_cast<i32>(route);
+    node->allowed |= method_bit(method);
+  }
+  return stl::result_success();
+}
+
+// Walks static children for `text`, creating or splitting nodes so that
+// the returned node ends exactly after it.
+Router::Node *Router::descend(Node *node, std::string_view text) {
+  while (!text.empty()) {
+    size_t i = node->indices.find(text.front());
+    if (i == std::string::npos) {
+      auto child = std::make_unique<Node>();
+      child->prefix = text;
+      node->indices.push_back(text.front());
+      node->children.push_back(std::move(child));
+      return node->children.back().get();
+    }
+    auto &slot = node->children[i];
+    size_t common = common_prefix(slot->prefix, text);
+    if (common < slot->prefix.size()) {
+      auto split = std::make_unique<Node>();
+      split->prefix = slot->prefix.substr(0, common);
+      slot->prefix.erase(0, common);
+      split->indices.push_back(slot->prefix.front());
+      split->children.push_back(std::move(slot));
+      slot = std::move(split);
+    }
+    node = slot.get();
+    text.remove_prefix(common);
+  }
+  return node;
+}
+
+bool Router::search(const Node *node, std::string_view path, Lookup &state) {
+  auto index = static_cast<size_t>(state.method);
+  if (path.empty() && node->allowed != 0) {
+    if (node->routes[index] != k_NoRoute) {
+      state.route = node->routes[index];
+      return true;
+    }
+    if (state.allowed == 0)
+      state.allowed = node->allowed;
+  }
+  if (!path.empty()) {
+    size_t i = node->indices.find(path.front());
+    if (i != std::string::npos) {
+      const Node *child = node->children[i].get();
+      if (path.substr(0, child->prefix.size()) == child->prefix &&
+          search(child, path.substr(child->prefix.size()), state)) {
+        return true;
+      }
+    }
+    if (node->param && path.front() != '/' &&
+        state.depth < RouteParams::k_Capacity) {
+      size_t end = std::min(path.find('/'), path.size());
+      state.captures[state.depth++] = {node->param->name, path.substr(0, end)};
+      if (search(node->param.get(), path.substr(end), state))
+        return true;
+      --state.depth;
+    }
+  }
+  if (node->wildcard) {
+    const Node *wildcard = node->wildcard.get();
+    if (wildcard->routes[index] != k_NoRoute &&
+        state.depth < RouteParams::k_Capacity) {
+      state.captures[state.depth++] = {wildcard->name, path};
+      state.route = wildcard->routes[index];
+      return true;
+    }
+    if (state.allowed == 0)
+      state.allowed = wildcard->allowed;
+  }
+  return false;
+}
+
+Router::Match Router::find(std::string_view path, EMethod method,
+                           RouteParams &params) const {
+  Lookup state;
+  state.method = method;
+  Match match;
+  if (search(m_Root.get(), path, state)) {
+    match.kind = EMatch::Found;
+    match.route = static_cast<size_t>(state.route);
+    params.clear();
+    for (size_t i = 0; i < state.depth; ++i)
+      params.set(state.captures[i].name, state.captures[i].value);
+  } else if (state.allowed != 0) {
+    match.kind = EMatch::MethodNotAllowed;
+    match.allowed = state.allowed;
+  }
+  return match;
+}
+
+} // namespace http::detail
@@ -0,0 +1,47 @@
+#pragma once
+
+#include "net/http.h"
+#include <array>
+#include <memory>
+
+namespace http::detail {
+
+// Compressed radix tree over route patterns. Static text is shared between
+// routes character by character; `:name` matches one path segment and a
+// trailing `*name` matches the rest. Every node carries a per-method table,
+// so a path that exists under another method is answered with 405 without
+// revisiting the routes. Lookups prefer static text over parameters over
+// wildcards and backtrack when a branch dead-ends.
+class Router {
+public:
+  enum class EMatch { Found, MethodNotAllowed, NotFound };
+
+  struct Match {
+    EMatch kind{EMatch::NotFound};
+    // Index passed to add() for the matched route.
+    size_t route{0};
+    // method_bit() mask of the methods the path is registered under.
+    u32 allowed{0};
+  };
+
+  Router();
+  ~Router();
+
+  // Registers `pattern` under `method`. The first registration of a
+  // pattern/method pair wins. Fails on malformed patterns and on parameters
+  // whose names conflict at the same position.
+  stl::result<> add(std::string_view pattern, EMethod method, size_t route);
+
+  Match find(std::string_view path, EMethod method, RouteParams &params) const;
+
+private:
+  struct Node;
+  struct Lookup;
+
+  static Node *descend(Node *node, std::string_view text);
+  static bool search(const Node *node, std::string_view path, Lookup &state);
+
+  std::unique_ptr<Node> m_Root;
+};
+
+} // namespace http::detail
@@ -0,0 +1,277 @@
+#include "scan.h"
+#include <array>
+#include <bit>
+#include <cstdint>
+
+#if !defined(SAP_HTTP_NO_SIMD) && (defined(__GNUC__) || defined(__clang__)) && \
+    (defined(__x86_64__) || defined(__i386__))
+#define SAP_HTTP_SCAN_X86 1
+#include <immintrin.h>
+#elif !defined(SAP_HTTP_NO_SIMD) && defined(__aarch64__) && defined(__ARM_NEON)
+#define SAP_HTTP_SCAN_NEON 1
+#include <arm_neon.h>
+#endif
+
+namespace http::detail {
+
+namespace {
+// RFC 9110 token characters.
+constexpr bool is_tchar(u8 c) {
+  if ((c >= '0' && c <= '9') || (c >= 'a' && c <= 'z') ||
+      (c >= 'A' && c <= 'Z'))
+    return true;
+  return std::string_view("!#$%&'*+-.^_`|~").find(static_cast<char>(c)) !=
+         std::string_view::npos;
+}
+
+constexpr std::array<bool, 256> k_Token = [] {
+  std::array<bool, 256> table{};
+  for (u32 c = 0; c < 256; ++c)
+    table[c] = is_tchar(static_cast<u8>(c));
+  return table;
+}();
+
+// The token characters split by nibble, for byte shuffles: `c` is one
+// exactly when k_LowNibble[c & 15] & k_HighNibble[c >> 4] is not zero.
+// They are all ASCII, so a high nibble of 8 or more has no bit.
+constexpr std::array<u8, 16> k_HighNibble = [] {
+  std::array<u8, 16> table{};
+  for (u32 high = 0; high < 8; ++high)
+    table[high] = static_cast<u8>(1u << high);
+  return table;
+}();
+
+constexpr std::array<u8, 16> k_LowNibble = [] {
+  std::array<u8, 16> table{};
+  for (u32 c = 0; c < 128; ++c) {
+    if (k_Token[c])
+      table[c & 15] |= k_HighNibble[c >> 4];
+  }
+  return table;
+}();
+
+// Every kernel looks at `n` bytes from `p` and returns the offset it
+// stopped at, `n` when it ran off the end.
+struct Kernels {
+  const char *name;
+  size_t (*find_either)(const char *p, size_t n, char a, char b);
+  size_t (*token_length)(const char *p, size_t n);
+  void (*lower)(const char *in, size_t n, char *out);
+};
+
+size_t find_either_scalar(const char *p, size_t n, char a, char b) {
+  size_t i = 0;
+  while (i < n && p[i] != a && p[i] != b)
+    ++i;
+  return i;
+}
+
+size_t token_length_scalar(const char *p, size_t n) {
+  size_t i = 0;
+  while (i < n && k_Token[static_cast<u8>(p[i])])
+    ++i;
+  return i;
+}
+
+void lower_scalar(const char *in, size_t n, char *out) {
+  for (size_t i = 0; i < n; ++i)
+    out[i] = ascii_lower(in[i]);
+}
+
+#if defined(SAP_HTTP_SCAN_X86)
+// SSE4.2 implies the SSSE3 byte shuffle the token check is built on.
+__attribute__((target("sse4.2"))) size_t
+find_either_sse(const char *p, size_t n, char a, char b) {
+  __m128i va = _mm_set1_epi8(a);
+  __m128i vb = _mm_set1_epi8(b);
+  size_t i = 0;
+  for (; i + 16 <= n; i += 16) {
+    __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i *>(p + i));
+    auto hits = static_cast<u32>(_mm_movemask_epi8(
+        _mm_or_si128(_mm_cmpeq_epi8(v, va), _mm_cmpeq_epi8(v, vb))));
+    if (hits)
+      return i + std::countr_zero(hits);
+  }
+  return i + find_either_scalar(p + i, n - i, a, b);
+}
+
+__attribute__((target("sse4.2"))) size_t token_length_sse(const char *p,
+                                                          size_t n) {
+  __m128i low = _mm_loadu_si128(
+      reinterpret_cast<const __m128i *>(k_LowNibble.data()));
+  __m128i high = _mm_loadu_si128(
+      reinterpret_cast<const __m128i *>(k_HighNibble.data()));
+  __m128i nibble = _mm_set1_epi8(0x0f);
+  size_t i = 0;
+  for (; i + 16 <= n; i += 16) {
+    __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i *>(p + i));
+    __m128i bits = _mm_and_si128(
+        _mm_shuffle_epi8(low, _mm_and_si128(v, nibble)),
+        _mm_shuffle_epi8(high, _mm_and_si128(_mm_srli_epi16(v, 4), nibble)));
+    auto misses = static_cast<u32>(
+        _mm_movemask_epi8(_mm_cmpeq_epi8(bits, _mm_setzero_si128())));
+    if (misses)
+      return i + std::countr_zero(misses);
+  }
+  return i + token_length_scalar(p + i, n - i);
+}
+
+__attribute__((target("sse4.2"))) void lower_sse(const char *in, size_t n,
+                                                 char *out) {
+  // Signed compares: bytes from 0x80 up are negative and stay as they are.
+  __m128i before_a = _mm_set1_epi8('A' - 1);
+  __m128i after_z = _mm_set1_epi8('Z' + 1);
+  __m128i bit = _mm_set1_epi8(0x20);
+  size_t i = 0;
+  for (; i + 16 <= n; i += 16) {
+    __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i *>(in + i));
+    __m128i upper = _mm_and_si128(_mm_cmpgt_epi8(v, before_a),
+                                  _mm_cmplt_epi8(v, after_z));
+    _mm_storeu_si128(reinterpret_cast<__m128i *>(out + i),
+                     _mm_add_epi8(v, _mm_and_si128(upper, bit)));
+  }
+  lower_scalar(in + i, n - i, out + i);
+}
+
+__attribute__((target("avx2"))) size_t
+find_either_avx2(const char *p, size_t n, char a, char b) {
+  __m256i va = _mm256_set1_epi8(a);
+  __m256i vb = _mm256_set1_epi8(b);
+  size_t i = 0;
+  for (; i + 32 <= n; i += 32) {
+    __m256i v = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(p + i));
+    auto hits = static_cast<u32>(_mm256_movemask_epi8(
+        _mm256_or_si256(_mm256_cmpeq_epi8(v, va), _mm256_cmpeq_epi8(v, vb))));
+    if (hits)
+      return i + std::countr_zero(hits);
+  }
+  return i + find_either_sse(p + i, n - i, a, b);
+}
+
+__attribute__((target("avx2"))) size_t token_length_avx2(const char *p,
+                                                         size_t n) {
+  // The shuffle works within each 128-bit lane, so both get the tables.
+  __m256i low = _mm256_broadcastsi128_si256(_mm_loadu_si128(
+      reinterpret_cast<const __m128i *>(k_LowNibble.data())));
+  __m256i high = _mm256_broadcastsi128_si256(_mm_loadu_si128(
+      reinterpret_cast<const __m128i *>(k_HighNibble.data())));
+  __m256i nibble = _mm256_set1_epi8(0x0f);
+  size_t i = 0;
+  for (; i + 32 <= n; i += 32) {
+    __m256i v = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(p + i));
+    __m256i bits = _mm256_and_si256(
+        _mm256_shuffle_epi8(low, _mm256_and_si256(v, nibble)),
+        _mm256_shuffle_epi8(high,
+                            _mm256_and_si256(_mm256_srli_epi16(v, 4), nibble)));
+    auto misses = static_cast<u32>(_mm256_movemask_epi8(
+        _mm256_cmpeq_epi8(bits, _mm256_setzero_si256())));
+    if (misses)
+      return i + std::countr_zero(misses);
+  }
+  return i + token_length_sse(p + i, n - i);
+}
+
+__attribute__((target("avx2"))) void lower_avx2(const char *in, size_t n,
+                                                char *out) {
+  __m256i before_a = _mm256_set1_epi8('A' - 1);
+  __m256i after_z = _mm256_set1_epi8('Z' + 1);
+  __m256i bit = _mm256_set1_epi8(0x20);
+  size_t i = 0;
+  for (; i + 32 <= n; i += 32) {
+    __m256i v = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(in + i));
+    __m256i upper = _mm256_and_si256(_mm256_cmpgt_epi8(v, before_a),
+                                     _mm256_cmpgt_epi8(after_z, v));
+    _mm256_storeu_si256(reinterpret_cast<__m256i *>(out + i),
+                        _mm256_add_epi8(v, _mm256_and_si256(upper, bit)));
+  }
+  lower_sse(in + i, n - i, out + i);
+}
+#elif defined(SAP_HTTP_SCAN_NEON)
+// Four bits per byte of a compare result, so the first match is at
+// countr_zero() / 4.
+std::uint64_t neon_mask(uint8x16_t matches) {
+  return vget_lane_u64(
+      vreinterpret_u64_u8(vshrn_n_u16(vreinterpretq_u16_u8(matches), 4)), 0);
+}
+
+size_t find_either_neon(const char *p, size_t n, char a, char b) {
+  uint8x16_t va = vdupq_n_u8(static_cast<u8>(a));
+  uint8x16_t vb = vdupq_n_u8(static_cast<u8>(b));
+  size_t i = 0;
+  for (; i + 16 <= n; i += 16) {
+    uint8x16_t v = vld1q_u8(reinterpret_cast<const u8 *>(p + i));
+    std::uint64_t hits = neon_mask(vorrq_u8(vceqq_u8(v, va), vceqq_u8(v, vb)));
+    if (hits)
+      return i + std::countr_zero(hits) / 4;
+  }
+  return i + find_either_scalar(p + i, n - i, a, b);
+}
+
+size_t token_length_neon(const char *p, size_t n) {
+  uint8x16_t low = vld1q_u8(k_LowNibble.data());
+  uint8x16_t high = vld1q_u8(k_HighNibble.data());
+  uint8x16_t nibble = vdupq_n_u8(0x0f);
+  size_t i = 0;
+  for (; i + 16 <= n; i += 16) {
+    uint8x16_t v = vld1q_u8(reinterpret_cast<const u8 *>(p + i));
+    uint8x16_t bits = vandq_u8(vqtbl1q_u8(low, vandq_u8(v, nibble)),
+                               vqtbl1q_u8(high, vshrq_n_u8(v, 4)));
+    std::uint64_t misses = neon_mask(vceqq_u8(bits, vdupq_n_u8(0)));
+    if (misses)
+      return i + std::countr_zero(misses) / 4;
+  }
+  return i + token_length_scalar(p + i, n - i);
+}
+
+void lower_neon(const char *in, size_t n, char *out) {
+  uint8x16_t bit = vdupq_n_u8(0x20);
+  size_t i = 0;
+  for (; i + 16 <= n; i += 16) {
+    uint8x16_t v = vld1q_u8(reinterpret_cast<const u8 *>(in + i));
+    uint8x16_t upper =
+        vandq_u8(vcgeq_u8(v, vdupq_n_u8('A')), vcleq_u8(v, vdupq_n_u8('Z')));
+    vst1q_u8(reinterpret_cast<u8 *>(out + i),
+             vaddq_u8(v, vandq_u8(upper, bit)));
+  }
+  lower_scalar(in + i, n - i, out + i);
+}
+#endif
+
+Kernels select_kernels() {
+#if defined(SAP_HTTP_SCAN_X86)
+  __builtin_cpu_init();
+  if (__builtin_cpu_supports("avx2"))
+    return {"avx2", find_either_avx2, token_length_avx2, lower_avx2};
+  if (__builtin_cpu_supports("sse4.2"))
+    return {"sse4.2", find_either_sse, token_length_sse, lower_sse};
+#elif defined(SAP_HTTP_SCAN_NEON)
+  return {"neon", find_either_neon, token_length_neon, lower_neon};
+#endif
+  return {"scalar", find_either_scalar, token_length_scalar, lower_scalar};
+}
+
+const Kernels &kernels() {
+  static const Kernels selected = select_kernels();
+  return selected;
+}
+} // namespace
+
+size_t find_either(std::string_view data, size_t from, char a, char b) {
+  if (from >= data.size())
+    return std::string_view::npos;
+  size_t at = from + kernels().find_either(data.data() + from,
+                                           data.size() - from, a, b);
+  return at < data.size() ? at : std::string_view::npos;
+}
+
+size_t token_length(std::string_view data) {
+  return kernels().token_length(data.data(), data.size());
+}
+
+void ascii_lower(std::string_view in, char *out) {
+  kernels().lower(in.data(), in.size(), out);
+}
+
+const char *scan_kernels() { return kernels().name; }
+
+} // namespace http::detail
@@ -0,0 +1,97 @@
+#pragma once
+
+#include "types.h"
+#include <algorithm>
+#include <cstring>
+#include <string_view>
+#include <type_traits>
+
+// Byte scanning for the parsers. Kernels for AVX2 and SSE4.2 are picked at
+// run time from what the CPU supports, NEON is used wherever it is the
+// baseline, and a scalar loop covers everything else; building with
+// SAP_HTTP_NO_SIMD keeps only the scalar one. Each call goes over its input
+// once, in 16 or 32 byte blocks with the tail done byte by byte.
+namespace http::detail {
+
+// Single bytes are left to memchr, which the C library already vectorizes.
+inline size_t find_byte(std::string_view data, size_t from, char c) {
+  if (from >= data.size())
+    return std::string_view::npos;
+  auto *hit = static_cast<const char *>(
+      std::memchr(data.data() + from, c, data.size() - from));
+  return hit ? static_cast<size_t>(hit - data.data()) : std::string_view::npos;
+}
+
+// The first of `a` or `b` at or after `from`, or npos.
+size_t find_either(std::string_view data, size_t from, char a, char b);
+
+// Length of the run of RFC 9110 token characters at the start of `data`.
+size_t token_length(std::string_view data);
+
+inline bool is_token(std::string_view data) {
+  return !data.empty() && token_length(data) == data.size();
+}
+
+// Writes `in` to `out` with A-Z lowered; `out` may be `in.data()`. Other
+// bytes, including non-ASCII ones, are copied as they are.
+void ascii_lower(std::string_view in, char *out);
+
+// Case folding as HTTP defines it for field names, tokens and schemes: only
+// A-Z change, whatever the C locale says.
+inline char ascii_lower(char c) {
+  return c >= 'A' && c <= 'Z' ? static_cast<char>(c + ('a' - 'A')) : c;
+}
+
+inline bool iequals(std::string_view a, std::string_view b) {
+  if (a.size() != b.size())
+    return false;
+  for (size_t i = 0; i < a.size(); ++i) {
+    if (ascii_lower(a[i]) != ascii_lower(b[i]))
+      return false;
+  }
+  return true;
+}
+
+inline bool is_ows(char c) { return c == ' ' || c == '\t'; }
+
+// `text` without the optional whitespace around it (RFC 9110 section 5.6.3).
+inline std::string_view trim_ows(std::string_view text) {
+  while (!text.empty() && is_ows(text.front()))
+    text.remove_prefix(1);
+  while (!text.empty() && is_ows(text.back()))
+    text.remove_suffix(1);
+  return text;
+}
+
+// Calls `visit` with each member of a comma-separated field value, trimmed,
+// skipping empty ones (RFC 9110 section 5.6.1). A `visit` returning bool
+// ends the walk by returning true, and so does for_each_member() then.
+template <typename Visit>
+bool for_each_member(std::string_view list, Visit &&visit) {
+  while (!list.empty()) {
+    size_t comma = std::min(list.find(','), list.size());
+    auto member = trim_ows(list.substr(0, comma));
+    list.remove_prefix(std::min(comma + 1, list.size()));
+    if (member.empty())
+      continue;
+    if constexpr (std::is_same_v<decltype(visit(member)), bool>) {
+      if (visit(member))
+        return true;
+    } else {
+      visit(member);
+    }
+  }
+  return false;
+}
+
+// Whether the list has `token` as a member, ignoring case.
+inline bool has_member(std::string_view list, std::string_view token) {
+  return for_each_member(list, [token](std::string_view member) {
+    return iequals(member, token);
+  });
+}
+
+// "avx2", "sse4.2", "neon" or "scalar": the kernels in use.
+const char *scan_kernels();
+
+} // namespace http::detail
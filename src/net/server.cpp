@@ -1,204 +1,1639 @@
 #include "net/http.h"
+#include "arena.h"
+#include "bounded_queue.h"
+#include "event_loop.h"
+#include "h2.h"
+#include "handoff.h"
+#include "limiter.h"
+#include "metrics.h"
+#include "response_cache.h"
+#include "router.h"
+#include "scan.h"
+#include "socket.h"
+#include "timer_wheel.h"
+#include "tls.h"
+#include "wire.h"
 #include <cstring>
+#include <unordered_map>
+#include <utility>
 
-#ifdef _WIN32
-#include <winsock2.h>
-#include <ws2tcpip.h>
-#pragma comment(lib, "ws2_32.lib")
-#else
-#include <arpa/inet.h>
-#include <fcntl.h>
-#include <netdb.h>
-#include <sys/socket.h>
-#include <unistd.h>
+#ifdef __linux__
+#include <pthread.h>
+#include <sched.h>
 #endif
 
 namespace http {
 
-// Parse incoming request and create a Request object
-static stl::result<Request> parse_request(const std::string &raw_request) {
-  std::istringstream stream(raw_request);
-  std::string line;
-  if (!std::getline(stream, line)) {
-    return stl::make_error<Request>("Empty request");
+namespace {
+using Clock = std::chrono::steady_clock;
+
+constexpr size_t k_ReadChunk = 8192;
+constexpr std::chrono::milliseconds k_LoopTick{100};
+// Connection deadlines are filed at loop-tick granularity; this many slots
+// cover about 100 s before an entry has to be filed again.
+constexpr size_t k_TimerSlots = 1024;
+} // namespace
+
+// Create a Request object from a parsed head; the body follows separately
+static Request build_request(const MessageParser &head,
+                             std::pmr::memory_resource *resource) {
+  // Create Request with URL containing just path and query
+  Request req(string_to_method(head.method()), URL::from_path(head.target()),
+              resource);
+  for (size_t i = 0; i < head.header_count(); ++i) {
+    auto field = head.header_at(i);
+    req.headers.set(field.name, field.value);
   }
+  return req;
+}
 
-  std::istringstream first_line(line);
-  std::string method_str, path_str, version;
-  first_line >> method_str >> path_str >> version;
+namespace {
+constexpr std::string_view k_Continue = "HTTP/1.1 100 Continue\r\n\r\n";
+// The end of a cached head, which is stored without Connection.
+constexpr std::string_view k_KeepAliveEnd = "Connection: keep-alive\r\n\r\n";
+constexpr std::string_view k_CloseEnd = "Connection: close\r\n\r\n";
 
-  auto method = string_to_method(method_str);
+// Reads requests off the front of a connection buffer one at a time. The head
+// is parsed incrementally, then the body (Content-Length or chunked) is
+// decoded into the Request as it arrives. Consumed bytes are erased from the
+// buffer right away, so an upload is never held twice.
+class RequestReader {
+public:
+  enum class EStatus { NeedMore, Complete, Failed };
 
-  // Create Request with URL containing just path and query
-  Request req(method, URL::from_path(path_str));
+  // Request headers are allocated from `resource`. With `timed` set, time
+  // spent in read() is accumulated per request for take_parse_time().
+  RequestReader(size_t max_body_size, std::pmr::memory_resource *resource,
+                bool timed = false)
+      : m_MaxBodySize(max_body_size), m_Resource(resource), m_Timed(timed),
+        m_Sink([this](std::string_view data) {
+          m_Request->body.append(data);
+        }) {}
+  RequestReader(const RequestReader &) = delete;
+  RequestReader &operator=(const RequestReader &) = delete;
+
+  EStatus read(std::string &in) {
+    if (!m_Timed)
+      return parse(in);
+    auto started = detail::MetricsClock::now();
+    auto status = parse(in);
+    m_ParseTime += detail::elapsed_ns(started);
+    return status;
+  }
 
-  // Parse headers
-  while (std::getline(stream, line) && line != "\r" && !line.empty()) {
-    if (line.back() == '\r')
-      line.pop_back();
-    auto colon = line.find(':');
-    if (colon != std::string::npos) {
-      auto key = line.substr(0, colon);
-      auto value = line.substr(colon + 1);
-      if (!value.empty() && value[0] == ' ')
-        value.erase(0, 1);
-      req.headers.set(key, value);
+  Request take_request() {
+    Request req = std::move(*m_Request);
+    m_Request.reset();
+    return req;
+  }
+  // No request is being assembled, so nothing lives in the arena.
+  bool is_idle() const { return !m_Request; }
+  // The head of the current request is in; its body is still arriving.
+  bool in_body() const { return m_InBody; }
+  bool keep_alive() const { return m_KeepAlive; }
+  // Whether the client understands a chunked response body.
+  bool accepts_chunked() const { return m_AcceptsChunked; }
+  i32 error_status() const { return m_ErrorStatus; }
+  // True once per request whose head asked for `Expect: 100-continue`.
+  bool take_continue() { return std::exchange(m_ExpectContinue, false); }
+  // Nanoseconds spent parsing the request just completed (or failed).
+  std::uint64_t take_parse_time() { return std::exchange(m_ParseTime, 0); }
+
+private:
+  EStatus parse(std::string &in) {
+    if (!m_InBody) {
+      auto status = m_Parser.parse(in);
+      if (status == EParseStatus::NeedMore)
+        return EStatus::NeedMore;
+      if (status == EParseStatus::Error)
+        return fail(m_Parser.is_too_large() ? 431 : 400);
+      m_Decoder.set_max_body_size(m_MaxBodySize);
+      if (!m_Decoder.start(m_Parser)) {
+        if (m_Decoder.is_too_large())
+          return fail(413);
+        return fail(m_Parser.has_header("transfer-encoding") &&
+                            !m_Parser.has_header("content-length")
+                        ? 501
+                        : 400);
+      }
+      // Constructed in place: assigning would copy the headers out of the
+      // arena.
+      m_Request.emplace(build_request(m_Parser, m_Resource));
+      m_KeepAlive = m_Parser.keep_alive();
+      m_AcceptsChunked = m_Parser.version() != "HTTP/1.0";
+      m_ExpectContinue = !m_Decoder.is_complete() &&
+                         detail::has_member(m_Parser.header("expect"),
+                                            "100-continue");
+      if (m_Decoder.mode() == BodyDecoder::EMode::Length)
+        m_Request->body.reserve(m_Decoder.body_size());
+      in.erase(0, m_Parser.head_size());
+      m_Parser.reset();
+      m_InBody = true;
     }
+    size_t consumed = 0;
+    auto status = m_Decoder.decode(in, consumed, m_Sink);
+    in.erase(0, consumed);
+    if (status == EParseStatus::Error)
+      return fail(m_Decoder.is_too_large() ? 413 : 400);
+    if (status == EParseStatus::NeedMore)
+      return EStatus::NeedMore;
+    // The body is already here, so an interim 100 would be pointless.
+    m_ExpectContinue = false;
+    m_InBody = false;
+    return EStatus::Complete;
   }
 
-  // Parse body
-  std::string body_content;
-  std::string body_line;
-  while (std::getline(stream, body_line)) {
-    body_content += body_line + "\n";
+  EStatus fail(i32 status) {
+    m_ErrorStatus = status;
+    return EStatus::Failed;
   }
-  if (!body_content.empty() && body_content.back() == '\n') {
-    body_content.pop_back();
+
+  size_t m_MaxBodySize;
+  std::pmr::memory_resource *m_Resource;
+  bool m_Timed;
+  std::uint64_t m_ParseTime{0};
+  MessageParser m_Parser;
+  BodyDecoder m_Decoder;
+  BodyDecoder::Sink m_Sink;
+  std::optional<Request> m_Request;
+  bool m_InBody{false};
+  bool m_KeepAlive{false};
+  bool m_AcceptsChunked{true};
+  bool m_ExpectContinue{false};
+  i32 m_ErrorStatus{400};
+};
+} // namespace
+
+struct Server::Deferred {
+  Request req;
+  size_t route;
+  detail::MetricsClock::time_point started{};
+  bool keep_alive{false};
+  std::optional<Task<Response>> task{};
+  // Set by the waiting connection. Called from inside the task when it
+  // completes after having suspended.
+  std::function<void()> on_done{};
+};
+
+Server::Server() = default;
+
+Server::Server(ServerConfig cfg)
+    : m_Config(std::move(cfg)), m_Routes(), m_IsRunning(false),
+      m_WorkerThreads() {}
+
+Server::~Server() { stop(); }
+
+static std::string allow_list(u32 allowed) {
+  std::string list;
+  for (size_t i = 0; i < detail::k_MethodCount; ++i) {
+    auto method = static_cast<EMethod>(i);
+    if (!(allowed & detail::method_bit(method)))
+      continue;
+    if (!list.empty())
+      list.append(", ");
+    list.append(method_to_string(method));
   }
-  req.body = body_content;
+  return list;
+}
 
-  return req;
+detail::MetricsShard *Server::local_metrics() const {
+  return m_Metrics ? &m_Metrics->local() : nullptr;
 }
 
-static std::string build_response(const Response &resp) {
-  std::ostringstream ss;
-  ss << "HTTP/1.1 " << resp.status_code << " ";
-  switch (resp.status_code) {
-  case 200:
-    ss << "OK";
-    break;
-  case 201:
-    ss << "Created";
-    break;
-  case 204:
-    ss << "No Content";
-    break;
-  case 400:
-    ss << "Bad Request";
-    break;
-  case 404:
-    ss << "Not Found";
-    break;
-  case 500:
-    ss << "Internal Server Error";
-    break;
-  default:
-    ss << "Unknown";
+std::optional<Response> Server::dispatch(Request &req, Exchange &exchange,
+                                         ResponseWriter &writer) const {
+  if (!m_Router)
+    return Response(404, "Not Found");
+  auto *metrics = exchange.metrics;
+  // Mounted routers first; the tree has what they lack.
+  const detail::StaticRoutes *routes = nullptr;
+  size_t index = 0;
+  detail::Router::Match match;
+  for (const auto &[first, mounted] : m_Static) {
+    u32 allowed = 0;
+    if (mounted->find(req.url.path, req.method, index, allowed)) {
+      routes = mounted.get();
+      match.kind = detail::Router::EMatch::Found;
+      match.route = first + index;
+      break;
+    }
+    match.allowed |= allowed;
+  }
+  if (!routes) {
+    u32 allowed = match.allowed;
+    match = m_Router->find(req.url.path, req.method, req.params);
+    match.allowed |= allowed;
+    if (match.kind == detail::Router::EMatch::NotFound && allowed)
+      match.kind = detail::Router::EMatch::MethodNotAllowed;
+  }
+  switch (match.kind) {
+  case detail::Router::EMatch::Found: {
+    const Route &route = m_Routes[match.route];
+    if (route.async)
+      return start_async(req, match.route, exchange);
+    auto run = [&]() -> std::optional<Response> {
+      try {
+        if (routes)
+          return routes->call(index, req);
+        if (!route.stream)
+          return route.handler(req);
+        route.stream(req, writer);
+      } catch (const std::exception &e) {
+        if (metrics)
+          metrics->handler_exceptions.add();
+        if (!writer.is_started())
+          return Response(500, std::string("Error: ") + e.what());
+        // The head is already out; all that is left is to hang up.
+        writer.fail();
+        return std::nullopt;
+      }
+      writer.finish();
+      return std::nullopt;
+    };
+    if (!metrics)
+      return run();
+    auto started = detail::MetricsClock::now();
+    auto resp = run();
+    auto &stats = metrics->route(match.route);
+    stats.latency.record(detail::elapsed_ns(started));
+    stats.requests.add();
+    i32 status = resp ? resp->status_code : writer.m_Status;
+    if (status >= 500 || !writer.is_ok())
+      stats.errors.add();
+    return resp;
+  }
+  case detail::Router::EMatch::MethodNotAllowed: {
+    if (metrics)
+      metrics->method_not_allowed.add();
+    Response resp(405, "Method Not Allowed");
+    resp.headers.set("Allow", allow_list(match.allowed));
+    return resp;
+  }
+  case detail::Router::EMatch::NotFound:
     break;
   }
-  ss << "\r\n";
-  for (const auto &[key, value] : resp.headers.data) {
-    ss << key << ": " << value << "\r\n";
+  if (metrics)
+    metrics->not_found.add();
+  return Response(404, "Not Found");
+}
+
+std::optional<Response> Server::start_async(Request &req, size_t route,
+                                            Exchange &exchange) const {
+  // The handler reads the request through a reference, so it has to live
+  // somewhere that survives a suspension. A short path moves out of the
+  // caller's stack, so the params follow it.
+  std::string_view path = req.url.path;
+  auto deferred =
+      std::unique_ptr<Deferred>(new Deferred{std::move(req), route});
+  deferred->req.params.rebase(path, deferred->req.url.path);
+  if (exchange.metrics)
+    deferred->started = detail::MetricsClock::now();
+  deferred->task.emplace(run_async(*deferred, exchange.metrics));
+  {
+    // Without a loop to resume it on, the handler's socket waits block.
+    std::optional<detail::BlockingScope> blocking;
+    if (!exchange.can_defer)
+      blocking.emplace();
+    deferred->task->start();
   }
-  ss << "\r\n";
-  if (!resp.body.empty()) {
-    ss << resp.body;
+  if (deferred->task->is_done()) {
+    Response resp = deferred->task->get();
+    // Middleware still reads the request.
+    path = deferred->req.url.path;
+    req = std::move(deferred->req);
+    req.params.rebase(path, req.url.path);
+    return resp;
   }
-  return ss.str();
+  if (exchange.can_defer) {
+    exchange.deferred = std::move(deferred);
+    return std::nullopt;
+  }
+  // Suspended on something other than a socket, with nothing to resume it.
+  return Response(500, "Error: handler suspended outside an event loop");
 }
 
-Server::Server(ServerConfig cfg)
-    : m_Config(std::move(cfg)), m_Routes(), m_IsRunning(false),
-      m_WorkerThreads() {}
+Task<Response> Server::run_async(Deferred &deferred,
+                                 detail::MetricsShard *metrics) const {
+  Response resp;
+  try {
+    resp = co_await m_Routes[deferred.route].async(deferred.req);
+  } catch (const std::exception &e) {
+    if (metrics)
+      metrics->handler_exceptions.add();
+    resp = Response(500, std::string("Error: ") + e.what());
+  }
+  if (metrics) {
+    auto &stats = metrics->route(deferred.route);
+    stats.latency.record(detail::elapsed_ns(deferred.started));
+    stats.requests.add();
+    if (resp.status_code >= 500)
+      stats.errors.add();
+  }
+  if (deferred.on_done)
+    deferred.on_done();
+  co_return resp;
+}
 
-Server::~Server() { stop(); }
+std::optional<Response> Server::process_request(Request req,
+                                                Exchange &exchange) const {
+  u32 limit = m_Config.max_keep_alive_requests;
+  exchange.keep_alive = m_Config.keep_alive && !is_closing() &&
+                        (limit == 0 || exchange.served + 1 < limit) &&
+                        exchange.wants_keep_alive;
+  ResponseWriter writer(exchange.out, exchange.sock, exchange.tls,
+                        exchange.keep_alive, req.method == EMethod::HEAD,
+                        exchange.accepts_chunked, m_Config.write_timeout);
+  Response streamed;
+  if (exchange.multiplexed)
+    writer.m_Buffer = &streamed;
+  std::string cache_key;
+  bool leading = false;
+  if (m_Cache) {
+    bool lookup = true;
+    bool parked = false;
+    cache_key = m_Cache->key_of(req, lookup);
+    detail::ResponseCache::Entry hit;
+    if (!cache_key.empty() && exchange.wake)
+      hit = m_Cache->acquire(cache_key, lookup, leading, *exchange.wake,
+                             parked);
+    else if (!cache_key.empty())
+      hit = m_Cache->acquire(cache_key, lookup, leading);
+    if (parked) {
+      exchange.parked = std::move(req);
+      return std::nullopt;
+    }
+    if (auto *metrics = exchange.metrics; metrics && hit) {
+      metrics->cache_hits.add();
+      metrics->requests.add();
+    } else if (metrics && lookup && !cache_key.empty()) {
+      metrics->cache_misses.add();
+    }
+    if (hit && exchange.multiplexed)
+      return hit->response;
+    if (hit) {
+      exchange.out.push_shared(hit, hit->head);
+      exchange.out.push_view(exchange.keep_alive ? k_KeepAliveEnd
+                                                 : k_CloseEnd);
+      exchange.out.push_shared(hit, hit->response.body);
+      return std::nullopt;
+    }
+  }
+  std::optional<Response> resp;
+  if (auto *metrics = exchange.metrics) {
+    auto started = detail::MetricsClock::now();
+    resp = dispatch(req, exchange, writer);
+    // A deferred handler is accounted for when it completes.
+    if (!exchange.deferred) {
+      metrics->handler.record(detail::elapsed_ns(started));
+      metrics->requests.add();
+    }
+  } else {
+    resp = dispatch(req, exchange, writer);
+  }
+  // Streamed and coroutine responses are not cached.
+  if (leading && (exchange.deferred || !resp))
+    m_Cache->complete(cache_key, nullptr);
+  if (exchange.deferred) {
+    exchange.deferred->keep_alive = exchange.keep_alive;
+    return resp;
+  }
+  if (!resp) {
+    exchange.keep_alive = writer.m_KeepAlive;
+    // What a streaming handler wrote goes out like any other response
+    // (middleware aside, as over HTTP/1.1); a broken one resets the stream.
+    if (exchange.multiplexed && writer.is_ok())
+      return streamed;
+    return resp;
+  }
+  apply_middleware(req, *resp);
+  if (leading)
+    m_Cache->complete(cache_key, &*resp);
+  // A drain may have begun while the handler ran.
+  if (is_closing())
+    exchange.keep_alive = false;
+  resp->headers.set(EHeader::Connection,
+                    exchange.keep_alive ? "keep-alive" : "close");
+  return resp;
+}
+
+static Response error_response(i32 status) {
+  Response resp(status);
+  resp.headers.set(EHeader::Connection, "close");
+  return resp;
+}
+
+static std::unique_ptr<detail::RequestArena>
+make_arena(const ServerConfig &config) {
+  if (!config.use_request_arena)
+    return nullptr;
+  return std::make_unique<detail::RequestArena>(config.request_arena_size);
+}
+
+static std::pmr::memory_resource *
+resource_of(const std::unique_ptr<detail::RequestArena> &arena) {
+  return arena ? arena->resource() : std::pmr::get_default_resource();
+}
+
+static void count_handshake(detail::MetricsShard *metrics,
+                            const detail::TlsStream &tls, bool completed) {
+  if (!metrics)
+    return;
+  if (!completed) {
+    metrics->tls_handshake_errors.add();
+    return;
+  }
+  metrics->tls_handshakes.add();
+  if (tls.resumed())
+    metrics->tls_resumed.add();
+}
+
+// The server side of the handshake on a blocking socket; nullptr when the
+// client does not complete it within `timeout`.
+static std::unique_ptr<detail::TlsStream>
+accept_tls(detail::TlsContext &context, i32 sock,
+           std::chrono::milliseconds timeout, detail::MetricsShard *metrics) {
+  auto stream = context.open(sock);
+  if (!stream)
+    return nullptr;
+  bool completed = stream.value()->handshake(timeout).has_value();
+  count_handshake(metrics, *stream.value(), completed);
+  if (!completed)
+    return nullptr;
+  return std::move(stream.value());
+}
+
+// Turns away a connection the server cannot take on. A TLS client would
+// need a handshake before it could read the 503, which is exactly the work
+// an overloaded server cannot take on, so it is only closed.
+static void refuse(i32 sock, bool tls, detail::MetricsShard *metrics) {
+  if (metrics) {
+    metrics->connections_rejected.add();
+    metrics->connections_closed.add();
+  }
+  if (!tls) {
+    Response resp(503, "Service Unavailable");
+    resp.headers.set(EHeader::Connection, "close");
+    detail::WireQueue out;
+    detail::write_response(out, std::move(resp));
+    out.send_all(sock);
+  }
+  detail::close_socket(sock);
+}
+
+static void close_connection(detail::ConnectionLimiter *limiter, i32 sock) {
+  if (limiter)
+    limiter->release(sock);
+  detail::close_socket(sock);
+}
+
+static std::chrono::milliseconds time_left(Clock::time_point until) {
+  return std::max(std::chrono::milliseconds{0},
+                  std::chrono::ceil<std::chrono::milliseconds>(until -
+                                                               Clock::now()));
+}
+
+bool Server::is_closing() const {
+  return !m_IsRunning.load() || m_IsDraining.load();
+}
+
+bool Server::wait_client(i32 sock, detail::TlsStream *tls,
+                         std::chrono::milliseconds timeout, bool idle) const {
+  auto until = Clock::now() + timeout;
+  while (true) {
+    auto left = time_left(until);
+    if (detail::wait_readable(sock, tls, std::min(left, k_LoopTick)))
+      return true;
+    if (left <= k_LoopTick || !m_IsRunning.load())
+      return false;
+    if (m_IsDraining.load()) {
+      if (idle)
+        return false;
+      if (Clock::now() >= m_DrainDeadline) {
+        m_Dropped.store(true);
+        return false;
+      }
+    }
+  }
+}
 
 void Server::handle_client(i32 client_socket) {
-  char buffer[8192];
-  std::string request_data;
-#ifdef _WIN32
-  i32 n = recv(client_socket, buffer, sizeof(buffer) - 1, 0);
-#else
-  ssize_t n = recv(client_socket, buffer, sizeof(buffer) - 1, 0);
-#endif
-  if (n > 0) {
-    buffer[n] = '\0';
-    request_data = buffer;
-    auto req_result = parse_request(request_data);
-    Response resp(404, "Not Found");
-    if (req_result) {
-      auto &req = req_result.value();
-      // Find matching route using URL path
-      for (const auto &route : m_Routes) {
-        if (route.method == req.method && route.path == req.url.path) {
-          try {
-            resp = route.handler(req);
-          } catch (const std::exception &e) {
-            resp = Response(500, std::string("Error: ") + e.what());
-          }
+  char buffer[k_ReadChunk];
+  std::string in;
+  auto *metrics = local_metrics();
+  // The waits below bound the time between reads; these bound a single
+  // call that poll() cannot see ahead of, such as the rest of a TLS record
+  // or a send to a client that stopped reading.
+  detail::set_io_timeouts(client_socket,
+                          std::max(m_Config.header_timeout,
+                                   m_Config.body_timeout),
+                          m_Config.write_timeout);
+  std::unique_ptr<detail::TlsStream> tls;
+  if (m_Tls) {
+    tls = accept_tls(*m_Tls, client_socket, m_Config.header_timeout, metrics);
+    if (!tls) {
+      close_connection(m_Limiter.get(), client_socket);
+      if (metrics)
+        metrics->connections_closed.add();
+      return;
+    }
+  }
+  // Without TLS to negotiate it, an HTTP/2 client is told apart by its
+  // preface.
+  bool sniff = m_Config.http2 && !tls;
+  bool h2 = m_Config.http2 && tls && tls->alpn() == "h2";
+  auto arena = make_arena(m_Config);
+  RequestReader reader(m_Config.max_body_size, resource_of(arena),
+                       metrics != nullptr);
+  detail::WireQueue out;
+  u32 served = 0;
+  bool keep_alive = !h2;
+  while (keep_alive) {
+    // Pipelined requests already buffered are answered before reading again.
+    auto status = reader.read(in);
+    // Bytes of the next head already buffered start its clock now.
+    auto head_started = Clock::now();
+    while (status == RequestReader::EStatus::NeedMore) {
+      if (reader.take_continue()) {
+        out.push_view(k_Continue);
+        if (!out.send_all(client_socket, tls.get()))
+          break;
+      }
+      bool awaiting = in.empty() && reader.is_idle();
+      auto timeout = m_Config.keep_alive_timeout;
+      if (reader.in_body())
+        timeout = m_Config.body_timeout;
+      else if (!awaiting)
+        timeout = time_left(head_started + m_Config.header_timeout);
+      if (!wait_client(client_socket, tls.get(), timeout, awaiting)) {
+        if (!awaiting && metrics && !is_closing())
+          metrics->connections_timed_out.add();
+        break;
+      }
+      auto n = detail::read_some(client_socket, tls.get(), buffer,
+                                 sizeof(buffer));
+      if (n <= 0)
+        break;
+      if (awaiting)
+        head_started = Clock::now();
+      in.append(buffer, n);
+      if (sniff) {
+        auto preface = detail::match_preface(in);
+        if (preface == detail::EPreface::Partial)
+          continue;
+        sniff = false;
+        h2 = preface == detail::EPreface::Present;
+        if (h2)
           break;
+      }
+      status = reader.read(in);
+    }
+    if (status == RequestReader::EStatus::NeedMore)
+      break;
+    std::optional<Response> resp;
+    if (status == RequestReader::EStatus::Failed) {
+      if (metrics)
+        metrics->parse_errors.add();
+      resp = error_response(reader.error_status());
+      keep_alive = false;
+    } else {
+      if (metrics)
+        metrics->parse.record(reader.take_parse_time());
+      Exchange exchange{out, client_socket, tls.get(), metrics, served++,
+                        reader.keep_alive(), reader.accepts_chunked()};
+      resp = process_request(reader.take_request(), exchange);
+      keep_alive = exchange.keep_alive;
+      if (arena && reader.is_idle())
+        arena->reset();
+    }
+    auto started = detail::MetricsClock::time_point();
+    if (metrics)
+      started = detail::MetricsClock::now();
+    if (resp)
+      detail::write_response(out, std::move(*resp));
+    bool sent = out.send_all(client_socket, tls.get());
+    if (metrics)
+      metrics->write.record(detail::elapsed_ns(started));
+    if (!sent)
+      break;
+  }
+  if (h2)
+    serve_h2(client_socket, tls.get(), in, metrics);
+  close_connection(m_Limiter.get(), client_socket);
+  if (metrics)
+    metrics->connections_closed.add();
+}
+
+void Server::serve_h2(i32 sock, detail::TlsStream *tls, std::string &in,
+                      detail::MetricsShard *metrics) {
+  if (metrics)
+    metrics->http2_connections.add();
+  detail::set_no_delay(sock);
+  detail::H2Session session(detail::H2Session::ERole::Server,
+                            *m_Config.http2, m_Config.max_body_size);
+  session.start();
+  char buffer[k_ReadChunk];
+  bool open = session.feed(in);
+  while (open) {
+    u32 stream;
+    Request req;
+    while (session.next_request(stream, req)) {
+      bool head_only = req.method == EMethod::HEAD;
+      Exchange exchange{session.out(), sock, tls, metrics, 0, true, true};
+      exchange.multiplexed = true;
+      auto resp = process_request(std::move(req), exchange);
+      if (resp)
+        session.respond(stream, std::move(*resp), head_only);
+      else
+        session.reset(stream);
+    }
+    if (is_closing())
+      session.go_away();
+    if (!session.out().send_all(sock, tls) || session.is_finished())
+      return;
+    // Body bytes held back by flow control wait for the client's
+    // WINDOW_UPDATE, like any write to a client that is not reading.
+    bool idle = session.stream_count() == 0;
+    auto timeout = session.has_blocked_data() ? m_Config.write_timeout
+                   : idle                     ? m_Config.keep_alive_timeout
+                                              : m_Config.body_timeout;
+    if (!wait_client(sock, tls, timeout, idle)) {
+      if (!idle && metrics && !is_closing())
+        metrics->connections_timed_out.add();
+      return;
+    }
+    auto n = detail::read_some(sock, tls, buffer, sizeof(buffer));
+    if (n <= 0)
+      return;
+    in.append(buffer, n);
+    open = session.feed(in);
+  }
+  // The GOAWAY saying what the client did wrong.
+  session.out().send_all(sock, tls);
+}
+
+// One accepted socket driven by a reactor. Reading parses and answers every
+// buffered request in order; writing drains their responses. While output
+// is pending the connection stops reading, which keeps pipelined responses
+// ordered and bounds memory per connection.
+class Server::Connection : public detail::IoHandler {
+public:
+  Connection(Server &server, Reactor &reactor, i32 sock,
+             std::unique_ptr<detail::TlsStream> tls)
+      : m_Server(server), m_Reactor(reactor), m_Socket(sock),
+        m_Tls(std::move(tls)), m_Metrics(server.local_metrics()),
+        m_State(m_Tls ? EState::Handshaking : EState::Reading),
+        m_Arena(make_arena(server.m_Config)),
+        m_Reader(server.m_Config.max_body_size, resource_of(m_Arena),
+                 m_Metrics != nullptr),
+        m_LastActive(Clock::now()), m_RequestStarted(m_LastActive) {}
+
+  void on_io(u32 events) override;
+  // The server is draining. Tells the client to open no more streams;
+  // false when the connection is between requests and can be closed.
+  bool drain();
+  bool on_handshake();
+  bool on_readable();
+  bool on_writable();
+
+  // When the connection is dropped unless the client makes progress; max()
+  // while a suspended handler holds it.
+  Clock::time_point deadline() const;
+  // Only waiting for the client's next request: expiring then is routine,
+  // not a slow client.
+  bool awaiting_request() const {
+    if (m_State == EState::Multiplexing)
+      return m_H2->stream_count() == 0 && m_StreamTasks.empty() &&
+             m_Parked.empty();
+    return m_State == EState::Reading && m_In.empty() && m_Reader.is_idle();
+  }
+
+  // Timer wheel bookkeeping for the reactor. needs_timer() tells whether
+  // the connection must be filed for `when`; at most one entry is live.
+  bool needs_timer(Clock::time_point when) const {
+    return when != Clock::time_point::max() &&
+           (!m_TimerId || m_FiledFor > when);
+  }
+  void filed(std::uint64_t id, Clock::time_point when) {
+    m_TimerId = id;
+    m_FiledFor = when;
+  }
+  // Whether `id` is the live entry, which is then used up.
+  bool take_timer(std::uint64_t id) {
+    if (id != m_TimerId)
+      return false;
+    m_TimerId = 0;
+    return true;
+  }
+  // Retries the requests parked for the response cache. A wake-up may be
+  // stale or meant for another request; those just park again.
+  void unpark();
+
+private:
+  enum class EState {
+    Handshaking,
+    Reading,
+    Waiting,
+    Writing,
+    Multiplexing,
+    Closed
+  };
+
+  // Reads everything available into m_In; false on a socket error.
+  bool read_input();
+  bool process();
+  // Runs one request and queues its response. Nothing once that is done;
+  // otherwise the connection now waits for the response, and the value is
+  // whether it is still open.
+  std::optional<bool> answer(Request req, Exchange &exchange);
+  bool defer(std::unique_ptr<Deferred> deferred);
+  void finish_deferred();
+  bool park(u32 stream, Exchange &exchange);
+  // Stops reading while an HTTP/1.1 response is being waited for.
+  bool hold();
+  // Calls unpark() on the reactor's thread; made on first use.
+  const std::function<void()> *waker();
+
+  // HTTP/2, once ALPN picked h2 or the client opened with the preface. The
+  // connection keeps reading throughout: the session answers PINGs and
+  // flow control while handlers run, and streams do not wait on each other.
+  bool start_h2();
+  bool on_h2(u32 events);
+  // Runs the handlers of complete requests and sends what the session
+  // queued.
+  bool serve_streams();
+  void serve_stream(u32 stream, Request req);
+  void finish_stream(u32 stream);
+
+  // A request waiting for a response another one is producing for the
+  // cache, with what the connection knew when it was read.
+  struct Parked {
+    Request req;
+    u32 served;
+    bool wants_keep_alive;
+    bool accepts_chunked;
+  };
+
+  Server &m_Server;
+  Reactor &m_Reactor;
+  i32 m_Socket;
+  std::unique_ptr<detail::TlsStream> m_Tls;
+  // Connections are created and driven on their reactor's thread.
+  detail::MetricsShard *m_Metrics;
+  EState m_State;
+  std::string m_In;
+  std::unique_ptr<detail::RequestArena> m_Arena;
+  RequestReader m_Reader;
+  detail::WireQueue m_Out;
+  // The suspended handler the connection is waiting for. Declared after the
+  // arena, which may hold its request's headers.
+  std::unique_ptr<Deferred> m_Deferred;
+  // Parked requests by stream, 0 over HTTP/1.1.
+  std::unordered_map<u32, Parked> m_Parked;
+  std::function<void()> m_Waker;
+  std::unique_ptr<detail::H2Session> m_H2;
+  // Suspended coroutine handlers of HTTP/2 streams.
+  std::unordered_map<u32, std::unique_ptr<Deferred>> m_StreamTasks;
+  u32 m_Events{detail::IO_READ};
+  u32 m_Served{0};
+  // Serialization and send time of the responses in m_Out.
+  std::uint64_t m_WriteTime{0};
+  bool m_CloseAfterWrite{false};
+  bool m_WaitingWritable{false};
+  // Last read or write progress, and when the request head being read (or
+  // the TLS handshake) began.
+  Clock::time_point m_LastActive;
+  Clock::time_point m_RequestStarted;
+  std::uint64_t m_TimerId{0};
+  Clock::time_point m_FiledFor{};
+};
+
+// Event loop plus the listening socket registration and the connections it
+// accepted. Each event-loop thread owns exactly one.
+class Server::Reactor : public detail::IoHandler {
+public:
+  Reactor(Server &server, i32 listen_socket)
+      : m_Server(server), m_ListenSocket(listen_socket) {}
+  ~Reactor() override {
+    for (auto &[sock, conn] : m_Connections)
+      close_connection(m_Server.m_Limiter.get(), sock);
+    if (auto *metrics = m_Server.local_metrics())
+      metrics->connections_closed.add(m_Connections.size());
+  }
+
+  stl::result<> open(bool shared_listener) {
+    auto result = loop.open();
+    if (!result)
+      return result;
+    u32 events = detail::IO_READ;
+    if (shared_listener)
+      events |= detail::IO_EXCLUSIVE;
+    if (!loop.poller().add(m_ListenSocket, events, this))
+      return stl::make_error<>("Failed to register listening socket");
+    loop.set_tick([this]() { tick(); });
+    return stl::result_success();
+  }
+
+  // Files `conn` on the timer wheel unless it is already filed for no later
+  // than its deadline.
+  void arm(i32 sock, Connection &conn) {
+    auto when = conn.deadline();
+    if (!conn.needs_timer(when))
+      return;
+    conn.filed(++m_LastTimer, when);
+    m_Timers.schedule({sock, m_LastTimer}, when);
+  }
+
+  // Drops connections past their deadline. Only slots that came due are
+  // looked at; connections that made progress since are filed again.
+  void expire() {
+    auto now = Clock::now();
+    m_Timers.advance(now, [this, now](const TimerEntry &entry) {
+      auto it = m_Connections.find(entry.sock);
+      if (it == m_Connections.end() || !it->second->take_timer(entry.id))
+        return;
+      auto &conn = *it->second;
+      if (conn.deadline() > now) {
+        arm(entry.sock, conn);
+        return;
+      }
+      auto *metrics = m_Server.local_metrics();
+      if (metrics && !conn.awaiting_request())
+        metrics->connections_timed_out.add();
+      close(entry.sock);
+    });
+  }
+
+  void run() { loop.run(m_Looping, k_LoopTick); }
+
+  // Runs every loop tick: stops the loop once the server stops, or once a
+  // drain has closed every connection.
+  void tick() {
+    if (!m_Server.m_IsRunning.load()) {
+      m_Looping.store(false);
+      return;
+    }
+    if (m_Server.m_IsDraining.load())
+      drain();
+    expire();
+  }
+
+  // Stops accepting, closes connections between requests, and past the
+  // drain deadline all the others too. The listener stays open: the
+  // kernel keeps queueing on it for whoever else accepts from it.
+  void drain() {
+    if (m_Accepting) {
+      loop.poller().remove(m_ListenSocket);
+      m_Accepting = false;
+    }
+    bool overdue = Clock::now() >= m_Server.m_DrainDeadline;
+    std::vector<i32> done;
+    for (auto &[sock, conn] : m_Connections) {
+      if (!conn->drain()) {
+        done.push_back(sock);
+      } else if (overdue) {
+        m_Server.m_Dropped.store(true);
+        done.push_back(sock);
+      }
+    }
+    for (i32 sock : done)
+      close(sock);
+    if (m_Connections.empty())
+      m_Looping.store(false);
+  }
+
+  // Accepts every pending connection on the listening socket.
+  void on_io(u32) override {
+    while (m_Accepting && m_Server.m_IsRunning.load()) {
+      sockaddr_storage client_addr{};
+      socklen_t client_len = sizeof(client_addr);
+      i32 client_socket = static_cast<i32>(
+          accept(m_ListenSocket, (sockaddr *)&client_addr, &client_len));
+      if (client_socket < 0) {
+        i32 err = detail::last_socket_error();
+        if (detail::is_interrupted(err))
+          continue;
+        break;
+      }
+      auto *limiter = m_Server.m_Limiter.get();
+      if (limiter && !limiter->admit(client_socket, client_addr)) {
+        auto *metrics = m_Server.local_metrics();
+        if (metrics)
+          metrics->connections_accepted.add();
+        refuse(client_socket, m_Server.m_Tls != nullptr, metrics);
+        continue;
+      }
+      if (!detail::set_nonblocking(client_socket)) {
+        close_connection(limiter, client_socket);
+        continue;
+      }
+      std::unique_ptr<detail::TlsStream> tls;
+      if (m_Server.m_Tls) {
+        auto opened = m_Server.m_Tls->open(client_socket);
+        if (!opened) {
+          close_connection(limiter, client_socket);
+          continue;
         }
+        tls = std::move(opened.value());
+      }
+      auto conn = std::make_unique<Connection>(m_Server, *this, client_socket,
+                                               std::move(tls));
+      if (!loop.poller().add(client_socket, detail::IO_READ, conn.get())) {
+        close_connection(limiter, client_socket);
+        continue;
       }
+      arm(client_socket, *conn);
+      m_Connections.emplace(client_socket, std::move(conn));
+      if (auto *metrics = m_Server.local_metrics())
+        metrics->connections_accepted.add();
     }
-    std::string response_str = build_response(resp);
-    send(client_socket, response_str.c_str(), response_str.size(), 0);
   }
-#ifdef _WIN32
-  closesocket(client_socket);
-#else
-  close(client_socket);
-#endif
+
+  void unpark(i32 sock) {
+    auto it = m_Connections.find(sock);
+    if (it != m_Connections.end())
+      it->second->unpark();
+  }
+
+  void close(i32 sock) {
+    auto it = m_Connections.find(sock);
+    if (it == m_Connections.end())
+      return;
+    loop.poller().remove(sock);
+    loop.retire(std::move(it->second));
+    m_Connections.erase(it);
+    close_connection(m_Server.m_Limiter.get(), sock);
+    if (auto *metrics = m_Server.local_metrics())
+      metrics->connections_closed.add();
+  }
+
+  detail::EventLoop loop;
+
+private:
+  // Stale entries, of closed connections or superseded deadlines, are told
+  // apart by `id`.
+  struct TimerEntry {
+    i32 sock;
+    std::uint64_t id;
+  };
+
+  Server &m_Server;
+  i32 m_ListenSocket;
+  bool m_Accepting{true};
+  std::atomic<bool> m_Looping{true};
+  std::unordered_map<i32, std::unique_ptr<Connection>> m_Connections;
+  detail::TimerWheel<TimerEntry> m_Timers{k_LoopTick, k_TimerSlots};
+  std::uint64_t m_LastTimer{0};
+};
+
+void Server::Connection::on_io(u32 events) {
+  if (m_State == EState::Closed)
+    return;
+  bool open = true;
+  if (m_State == EState::Handshaking)
+    open = on_handshake();
+  else if (m_State == EState::Reading &&
+           (events & (detail::IO_READ | detail::IO_CLOSED)))
+    open = on_readable();
+  else if (m_State == EState::Writing && (events & detail::IO_WRITE))
+    open = on_writable();
+  else if (m_State == EState::Multiplexing)
+    open = on_h2(events);
+  else if (events & detail::IO_CLOSED)
+    open = false;
+  if (!open) {
+    m_State = EState::Closed;
+    m_Reactor.close(m_Socket);
+    return;
+  }
+  m_Reactor.arm(m_Socket, *this);
 }
 
-stl::result<> Server::start() {
-#ifdef _WIN32
-  WSADATA wsa_data;
-  if (WSAStartup(MAKEWORD(2, 2), &wsa_data) != 0) {
-    return stl::make_error<>("Failed to initialize Winsock");
+bool Server::Connection::drain() {
+  if (m_State == EState::Multiplexing && !m_H2->is_failed()) {
+    m_H2->go_away();
+    // Whatever does not fit now goes out with the connection's next event.
+    if (m_H2->out().flush(m_Socket, m_Tls.get()) == detail::EFlush::Failed)
+      return false;
   }
-#endif
-  m_Config.server_socket = socket(AF_INET, SOCK_STREAM, 0);
-  if (m_Config.server_socket < 0) {
-#ifdef _WIN32
-    i32 err = WSAGetLastError();
-    return stl::make_error<>("Failed to create socket: " + std::to_string(err));
+  return !awaiting_request();
+}
+
+Clock::time_point Server::Connection::deadline() const {
+  const auto &config = m_Server.m_Config;
+  switch (m_State) {
+  case EState::Handshaking:
+    return m_RequestStarted + config.header_timeout;
+  case EState::Reading:
+    if (m_Reader.in_body())
+      return m_LastActive + config.body_timeout;
+    if (!m_In.empty())
+      return m_RequestStarted + config.header_timeout;
+    return m_LastActive + config.keep_alive_timeout;
+  case EState::Writing:
+    return m_LastActive + config.write_timeout;
+  case EState::Multiplexing:
+    if (!m_H2->out().empty() || m_H2->has_blocked_data())
+      return m_LastActive + config.write_timeout;
+    if (!m_StreamTasks.empty() || !m_Parked.empty())
+      break;
+    if (m_H2->stream_count() > 0)
+      return m_LastActive + config.body_timeout;
+    return m_LastActive + config.keep_alive_timeout;
+  case EState::Waiting:
+  case EState::Closed:
+    break;
+  }
+  return Clock::time_point::max();
+}
+
+bool Server::Connection::on_handshake() {
+  auto status = m_Tls->handshake();
+  if (status == detail::TlsStream::EHandshake::Failed) {
+    count_handshake(m_Metrics, *m_Tls, false);
+    return false;
+  }
+  bool wants_write = status == detail::TlsStream::EHandshake::WantWrite;
+  if (wants_write != m_WaitingWritable) {
+    m_WaitingWritable = wants_write;
+    if (!m_Reactor.loop.poller().modify(
+            m_Socket, wants_write ? detail::IO_WRITE : detail::IO_READ, this))
+      return false;
+  }
+  if (status != detail::TlsStream::EHandshake::Done)
+    return true;
+  count_handshake(m_Metrics, *m_Tls, true);
+  m_State = EState::Reading;
+  m_LastActive = Clock::now();
+  m_RequestStarted = m_LastActive;
+  if (m_Server.m_Config.http2 && m_Tls->alpn() == "h2")
+    return start_h2();
+  // The first request may have come in the same flight as the client's
+  // Finished message.
+  return on_readable();
+}
+
+bool Server::Connection::read_input() {
+  char buffer[k_ReadChunk];
+  while (true) {
+    auto n = detail::read_some(m_Socket, m_Tls.get(), buffer, sizeof(buffer));
+    if (n > 0) {
+      m_In.append(buffer, n);
+      continue;
+    }
+    if (n == 0) {
+      // Half-closed peer: answer what it already sent, then hang up.
+      m_CloseAfterWrite = true;
+      break;
+    }
+    i32 err = detail::last_socket_error();
+    if (detail::is_interrupted(err))
+      continue;
+    if (detail::is_would_block(err))
+      break;
+    return false;
+  }
+  return true;
+}
+
+bool Server::Connection::on_readable() {
+  bool awaiting = awaiting_request();
+  if (!read_input())
+    return false;
+  m_LastActive = Clock::now();
+  if (awaiting)
+    m_RequestStarted = m_LastActive;
+  if (m_Server.m_Config.http2 && !m_Tls && m_Served == 0 &&
+      m_Reader.is_idle()) {
+    switch (detail::match_preface(m_In)) {
+    case detail::EPreface::Present:
+      return start_h2();
+    case detail::EPreface::Partial:
+      return !m_CloseAfterWrite;
+    case detail::EPreface::Absent:
+      break;
+    }
+  }
+  return process();
+}
+
+bool Server::Connection::process() {
+  bool keep_alive = true;
+  while (keep_alive) {
+    auto status = m_Reader.read(m_In);
+    if (m_Reader.take_continue())
+      m_Out.push_view(k_Continue);
+    if (status == RequestReader::EStatus::NeedMore)
+      break;
+    if (status == RequestReader::EStatus::Failed) {
+      if (m_Metrics)
+        m_Metrics->parse_errors.add();
+      detail::write_response(m_Out, error_response(m_Reader.error_status()));
+      keep_alive = false;
+      break;
+    }
+    if (m_Metrics)
+      m_Metrics->parse.record(m_Reader.take_parse_time());
+    // Whatever is left in m_In belongs to the next request's head.
+    m_RequestStarted = m_LastActive;
+    Exchange exchange{m_Out, m_Socket, m_Tls.get(), m_Metrics, m_Served++,
+                      m_Reader.keep_alive(), m_Reader.accepts_chunked()};
+    if (auto open = answer(m_Reader.take_request(), exchange))
+      return *open;
+    keep_alive = exchange.keep_alive;
+  }
+  if (!keep_alive)
+    m_CloseAfterWrite = true;
+  if (m_Out.empty())
+    return !m_CloseAfterWrite;
+  m_State = EState::Writing;
+  return on_writable();
+}
+
+std::optional<bool> Server::Connection::answer(Request req,
+                                               Exchange &exchange) {
+  exchange.can_defer = true;
+  if (m_Server.m_Cache)
+    exchange.wake = waker();
+  auto resp = m_Server.process_request(std::move(req), exchange);
+  if (exchange.deferred)
+    return defer(std::move(exchange.deferred));
+  if (exchange.parked)
+    return park(0, exchange);
+  if (m_Arena && m_Reader.is_idle())
+    m_Arena->reset();
+  if (!resp)
+    return std::nullopt;
+  if (!m_Metrics) {
+    detail::write_response(m_Out, std::move(*resp));
+    return std::nullopt;
+  }
+  auto started = detail::MetricsClock::now();
+  detail::write_response(m_Out, std::move(*resp));
+  m_WriteTime += detail::elapsed_ns(started);
+  return std::nullopt;
+}
+
+// Parks the connection until its suspended handler completes. Reading stops
+// meanwhile: requests pipelined behind it have to wait their turn anyway, and
+// a readable socket nobody drains would wake the loop over and over.
+bool Server::Connection::defer(std::unique_ptr<Deferred> deferred) {
+  m_Deferred = std::move(deferred);
+  m_Deferred->on_done = [this]() {
+    // Still inside the task's frame, which finish_deferred() frees.
+    m_Reactor.loop.post([this]() { finish_deferred(); });
+  };
+  return hold();
+}
+
+bool Server::Connection::hold() {
+  m_State = EState::Waiting;
+  // Answers to earlier pipelined requests go out as far as the socket takes
+  // them now; the rest follows the one waited for.
+  if (m_Out.flush(m_Socket, m_Tls.get()) == detail::EFlush::Failed)
+    return false;
+  return m_Reactor.loop.poller().modify(m_Socket, 0, this);
+}
+
+// Parks a request until the response it waits for lands in the cache,
+// rather than blocking the loop on a handler running on another.
+bool Server::Connection::park(u32 stream, Exchange &exchange) {
+  m_Parked.insert_or_assign(
+      stream, Parked{std::move(*exchange.parked), exchange.served,
+                     exchange.wants_keep_alive, exchange.accepts_chunked});
+  return exchange.multiplexed || hold();
+}
+
+const std::function<void()> *Server::Connection::waker() {
+  if (!m_Waker) {
+    m_Waker = [&reactor = m_Reactor, sock = m_Socket]() {
+      // The connection is looked up again, as it may be gone by then.
+      reactor.loop.post_external(
+          [&reactor, sock]() { reactor.unpark(sock); });
+    };
+  }
+  return &m_Waker;
+}
+
+void Server::Connection::unpark() {
+  bool open = true;
+  if (m_State == EState::Multiplexing && !m_Parked.empty()) {
+    auto parked = std::move(m_Parked);
+    m_Parked.clear();
+    for (auto &[stream, request] : parked)
+      serve_stream(stream, std::move(request.req));
+    open = serve_streams();
+  } else if (m_State == EState::Waiting && !m_Parked.empty()) {
+    auto request = std::move(m_Parked.begin()->second);
+    m_Parked.clear();
+    Exchange exchange{m_Out, m_Socket, m_Tls.get(), m_Metrics, request.served,
+                      request.wants_keep_alive, request.accepts_chunked};
+    if (auto waiting = answer(std::move(request.req), exchange)) {
+      open = *waiting;
+    } else {
+      if (!exchange.keep_alive)
+        m_CloseAfterWrite = true;
+      m_State = EState::Writing;
+      open = m_Reactor.loop.poller().modify(m_Socket, detail::IO_READ, this) &&
+             on_writable();
+    }
+  } else {
+    return;
+  }
+  if (!open) {
+    m_State = EState::Closed;
+    m_Reactor.close(m_Socket);
+    return;
+  }
+  m_Reactor.arm(m_Socket, *this);
+}
+
+void Server::Connection::finish_deferred() {
+  // The client may have hung up while the handler was suspended.
+  if (m_State != EState::Waiting)
+    return;
+  auto deferred = std::move(m_Deferred);
+  Response resp = deferred->task->get();
+  m_Server.apply_middleware(deferred->req, resp);
+  if (m_Metrics) {
+    m_Metrics->handler.record(detail::elapsed_ns(deferred->started));
+    m_Metrics->requests.add();
+  }
+  if (m_Server.is_closing())
+    deferred->keep_alive = false;
+  resp.headers.set(EHeader::Connection,
+                   deferred->keep_alive ? "keep-alive" : "close");
+  if (!deferred->keep_alive)
+    m_CloseAfterWrite = true;
+  deferred.reset();
+  if (m_Arena && m_Reader.is_idle())
+    m_Arena->reset();
+  auto started = detail::MetricsClock::time_point();
+  if (m_Metrics)
+    started = detail::MetricsClock::now();
+  detail::write_response(m_Out, std::move(resp));
+  if (m_Metrics)
+    m_WriteTime += detail::elapsed_ns(started);
+  m_State = EState::Writing;
+  bool open = m_Reactor.loop.poller().modify(m_Socket, detail::IO_READ, this) &&
+              on_writable();
+  if (!open) {
+    m_State = EState::Closed;
+    m_Reactor.close(m_Socket);
+    return;
+  }
+  m_Reactor.arm(m_Socket, *this);
+}
+
+bool Server::Connection::on_writable() {
+  // Being writable again means the client took some of the output.
+  m_LastActive = Clock::now();
+  auto started = detail::MetricsClock::time_point();
+  if (m_Metrics)
+    started = detail::MetricsClock::now();
+  auto flushed = m_Out.flush(m_Socket, m_Tls.get());
+  if (m_Metrics) {
+    m_WriteTime += detail::elapsed_ns(started);
+    if (flushed == detail::EFlush::Done)
+      m_Metrics->write.record(std::exchange(m_WriteTime, 0));
+  }
+  switch (flushed) {
+  case detail::EFlush::Failed:
+    return false;
+  case detail::EFlush::Blocked:
+    if (!m_WaitingWritable) {
+      m_WaitingWritable = true;
+      return m_Reactor.loop.poller().modify(m_Socket, detail::IO_WRITE, this);
+    }
+    return true;
+  case detail::EFlush::Done:
+    break;
+  }
+  if (m_CloseAfterWrite)
+    return false;
+  m_State = EState::Reading;
+  if (m_WaitingWritable) {
+    m_WaitingWritable = false;
+    if (!m_Reactor.loop.poller().modify(m_Socket, detail::IO_READ, this))
+      return false;
+  }
+  // Requests pipelined behind the ones just answered may already be here.
+  return process();
+}
+
+bool Server::Connection::start_h2() {
+  if (m_Metrics)
+    m_Metrics->http2_connections.add();
+  detail::set_no_delay(m_Socket);
+  m_State = EState::Multiplexing;
+  m_H2 = std::make_unique<detail::H2Session>(
+      detail::H2Session::ERole::Server, *m_Server.m_Config.http2,
+      m_Server.m_Config.max_body_size);
+  m_H2->start();
+  m_H2->feed(m_In);
+  return serve_streams();
+}
+
+bool Server::Connection::on_h2(u32 events) {
+  if (events & (detail::IO_READ | detail::IO_CLOSED)) {
+    if (!read_input())
+      return false;
+    m_H2->feed(m_In);
+  }
+  m_LastActive = Clock::now();
+  return serve_streams();
+}
+
+bool Server::Connection::serve_streams() {
+  u32 stream;
+  Request req;
+  while (!m_H2->is_failed() && m_H2->next_request(stream, req))
+    serve_stream(stream, std::move(req));
+  if (m_Server.is_closing())
+    m_H2->go_away();
+  auto flushed = m_H2->out().flush(m_Socket, m_Tls.get());
+  if (flushed == detail::EFlush::Failed)
+    return false;
+  bool blocked = flushed == detail::EFlush::Blocked;
+  // Once the client hung up only answers to suspended handlers are left.
+  bool done = m_H2->is_finished() || m_CloseAfterWrite;
+  if (!blocked && done &&
+      (m_H2->is_failed() || (m_StreamTasks.empty() && m_Parked.empty())))
+    return false;
+  u32 events = 0;
+  if (!done)
+    events |= detail::IO_READ;
+  if (blocked)
+    events |= detail::IO_WRITE;
+  if (events != m_Events) {
+    m_Events = events;
+    return m_Reactor.loop.poller().modify(m_Socket, events, this);
+  }
+  return true;
+}
+
+void Server::Connection::serve_stream(u32 stream, Request req) {
+  bool head_only = req.method == EMethod::HEAD;
+  Exchange exchange{m_H2->out(), m_Socket, m_Tls.get(), m_Metrics, 0,
+                    true, true};
+  exchange.can_defer = true;
+  exchange.multiplexed = true;
+  if (m_Server.m_Cache)
+    exchange.wake = waker();
+  auto resp = m_Server.process_request(std::move(req), exchange);
+  if (exchange.parked) {
+    park(stream, exchange);
+    return;
+  }
+  if (exchange.deferred) {
+    auto &deferred = m_StreamTasks[stream];
+    deferred = std::move(exchange.deferred);
+    deferred->on_done = [this, stream]() {
+      m_Reactor.loop.post([this, stream]() { finish_stream(stream); });
+    };
+    return;
+  }
+  if (resp)
+    m_H2->respond(stream, std::move(*resp), head_only);
+  else
+    m_H2->reset(stream);
+}
+
+void Server::Connection::finish_stream(u32 stream) {
+  // The connection may have closed while the handler was suspended.
+  auto it = m_StreamTasks.find(stream);
+  if (m_State != EState::Multiplexing || it == m_StreamTasks.end())
+    return;
+  auto deferred = std::move(it->second);
+  m_StreamTasks.erase(it);
+  Response resp = deferred->task->get();
+  m_Server.apply_middleware(deferred->req, resp);
+  if (m_Metrics) {
+    m_Metrics->handler.record(detail::elapsed_ns(deferred->started));
+    m_Metrics->requests.add();
+  }
+  m_H2->respond(stream, std::move(resp),
+                deferred->req.method == EMethod::HEAD);
+  deferred.reset();
+  if (!serve_streams()) {
+    m_State = EState::Closed;
+    m_Reactor.close(m_Socket);
+    return;
+  }
+  m_Reactor.arm(m_Socket, *this);
+}
+
+// Pins `thread` to one core, chosen round-robin by `index`.
+static void pin_to_cpu(std::thread &thread, u32 index) {
+#ifdef __linux__
+  u32 cores = std::max(1u, std::thread::hardware_concurrency());
+  cpu_set_t set;
+  CPU_ZERO(&set);
+  CPU_SET(index % cores, &set);
+  pthread_setaffinity_np(thread.native_handle(), sizeof(set), &set);
 #else
-    return stl::make_error<>("Failed to create socket: " +
-                             std::string(strerror(errno)));
+  (void)thread;
+  (void)index;
 #endif
+}
+
+void Server::run_event_loops() {
+  for (i32 sock : m_Listeners) {
+    if (!detail::set_nonblocking(sock))
+      return;
+  }
+  size_t listeners = m_Listeners.size();
+  u32 count = std::max<u32>({1, m_Config.event_loop_threads,
+                             static_cast<u32>(listeners)});
+  // With reuse_port every loop owns a listener and the kernel balances
+  // between them; loops beyond the listeners' number share theirs.
+  std::vector<std::unique_ptr<Reactor>> reactors;
+  for (u32 i = 0; i < count; ++i) {
+    auto reactor = std::make_unique<Reactor>(*this, m_Listeners[i % listeners]);
+    if (!reactor->open(i % listeners + listeners < count))
+      break;
+    reactors.push_back(std::move(reactor));
+  }
+  // Pinned loops all get their own thread so the caller's affinity is left
+  // alone.
+  size_t first = m_Config.pin_threads ? 0 : 1;
+  std::vector<std::thread> threads;
+  for (size_t i = first; i < reactors.size(); ++i) {
+    threads.emplace_back([&reactor = *reactors[i]]() { reactor.run(); });
+    if (m_Config.pin_threads)
+      pin_to_cpu(threads.back(), static_cast<u32>(i));
   }
+  if (first == 1 && !reactors.empty())
+    reactors[0]->run();
+  for (auto &t : threads)
+    t.join();
+}
+
+// Creates a socket bound to the configured address and port and starts
+// listening on it.
+static stl::result<i32> open_listener(const ServerConfig &config) {
+  std::string port = std::to_string(config.port);
+  struct addrinfo hints{}, *res = nullptr;
+  hints.ai_family = AF_UNSPEC;
+  hints.ai_socktype = SOCK_STREAM;
+  hints.ai_flags = AI_PASSIVE;
+  const char *host =
+      config.bind_address.empty() ? nullptr : config.bind_address.c_str();
+  i32 gai_result = getaddrinfo(host, port.c_str(), &hints, &res);
+  if (gai_result != 0 || res == nullptr) {
+    return stl::make_error<i32>("Failed to resolve bind address " +
+                                config.bind_address);
+  }
+  auto fail = [&](std::string what, i32 sock) {
+    std::string error = what + detail::socket_error_string(
+                                   detail::last_socket_error());
+    if (sock >= 0)
+      detail::close_socket(sock);
+    freeaddrinfo(res);
+    return stl::make_error<i32>(error);
+  };
+  i32 sock = static_cast<i32>(
+      socket(res->ai_family, res->ai_socktype, res->ai_protocol));
+  if (sock < 0)
+    return fail("Failed to create socket: ", sock);
   i32 opt = 1;
-  setsockopt(m_Config.server_socket, SOL_SOCKET, SO_REUSEADDR,
-             (const char *)&opt, sizeof(opt));
-  sockaddr_in addr{};
-  addr.sin_family = AF_INET;
-  addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
-  addr.sin_port = htons(m_Config.port);
-  if (bind(m_Config.server_socket, (sockaddr *)&addr, sizeof(addr)) < 0) {
-#ifdef _WIN32
-    i32 err = WSAGetLastError();
-    closesocket(m_Config.server_socket);
-    return stl::make_error<>("Failed to bind to port " +
-                             std::to_string(m_Config.port) + ": " +
-                             std::to_string(err));
+  setsockopt(sock, SOL_SOCKET, SO_REUSEADDR, (const char *)&opt, sizeof(opt));
+  if (config.reuse_port) {
+#ifdef SO_REUSEPORT
+    if (setsockopt(sock, SOL_SOCKET, SO_REUSEPORT, (const char *)&opt,
+                   sizeof(opt)) < 0)
+      return fail("Failed to set SO_REUSEPORT: ", sock);
 #else
-    close(m_Config.server_socket);
-    return stl::make_error<>("Failed to bind to port " +
-                             std::to_string(m_Config.port) + ": " +
-                             std::string(strerror(errno)));
+    detail::close_socket(sock);
+    freeaddrinfo(res);
+    return stl::make_error<i32>("SO_REUSEPORT is not supported");
 #endif
   }
-  if (listen(m_Config.server_socket, 10) < 0) {
+  if (res->ai_family == AF_INET6) {
+    // Let "::" accept IPv4 clients too; Windows defaults to IPv6 only.
+    i32 v6_only = 0;
+    setsockopt(sock, IPPROTO_IPV6, IPV6_V6ONLY, (const char *)&v6_only,
+               sizeof(v6_only));
+  }
+  if (bind(sock, res->ai_addr, static_cast<socklen_t>(res->ai_addrlen)) < 0) {
+    return fail("Failed to bind to port " + port + ": ", sock);
+  }
+  if (listen(sock, config.listen_backlog) < 0)
+    return fail("Failed to listen: ", sock);
+  freeaddrinfo(res);
+  return sock;
+}
+
+stl::result<> Server::start() {
+  if (m_Config.reuse_port && !m_Config.use_event_loop)
+    return stl::make_error<>("reuse_port requires use_event_loop");
+  std::vector<i32> adopted = m_Config.server_sockets;
+  if (m_Config.server_socket >= 0)
+    adopted.insert(adopted.begin(), m_Config.server_socket);
+  if (adopted.size() > 1 && !m_Config.use_event_loop)
+    return stl::make_error<>("server_sockets requires use_event_loop");
+  auto router = std::make_unique<detail::Router>();
+  for (size_t i = 0; i < m_Routes.size(); ++i) {
+    if (m_Routes[i].is_static)
+      continue;
+    auto added = router->add(m_Routes[i].path, m_Routes[i].method, i);
+    if (!added)
+      return added;
+  }
+  if (m_Config.tls) {
+    auto tls = *m_Config.tls;
+    auto &alpn = tls.alpn;
+    bool offered = std::find(alpn.begin(), alpn.end(), "h2") != alpn.end();
+    if (m_Config.http2 && !offered)
+      alpn.insert(alpn.begin(), "h2");
+    auto context = detail::TlsContext::create_server(tls);
+    if (!context)
+      return stl::make_error<>(context.error());
+    m_Tls = std::move(context.value());
+  }
+  if (m_Config.max_connections > 0 || m_Config.max_connections_per_ip > 0) {
+    m_Limiter = std::make_unique<detail::ConnectionLimiter>(
+        m_Config.max_connections, m_Config.max_connections_per_ip);
+  }
+  m_Router = std::move(router);
+  if (m_Config.collect_metrics)
+    m_Metrics = std::make_unique<detail::MetricsRegistry>(m_Routes.size());
 #ifdef _WIN32
-    i32 err = WSAGetLastError();
-    closesocket(m_Config.server_socket);
-    return stl::make_error<>("Failed to listen: " + std::to_string(err));
-#else
-    close(m_Config.server_socket);
-    return stl::make_error<>("Failed to listen: " +
-                             std::string(strerror(errno)));
+  WSADATA wsa_data;
+  if (WSAStartup(MAKEWORD(2, 2), &wsa_data) != 0) {
+    return stl::make_error<>("Failed to initialize Winsock");
+  }
 #endif
+  u32 count = m_Config.reuse_port
+                  ? std::max<u32>(1, m_Config.event_loop_threads)
+                  : 1;
+  // Adopted sockets are the only ones; loops take them in turn.
+  m_SharesListeners = !adopted.empty();
+  if (m_SharesListeners) {
+    m_Listeners = std::move(adopted);
+    count = 0;
   }
+  for (u32 i = 0; i < count; ++i) {
+    auto listener = open_listener(m_Config);
+    if (!listener) {
+      close_listeners();
+      return stl::make_error<>(listener.error());
+    }
+    m_Listeners.push_back(listener.value());
+  }
+  m_IsDraining = false;
+  m_Dropped = false;
   m_IsRunning = true;
   return stl::result_success();
 }
 
 void Server::run() {
-  while (m_IsRunning.load()) {
-    sockaddr_in client_addr{};
+  {
+    std::lock_guard lock(m_ServeMutex);
+    // Stopped already, and the listeners with it.
+    if (m_Listeners.empty())
+      return;
+    m_IsServing = true;
+  }
+  if (m_Config.use_event_loop)
+    run_event_loops();
+  else
+    accept_clients();
+  {
+    std::lock_guard lock(m_ServeMutex);
+    m_IsServing = false;
+    // stop() leaves the listeners to us while we may still poll them.
+    if (!m_IsRunning.load())
+      close_listeners();
+  }
+  m_Served.notify_all();
+}
+
+void Server::accept_clients() {
+  std::unique_ptr<detail::BoundedQueue<i32>> pending;
+  if (m_Config.is_multithreaded) {
+    pending = std::make_unique<detail::BoundedQueue<i32>>(
+        std::max<u32>(1, m_Config.max_pending_connections));
+    u32 workers = m_Config.worker_threads;
+    if (workers == 0)
+      workers = std::max(1u, std::thread::hardware_concurrency());
+    for (u32 i = 0; i < workers; ++i) {
+      m_WorkerThreads.emplace_back([this, queue = pending.get()]() {
+        while (auto sock = queue->pop())
+          handle_client(*sock);
+      });
+    }
+  }
+  // Only run() closes it while we are here.
+  i32 listener = m_Listeners.front();
+  while (m_IsRunning.load() && !m_IsDraining.load()) {
+    // Polled rather than left blocking in accept(), which neither a drain
+    // nor a stop could interrupt, so both are seen within a tick.
+    if (!detail::wait_readable(listener, k_LoopTick))
+      continue;
+    sockaddr_storage client_addr{};
     socklen_t client_len = sizeof(client_addr);
     i32 client_socket =
-        accept(m_Config.server_socket, (sockaddr *)&client_addr, &client_len);
+        accept(listener, (sockaddr *)&client_addr, &client_len);
     if (client_socket < 0) {
 #ifdef _WIN32
       int err = WSAGetLastError();
@@ -218,29 +1653,122 @@ void Server::run() {
       continue;
 #endif
     }
-    if (m_Config.is_multithreaded) {
-      std::thread([this, client_socket]() {
-        handle_client(client_socket);
-      }).detach();
+    auto *metrics = local_metrics();
+    if (metrics)
+      metrics->connections_accepted.add();
+    if (m_Limiter && !m_Limiter->admit(client_socket, client_addr)) {
+      refuse(client_socket, m_Tls != nullptr, metrics);
+      continue;
+    }
+    if (pending) {
+      if (!pending->try_push(client_socket)) {
+        if (m_Limiter)
+          m_Limiter->release(client_socket);
+        refuse(client_socket, m_Tls != nullptr, metrics);
+      }
     } else {
       handle_client(client_socket);
     }
   }
+  if (pending) {
+    // Draining, the workers still serve the connections accepted already.
+    if (m_IsDraining.load()) {
+      pending->finish();
+    } else {
+      for (i32 sock : pending->close())
+        close_connection(m_Limiter.get(), sock);
+    }
+    for (auto &worker : m_WorkerThreads)
+      worker.join();
+    m_WorkerThreads.clear();
+  }
 }
 
-void Server::stop() {
-  m_IsRunning.store(false);
-  if (m_Config.server_socket >= 0) {
+ServerMetrics Server::metrics() const {
+  ServerMetrics snapshot;
+  snapshot.routes.reserve(m_Routes.size());
+  for (auto &route : m_Routes)
+    snapshot.routes.push_back({route.path, route.method, 0, 0, {}});
+  if (m_Metrics)
+    m_Metrics->collect(snapshot);
+  return snapshot;
+}
+
+void Server::expose_metrics(std::string_view path) {
+  route(path, EMethod::GET, [this](const Request &) {
+    Response resp(200, metrics().to_prometheus());
+    resp.headers.set(EHeader::ContentType, "text/plain; version=0.0.4");
+    // A response cache must not hold scrapes back.
+    resp.headers.set("Cache-Control", "no-store");
+    return resp;
+  });
+}
+
+void Server::use(Middleware middleware) {
+  if (m_Router)
+    return;
+  m_Middleware.push_back(std::move(middleware));
+}
+
+void Server::cache_responses(ResponseCacheConfig config) {
+  if (m_Router)
+    return;
+  m_Cache = std::make_unique<detail::ResponseCache>(std::move(config));
+}
+
+void Server::apply_middleware(const Request &req, Response &resp) const {
+  for (const auto &middleware : m_Middleware)
+    middleware(req, resp);
+}
+
+void Server::close_listeners() {
+  for (i32 sock : m_Listeners) {
+    // Shutting a shared listener down would stop every process using it.
+    if (!m_SharesListeners.load()) {
 #ifdef _WIN32
-    ::shutdown(m_Config.server_socket, SD_BOTH);
-    closesocket(m_Config.server_socket);
-    WSACleanup();
+      ::shutdown(sock, SD_BOTH);
 #else
-    ::shutdown(m_Config.server_socket, SHUT_RDWR);
-    close(m_Config.server_socket);
+      ::shutdown(sock, SHUT_RDWR);
+#endif
+    }
+    detail::close_socket(sock);
+  }
+  m_Listeners.clear();
+#ifdef _WIN32
+  // Pairs with the WSAStartup() in start().
+  WSACleanup();
 #endif
-    m_Config.server_socket = -1;
+}
+
+bool Server::shutdown(std::chrono::milliseconds grace) {
+  {
+    std::unique_lock lock(m_ServeMutex);
+    if (m_IsServing && m_IsRunning.load()) {
+      m_DrainDeadline = Clock::now() + grace;
+      m_IsDraining.store(true);
+      m_Served.wait(lock, [this]() { return !m_IsServing; });
+    }
   }
+  stop();
+  return !m_Dropped.load();
+}
+
+stl::result<> Server::hand_off(std::string_view path) {
+  std::lock_guard lock(m_ServeMutex);
+  if (m_Listeners.empty())
+    return stl::make_error<>("Server is not listening");
+  auto sent = detail::send_sockets(path, m_Listeners);
+  if (sent)
+    m_SharesListeners.store(true);
+  return sent;
+}
+
+void Server::stop() {
+  m_IsRunning.store(false);
+  std::lock_guard lock(m_ServeMutex);
+  // Otherwise run() closes them once its loops have seen the flag.
+  if (!m_IsServing && !m_Listeners.empty())
+    close_listeners();
 }
 
 } // namespace http
\ No newline at end of file
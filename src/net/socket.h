@@ -0,0 +1,269 @@
+#pragma once
+
+#include "types.h"
+#include <chrono>
+#include <string>
+#include <string_view>
+
+#ifdef _WIN32
+#include <winsock2.h>
+#include <ws2tcpip.h>
+#pragma comment(lib, "ws2_32.lib")
+#else
+#include <arpa/inet.h>
+#include <cerrno>
+#include <cstring>
+#include <fcntl.h>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <unistd.h>
+#endif
+#if defined(__linux__)
+#include <csignal>
+#include <pthread.h>
+#endif
+
+// Small platform shims shared by the client and server translation units.
+namespace http::detail {
+
+// Writing to a peer that already hung up must fail with EPIPE instead of
+// raising SIGPIPE in the host process.
+#ifdef MSG_NOSIGNAL
+inline constexpr i32 k_SendFlags = MSG_NOSIGNAL;
+#else
+inline constexpr i32 k_SendFlags = 0;
+#endif
+
+inline void close_socket(i32 sock) {
+#ifdef _WIN32
+  closesocket(sock);
+#else
+  close(sock);
+#endif
+}
+
+inline i32 last_socket_error() {
+#ifdef _WIN32
+  return WSAGetLastError();
+#else
+  return errno;
+#endif
+}
+
+inline void set_socket_error(i32 err) {
+#ifdef _WIN32
+  WSASetLastError(err);
+#else
+  errno = err;
+#endif
+}
+
+inline constexpr i32 k_WouldBlock =
+#ifdef _WIN32
+    WSAEWOULDBLOCK;
+#else
+    EWOULDBLOCK;
+#endif
+
+inline bool is_would_block(i32 err) {
+#ifdef _WIN32
+  return err == WSAEWOULDBLOCK;
+#else
+  return err == EAGAIN || err == EWOULDBLOCK;
+#endif
+}
+
+inline bool is_interrupted(i32 err) {
+#ifdef _WIN32
+  return err == WSAEINTR;
+#else
+  return err == EINTR;
+#endif
+}
+
+inline std::string socket_error_string(i32 err) {
+#ifdef _WIN32
+  return std::to_string(err);
+#else
+  return std::string(strerror(err));
+#endif
+}
+
+// A non-blocking connect() that has not completed yet.
+inline bool is_in_progress(i32 err) {
+#ifdef _WIN32
+  return err == WSAEWOULDBLOCK;
+#else
+  return err == EINPROGRESS;
+#endif
+}
+
+inline constexpr i32 k_TimedOut =
+#ifdef _WIN32
+    WSAETIMEDOUT;
+#else
+    ETIMEDOUT;
+#endif
+
+// The error a non-blocking connect() finished with, 0 once connected.
+inline i32 pending_socket_error(i32 sock) {
+  i32 err = 0;
+  socklen_t len = sizeof(err);
+  if (getsockopt(sock, SOL_SOCKET, SO_ERROR, reinterpret_cast<char *>(&err),
+                 &len) != 0)
+    return last_socket_error();
+  return err;
+}
+
+// Bounds single blocking recv() and send() calls, which then fail with
+// would-block.
+inline void set_io_timeouts(i32 sock, std::chrono::milliseconds recv_timeout,
+                            std::chrono::milliseconds send_timeout) {
+  auto apply = [sock](i32 option, std::chrono::milliseconds timeout) {
+#ifdef _WIN32
+    DWORD value = static_cast<DWORD>(timeout.count());
+#else
+    timeval value{};
+    value.tv_sec = static_cast<time_t>(timeout.count() / 1000);
+    value.tv_usec = static_cast<suseconds_t>(timeout.count() % 1000 * 1000);
+#endif
+    setsockopt(sock, SOL_SOCKET, option, reinterpret_cast<const char *>(&value),
+               sizeof(value));
+  };
+  apply(SO_RCVTIMEO, recv_timeout);
+  apply(SO_SNDTIMEO, send_timeout);
+}
+
+inline bool set_nonblocking(i32 sock, bool enabled = true) {
+#ifdef _WIN32
+  u_long mode = enabled ? 1 : 0;
+  return ioctlsocket(sock, FIONBIO, &mode) == 0;
+#else
+  i32 flags = fcntl(sock, F_GETFL, 0);
+  if (flags < 0)
+    return false;
+  flags = enabled ? flags | O_NONBLOCK : flags & ~O_NONBLOCK;
+  return fcntl(sock, F_SETFL, flags) == 0;
+#endif
+}
+
+// Sends small writes at once instead of holding them back for an ACK. An
+// HTTP/2 connection needs this: its WINDOW_UPDATE and SETTINGS frames are
+// tiny and, held back, stall the peer.
+inline void set_no_delay(i32 sock) {
+  i32 on = 1;
+  setsockopt(sock, IPPROTO_TCP, TCP_NODELAY,
+             reinterpret_cast<const char *>(&on), sizeof(on));
+}
+
+// Blocks until `sock` is readable. Returns false on timeout or error.
+inline bool wait_readable(i32 sock, std::chrono::milliseconds timeout) {
+#ifdef _WIN32
+  WSAPOLLFD p{};
+  p.fd = sock;
+  p.events = POLLRDNORM;
+  return WSAPoll(&p, 1, static_cast<i32>(timeout.count())) > 0;
+#else
+  pollfd p{};
+  p.fd = sock;
+  p.events = POLLIN;
+  i32 n;
+  do {
+    n = ::poll(&p, 1, static_cast<i32>(timeout.count()));
+  } while (n < 0 && errno == EINTR);
+  return n > 0;
+#endif
+}
+
+// Blocks until `sock` can take more output. Returns false on timeout or
+// error.
+inline bool wait_writable(i32 sock, std::chrono::milliseconds timeout) {
+#ifdef _WIN32
+  WSAPOLLFD p{};
+  p.fd = sock;
+  p.events = POLLWRNORM;
+  return WSAPoll(&p, 1, static_cast<i32>(timeout.count())) > 0;
+#else
+  pollfd p{};
+  p.fd = sock;
+  p.events = POLLOUT;
+  i32 n;
+  do {
+    n = ::poll(&p, 1, static_cast<i32>(timeout.count()));
+  } while (n < 0 && errno == EINTR);
+  return n > 0 && !(p.revents & (POLLERR | POLLHUP | POLLNVAL));
+#endif
+}
+
+// Blocks until `sock` is readable (with `read`) or can take more output
+// (with `write`). An error or hang-up counts as ready, for the next read or
+// write to report. Returns false on timeout.
+inline bool wait_ready(i32 sock, bool read, bool write,
+                       std::chrono::milliseconds timeout) {
+#ifdef _WIN32
+  WSAPOLLFD p{};
+  p.fd = sock;
+  p.events = (read ? POLLRDNORM : 0) | (write ? POLLWRNORM : 0);
+  return WSAPoll(&p, 1, static_cast<i32>(timeout.count())) > 0;
+#else
+  pollfd p{};
+  p.fd = sock;
+  p.events = static_cast<short>((read ? POLLIN : 0) | (write ? POLLOUT : 0));
+  i32 n;
+  do {
+    n = ::poll(&p, 1, static_cast<i32>(timeout.count()));
+  } while (n < 0 && errno == EINTR);
+  return n > 0;
+#endif
+}
+
+#if defined(__linux__)
+// sendfile and OpenSSL's socket writes have no MSG_NOSIGNAL, so SIGPIPE is
+// blocked on this thread while they run and a signal raised by a dead peer
+// is consumed before unblocking.
+class SigpipeGuard {
+public:
+  SigpipeGuard() {
+    sigemptyset(&m_Pipe);
+    sigaddset(&m_Pipe, SIGPIPE);
+    sigpending(&m_Pending);
+    m_WasPending = sigismember(&m_Pending, SIGPIPE) == 1;
+    pthread_sigmask(SIG_BLOCK, &m_Pipe, &m_Old);
+  }
+  ~SigpipeGuard() {
+    if (m_Raised && !m_WasPending) {
+      timespec zero{};
+      while (sigtimedwait(&m_Pipe, nullptr, &zero) < 0 && errno == EINTR) {
+      }
+    }
+    pthread_sigmask(SIG_SETMASK, &m_Old, nullptr);
+  }
+  void raised() { m_Raised = true; }
+
+private:
+  sigset_t m_Pipe, m_Old, m_Pending;
+  bool m_WasPending{false};
+  bool m_Raised{false};
+};
+#endif
+
+// Sends all of `data`, looping over partial writes.
+inline bool send_all(i32 sock, std::string_view data) {
+  size_t sent = 0;
+  while (sent < data.size()) {
+    auto n = ::send(sock, data.data() + sent,
+                    static_cast<i32>(data.size() - sent), k_SendFlags);
+    if (n < 0 && is_interrupted(last_socket_error()))
+      continue;
+    if (n <= 0)
+      return false;
+    sent += n;
+  }
+  return true;
+}
+
+} // namespace http::detail
@@ -0,0 +1,365 @@
+#include "static_files.h"
+#include "scan.h"
+#include <charconv>
+#include <cstdio>
+#include <optional>
+
+namespace http::detail {
+
+namespace {
+enum class ERange { Ignore, Satisfiable, Unsatisfiable };
+
+struct ContentType {
+  std::string_view extension;
+  std::string_view type;
+};
+
+constexpr ContentType k_ContentTypes[] = {
+    {"css", "text/css"},
+    {"gif", "image/gif"},
+    {"htm", "text/html"},
+    {"html", "text/html"},
+    {"ico", "image/x-icon"},
+    {"jpeg", "image/jpeg"},
+    {"jpg", "image/jpeg"},
+    {"js", "text/javascript"},
+    {"json", "application/json"},
+    {"map", "application/json"},
+    {"mjs", "text/javascript"},
+    {"mp4", "video/mp4"},
+    {"pdf", "application/pdf"},
+    {"png", "image/png"},
+    {"svg", "image/svg+xml"},
+    {"txt", "text/plain"},
+    {"wasm", "application/wasm"},
+    {"webp", "image/webp"},
+    {"woff", "font/woff"},
+    {"woff2", "font/woff2"},
+    {"xml", "application/xml"},
+};
+
+i32 hex_value(char c) {
+  if (c >= '0' && c <= '9')
+    return c - '0';
+  if (c >= 'a' && c <= 'f')
+    return c - 'a' + 10;
+  if (c >= 'A' && c <= 'F')
+    return c - 'A' + 10;
+  return -1;
+}
+
+std::optional<std::string> percent_decode(std::string_view text) {
+  std::string decoded;
+  decoded.reserve(text.size());
+  for (size_t i = 0; i < text.size(); ++i) {
+    if (text[i] != '%') {
+      decoded.push_back(text[i]);
+      continue;
+    }
+    if (i + 2 >= text.size())
+      return std::nullopt;
+    i32 high = hex_value(text[i + 1]), low = hex_value(text[i + 2]);
+    if (high < 0 || low < 0)
+      return std::nullopt;
+    decoded.push_back(static_cast<char>(high * 16 + low));
+    i += 2;
+  }
+  return decoded;
+}
+
+// Rejects anything that could name a file outside the served directory.
+bool is_safe_path(std::string_view path) {
+  if (path.find('\0') != std::string_view::npos ||
+      path.find('\\') != std::string_view::npos ||
+      path.find(':') != std::string_view::npos) {
+    return false;
+  }
+  while (!path.empty()) {
+    size_t end = std::min(path.find('/'), path.size());
+    auto segment = path.substr(0, end);
+    if (segment == "." || segment == "..")
+      return false;
+    path.remove_prefix(std::min(end + 1, path.size()));
+  }
+  return true;
+}
+
+// If-None-Match uses weak comparison, so a W/ prefix is ignored.
+bool etag_matches(std::string_view header, std::string_view etag) {
+  return for_each_member(header, [etag](std::string_view candidate) {
+    if (candidate == "*")
+      return true;
+    if (candidate.substr(0, 2) == "W/")
+      candidate.remove_prefix(2);
+    return candidate == etag;
+  });
+}
+
+bool parse_offset(std::string_view text, std::uint64_t &value) {
+  if (text.empty())
+    return false;
+  auto [end, ec] = std::from_chars(text.data(), text.data() + text.size(),
+                                   value);
+  return ec == std::errc() && end == text.data() + text.size();
+}
+
+// Parses a single `bytes=` range into [first, last]. Multiple ranges and
+// unknown units are ignored, which answers them with the whole file.
+ERange parse_range(std::string_view header, std::uint64_t size,
+                   std::uint64_t &first, std::uint64_t &last) {
+  header = trim_ows(header);
+  constexpr std::string_view k_Unit = "bytes=";
+  if (header.substr(0, k_Unit.size()) != k_Unit)
+    return ERange::Ignore;
+  auto spec = trim_ows(header.substr(k_Unit.size()));
+  size_t dash = spec.find('-');
+  if (dash == std::string_view::npos ||
+      spec.find(',') != std::string_view::npos) {
+    return ERange::Ignore;
+  }
+  auto start = trim_ows(spec.substr(0, dash));
+  auto end = trim_ows(spec.substr(dash + 1));
+  if (start.empty()) {
+    std::uint64_t suffix = 0;
+    if (!parse_offset(end, suffix))
+      return ERange::Ignore;
+    if (suffix == 0 || size == 0)
+      return ERange::Unsatisfiable;
+    first = size - std::min(suffix, size);
+    last = size - 1;
+    return ERange::Satisfiable;
+  }
+  if (!parse_offset(start, first))
+    return ERange::Ignore;
+  last = size == 0 ? 0 : size - 1;
+  if (!end.empty()) {
+    std::uint64_t requested = 0;
+    if (!parse_offset(end, requested) || requested < first)
+      return ERange::Ignore;
+    last = std::min(last, requested);
+  }
+  return first < size ? ERange::Satisfiable : ERange::Unsatisfiable;
+}
+
+std::string make_etag(const FileInfo &info) {
+  char buffer[48];
+  auto *end = buffer;
+  *end++ = '"';
+  end = std::to_chars(end, buffer + sizeof(buffer), info.size, 16).ptr;
+  *end++ = '-';
+  end = std::to_chars(end, buffer + sizeof(buffer),
+                      static_cast<std::uint64_t>(info.mtime_ns), 16)
+            .ptr;
+  *end++ = '"';
+  return std::string(buffer, end);
+}
+
+bool same_file(const FileInfo &a, const FileInfo &b) {
+  return a.size == b.size && a.mtime_ns == b.mtime_ns && a.inode == b.inode;
+}
+
+Response not_found() { return Response(404, "Not Found"); }
+} // namespace
+
+std::string http_date(std::int64_t seconds) {
+  static constexpr const char *k_Days[] = {"Thu", "Fri", "Sat", "Sun",
+                                           "Mon", "Tue", "Wed"};
+  static constexpr const char *k_Months[] = {"Jan", "Feb", "Mar", "Apr",
+                                             "May", "Jun", "Jul", "Aug",
+                                             "Sep", "Oct", "Nov", "Dec"};
+  std::int64_t days = seconds / 86400, rest = seconds % 86400;
+  if (rest < 0) {
+    rest += 86400;
+    --days;
+  }
+  const char *weekday = k_Days[((days % 7) + 7) % 7];
+  // Civil date from days since 1970-01-01 (Howard Hinnant's algorithm).
+  std::int64_t z = days + 719468;
+  std::int64_t era = (z >= 0 ? z : z - 146096) / 146097;
+  std::int64_t doe = z - era * 146097;
+  std::int64_t yoe = (doe - doe / 1460 + doe / 36524 - doe / 146096) / 365;
+  std::int64_t doy = doe - (365 * yoe + yoe / 4 - yoe / 100);
+  std::int64_t mp = (5 * doy + 2) / 153;
+  i32 day = static_cast<i32>(doy - (153 * mp + 2) / 5 + 1);
+  i32 month = static_cast<i32>(mp < 10 ? mp + 3 : mp - 9);
+  i32 year = static_cast<i32>(yoe + era * 400 + (month <= 2 ? 1 : 0));
+  i32 clock = static_cast<i32>(rest);
+
+  char buffer[40];
+  std::snprintf(buffer, sizeof(buffer), "%s, %02d %s %04d %02d:%02d:%02d GMT",
+                weekday, day, k_Months[month - 1], year, clock / 3600,
+                clock % 3600 / 60, clock % 60);
+  return buffer;
+}
+
+std::string_view content_type_for(std::string_view path) {
+  size_t dot = path.rfind('.');
+  if (dot == std::string_view::npos ||
+      path.find('/', dot) != std::string_view::npos) {
+    return "application/octet-stream";
+  }
+  std::string extension(path.substr(dot + 1));
+  ascii_lower(extension, extension.data());
+  for (const auto &entry : k_ContentTypes) {
+    if (entry.extension == extension)
+      return entry.type;
+  }
+  return "application/octet-stream";
+}
+
+StaticFiles::StaticFiles(std::string directory, StaticFileConfig config)
+    : m_Directory(std::move(directory)), m_Config(std::move(config)) {
+  while (m_Directory.size() > 1 && m_Directory.back() == '/')
+    m_Directory.pop_back();
+}
+
+size_t StaticFiles::cached_files() const {
+  std::lock_guard lock(m_Mutex);
+  return m_Lru.size();
+}
+
+std::shared_ptr<StaticFiles::Entry>
+StaticFiles::load(const std::string &path) {
+  auto opened = FileHandle::open(path);
+  if (!opened || !opened.value()->info().is_regular)
+    return nullptr;
+  auto entry = std::make_shared<Entry>();
+  entry->file = std::move(opened.value());
+  const auto &info = entry->file->info();
+  entry->etag = make_etag(info);
+  std::int64_t seconds = info.mtime_ns / 1000000000;
+  if (info.mtime_ns < 0 && info.mtime_ns % 1000000000 != 0)
+    --seconds;
+  entry->last_modified = http_date(seconds);
+  entry->content_type = content_type_for(path);
+  return entry;
+}
+
+std::shared_ptr<const StaticFiles::Entry>
+StaticFiles::lookup(const std::string &path) {
+  auto now = Clock::now();
+  std::shared_ptr<Entry> cached;
+  {
+    std::lock_guard lock(m_Mutex);
+    auto it = m_Index.find(path);
+    if (it != m_Index.end()) {
+      m_Lru.splice(m_Lru.begin(), m_Lru, it->second);
+      cached = it->second->second;
+      if (now - cached->checked < m_Config.revalidate_after)
+        return cached;
+    }
+  }
+
+  // Disk access happens outside the lock; concurrent misses on one path
+  // may both open it, and the last one in wins.
+  std::shared_ptr<Entry> fresh;
+  if (cached) {
+    auto info = FileHandle::stat(path);
+    if (info && same_file(info.value(), cached->file->info()))
+      fresh = cached;
+  }
+  if (!fresh)
+    fresh = load(path);
+
+  std::lock_guard lock(m_Mutex);
+  auto it = m_Index.find(path);
+  if (!fresh) {
+    if (it != m_Index.end()) {
+      m_Lru.erase(it->second);
+      m_Index.erase(it);
+    }
+    return nullptr;
+  }
+  fresh->checked = now;
+  if (it != m_Index.end()) {
+    it->second->second = fresh;
+    return fresh;
+  }
+  if (m_Config.max_cached_files == 0)
+    return fresh;
+  m_Lru.emplace_front(path, fresh);
+  m_Index.emplace(path, m_Lru.begin());
+  while (m_Lru.size() > m_Config.max_cached_files) {
+    m_Index.erase(m_Lru.back().first);
+    m_Lru.pop_back();
+  }
+  return fresh;
+}
+
+Response StaticFiles::serve(const Request &req, std::string_view relative) {
+  auto decoded = percent_decode(relative);
+  if (!decoded || !is_safe_path(*decoded))
+    return not_found();
+  std::string path = m_Directory + "/" + *decoded;
+  if (decoded->empty() || decoded->back() == '/')
+    path += m_Config.index_file;
+  auto entry = lookup(path);
+  if (!entry)
+    return not_found();
+
+  auto if_none_match = req.headers.get("If-None-Match");
+  if (!if_none_match.empty() && etag_matches(if_none_match, entry->etag)) {
+    Response resp(304);
+    resp.headers.remove(EHeader::ContentLength);
+    resp.headers.remove(EHeader::ContentType);
+    resp.headers.set("ETag", entry->etag);
+    resp.headers.set("Last-Modified", entry->last_modified);
+    return resp;
+  }
+
+  std::uint64_t size = entry->file->info().size;
+  std::uint64_t first = 0, last = size == 0 ? 0 : size - 1;
+  Response resp(200);
+  auto range = req.headers.get("Range");
+  auto if_range = req.headers.get("If-Range");
+  if (!range.empty() && (if_range.empty() || if_range == entry->etag)) {
+    switch (parse_range(range, size, first, last)) {
+    case ERange::Unsatisfiable: {
+      Response unsatisfiable(416);
+      unsatisfiable.headers.set("Content-Range",
+                                "bytes */" + std::to_string(size));
+      return unsatisfiable;
+    }
+    case ERange::Satisfiable:
+      resp.status_code = 206;
+      resp.headers.set("Content-Range", "bytes " + std::to_string(first) +
+                                            "-" + std::to_string(last) + "/" +
+                                            std::to_string(size));
+      break;
+    case ERange::Ignore:
+      first = 0;
+      last = size == 0 ? 0 : size - 1;
+      break;
+    }
+  }
+  std::uint64_t length = size == 0 ? 0 : last - first + 1;
+  resp.headers.set(EHeader::ContentLength, std::to_string(length));
+  resp.headers.set(EHeader::ContentType, entry->content_type);
+  resp.headers.set("ETag", entry->etag);
+  resp.headers.set("Last-Modified", entry->last_modified);
+  resp.headers.set("Accept-Ranges", "bytes");
+  if (req.method != EMethod::HEAD && length > 0)
+    resp.file = FileBody{entry->file, first, length};
+  return resp;
+}
+
+} // namespace http::detail
+
+namespace http {
+
+void Server::serve_static(std::string_view prefix, std::string directory,
+                          StaticFileConfig config) {
+  std::string pattern(prefix);
+  while (!pattern.empty() && pattern.back() == '/')
+    pattern.pop_back();
+  pattern.append("/*path");
+  auto files = std::make_shared<detail::StaticFiles>(std::move(directory),
+                                                     std::move(config));
+  auto handler = [files](const Request &req) {
+    return files->serve(req, req.params.get("path"));
+  };
+  route(pattern, EMethod::GET, handler);
+  route(pattern, EMethod::HEAD, handler);
+}
+
+} // namespace http
@@ -0,0 +1,52 @@
+#pragma once
+
+#include "file.h"
+#include "net/http.h"
+#include <list>
+#include <mutex>
+#include <unordered_map>
+
+namespace http::detail {
+
+// Answers requests for files below one directory. Open descriptors and
+// their validators are kept in an LRU cache, so a hot file costs no open or
+// stat per request and a matching If-None-Match costs no syscall at all.
+class StaticFiles {
+public:
+  StaticFiles(std::string directory, StaticFileConfig config);
+
+  // `relative` is the still percent-encoded path below the directory.
+  Response serve(const Request &req, std::string_view relative);
+
+  size_t cached_files() const;
+
+private:
+  using Clock = std::chrono::steady_clock;
+
+  struct Entry {
+    std::shared_ptr<const FileHandle> file;
+    std::string etag;
+    std::string last_modified;
+    std::string_view content_type;
+    Clock::time_point checked;
+  };
+  using Lru = std::list<std::pair<std::string, std::shared_ptr<Entry>>>;
+
+  // Returns the cached entry for `path`, opening or revalidating it as
+  // needed, or nullptr when it is not a readable regular file.
+  std::shared_ptr<const Entry> lookup(const std::string &path);
+  std::shared_ptr<Entry> load(const std::string &path);
+
+  std::string m_Directory;
+  StaticFileConfig m_Config;
+  mutable std::mutex m_Mutex;
+  Lru m_Lru;
+  std::unordered_map<std::string, Lru::iterator> m_Index;
+};
+
+// Formats seconds since the epoch as an IMF-fixdate, e.g.
+// "Sun, 06 Nov 1994 08:49:37 GMT".
+std::string http_date(std::int64_t seconds);
+std::string_view content_type_for(std::string_view path);
+
+} // namespace http::detail
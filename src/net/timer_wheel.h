@@ -0,0 +1,55 @@
+#pragma once
+
+#include <algorithm>
+#include <chrono>
+#include <vector>
+
+namespace http::detail {
+
+// Coarse deadlines for many entries at once. Filing an entry is O(1) and
+// advance() only visits the slots that came due, so a loop with thousands
+// of connections pays nothing per tick for the ones far from expiry.
+// Entries come back at or after their deadline, at most a tick late; ones
+// beyond the span of the wheel come back early, for the caller to file
+// again. Entries are never removed: the caller recognises stale ones.
+template <typename T> class TimerWheel {
+public:
+  using Clock = std::chrono::steady_clock;
+
+  TimerWheel(std::chrono::milliseconds tick, size_t slots,
+             Clock::time_point now = Clock::now())
+      : m_Tick(tick), m_Slots(std::max<size_t>(2, slots)), m_Now(now) {}
+
+  void schedule(T value, Clock::time_point when) {
+    size_t ticks = 1;
+    if (when > m_Now) {
+      auto ahead = (when - m_Now + m_Tick - Clock::duration{1}) / m_Tick;
+      ticks = std::clamp<size_t>(static_cast<size_t>(ahead), 1,
+                                 m_Slots.size() - 1);
+    }
+    m_Slots[(m_Current + ticks) % m_Slots.size()].push_back(std::move(value));
+  }
+
+  // Turns the wheel up to `now`, handing every entry in the slots it
+  // passes to `on_due`, which may schedule again.
+  template <typename Fn> void advance(Clock::time_point now, Fn &&on_due) {
+    while (m_Now + m_Tick <= now) {
+      m_Now += m_Tick;
+      m_Current = (m_Current + 1) % m_Slots.size();
+      m_Due.swap(m_Slots[m_Current]);
+      for (auto &value : m_Due)
+        on_due(value);
+      m_Due.clear();
+    }
+  }
+
+private:
+  Clock::duration m_Tick;
+  std::vector<std::vector<T>> m_Slots;
+  // Reused between slots so a steady load stops allocating.
+  std::vector<T> m_Due;
+  size_t m_Current{0};
+  Clock::time_point m_Now;
+};
+
+} // namespace http::detail
@@ -0,0 +1,527 @@
+#include "tls.h"
+#include <algorithm>
+
+#ifdef SAP_HTTP_TLS
+#include <openssl/err.h>
+#include <openssl/ssl.h>
+#include <openssl/x509v3.h>
+#endif
+
+namespace http::detail {
+
+namespace {
+std::mutex g_ClientMutex;
+std::shared_ptr<TlsContext> g_Client;
+} // namespace
+
+stl::result<std::shared_ptr<TlsContext>> TlsContext::client() {
+  std::lock_guard lock(g_ClientMutex);
+  if (!g_Client) {
+    auto created = create_client({});
+    if (!created)
+      return created;
+    g_Client = std::move(created.value());
+  }
+  return g_Client;
+}
+
+stl::result<> TlsContext::configure_client(const ClientTlsConfig &config) {
+  auto created = create_client(config);
+  if (!created)
+    return stl::make_error<>(created.error());
+  std::shared_ptr<TlsContext> previous;
+  {
+    std::lock_guard lock(g_ClientMutex);
+    previous = std::exchange(g_Client, std::move(created.value()));
+  }
+  // Streams still open keep the old context alive until they close.
+  return stl::result_success();
+}
+
+#ifdef SAP_HTTP_TLS
+
+namespace {
+// The socket error reported once OpenSSL has given up on a session.
+#ifdef _WIN32
+constexpr i32 k_Aborted = WSAECONNABORTED;
+#else
+constexpr i32 k_Aborted = ECONNABORTED;
+#endif
+// Plaintext per SSL_write when copying a file, one full record.
+constexpr size_t k_FileChunk = 16 * 1024;
+// Largest sendfile handed to kernel TLS at once.
+constexpr std::uint64_t k_MaxFileChunk = std::uint64_t{1} << 30;
+
+// `what`, followed by the oldest queued OpenSSL error if there is one.
+std::string ssl_error(std::string_view what) {
+  std::string error(what);
+  unsigned long code = ERR_get_error();
+  if (code != 0) {
+    char reason[256];
+    ERR_error_string_n(code, reason, sizeof(reason));
+    error.append(": ");
+    error.append(reason);
+  }
+  ERR_clear_error();
+  return error;
+}
+
+template <typename T> stl::result<T> ssl_failure(std::string_view what) {
+  return stl::make_error<T>(ssl_error(what));
+}
+
+// Slot on client SSL objects pointing back at their TlsStream.
+i32 stream_index() {
+  static const i32 index =
+      SSL_get_ex_new_index(0, nullptr, nullptr, nullptr, nullptr);
+  return index;
+}
+
+// Length-prefixed protocol names, as ALPN puts them on the wire.
+std::string alpn_wire(const std::vector<std::string> &protocols) {
+  std::string wire;
+  for (const auto &protocol : protocols) {
+    if (protocol.empty() || protocol.size() > 255)
+      continue;
+    wire.push_back(static_cast<char>(protocol.size()));
+    wire.append(protocol);
+  }
+  return wire;
+}
+
+// Picks the first server protocol the client also offers.
+i32 select_alpn(SSL *, const unsigned char **out, unsigned char *out_length,
+                const unsigned char *offered, unsigned int offered_length,
+                void *arg) {
+  const auto *ours = static_cast<const std::string *>(arg);
+  unsigned char *selected = nullptr;
+  if (SSL_select_next_proto(
+          &selected, out_length,
+          reinterpret_cast<const unsigned char *>(ours->data()),
+          static_cast<unsigned int>(ours->size()), offered,
+          offered_length) != OPENSSL_NPN_NEGOTIATED)
+    return SSL_TLSEXT_ERR_NOACK;
+  *out = selected;
+  return SSL_TLSEXT_ERR_OK;
+}
+
+bool is_ip_address(const std::string &host) {
+  unsigned char address[sizeof(in6_addr)];
+  return inet_pton(AF_INET, host.c_str(), address) == 1 ||
+         inet_pton(AF_INET6, host.c_str(), address) == 1;
+}
+
+// Settings both sides share.
+void configure_common(SSL_CTX *ctx, bool ktls) {
+  SSL_CTX_set_min_proto_version(ctx, TLS1_2_VERSION);
+  std::uint64_t options = SSL_OP_NO_RENEGOTIATION;
+#ifdef SSL_OP_IGNORE_UNEXPECTED_EOF
+  // HTTP framing already tells a truncated message from a complete one.
+  options |= SSL_OP_IGNORE_UNEXPECTED_EOF;
+#endif
+#ifdef SSL_OP_ENABLE_KTLS
+  if (ktls)
+    options |= SSL_OP_ENABLE_KTLS;
+#else
+  (void)ktls;
+#endif
+  SSL_CTX_set_options(ctx, options);
+  // WireQueue resumes a blocked write from wherever its segments now are.
+  SSL_CTX_set_mode(ctx, SSL_MODE_ENABLE_PARTIAL_WRITE |
+                            SSL_MODE_ACCEPT_MOVING_WRITE_BUFFER);
+}
+} // namespace
+
+stl::result<std::shared_ptr<TlsContext>>
+TlsContext::create_server(const TlsConfig &config) {
+  using Result = std::shared_ptr<TlsContext>;
+  SSL_CTX *ctx = SSL_CTX_new(TLS_server_method());
+  if (!ctx)
+    return ssl_failure<Result>("Failed to create TLS context");
+  std::shared_ptr<TlsContext> context(new TlsContext(ctx, true));
+  configure_common(ctx, config.ktls);
+  if (!config.session_tickets)
+    SSL_CTX_set_options(ctx, SSL_OP_NO_TICKET);
+  if (SSL_CTX_use_certificate_chain_file(
+          ctx, config.certificate_file.c_str()) != 1)
+    return ssl_failure<Result>("Failed to load TLS certificate " +
+                               config.certificate_file);
+  if (SSL_CTX_use_PrivateKey_file(ctx, config.private_key_file.c_str(),
+                                  SSL_FILETYPE_PEM) != 1)
+    return ssl_failure<Result>("Failed to load TLS private key " +
+                               config.private_key_file);
+  if (SSL_CTX_check_private_key(ctx) != 1)
+    return ssl_failure<Result>("TLS private key does not match certificate");
+  if (config.session_cache_size > 0) {
+    static constexpr unsigned char k_SessionContext[] = "sap_http";
+    SSL_CTX_set_session_id_context(ctx, k_SessionContext,
+                                   sizeof(k_SessionContext) - 1);
+    SSL_CTX_set_session_cache_mode(ctx, SSL_SESS_CACHE_SERVER);
+    SSL_CTX_sess_set_cache_size(ctx,
+                                static_cast<long>(config.session_cache_size));
+  } else {
+    SSL_CTX_set_session_cache_mode(ctx, SSL_SESS_CACHE_OFF);
+  }
+  context->m_Alpn = alpn_wire(config.alpn);
+  if (!context->m_Alpn.empty())
+    SSL_CTX_set_alpn_select_cb(ctx, select_alpn, &context->m_Alpn);
+  return context;
+}
+
+stl::result<std::shared_ptr<TlsContext>>
+TlsContext::create_client(const ClientTlsConfig &config) {
+  using Result = std::shared_ptr<TlsContext>;
+  SSL_CTX *ctx = SSL_CTX_new(TLS_client_method());
+  if (!ctx)
+    return ssl_failure<Result>("Failed to create TLS context");
+  std::shared_ptr<TlsContext> context(new TlsContext(ctx, false));
+  configure_common(ctx, config.ktls);
+  if (config.verify_peer) {
+    SSL_CTX_set_verify(ctx, SSL_VERIFY_PEER, nullptr);
+    bool loaded =
+        config.ca_file.empty() && config.ca_path.empty()
+            ? SSL_CTX_set_default_verify_paths(ctx) == 1
+            : SSL_CTX_load_verify_locations(
+                  ctx,
+                  config.ca_file.empty() ? nullptr : config.ca_file.c_str(),
+                  config.ca_path.empty() ? nullptr
+                                         : config.ca_path.c_str()) == 1;
+    if (!loaded)
+      return ssl_failure<Result>("Failed to load TLS trust store");
+  }
+  context->m_ResumeSessions =
+      config.resume_sessions && config.session_cache_size > 0;
+  context->m_SessionLimit = config.session_cache_size;
+  if (context->m_ResumeSessions) {
+    // Sessions are kept per host:port here rather than in OpenSSL's cache,
+    // which a client never looks up by itself.
+    SSL_CTX_set_session_cache_mode(ctx, SSL_SESS_CACHE_CLIENT |
+                                            SSL_SESS_CACHE_NO_INTERNAL_STORE);
+    SSL_CTX_sess_set_new_cb(ctx, &TlsContext::on_new_session);
+  } else {
+    SSL_CTX_set_session_cache_mode(ctx, SSL_SESS_CACHE_OFF);
+  }
+  context->m_Alpn = alpn_wire({"http/1.1"});
+  // Unlike almost every other OpenSSL call, 0 means success.
+  if (SSL_CTX_set_alpn_protos(
+          ctx, reinterpret_cast<const unsigned char *>(context->m_Alpn.data()),
+          static_cast<unsigned int>(context->m_Alpn.size())) != 0)
+    return ssl_failure<Result>("Failed to set ALPN protocols");
+  return context;
+}
+
+TlsContext::~TlsContext() {
+  for (auto &[key, session] : m_Sessions)
+    SSL_SESSION_free(session);
+  SSL_CTX_free(m_Ctx);
+}
+
+stl::result<std::unique_ptr<TlsStream>>
+TlsContext::open(i32 sock, std::string_view host, std::string_view port,
+                 bool offer_h2) {
+  using Result = std::unique_ptr<TlsStream>;
+  SSL *ssl = SSL_new(m_Ctx);
+  if (!ssl)
+    return ssl_failure<Result>("Failed to create TLS session");
+  std::unique_ptr<TlsStream> stream(
+      new TlsStream(shared_from_this(), ssl, sock));
+  if (SSL_set_fd(ssl, sock) != 1)
+    return ssl_failure<Result>("Failed to attach TLS session");
+  if (m_IsServer) {
+    SSL_set_accept_state(ssl);
+    return stream;
+  }
+  SSL_set_connect_state(ssl);
+  std::string name(host);
+  // SNI carries host names only; an address is matched against the
+  // certificate's IP entries instead.
+  bool named = !is_ip_address(name);
+  if (named && (SSL_set_tlsext_host_name(ssl, name.c_str()) != 1 ||
+                SSL_set1_host(ssl, name.c_str()) != 1))
+    return ssl_failure<Result>("Failed to set TLS host name");
+  if (!named &&
+      X509_VERIFY_PARAM_set1_ip_asc(SSL_get0_param(ssl), name.c_str()) != 1)
+    return ssl_failure<Result>("Failed to set TLS host address");
+  static const std::string k_H2Alpn = alpn_wire({"h2", "http/1.1"});
+  if (offer_h2 &&
+      SSL_set_alpn_protos(
+          ssl, reinterpret_cast<const unsigned char *>(k_H2Alpn.data()),
+          static_cast<unsigned int>(k_H2Alpn.size())) != 0)
+    return ssl_failure<Result>("Failed to set ALPN protocols");
+  if (m_ResumeSessions) {
+    stream->m_SessionKey = name + ":" + std::string(port);
+    SSL_set_ex_data(ssl, stream_index(), stream.get());
+    if (auto *session = find_session(stream->m_SessionKey)) {
+      SSL_set_session(ssl, session);
+      SSL_SESSION_free(session);
+    }
+  }
+  return stream;
+}
+
+ssl_session_st *TlsContext::find_session(const std::string &key) {
+  std::lock_guard lock(m_Mutex);
+  auto it = m_SessionIndex.find(key);
+  if (it == m_SessionIndex.end())
+    return nullptr;
+  m_Sessions.splice(m_Sessions.begin(), m_Sessions, it->second);
+  SSL_SESSION *session = it->second->second;
+  SSL_SESSION_up_ref(session);
+  return session;
+}
+
+void TlsContext::store_session(const std::string &key,
+                               ssl_session_st *session) {
+  std::vector<SSL_SESSION *> evicted;
+  {
+    std::lock_guard lock(m_Mutex);
+    auto it = m_SessionIndex.find(key);
+    if (it != m_SessionIndex.end()) {
+      // The newest ticket replaces the one it was issued for.
+      evicted.push_back(std::exchange(it->second->second, session));
+      m_Sessions.splice(m_Sessions.begin(), m_Sessions, it->second);
+    } else {
+      m_Sessions.emplace_front(key, session);
+      m_SessionIndex.emplace(key, m_Sessions.begin());
+    }
+    while (m_Sessions.size() > m_SessionLimit) {
+      evicted.push_back(m_Sessions.back().second);
+      m_SessionIndex.erase(m_Sessions.back().first);
+      m_Sessions.pop_back();
+    }
+  }
+  for (auto *old : evicted)
+    SSL_SESSION_free(old);
+}
+
+i32 TlsContext::on_new_session(ssl_st *ssl, ssl_session_st *session) {
+  auto *stream =
+      static_cast<TlsStream *>(SSL_get_ex_data(ssl, stream_index()));
+  if (!stream)
+    return 0;
+  stream->m_Context->store_session(stream->m_SessionKey, session);
+  // Returning 1 hands our reference to store_session().
+  return 1;
+}
+
+TlsStream::~TlsStream() {
+  // OpenSSL invalidates the session of a connection freed without a
+  // shutdown. The socket may already be closed, so the shutdown is only
+  // recorded, not sent; a connection that failed keeps that effect.
+  if (!m_Failed)
+    SSL_set_shutdown(m_Ssl, SSL_SENT_SHUTDOWN | SSL_RECEIVED_SHUTDOWN);
+  SSL_free(m_Ssl);
+}
+
+TlsStream::EHandshake TlsStream::handshake() {
+#if defined(__linux__)
+  SigpipeGuard guard;
+#endif
+  ERR_clear_error();
+  i32 rc = SSL_do_handshake(m_Ssl);
+  if (rc == 1)
+    return EHandshake::Done;
+  switch (SSL_get_error(m_Ssl, rc)) {
+  case SSL_ERROR_WANT_READ:
+    return EHandshake::WantRead;
+  case SSL_ERROR_WANT_WRITE:
+    return EHandshake::WantWrite;
+  default:
+    break;
+  }
+  m_Failed = true;
+#if defined(__linux__)
+  if (last_socket_error() == EPIPE)
+    guard.raised();
+#endif
+  long verified = SSL_get_verify_result(m_Ssl);
+  if (verified != X509_V_OK) {
+    m_Error = std::string("TLS certificate verification failed: ") +
+              X509_verify_cert_error_string(verified);
+    ERR_clear_error();
+  } else {
+    m_Error = ssl_error("TLS handshake failed");
+  }
+  return EHandshake::Failed;
+}
+
+stl::result<> TlsStream::handshake(std::chrono::milliseconds timeout) {
+  // Driven without blocking so a silent peer cannot hold the thread past
+  // `timeout`.
+  if (!set_nonblocking(m_Socket))
+    return stl::make_error<>("TLS handshake failed: cannot set socket mode");
+  auto deadline = std::chrono::steady_clock::now() + timeout;
+  auto status = handshake();
+  while (status == EHandshake::WantRead || status == EHandshake::WantWrite) {
+    auto left = std::chrono::duration_cast<std::chrono::milliseconds>(
+        deadline - std::chrono::steady_clock::now());
+    bool ready = left.count() > 0 &&
+                 (status == EHandshake::WantRead
+                      ? wait_readable(m_Socket, left)
+                      : wait_writable(m_Socket, left));
+    if (!ready) {
+      m_Error = "TLS handshake timed out";
+      status = EHandshake::Failed;
+      break;
+    }
+    status = handshake();
+  }
+  bool restored = set_nonblocking(m_Socket, false);
+  if (status == EHandshake::Failed)
+    return stl::make_error<>(m_Error);
+  if (!restored)
+    return stl::make_error<>("TLS handshake failed: cannot set socket mode");
+  return stl::result_success();
+}
+
+std::ptrdiff_t TlsStream::io_result(i32 rc) {
+  m_WantsWrite = false;
+  if (rc > 0)
+    return rc;
+  switch (SSL_get_error(m_Ssl, rc)) {
+  case SSL_ERROR_WANT_READ:
+    set_socket_error(k_WouldBlock);
+    return -1;
+  case SSL_ERROR_WANT_WRITE:
+    m_WantsWrite = true;
+    set_socket_error(k_WouldBlock);
+    return -1;
+  case SSL_ERROR_ZERO_RETURN:
+    return 0;
+  case SSL_ERROR_SYSCALL: {
+    ERR_clear_error();
+    // The socket call's own error, if it left one; none means EOF.
+    i32 err = last_socket_error();
+    if (err == 0)
+      return 0;
+    if (is_would_block(err) || is_interrupted(err))
+      set_socket_error(k_Aborted);
+    return -1;
+  }
+  default:
+    m_Failed = true;
+    m_Error = ssl_error("TLS error");
+    set_socket_error(k_Aborted);
+    return -1;
+  }
+}
+
+std::ptrdiff_t TlsStream::read(char *data, size_t size) {
+  ERR_clear_error();
+  set_socket_error(0);
+  return io_result(SSL_read(
+      m_Ssl, data, static_cast<i32>(std::min<size_t>(size, INT32_MAX))));
+}
+
+std::ptrdiff_t TlsStream::write(const char *data, size_t size) {
+  ERR_clear_error();
+  set_socket_error(0);
+  return io_result(SSL_write(
+      m_Ssl, data, static_cast<i32>(std::min<size_t>(size, INT32_MAX))));
+}
+
+std::ptrdiff_t TlsStream::send_file(const FileHandle &file,
+                                    std::uint64_t offset,
+                                    std::uint64_t length) {
+#if defined(SSL_OP_ENABLE_KTLS) && !defined(OPENSSL_NO_KTLS)
+  if (ktls_send()) {
+    ERR_clear_error();
+    set_socket_error(0);
+    auto n = SSL_sendfile(m_Ssl, file.fd(), static_cast<off_t>(offset),
+                          std::min(length, k_MaxFileChunk), 0);
+    if (n >= 0)
+      return n;
+    return io_result(-1);
+  }
+#else
+  (void)k_MaxFileChunk;
+#endif
+  char buffer[k_FileChunk];
+  auto n = file.read_at(buffer, std::min<std::uint64_t>(length, k_FileChunk),
+                        offset);
+  if (n <= 0)
+    return 0;
+  // Bytes read but not accepted are read again for the retry.
+  return write(buffer, static_cast<size_t>(n));
+}
+
+bool TlsStream::has_pending() const {
+  return SSL_pending(m_Ssl) > 0 || SSL_has_pending(m_Ssl) == 1;
+}
+
+bool TlsStream::resumed() const { return SSL_session_reused(m_Ssl) == 1; }
+
+bool TlsStream::ktls_send() const {
+#if defined(SSL_OP_ENABLE_KTLS) && !defined(OPENSSL_NO_KTLS)
+  return BIO_get_ktls_send(SSL_get_wbio(m_Ssl)) == 1;
+#else
+  return false;
+#endif
+}
+
+std::string_view TlsStream::alpn() const {
+  const unsigned char *protocol = nullptr;
+  unsigned int length = 0;
+  SSL_get0_alpn_selected(m_Ssl, &protocol, &length);
+  return protocol ? std::string_view(reinterpret_cast<const char *>(protocol),
+                                     length)
+                  : std::string_view();
+}
+
+bool TlsStream::check_idle() {
+  char byte;
+  ERR_clear_error();
+  i32 rc = SSL_read(m_Ssl, &byte, 1);
+  bool idle = rc <= 0 && SSL_get_error(m_Ssl, rc) == SSL_ERROR_WANT_READ;
+  ERR_clear_error();
+  return idle;
+}
+
+#else // !SAP_HTTP_TLS
+
+namespace {
+constexpr std::string_view k_NoTls =
+    "TLS support is not built in (configure with SAP_HTTP_WITH_TLS)";
+} // namespace
+
+stl::result<std::shared_ptr<TlsContext>>
+TlsContext::create_server(const TlsConfig &) {
+  return stl::make_error<std::shared_ptr<TlsContext>>(std::string(k_NoTls));
+}
+
+stl::result<std::shared_ptr<TlsContext>>
+TlsContext::create_client(const ClientTlsConfig &) {
+  return stl::make_error<std::shared_ptr<TlsContext>>(std::string(k_NoTls));
+}
+
+TlsContext::~TlsContext() = default;
+
+stl::result<std::unique_ptr<TlsStream>>
+TlsContext::open(i32, std::string_view, std::string_view, bool) {
+  return stl::make_error<std::unique_ptr<TlsStream>>(std::string(k_NoTls));
+}
+
+i32 TlsContext::on_new_session(ssl_st *, ssl_session_st *) { return 0; }
+
+// No context can be created, so no stream ever exists; these only satisfy
+// the callers compiled against them.
+TlsStream::~TlsStream() = default;
+TlsStream::EHandshake TlsStream::handshake() { return EHandshake::Failed; }
+stl::result<> TlsStream::handshake(std::chrono::milliseconds) {
+  return stl::make_error<>(std::string(k_NoTls));
+}
+std::ptrdiff_t TlsStream::read(char *, size_t) { return -1; }
+std::ptrdiff_t TlsStream::write(const char *, size_t) { return -1; }
+std::ptrdiff_t TlsStream::send_file(const FileHandle &, std::uint64_t,
+                                    std::uint64_t) {
+  return -1;
+}
+bool TlsStream::has_pending() const { return false; }
+bool TlsStream::resumed() const { return false; }
+bool TlsStream::ktls_send() const { return false; }
+std::string_view TlsStream::alpn() const { return {}; }
+bool TlsStream::check_idle() { return false; }
+
+#endif // SAP_HTTP_TLS
+
+} // namespace http::detail
@@ -0,0 +1,138 @@
+#pragma once
+
+#include "file.h"
+#include "net/http.h"
+#include "socket.h"
+#include <list>
+#include <unordered_map>
+
+// OpenSSL types stay out of every other translation unit.
+struct ssl_st;
+struct ssl_ctx_st;
+struct ssl_session_st;
+
+namespace http::detail {
+
+class TlsStream;
+
+// One SSL_CTX: the server's certificate, ALPN list and session cache, or
+// the client's trust store and the sessions it resumes, per host and port.
+class TlsContext : public std::enable_shared_from_this<TlsContext> {
+public:
+  static stl::result<std::shared_ptr<TlsContext>>
+  create_server(const TlsConfig &config);
+  static stl::result<std::shared_ptr<TlsContext>>
+  create_client(const ClientTlsConfig &config);
+  // The context every https Client call uses; see Client::configure_tls().
+  static stl::result<std::shared_ptr<TlsContext>> client();
+  static stl::result<> configure_client(const ClientTlsConfig &config);
+
+  ~TlsContext();
+  TlsContext(const TlsContext &) = delete;
+  TlsContext &operator=(const TlsContext &) = delete;
+
+  // A stream over the connected socket `sock`. `host` is verified against
+  // the peer certificate and sent as SNI; it is empty on the server side.
+  // A client stream with `offer_h2` offers HTTP/2 ahead of HTTP/1.1.
+  stl::result<std::unique_ptr<TlsStream>> open(i32 sock,
+                                               std::string_view host = {},
+                                               std::string_view port = {},
+                                               bool offer_h2 = false);
+
+private:
+  friend class TlsStream;
+
+  explicit TlsContext(ssl_ctx_st *ctx, bool is_server)
+      : m_Ctx(ctx), m_IsServer(is_server) {}
+
+  // Client side: the latest session for `key`, with a reference for the
+  // caller, or nullptr.
+  ssl_session_st *find_session(const std::string &key);
+  // Takes over the reference to `session`.
+  void store_session(const std::string &key, ssl_session_st *session);
+  // OpenSSL's new-session callback: files a ticket under its stream's key.
+  static i32 on_new_session(ssl_st *ssl, ssl_session_st *session);
+
+  ssl_ctx_st *m_Ctx;
+  bool m_IsServer;
+  // ALPN protocols in wire format, in server preference order.
+  std::string m_Alpn;
+  bool m_ResumeSessions{false};
+  size_t m_SessionLimit{0};
+  std::mutex m_Mutex;
+  std::list<std::pair<std::string, ssl_session_st *>> m_Sessions;
+  std::unordered_map<std::string, decltype(m_Sessions)::iterator>
+      m_SessionIndex;
+};
+
+// TLS on top of one socket, blocking or not. read() and write() follow the
+// recv()/send() contract: when the socket would block they return -1 with
+// last_socket_error() reporting would-block, and wants_write() tells which
+// readiness the retry waits for.
+class TlsStream {
+public:
+  enum class EHandshake { Done, WantRead, WantWrite, Failed };
+
+  ~TlsStream();
+  TlsStream(const TlsStream &) = delete;
+  TlsStream &operator=(const TlsStream &) = delete;
+
+  // Advances the handshake as far as the socket allows.
+  EHandshake handshake();
+  // Completes the handshake on a blocking socket within `timeout`.
+  stl::result<> handshake(std::chrono::milliseconds timeout);
+
+  std::ptrdiff_t read(char *data, size_t size);
+  std::ptrdiff_t write(const char *data, size_t size);
+  // Sends file bytes. With kernel TLS the kernel encrypts them straight
+  // from the page cache; otherwise they are read and written in chunks.
+  std::ptrdiff_t send_file(const FileHandle &file, std::uint64_t offset,
+                           std::uint64_t length);
+
+  // Decrypted or buffered bytes a read returns without touching the socket.
+  bool has_pending() const;
+  bool wants_write() const { return m_WantsWrite; }
+  bool resumed() const;
+  bool ktls_send() const;
+  // The protocol ALPN settled on, empty without one.
+  std::string_view alpn() const;
+  const std::string &error() const { return m_Error; }
+  // For a pooled non-blocking socket the peer may have written to: consumes
+  // session tickets and alerts and returns whether the connection is still
+  // usable with no application data waiting.
+  bool check_idle();
+
+private:
+  friend class TlsContext;
+
+  TlsStream(std::shared_ptr<TlsContext> context, ssl_st *ssl, i32 sock)
+      : m_Context(std::move(context)), m_Ssl(ssl), m_Socket(sock) {}
+
+  // Maps the result of an SSL call onto the recv()/send() contract.
+  std::ptrdiff_t io_result(i32 rc);
+
+  std::shared_ptr<TlsContext> m_Context;
+  ssl_st *m_Ssl;
+  i32 m_Socket;
+  bool m_WantsWrite{false};
+  // A protocol error or failed handshake ended the session.
+  bool m_Failed{false};
+  std::string m_Error;
+  std::string m_SessionKey;
+};
+
+// recv() for a socket with an optional TLS stream over it.
+inline std::ptrdiff_t read_some(i32 sock, TlsStream *tls, char *data,
+                                size_t size) {
+  if (tls)
+    return tls->read(data, size);
+  return ::recv(sock, data, static_cast<i32>(size), 0);
+}
+
+// wait_readable() that also counts bytes TLS already holds.
+inline bool wait_readable(i32 sock, TlsStream *tls,
+                          std::chrono::milliseconds timeout) {
+  return (tls && tls->has_pending()) || wait_readable(sock, timeout);
+}
+
+} // namespace http::detail
@@ -0,0 +1,240 @@
+#include "trace.h"
+#include <atomic>
+#include <cstdio>
+#include <random>
+
+namespace http {
+
+namespace {
+// Installed once per process and read by every request, so it is checked
+// without the lock first.
+struct ObserverSlot {
+  std::atomic<bool> set{false};
+  std::mutex mutex;
+  std::shared_ptr<const ClientObserver> observer;
+};
+
+ObserverSlot &observer_slot() {
+  static ObserverSlot slot;
+  return slot;
+}
+
+bool is_hex(std::string_view text) {
+  return std::all_of(text.begin(), text.end(), [](char c) {
+    return (c >= '0' && c <= '9') || (c >= 'a' && c <= 'f');
+  });
+}
+
+// `bytes` random bytes as lowercase hex; never all zeros, which W3C trace
+// context reserves for "invalid".
+std::string random_id(size_t bytes) {
+  static const char k_Digits[] = "0123456789abcdef";
+  thread_local std::mt19937_64 engine{std::random_device{}()};
+  std::string id;
+  do {
+    id.clear();
+    for (size_t i = 0; i < bytes; i += 8) {
+      std::uint64_t value = engine();
+      for (size_t j = 0; j < 8 && i + j < bytes; ++j) {
+        id.push_back(k_Digits[(value >> 4) & 0xf]);
+        id.push_back(k_Digits[value & 0xf]);
+        value >>= 8;
+      }
+    }
+  } while (id.find_first_not_of('0') == std::string::npos);
+  return id;
+}
+
+// Takes the trace id and parent span of a `traceparent` header
+// (version-traceid-parentid-flags); false when it is malformed.
+bool parse_traceparent(std::string_view value, ClientTrace &trace) {
+  if (value.size() < 55 || value[2] != '-' || value[35] != '-' ||
+      value[52] != '-')
+    return false;
+  auto version = value.substr(0, 2);
+  auto trace_id = value.substr(3, 32);
+  auto parent = value.substr(36, 16);
+  if (!is_hex(version) || version == "ff" || !is_hex(trace_id) ||
+      !is_hex(parent) || trace_id.find_first_not_of('0') == value.npos ||
+      parent.find_first_not_of('0') == value.npos)
+    return false;
+  trace.trace_id = trace_id;
+  trace.parent_span_id = parent;
+  return true;
+}
+
+void append_json_string(std::string &out, std::string_view text) {
+  out.push_back('"');
+  for (char c : text) {
+    auto byte = static_cast<unsigned char>(c);
+    if (c == '"' || c == '\\') {
+      out.push_back('\\');
+      out.push_back(c);
+    } else if (byte < 0x20) {
+      char escaped[8];
+      std::snprintf(escaped, sizeof(escaped), "\\u%04x", byte);
+      out.append(escaped);
+    } else {
+      out.push_back(c);
+    }
+  }
+  out.push_back('"');
+}
+
+// OTLP/JSON carries 64-bit integers as decimal strings.
+std::string unix_nanos(const ClientTrace &trace, ClientTrace::TimePoint at) {
+  auto wall = trace.wall_start.time_since_epoch() + (at - trace.start);
+  return std::to_string(
+      std::chrono::duration_cast<std::chrono::nanoseconds>(wall).count());
+}
+
+class JsonAttributes {
+public:
+  explicit JsonAttributes(std::string &out) : m_Out(out) {
+    m_Out.append("\"attributes\":[");
+  }
+  ~JsonAttributes() { m_Out.push_back(']'); }
+
+  void add(std::string_view key, std::string_view value) {
+    open(key, "stringValue");
+    append_json_string(m_Out, value);
+    m_Out.append("}}");
+  }
+  void add(std::string_view key, std::int64_t value) {
+    open(key, "intValue");
+    m_Out.append("\"" + std::to_string(value) + "\"}}");
+  }
+  void add(std::string_view key, bool value) {
+    open(key, "boolValue");
+    m_Out.append(value ? "true}}" : "false}}");
+  }
+
+private:
+  void open(std::string_view key, std::string_view type) {
+    if (m_Count++ > 0)
+      m_Out.push_back(',');
+    m_Out.append("{\"key\":");
+    append_json_string(m_Out, key);
+    m_Out.append(",\"value\":{\"");
+    m_Out.append(type);
+    m_Out.append("\":");
+  }
+
+  std::string &m_Out;
+  size_t m_Count{0};
+};
+} // namespace
+
+std::string ClientTrace::to_otlp_json() const {
+  std::string out;
+  out.reserve(1024);
+  out.append("{\"traceId\":\"" + trace_id + "\",\"spanId\":\"" + span_id +
+             "\"");
+  if (!parent_span_id.empty())
+    out.append(",\"parentSpanId\":\"" + parent_span_id + "\"");
+  out.append(",\"name\":");
+  append_json_string(out, method_to_string(method));
+  // SPAN_KIND_CLIENT.
+  out.append(",\"kind\":3,\"startTimeUnixNano\":\"" + unix_nanos(*this, start) +
+             "\",\"endTimeUnixNano\":\"" + unix_nanos(*this, end) + "\",");
+  {
+    bool default_port = (url.scheme == "https" && url.port == "443") ||
+                        (url.scheme == "http" && url.port == "80");
+    std::string full = url.scheme + "://" + url.host;
+    if (!default_port)
+      full.append(":" + url.port);
+    full.append(url.full_path());
+    JsonAttributes attributes(out);
+    attributes.add("http.request.method", method_to_string(method));
+    attributes.add("url.full", full);
+    attributes.add("server.address", url.host);
+    attributes.add("server.port", std::int64_t{std::atoi(url.port.c_str())});
+    attributes.add("network.protocol.version", http2 ? "2" : "1.1");
+    if (status_code > 0)
+      attributes.add("http.response.status_code", std::int64_t{status_code});
+    attributes.add("sap_http.connection.reused", reused);
+    attributes.add("sap_http.dns.cached", dns_cached);
+    attributes.add("sap_http.attempts", std::int64_t{attempts});
+    attributes.add("sap_http.bytes_sent",
+                   static_cast<std::int64_t>(bytes_sent));
+    attributes.add("sap_http.bytes_received",
+                   static_cast<std::int64_t>(bytes_received));
+  }
+  out.append(",\"events\":[");
+  const std::pair<const char *, TimePoint> events[] = {
+      {"dns.start", dns_start},         {"dns.end", dns_end},
+      {"connect.start", connect_start}, {"connect.end", connect_end},
+      {"tls.start", tls_start},         {"tls.end", tls_end},
+      {"request.start", write_start},   {"request.end", write_end},
+      {"response.first_byte", first_byte}};
+  bool first = true;
+  for (const auto &[name, at] : events) {
+    if (at == TimePoint{})
+      continue;
+    if (!first)
+      out.push_back(',');
+    first = false;
+    out.append("{\"timeUnixNano\":\"" + unix_nanos(*this, at) +
+               "\",\"name\":\"" + name + "\"}");
+  }
+  out.append("],\"status\":{");
+  // Client spans count 4xx answers as errors too.
+  if (!error.empty()) {
+    out.append("\"code\":2,\"message\":");
+    append_json_string(out, error);
+  } else if (status_code >= 400) {
+    out.append("\"code\":2");
+  }
+  out.append("}}");
+  return out;
+}
+
+namespace detail {
+
+std::shared_ptr<const ClientObserver> installed_observer() {
+  auto &slot = observer_slot();
+  if (!slot.set.load(std::memory_order_acquire))
+    return nullptr;
+  std::lock_guard lock(slot.mutex);
+  return slot.observer;
+}
+
+void install_observer(ClientObserver observer) {
+  auto &slot = observer_slot();
+  std::lock_guard lock(slot.mutex);
+  slot.observer = observer ? std::make_shared<const ClientObserver>(
+                                 std::move(observer))
+                           : nullptr;
+  slot.set.store(slot.observer != nullptr, std::memory_order_release);
+}
+
+RequestTrace::RequestTrace(const Request &req,
+                           std::shared_ptr<const ClientObserver> observer)
+    : m_Observer(std::move(observer)) {
+  if (!m_Observer)
+    return;
+  m_Trace = std::make_unique<ClientTrace>();
+  m_Trace->method = req.method;
+  m_Trace->url = req.url;
+  m_Trace->start = ClientTrace::Clock::now();
+  m_Trace->wall_start = std::chrono::system_clock::now();
+  if (!parse_traceparent(req.headers.get("traceparent"), *m_Trace))
+    m_Trace->trace_id = random_id(16);
+  m_Trace->span_id = random_id(8);
+}
+
+stl::result<Response> RequestTrace::finish(stl::result<Response> result) {
+  if (!m_Trace)
+    return result;
+  m_Trace->end = ClientTrace::Clock::now();
+  if (result)
+    m_Trace->status_code = result.value().status_code;
+  else
+    m_Trace->error = result.error();
+  (*m_Observer)(*m_Trace);
+  return result;
+}
+
+} // namespace detail
+
+} // namespace http
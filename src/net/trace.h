@@ -0,0 +1,35 @@
+#pragma once
+
+#include "net/http.h"
+
+namespace http::detail {
+
+// The observer installed with Client::observe(), or nullptr. Costs one
+// atomic load while there is none.
+std::shared_ptr<const ClientObserver> installed_observer();
+void install_observer(ClientObserver observer);
+
+// The trace of one client request, kept only while the request is
+// observed; get() is nullptr otherwise and every step skips tracing.
+class RequestTrace {
+public:
+  RequestTrace(const Request &req,
+               std::shared_ptr<const ClientObserver> observer);
+
+  ClientTrace *get() const { return m_Trace.get(); }
+  // Records how the request ended and reports it to the observer.
+  stl::result<Response> finish(stl::result<Response> result);
+
+private:
+  std::shared_ptr<const ClientObserver> m_Observer;
+  std::unique_ptr<ClientTrace> m_Trace;
+};
+
+// Stamps `point` of `trace`, when there is one, with the current time.
+inline void mark(ClientTrace *trace,
+                 ClientTrace::TimePoint ClientTrace::*point) {
+  if (trace)
+    trace->*point = ClientTrace::Clock::now();
+}
+
+} // namespace http::detail
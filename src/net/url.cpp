@@ -1,10 +1,11 @@
 #include "net/http.h"
+#include "scan.h"
 
 namespace http {
 
 URL URL::from_path(std::string_view path_and_query) {
   URL u;
-  auto query_pos = path_and_query.find('?');
+  auto query_pos = detail::find_byte(path_and_query, 0, '?');
   if (query_pos != std::string_view::npos) {
     u.path = path_and_query.substr(0, query_pos);
     u.query = path_and_query.substr(query_pos);
@@ -25,14 +26,17 @@ stl::result<URL> URL::parse(std::string_view raw_url) {
   u.scheme = raw_url.substr(0, scheme_end);
   pos = scheme_end + 3;
   // Parse host and optional port
-  auto path_start = raw_url.find('/', pos);
-  auto query_start = raw_url.find('?', pos);
-  auto host_end = std::min(path_start, query_start);
+  auto host_end = detail::find_either(raw_url, pos, '/', '?');
+  auto path_start = std::string_view::npos;
+  auto query_start = host_end;
   if (host_end == std::string_view::npos) {
     host_end = raw_url.length();
+  } else if (raw_url[host_end] == '/') {
+    path_start = host_end;
+    query_start = detail::find_byte(raw_url, host_end, '?');
   }
   auto host_port = raw_url.substr(pos, host_end - pos);
-  auto port_pos = host_port.find(':');
+  auto port_pos = detail::find_byte(host_port, 0, ':');
   if (port_pos != std::string_view::npos) {
     u.host = host_port.substr(0, port_pos);
     u.port = host_port.substr(port_pos + 1);
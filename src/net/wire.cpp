@@ -0,0 +1,359 @@
+#include "wire.h"
+#include "tls.h"
+#include <charconv>
+
+#ifndef _WIN32
+#include <sys/uio.h>
+#endif
+#if defined(__linux__)
+#include <sys/sendfile.h>
+#elif defined(__APPLE__) || defined(__FreeBSD__)
+#include <sys/types.h>
+#endif
+
+namespace http::detail {
+
+namespace {
+// Segments gathered into one send call.
+constexpr size_t k_MaxIov = 16;
+// Larger buffers are released rather than kept for reuse.
+constexpr size_t k_MaxSpareCapacity = 4096;
+constexpr size_t k_MaxSpare = 4;
+// Largest single sendfile call, and the copy buffer where there is none.
+constexpr std::uint64_t k_MaxFileChunk = std::uint64_t{1} << 30;
+constexpr size_t k_CopyChunk = 64 * 1024;
+// Largest TLS record payload.
+constexpr size_t k_TlsRecord = 16 * 1024;
+
+// Sends up to `length` bytes of `file` from `offset`. Returns the bytes
+// written, 0 if the file ended early, or -1 with the socket error set.
+std::ptrdiff_t send_file_chunk(i32 sock, const FileHandle &file,
+                               std::uint64_t offset, std::uint64_t length) {
+  length = std::min(length, k_MaxFileChunk);
+#if defined(__linux__)
+  off_t position = static_cast<off_t>(offset);
+  return ::sendfile(sock, file.fd(), &position, static_cast<size_t>(length));
+#elif defined(__APPLE__)
+  off_t sent = static_cast<off_t>(length);
+  i32 rc = ::sendfile(file.fd(), sock, static_cast<off_t>(offset), &sent,
+                      nullptr, 0);
+  // A partial write reports EAGAIN but still counts what went out.
+  if (sent > 0)
+    return static_cast<std::ptrdiff_t>(sent);
+  return rc == 0 ? 0 : -1;
+#elif defined(__FreeBSD__)
+  off_t sent = 0;
+  i32 rc = ::sendfile(file.fd(), sock, static_cast<off_t>(offset),
+                      static_cast<size_t>(length), nullptr, &sent, 0);
+  if (sent > 0)
+    return static_cast<std::ptrdiff_t>(sent);
+  return rc == 0 ? 0 : -1;
+#else
+  char buffer[k_CopyChunk];
+  auto n = file.read_at(buffer, std::min<std::uint64_t>(length, k_CopyChunk),
+                        offset);
+  if (n <= 0)
+    return 0;
+  // Bytes read but not accepted by the socket are read again next time.
+  return ::send(sock, buffer, static_cast<i32>(n), k_SendFlags);
+#endif
+}
+
+} // namespace
+
+std::string WireQueue::take_buffer() {
+  if (m_Spare.empty())
+    return {};
+  std::string buffer = std::move(m_Spare.back());
+  m_Spare.pop_back();
+  buffer.clear();
+  return buffer;
+}
+
+void WireQueue::push(std::string data) {
+  if (data.empty())
+    return;
+  Segment segment;
+  segment.owned = std::move(data);
+  m_Segments.push_back(std::move(segment));
+}
+
+void WireQueue::push_view(std::string_view data) {
+  if (data.empty())
+    return;
+  Segment segment;
+  segment.view = data;
+  segment.is_view = true;
+  m_Segments.push_back(std::move(segment));
+}
+
+void WireQueue::push_shared(std::shared_ptr<const void> owner,
+                            std::string_view data) {
+  if (data.empty())
+    return;
+  Segment segment;
+  segment.view = data;
+  segment.is_view = true;
+  segment.owner = std::move(owner);
+  m_Segments.push_back(std::move(segment));
+}
+
+void WireQueue::push_file(std::shared_ptr<const FileHandle> file,
+                          std::uint64_t offset, std::uint64_t length) {
+  if (length == 0)
+    return;
+  Segment segment;
+  segment.file = std::move(file);
+  segment.file_offset = offset;
+  segment.file_length = length;
+  m_Segments.push_back(std::move(segment));
+}
+
+size_t WireQueue::pending_bytes() const {
+  size_t total = 0;
+  for (const auto &segment : m_Segments) {
+    total += segment.file ? static_cast<size_t>(segment.file_length)
+                          : segment.bytes().size();
+  }
+  return total - m_Offset;
+}
+
+void WireQueue::consume(size_t bytes) {
+  while (bytes > 0) {
+    auto &front = m_Segments.front();
+    size_t left = front.bytes().size() - m_Offset;
+    if (bytes < left) {
+      m_Offset += bytes;
+      return;
+    }
+    bytes -= left;
+    m_Offset = 0;
+    if (!front.is_view && front.owned.capacity() <= k_MaxSpareCapacity &&
+        m_Spare.size() < k_MaxSpare) {
+      m_Spare.push_back(std::move(front.owned));
+    }
+    m_Segments.pop_front();
+  }
+}
+
+EFlush WireQueue::flush_file(i32 sock, Segment &segment) {
+#if defined(SO_NOSIGPIPE)
+  i32 on = 1;
+  setsockopt(sock, SOL_SOCKET, SO_NOSIGPIPE, &on, sizeof(on));
+#elif defined(__linux__)
+  SigpipeGuard guard;
+#endif
+  while (segment.file_length > 0) {
+    auto n = send_file_chunk(sock, *segment.file, segment.file_offset,
+                             segment.file_length);
+    if (n > 0) {
+      segment.file_offset += static_cast<std::uint64_t>(n);
+      segment.file_length -= static_cast<std::uint64_t>(n);
+      continue;
+    }
+    // The file shrank underneath us; the promised length cannot be met.
+    if (n == 0)
+      return EFlush::Failed;
+    i32 err = last_socket_error();
+    if (is_interrupted(err))
+      continue;
+    if (is_would_block(err))
+      return EFlush::Blocked;
+#if defined(__linux__) && !defined(SO_NOSIGPIPE)
+    if (err == EPIPE)
+      guard.raised();
+#endif
+    return EFlush::Failed;
+  }
+  m_Segments.pop_front();
+  return EFlush::Done;
+}
+
+EFlush WireQueue::flush_tls(TlsStream &tls) {
+#if defined(__linux__)
+  SigpipeGuard guard;
+#endif
+  while (!m_Segments.empty()) {
+    auto &front = m_Segments.front();
+    std::ptrdiff_t n;
+    if (front.file) {
+      n = tls.send_file(*front.file, front.file_offset, front.file_length);
+      if (n > 0) {
+        front.file_offset += static_cast<std::uint64_t>(n);
+        front.file_length -= static_cast<std::uint64_t>(n);
+        if (front.file_length == 0)
+          m_Segments.pop_front();
+        continue;
+      }
+    } else {
+      auto bytes = front.bytes().substr(m_Offset);
+      if (bytes.size() < k_TlsRecord && m_Segments.size() > 1 &&
+          !m_Segments[1].file) {
+        // A retry after a blocked write gathers at least as many bytes as
+        // before, which is all OpenSSL asks of a repeated SSL_write.
+        m_Record.clear();
+        for (size_t i = 0; i < m_Segments.size() && !m_Segments[i].file &&
+                           m_Record.size() < k_TlsRecord;
+             ++i) {
+          auto segment = m_Segments[i].bytes();
+          if (i == 0)
+            segment.remove_prefix(m_Offset);
+          m_Record.append(
+              segment.substr(0, k_TlsRecord - m_Record.size()));
+        }
+        bytes = m_Record;
+      }
+      n = tls.write(bytes.data(), bytes.size());
+      if (n > 0) {
+        consume(static_cast<size_t>(n));
+        continue;
+      }
+    }
+    i32 err = last_socket_error();
+    if (n < 0 && is_interrupted(err))
+      continue;
+    if (n < 0 && is_would_block(err))
+      return EFlush::Blocked;
+#if defined(__linux__)
+    if (n < 0 && err == EPIPE)
+      guard.raised();
+#endif
+    return EFlush::Failed;
+  }
+  return EFlush::Done;
+}
+
+EFlush WireQueue::flush(i32 sock, TlsStream *tls) {
+  if (tls)
+    return flush_tls(*tls);
+  while (!m_Segments.empty()) {
+    if (m_Segments.front().file) {
+      auto status = flush_file(sock, m_Segments.front());
+      if (status != EFlush::Done)
+        return status;
+      continue;
+    }
+    // Gather memory segments up to the next file segment.
+    size_t count = 0;
+    size_t limit = std::min(m_Segments.size(), k_MaxIov);
+    while (count < limit && !m_Segments[count].file)
+      ++count;
+#ifdef _WIN32
+    WSABUF buffers[k_MaxIov];
+    for (size_t i = 0; i < count; ++i) {
+      auto bytes = m_Segments[i].bytes();
+      if (i == 0)
+        bytes.remove_prefix(m_Offset);
+      buffers[i].buf = const_cast<char *>(bytes.data());
+      buffers[i].len = static_cast<ULONG>(bytes.size());
+    }
+    DWORD sent = 0;
+    i32 rc = WSASend(sock, buffers, static_cast<DWORD>(count), &sent, 0,
+                     nullptr, nullptr);
+    std::ptrdiff_t n = rc == 0 ? static_cast<std::ptrdiff_t>(sent) : -1;
+#else
+    iovec buffers[k_MaxIov];
+    for (size_t i = 0; i < count; ++i) {
+      auto bytes = m_Segments[i].bytes();
+      if (i == 0)
+        bytes.remove_prefix(m_Offset);
+      buffers[i].iov_base = const_cast<char *>(bytes.data());
+      buffers[i].iov_len = bytes.size();
+    }
+    i32 flags = k_SendFlags;
+#ifdef MSG_MORE
+    // Hold a head back briefly so it can share a packet with the file.
+    if (count < m_Segments.size() && m_Segments[count].file)
+      flags |= MSG_MORE;
+#endif
+    // sendmsg rather than writev so k_SendFlags can suppress SIGPIPE.
+    msghdr msg{};
+    msg.msg_iov = buffers;
+    msg.msg_iovlen = static_cast<decltype(msg.msg_iovlen)>(count);
+    std::ptrdiff_t n = sendmsg(sock, &msg, flags);
+#endif
+    if (n > 0) {
+      consume(static_cast<size_t>(n));
+      continue;
+    }
+    i32 err = last_socket_error();
+    if (n < 0 && is_interrupted(err))
+      continue;
+    if (n < 0 && is_would_block(err))
+      return EFlush::Blocked;
+    return EFlush::Failed;
+  }
+  return EFlush::Done;
+}
+
+bool WireQueue::send_all(i32 sock, TlsStream *tls) {
+  return flush(sock, tls) == EFlush::Done;
+}
+
+std::string_view status_text(i32 code) {
+  switch (code) {
+  case 200:
+    return "OK";
+  case 201:
+    return "Created";
+  case 204:
+    return "No Content";
+  case 206:
+    return "Partial Content";
+  case 304:
+    return "Not Modified";
+  case 400:
+    return "Bad Request";
+  case 403:
+    return "Forbidden";
+  case 404:
+    return "Not Found";
+  case 405:
+    return "Method Not Allowed";
+  case 413:
+    return "Payload Too Large";
+  case 416:
+    return "Range Not Satisfiable";
+  case 431:
+    return "Request Header Fields Too Large";
+  case 500:
+    return "Internal Server Error";
+  case 501:
+    return "Not Implemented";
+  case 503:
+    return "Service Unavailable";
+  default:
+    return "Unknown";
+  }
+}
+
+void append_head(std::string &out, const Response &resp) {
+  char code[16];
+  auto [end, ec] = std::to_chars(code, code + sizeof(code), resp.status_code);
+  out.append("HTTP/1.1 ");
+  out.append(code, end);
+  out.push_back(' ');
+  out.append(status_text(resp.status_code));
+  out.append("\r\n");
+  for (const auto &[key, value] : resp.headers) {
+    out.append(key);
+    out.append(": ");
+    out.append(value);
+    out.append("\r\n");
+  }
+}
+
+void write_response(WireQueue &out, Response resp) {
+  std::string head = out.take_buffer();
+  append_head(head, resp);
+  head.append("\r\n");
+  out.push(std::move(head));
+  if (resp.file) {
+    out.push_file(std::move(resp.file->handle), resp.file->offset,
+                  resp.file->length);
+    return;
+  }
+  out.push(std::move(resp.body));
+}
+
+} // namespace http::detail
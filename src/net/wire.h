@@ -0,0 +1,85 @@
+#pragma once
+
+#include "net/http.h"
+#include "file.h"
+#include "socket.h"
+#include <cstddef>
+#include <deque>
+#include <string>
+#include <string_view>
+#include <vector>
+
+namespace http::detail {
+
+class TlsStream;
+
+enum class EFlush { Done, Blocked, Failed };
+
+// Outgoing bytes kept as a list of segments and written with one vectored
+// send per flush, so a response head and its body leave together without
+// first being copied into one string. Partly written segments resume where
+// the last send stopped.
+class WireQueue {
+public:
+  // An empty string to serialize a head into. Buffers of flushed segments
+  // are handed out again, so steady-state heads do not allocate.
+  std::string take_buffer();
+
+  void push(std::string data);
+  // `data` must stay alive until it has been flushed.
+  void push_view(std::string_view data);
+  // `data` lies in memory `owner` keeps alive; the queue holds on to it
+  // until the bytes are flushed.
+  void push_shared(std::shared_ptr<const void> owner, std::string_view data);
+  // Queues `length` bytes of `file` starting at `offset`. They go from the
+  // page cache to the socket with sendfile where the platform has it.
+  void push_file(std::shared_ptr<const FileHandle> file, std::uint64_t offset,
+                 std::uint64_t length);
+
+  bool empty() const { return m_Segments.empty(); }
+  size_t pending_bytes() const;
+
+  // Writes as much as the socket accepts without blocking the caller,
+  // through `tls` when the connection has it.
+  EFlush flush(i32 sock, TlsStream *tls = nullptr);
+  // Writes everything on a blocking socket.
+  bool send_all(i32 sock, TlsStream *tls = nullptr);
+
+private:
+  struct Segment {
+    std::string owned;
+    std::string_view view;
+    bool is_view{false};
+    std::shared_ptr<const void> owner;
+    // File segments advance file_offset as they are sent instead of using
+    // m_Offset.
+    std::shared_ptr<const FileHandle> file;
+    std::uint64_t file_offset{0};
+    std::uint64_t file_length{0};
+
+    std::string_view bytes() const {
+      return is_view ? view : std::string_view(owned);
+    }
+  };
+
+  void consume(size_t bytes);
+  EFlush flush_file(i32 sock, Segment &segment);
+  EFlush flush_tls(TlsStream &tls);
+
+  std::deque<Segment> m_Segments;
+  // Bytes of the front segment already written.
+  size_t m_Offset{0};
+  std::vector<std::string> m_Spare;
+  // Small segments copied together so they share one TLS record.
+  std::string m_Record;
+};
+
+std::string_view status_text(i32 code);
+// Appends the status line and fields, each ending in CRLF, but not the empty
+// line that ends the head.
+void append_head(std::string &out, const Response &resp);
+// Serializes the head into a recycled buffer and queues the body after it
+// as its own segment, so the body is moved rather than copied.
+void write_response(WireQueue &out, Response resp);
+
+} // namespace http::detail
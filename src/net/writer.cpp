@@ -0,0 +1,143 @@
+#include "net/http.h"
+#include "socket.h"
+#include "wire.h"
+#include <charconv>
+
+namespace http {
+
+ResponseWriter::ResponseWriter(detail::WireQueue &out, i32 sock,
+                               detail::TlsStream *tls, bool keep_alive,
+                               bool head_only, bool accepts_chunked,
+                               std::chrono::milliseconds timeout)
+    : m_Out(out), m_Socket(sock), m_Tls(tls), m_Timeout(timeout),
+      m_KeepAlive(keep_alive), m_HeadOnly(head_only),
+      m_AcceptsChunked(accepts_chunked) {}
+
+bool ResponseWriter::fail() {
+  m_Failed = true;
+  m_KeepAlive = false;
+  return false;
+}
+
+bool ResponseWriter::start(i32 status, Headers headers) {
+  if (m_Started)
+    return false;
+  m_Started = true;
+  m_Status = status;
+  Response head;
+  head.status_code = status;
+  head.headers = std::move(headers);
+  head.headers.remove(EHeader::TransferEncoding);
+  auto length = head.headers.get(EHeader::ContentLength);
+  if (!length.empty()) {
+    auto [end, ec] = std::from_chars(length.data(),
+                                     length.data() + length.size(),
+                                     m_Remaining);
+    m_HasLength = ec == std::errc() && end == length.data() + length.size();
+    if (!m_HasLength)
+      head.headers.remove(EHeader::ContentLength);
+  }
+  if (m_Buffer) {
+    // HTTP/2 frames the body itself once the handler is done.
+    if (m_HeadOnly)
+      m_Remaining = 0;
+    m_Buffer->status_code = status;
+    m_Buffer->headers = std::move(head.headers);
+    return true;
+  }
+  bool no_body =
+      status == 204 || status == 304 || (status >= 100 && status < 200);
+  if (no_body) {
+    m_HasLength = true;
+    m_Remaining = 0;
+  } else if (!m_HasLength && m_AcceptsChunked) {
+    m_Chunked = true;
+    head.headers.set(EHeader::TransferEncoding, "chunked");
+  } else if (!m_HasLength) {
+    // Without chunking the end of the body can only be signalled by
+    // closing the connection.
+    m_KeepAlive = false;
+  }
+  if (m_HeadOnly)
+    m_Remaining = 0;
+  head.headers.set(EHeader::Connection, m_KeepAlive ? "keep-alive" : "close");
+  detail::write_response(m_Out, std::move(head));
+  return true;
+}
+
+bool ResponseWriter::write(std::string_view data) {
+  if (m_Failed || m_Finished)
+    return false;
+  if (!m_Started)
+    start(200);
+  if (m_HeadOnly || data.empty())
+    return true;
+  if (m_HasLength) {
+    if (data.size() > m_Remaining)
+      return fail();
+    m_Remaining -= data.size();
+  }
+  if (m_Buffer) {
+    m_Buffer->body.append(data);
+    return true;
+  }
+  std::string chunk = m_Out.take_buffer();
+  if (m_Chunked) {
+    char size[20];
+    auto [end, ec] = std::to_chars(size, size + sizeof(size), data.size(), 16);
+    chunk.append(size, end);
+    chunk.append("\r\n");
+  }
+  chunk.append(data);
+  if (m_Chunked)
+    chunk.append("\r\n");
+  m_Queued += chunk.size();
+  m_Out.push(std::move(chunk));
+  if (m_Queued >= k_HighWater)
+    return flush();
+  return true;
+}
+
+bool ResponseWriter::flush() {
+  if (m_Failed)
+    return false;
+  if (m_Buffer)
+    return true;
+  while (true) {
+    switch (m_Out.flush(m_Socket, m_Tls)) {
+    case detail::EFlush::Done:
+      m_Queued = 0;
+      return true;
+    case detail::EFlush::Failed:
+      return fail();
+    case detail::EFlush::Blocked:
+      // Only the event loop hands out non-blocking sockets; waiting here
+      // holds up its other connections for as long as this client lags.
+      if (!detail::wait_writable(m_Socket, m_Timeout))
+        return fail();
+      break;
+    }
+  }
+}
+
+bool ResponseWriter::finish() {
+  if (m_Finished)
+    return !m_Failed;
+  if (!m_Started) {
+    Headers empty;
+    empty.set(EHeader::ContentLength, "0");
+    start(200, std::move(empty));
+  }
+  m_Finished = true;
+  if (m_Failed)
+    return false;
+  if (m_Chunked && !m_HeadOnly)
+    m_Out.push_view("0\r\n\r\n");
+  // A body shorter than announced leaves the client waiting for bytes that
+  // never come; closing tells it the response is over.
+  if (m_HasLength && m_Remaining > 0)
+    return fail();
+  return true;
+}
+
+} // namespace http
@@ -15,4 +15,59 @@ TEST(ClientTest, InvalidUrlPost) {
 
   EXPECT_FALSE(result.has_value());
   EXPECT_TRUE(result.has_error());
-}
\ No newline at end of file
+}
+
+TEST(ClientTest, PreResolveLocalhost) {
+  auto result = http::Client::pre_resolve("localhost", "8080").get();
+  EXPECT_TRUE(result.has_value());
+}
+
+TEST(ClientTest, PreResolveCachesFailures) {
+  http::Client::configure_dns_cache(http::DnsCacheConfig{});
+  auto first = http::Client::pre_resolve("does-not-exist.invalid").get();
+  ASSERT_FALSE(first.has_value());
+  auto second = http::Client::pre_resolve("does-not-exist.invalid").get();
+  ASSERT_FALSE(second.has_value());
+  EXPECT_EQ(first.error(), second.error());
+  http::Client::clear_dns_cache();
+}
+
+TEST(ClientTest, TraceExportsOtlpSpan) {
+  http::ClientTrace trace;
+  trace.method = http::EMethod::POST;
+  trace.url = http::URL::parse("http://example.com:8080/upload?x=1").value();
+  trace.trace_id = "4bf92f3577b34da6a3ce929d0e0e4736";
+  trace.span_id = "00f067aa0ba902b7";
+  trace.wall_start = std::chrono::system_clock::time_point(
+      std::chrono::seconds(1700000000));
+  trace.start = http::ClientTrace::Clock::now();
+  trace.dns_start = trace.start;
+  trace.dns_end = trace.start + std::chrono::microseconds(250);
+  trace.end = trace.start + std::chrono::milliseconds(3);
+  trace.status_code = 503;
+
+  auto span = trace.to_otlp_json();
+  EXPECT_NE(span.find("\"traceId\":\"4bf92f3577b34da6a3ce929d0e0e4736\""),
+            std::string::npos);
+  EXPECT_EQ(span.find("parentSpanId"), std::string::npos);
+  EXPECT_NE(span.find("\"kind\":3"), std::string::npos);
+  EXPECT_NE(span.find("\"startTimeUnixNano\":\"1700000000000000000\""),
+            std::string::npos);
+  EXPECT_NE(span.find("\"endTimeUnixNano\":\"1700000000003000000\""),
+            std::string::npos);
+  EXPECT_NE(span.find("{\"timeUnixNano\":\"1700000000000250000\","
+                      "\"name\":\"dns.end\"}"),
+            std::string::npos);
+  EXPECT_EQ(span.find("connect.start"), std::string::npos);
+  EXPECT_NE(span.find("\"url.full\",\"value\":{\"stringValue\":"
+                      "\"http://example.com:8080/upload?x=1\"}"),
+            std::string::npos);
+  EXPECT_NE(span.find("\"http.response.status_code\",\"value\":"
+                      "{\"intValue\":\"503\"}"),
+            std::string::npos);
+  EXPECT_NE(span.find("\"status\":{\"code\":2}"), std::string::npos);
+  EXPECT_EQ(http::ClientTrace::between(trace.dns_start, trace.dns_end),
+            std::chrono::microseconds(250));
+  EXPECT_EQ(http::ClientTrace::between(trace.tls_start, trace.tls_end),
+            std::chrono::nanoseconds(0));
+}
@@ -0,0 +1,103 @@
+#include "net/http.h"
+#include <gtest/gtest.h>
+
+static std::string json_body(size_t items) {
+  std::string body = "[";
+  for (size_t i = 0; i < items; ++i) {
+    if (i > 0)
+      body += ",";
+    body += "{\"id\":" + std::to_string(i) + ",\"name\":\"item\"}";
+  }
+  return body + "]";
+}
+
+static http::Response json_response(std::string body) {
+  http::Response resp(200, std::move(body));
+  resp.headers.set(http::EHeader::ContentType, "application/json");
+  return resp;
+}
+
+static http::Request accepting(std::string_view encodings) {
+  http::Request req(http::EMethod::GET, http::URL::from_path("/items"));
+  req.headers.set("Accept-Encoding", encodings);
+  return req;
+}
+
+TEST(CompressionTest, LeavesSmallAndOpaqueBodiesAlone) {
+  auto compress = http::compress_responses();
+  auto req = accepting("gzip, br");
+
+  auto small = json_response("{\"id\":1}");
+  compress(req, small);
+  EXPECT_EQ(small.body, "{\"id\":1}");
+  EXPECT_FALSE(small.headers.has("content-encoding"));
+  // The answer depends on Accept-Encoding either way.
+  EXPECT_EQ(small.headers.get("vary"), "Accept-Encoding");
+
+  auto image = http::Response(200, std::string(4096, 'x'));
+  image.headers.set(http::EHeader::ContentType, "image/png");
+  compress(req, image);
+  EXPECT_EQ(image.body.size(), 4096u);
+  EXPECT_FALSE(image.headers.has("vary"));
+
+  auto head = json_response(json_body(200));
+  auto head_req = accepting("gzip");
+  head_req.method = http::EMethod::HEAD;
+  compress(head_req, head);
+  EXPECT_FALSE(head.headers.has("content-encoding"));
+
+  auto refused = json_response(json_body(200));
+  compress(accepting("gzip;q=0, br;q=0"), refused);
+  EXPECT_FALSE(refused.headers.has("content-encoding"));
+}
+
+#if defined(SAP_HTTP_ZLIB) && defined(SAP_HTTP_BROTLI)
+TEST(CompressionTest, NegotiatesByQualityThenPreference) {
+  auto compress = http::compress_responses();
+  auto body = json_body(200);
+
+  auto both = json_response(body);
+  compress(accepting("gzip, deflate, br"), both);
+  EXPECT_EQ(both.headers.get("content-encoding"), "br");
+  EXPECT_LT(both.body.size(), body.size() / 4);
+  EXPECT_EQ(both.headers.get(http::EHeader::ContentLength),
+            std::to_string(both.body.size()));
+
+  auto weighted = json_response(body);
+  compress(accepting("br;q=0.5, gzip;q=0.8"), weighted);
+  EXPECT_EQ(weighted.headers.get("content-encoding"), "gzip");
+
+  auto wildcard = json_response(body);
+  compress(accepting("*;q=0.3, br;q=0"), wildcard);
+  EXPECT_EQ(wildcard.headers.get("content-encoding"), "gzip");
+
+  http::CompressionConfig no_brotli;
+  no_brotli.brotli = false;
+  auto gzip_only = json_response(body);
+  http::compress_responses(no_brotli)(accepting("br, deflate"), gzip_only);
+  EXPECT_EQ(gzip_only.headers.get("content-encoding"), "deflate");
+}
+
+TEST(CompressionTest, WeakensStrongValidators) {
+  auto compress = http::compress_responses();
+  auto resp = json_response(json_body(200));
+  resp.headers.set("ETag", "\"v1\"");
+  resp.headers.set("Vary", "Origin");
+  compress(accepting("gzip"), resp);
+  EXPECT_EQ(resp.headers.get("etag"), "W/\"v1\"");
+  EXPECT_EQ(resp.headers.get("vary"), "Origin, Accept-Encoding");
+}
+
+TEST(CompressionTest, ReusesCachedBodies) {
+  auto compress = http::compress_responses();
+  auto first = json_response(json_body(500));
+  auto second = json_response(json_body(500));
+  compress(accepting("gzip"), first);
+  compress(accepting("gzip"), second);
+  EXPECT_EQ(first.body, second.body);
+
+  auto other = json_response(json_body(501));
+  compress(accepting("gzip"), other);
+  EXPECT_NE(other.body, first.body);
+}
+#endif
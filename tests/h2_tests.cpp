@@ -0,0 +1,361 @@
+#include "net/http.h"
+#include <gtest/gtest.h>
+#include <thread>
+
+#ifdef _WIN32
+#include <winsock2.h>
+#include <ws2tcpip.h>
+#else
+#include <arpa/inet.h>
+#include <sys/resource.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#endif
+
+static http::Request get(const std::string &url) {
+  return http::Request(http::EMethod::GET, http::URL::parse(url).value());
+}
+
+static std::string pattern(size_t size) {
+  std::string data(size, '\0');
+  for (size_t i = 0; i < data.size(); ++i)
+    data[i] = static_cast<char>('a' + i % 26);
+  return data;
+}
+
+static http::ServerConfig h2_config(u16 port, bool event_loop) {
+  http::ServerConfig cfg{-1, port};
+  cfg.use_event_loop = event_loop;
+  cfg.http2 = http::Http2Config{};
+  return cfg;
+}
+
+static void expect_h2c_exchanges(http::ServerConfig cfg) {
+  u16 port = cfg.port;
+  std::string base = "http://127.0.0.1:" + std::to_string(port);
+  std::string large = pattern(3 * 1024 * 1024 + 5);
+
+  http::Server server{std::move(cfg)};
+  server.route("/hello", http::EMethod::GET, [](const http::Request &req) {
+    return http::Response(200, "hello " + std::string(req.headers.get("host")));
+  });
+  server.route("/echo", http::EMethod::POST, [](const http::Request &req) {
+    http::Response resp(200, req.body);
+    resp.headers.set("x-query", req.url.query);
+    return resp;
+  });
+  server.route("/large", http::EMethod::GET, [&large](const http::Request &) {
+    return http::Response(200, large);
+  });
+  server.route("/streamed", http::EMethod::GET,
+               [](const http::Request &, http::ResponseWriter &writer) {
+                 writer.start(200, {});
+                 for (i32 i = 0; i < 100; ++i)
+                   writer.write("row," + std::to_string(i) + "\n");
+               });
+  ASSERT_TRUE(server.start().has_value());
+  std::thread server_thread([&server]() { server.run(); });
+  std::this_thread::sleep_for(std::chrono::milliseconds(200));
+
+  http::ClientPoolConfig pool_cfg;
+  // Small windows, so the large bodies wait on WINDOW_UPDATE.
+  http::Http2Config h2;
+  h2.initial_window_size = 65535;
+  pool_cfg.http2 = h2;
+  http::ClientPool pool(pool_cfg);
+  std::vector<std::future<stl::result<http::Response>>> pending;
+  for (i32 i = 0; i < 20; ++i) {
+    http::Request post(http::EMethod::POST,
+                       http::URL::parse(base + "/echo?n=" + std::to_string(i))
+                           .value());
+    post.set_body(i == 0 ? large : std::to_string(i));
+    pending.push_back(http::Client::async_send(std::move(post), pool));
+    pending.push_back(http::Client::async_send(get(base + "/large"), pool));
+  }
+  auto hello = http::Client::send(get(base + "/hello"), pool);
+  auto streamed = http::Client::send(get(base + "/streamed"), pool);
+  auto missing = http::Client::send(get(base + "/missing"), pool);
+  std::vector<stl::result<http::Response>> results;
+  for (auto &f : pending)
+    results.push_back(f.get());
+  auto metrics = server.metrics();
+  pool.clear();
+  server.stop();
+  server_thread.join();
+
+  ASSERT_TRUE(hello.has_value()) << hello.error();
+  EXPECT_EQ(hello.value().body, "hello 127.0.0.1:" + std::to_string(port));
+  ASSERT_TRUE(streamed.has_value()) << streamed.error();
+  EXPECT_EQ(streamed.value().body.substr(0, 12), "row,0\nrow,1\n");
+  EXPECT_EQ(streamed.value().body.size(), 690u);
+  ASSERT_TRUE(missing.has_value()) << missing.error();
+  EXPECT_EQ(missing.value().status_code, 404);
+  for (size_t i = 0; i < results.size(); ++i) {
+    ASSERT_TRUE(results[i].has_value()) << results[i].error();
+    auto &resp = results[i].value();
+    EXPECT_EQ(resp.status_code, 200);
+    if (i % 2 == 1) {
+      EXPECT_TRUE(resp.body == large);
+      continue;
+    }
+    EXPECT_EQ(resp.headers.get("x-query"), "?n=" + std::to_string(i / 2));
+    if (i == 0)
+      EXPECT_TRUE(resp.body == large);
+    else
+      EXPECT_EQ(resp.body, std::to_string(i / 2));
+  }
+  // Every request shared one connection.
+  EXPECT_EQ(metrics.connections_accepted, 1u);
+  EXPECT_EQ(metrics.http2_connections, 1u);
+}
+
+TEST(Http2Test, ServesPriorKnowledgeClients) {
+  expect_h2c_exchanges(h2_config(10047, false));
+}
+
+TEST(Http2Test, ServesPriorKnowledgeClientsEventLoop) {
+  expect_h2c_exchanges(h2_config(10048, true));
+}
+
+TEST(Http2Test, KeepsServingHttp11) {
+  http::Server server{h2_config(10049, true)};
+  server.route("/hello", http::EMethod::GET, [](const http::Request &) {
+    return http::Response(200, "hello");
+  });
+  ASSERT_TRUE(server.start().has_value());
+  std::thread server_thread([&server]() { server.run(); });
+  std::this_thread::sleep_for(std::chrono::milliseconds(200));
+
+  auto resp = http::Client::send(get("http://127.0.0.1:10049/hello"));
+  auto metrics = server.metrics();
+  server.stop();
+  server_thread.join();
+
+  ASSERT_TRUE(resp.has_value()) << resp.error();
+  EXPECT_EQ(resp.value().body, "hello");
+  EXPECT_EQ(metrics.http2_connections, 0u);
+}
+
+// The frames a connection sends until stream 1 ends.
+struct Frame {
+  u8 type;
+  u8 flags;
+  u32 stream;
+  std::string payload;
+};
+
+static std::vector<Frame> read_frames(i32 sock) {
+  std::vector<Frame> frames;
+  std::string in;
+  char buffer[4096];
+  while (true) {
+    while (in.size() >= 9) {
+      auto byte = [&in](size_t i) { return static_cast<u8>(in[i]); };
+      size_t length = (byte(0) << 16) | (byte(1) << 8) | byte(2);
+      if (in.size() < 9 + length)
+        break;
+      u32 stream = ((byte(5) & 0x7f) << 24) | (byte(6) << 16) |
+                   (byte(7) << 8) | byte(8);
+      frames.push_back({byte(3), byte(4), stream, in.substr(9, length)});
+      in.erase(0, 9 + length);
+      if (stream == 1 && (frames.back().flags & 0x1))
+        return frames;
+    }
+    auto n = recv(sock, buffer, sizeof(buffer), 0);
+    if (n <= 0)
+      return frames;
+    in.append(buffer, static_cast<size_t>(n));
+  }
+}
+
+TEST(Http2Test, AnswersRawFrames) {
+  http::Server server{h2_config(10050, true)};
+  server.route("/", http::EMethod::GET, [](const http::Request &req) {
+    return http::Response(200, std::string(req.headers.get("host")));
+  });
+  ASSERT_TRUE(server.start().has_value());
+  std::thread server_thread([&server]() { server.run(); });
+  std::this_thread::sleep_for(std::chrono::milliseconds(200));
+
+  i32 sock = static_cast<i32>(socket(AF_INET, SOCK_STREAM, 0));
+  sockaddr_in addr{};
+  addr.sin_family = AF_INET;
+  addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+  addr.sin_port = htons(10050);
+  ASSERT_EQ(connect(sock, (sockaddr *)&addr, sizeof(addr)), 0);
+  // The preface, empty SETTINGS, and the first request of RFC 7541
+  // C.4.1: GET http://www.example.com/ with Huffman-coded strings.
+  std::string out = "PRI * HTTP/2.0\r\n\r\nSM\r\n\r\n";
+  out.append("\x00\x00\x00\x04\x00\x00\x00\x00\x00", 9);
+  out.append("\x00\x00\x11\x01\x05\x00\x00\x00\x01", 9);
+  out.append("\x82\x86\x84\x41\x8c\xf1\xe3\xc2\xe5\xf2\x3a\x6b\xa0\xab\x90"
+             "\xf4\xff",
+             17);
+  send(sock, out.data(), static_cast<i32>(out.size()), 0);
+  auto frames = read_frames(sock);
+#ifdef _WIN32
+  closesocket(sock);
+#else
+  close(sock);
+#endif
+  server.stop();
+  server_thread.join();
+
+  // SETTINGS first, then the ACK of ours, then the response.
+  ASSERT_GE(frames.size(), 4u);
+  EXPECT_EQ(frames[0].type, 0x4);
+  EXPECT_EQ(frames[0].flags, 0x0);
+  bool acked = false;
+  const Frame *head = nullptr;
+  std::string body;
+  for (auto &frame : frames) {
+    acked |= frame.type == 0x4 && frame.flags == 0x1;
+    if (frame.type == 0x1 && frame.stream == 1)
+      head = &frame;
+    if (frame.type == 0x0 && frame.stream == 1)
+      body += frame.payload;
+  }
+  EXPECT_TRUE(acked);
+  ASSERT_NE(head, nullptr);
+  // :status 200 is entry 8 of the static table.
+  EXPECT_EQ(static_cast<u8>(head->payload[0]), 0x88);
+  EXPECT_EQ(body, "www.example.com");
+}
+
+// A header block of `fields` followed by one ~4 KB literal added to the
+// dynamic table and `references` one-byte references to it, framed as
+// HEADERS plus CONTINUATIONs on stream 1.
+static std::string amplified_head(std::string_view fields, size_t references) {
+  std::string block(fields);
+  block.append("\x40\x05x-big\x7f\xa1\x1e", 10);
+  block.append(4000, 'v');
+  block.append(references, '\xbe');
+  std::string frames;
+  for (size_t at = 0; at < block.size(); at += 16384) {
+    size_t length = std::min<size_t>(16384, block.size() - at);
+    u8 type = at == 0 ? 0x1 : 0x9;
+    u8 flags = at == 0 ? 0x1 : 0x0;
+    if (at + length == block.size())
+      flags |= 0x4;
+    char head[9] = {static_cast<char>(length >> 16),
+                    static_cast<char>(length >> 8),
+                    static_cast<char>(length),
+                    static_cast<char>(type),
+                    static_cast<char>(flags),
+                    0,
+                    0,
+                    0,
+                    1};
+    frames.append(head, 9);
+    frames.append(block, at, length);
+  }
+  return frames;
+}
+
+#ifndef _WIN32
+// Peak resident size of the process so far, in kilobytes.
+static long peak_rss() {
+  rusage usage{};
+  getrusage(RUSAGE_SELF, &usage);
+  return usage.ru_maxrss;
+}
+#endif
+
+TEST(Http2Test, RefusesAmplifiedRequestHeads) {
+  http::Server server{h2_config(10064, true)};
+  server.route("/", http::EMethod::GET, [](const http::Request &) {
+    return http::Response(200, "ok");
+  });
+  ASSERT_TRUE(server.start().has_value());
+  std::thread server_thread([&server]() { server.run(); });
+  std::this_thread::sleep_for(std::chrono::milliseconds(200));
+
+  i32 sock = static_cast<i32>(socket(AF_INET, SOCK_STREAM, 0));
+  sockaddr_in addr{};
+  addr.sin_family = AF_INET;
+  addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+  addr.sin_port = htons(10064);
+  ASSERT_EQ(connect(sock, (sockaddr *)&addr, sizeof(addr)), 0);
+  // 130 KB on the wire that would decode to over 500 MB of fields.
+  std::string out = "PRI * HTTP/2.0\r\n\r\nSM\r\n\r\n";
+  out.append("\x00\x00\x00\x04\x00\x00\x00\x00\x00", 9);
+  out += amplified_head("\x82\x86\x84", 130000);
+#ifndef _WIN32
+  long peak_before = peak_rss();
+#endif
+  auto started = std::chrono::steady_clock::now();
+  send(sock, out.data(), static_cast<i32>(out.size()), 0);
+  auto frames = read_frames(sock);
+  auto elapsed = std::chrono::steady_clock::now() - started;
+#ifdef _WIN32
+  closesocket(sock);
+#else
+  close(sock);
+#endif
+  server.stop();
+  server_thread.join();
+
+  const Frame *head = nullptr;
+  for (auto &frame : frames) {
+    if (frame.type == 0x1 && frame.stream == 1)
+      head = &frame;
+  }
+  ASSERT_NE(head, nullptr);
+  // :status takes a literal "431", too short for Huffman to shrink.
+  EXPECT_NE(head->payload.find("431"), std::string::npos);
+  EXPECT_LT(elapsed, std::chrono::milliseconds(500));
+#ifndef _WIN32
+  EXPECT_LT(peak_rss() - peak_before, 64 * 1024);
+#endif
+}
+
+TEST(Http2Test, ClientRejectsAmplifiedResponseHeads) {
+  i32 listener = static_cast<i32>(socket(AF_INET, SOCK_STREAM, 0));
+  i32 opt = 1;
+  setsockopt(listener, SOL_SOCKET, SO_REUSEADDR, (const char *)&opt,
+             sizeof(opt));
+  sockaddr_in addr{};
+  addr.sin_family = AF_INET;
+  addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+  addr.sin_port = htons(10065);
+  bind(listener, (sockaddr *)&addr, sizeof(addr));
+  listen(listener, 1);
+  std::thread server([listener]() {
+    i32 client = static_cast<i32>(accept(listener, nullptr, nullptr));
+    char buffer[4096];
+    recv(client, buffer, sizeof(buffer), 0);
+    std::string out("\x00\x00\x00\x04\x00\x00\x00\x00\x00", 9);
+    out += amplified_head("\x88", 130000);
+    send(client, out.data(), static_cast<i32>(out.size()), 0);
+    // Drained until the client hangs up, so closing never resets the
+    // connection under the head it is still reading.
+    while (recv(client, buffer, sizeof(buffer), 0) > 0) {
+    }
+#ifdef _WIN32
+    closesocket(client);
+    closesocket(listener);
+#else
+    close(client);
+    close(listener);
+#endif
+  });
+
+  http::ClientPoolConfig config;
+  config.http2 = http::Http2Config{};
+  http::ClientPool pool(config);
+  // Not idempotent, so the failed stream is not replayed on a connection
+  // the fake server would never accept.
+  http::Request req(http::EMethod::POST,
+                    http::URL::parse("http://127.0.0.1:10065/").value());
+  req.timeout = std::chrono::seconds(2);
+  auto started = std::chrono::steady_clock::now();
+  auto resp = http::Client::send(std::move(req), pool);
+  auto elapsed = std::chrono::steady_clock::now() - started;
+  pool.clear();
+  server.join();
+
+  ASSERT_FALSE(resp.has_value());
+  EXPECT_NE(resp.error().find("max_header_list_size"), std::string::npos)
+      << resp.error();
+  EXPECT_LT(elapsed, std::chrono::milliseconds(1000));
+}
@@ -1,5 +1,7 @@
 #include "net/http.h"
+#include <clocale>
 #include <gtest/gtest.h>
+#include <memory_resource>
 
 TEST(HeadersTest, SetAndGet) {
   http::Headers h;
@@ -60,4 +62,83 @@ TEST(HeadersTest, EmptyValue) {
   h.set("Empty-Header", "");
   EXPECT_TRUE(h.has("Empty-Header"));
   EXPECT_EQ(h.get("Empty-Header"), "");
-}
\ No newline at end of file
+}
+
+TEST(HeadersTest, LowercasesLongNames) {
+  http::Headers h;
+  h.set("X-Upper-AND-lower-Case-Name-Over-Thirty-Two-Bytes-\xc3\x89", "1");
+  ASSERT_EQ(h.size(), 1u);
+  EXPECT_EQ(h.begin()->name,
+            "x-upper-and-lower-case-name-over-thirty-two-bytes-\xc3\x89");
+  EXPECT_EQ(h.get("x-UPPER-and-LOWER-case-NAME-over-THIRTY-two-BYTES-\xc3\x89"),
+            "1");
+}
+
+TEST(HeadersTest, LookupsIgnoreLocale) {
+  // A Turkish locale lowers 'I' to a dotless i; names fold ASCII only.
+  if (!std::setlocale(LC_CTYPE, "tr_TR.ISO-8859-9") &&
+      !std::setlocale(LC_CTYPE, "tr_TR.ISO8859-9"))
+    GTEST_SKIP() << "no Turkish locale installed";
+  http::Headers h;
+  h.set("If-None-Match", "\"v1\"");
+  bool found = h.has("If-None-Match");
+  auto value = std::string(h.get("IF-NONE-MATCH"));
+  std::setlocale(LC_CTYPE, "C");
+  EXPECT_TRUE(found);
+  EXPECT_EQ(value, "\"v1\"");
+}
+
+TEST(HeadersTest, KnownHeaderSlots) {
+  http::Headers h;
+  h.set("Content-Length", "42");
+  EXPECT_TRUE(h.has(http::EHeader::ContentLength));
+  EXPECT_EQ(h.get(http::EHeader::ContentLength), "42");
+  h.set(http::EHeader::ContentLength, "7");
+  EXPECT_EQ(h.get("content-length"), "7");
+  EXPECT_EQ(h.size(), 1u);
+  EXPECT_FALSE(h.has(http::EHeader::Host));
+}
+
+TEST(HeadersTest, RemoveKeepsSlotsConsistent) {
+  http::Headers h;
+  h.set("X-First", "1");
+  h.set(http::EHeader::Host, "example.com");
+  h.set("Connection", "close");
+  EXPECT_TRUE(h.remove("x-first"));
+  EXPECT_FALSE(h.remove("x-first"));
+  EXPECT_EQ(h.get(http::EHeader::Host), "example.com");
+  EXPECT_EQ(h.get(http::EHeader::Connection), "close");
+  EXPECT_TRUE(h.remove(http::EHeader::Host));
+  EXPECT_EQ(h.get("Connection"), "close");
+  EXPECT_EQ(h.size(), 1u);
+}
+
+TEST(HeadersTest, IteratesInInsertionOrder) {
+  http::Headers h;
+  h.set("X-B", "2");
+  h.set("X-A", "1");
+  h.set("Content-Type", "text/plain");
+  std::vector<std::string> names;
+  for (const auto &[name, value] : h) {
+    names.emplace_back(name);
+  }
+  EXPECT_EQ(names, (std::vector<std::string>{"x-b", "x-a", "content-type"}));
+}
+
+TEST(HeadersTest, AllocatesFromResource) {
+  std::byte buffer[4096];
+  std::pmr::monotonic_buffer_resource arena(buffer, sizeof(buffer),
+                                            std::pmr::null_memory_resource());
+  http::Headers h(&arena);
+  h.set("X-Long-Header-Name-Beyond-SSO", std::string(100, 'v'));
+  h.set(http::EHeader::ContentType, "text/plain");
+  const auto *begin = reinterpret_cast<const char *>(buffer);
+  const char *name = h.begin()->name.data();
+  EXPECT_TRUE(name >= begin && name < begin + sizeof(buffer));
+
+  // Copies leave the arena.
+  http::Headers copy = h;
+  const char *copied = copy.begin()->name.data();
+  EXPECT_FALSE(copied >= begin && copied < begin + sizeof(buffer));
+  EXPECT_EQ(copy.get("x-long-header-name-beyond-sso"), std::string(100, 'v'));
+}
@@ -1,6 +1,157 @@
 #include "net/http.h"
+#include <filesystem>
+#include <fstream>
 #include <gtest/gtest.h>
 
+#ifdef _WIN32
+#include <winsock2.h>
+#include <ws2tcpip.h>
+#else
+#include <arpa/inet.h>
+#include <fcntl.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#endif
+
+// Writes `payload` (then `delayed`, shortly after) over one plain TCP
+// connection and returns everything the server sends back until it closes
+// the connection.
+static std::string raw_exchange(u16 port, const std::string &payload,
+                                const std::string &delayed = "") {
+  i32 sock = static_cast<i32>(socket(AF_INET, SOCK_STREAM, 0));
+  sockaddr_in addr{};
+  addr.sin_family = AF_INET;
+  addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+  addr.sin_port = htons(port);
+  std::string received;
+  if (connect(sock, (sockaddr *)&addr, sizeof(addr)) == 0) {
+    send(sock, payload.data(), static_cast<i32>(payload.size()), 0);
+    if (!delayed.empty()) {
+      std::this_thread::sleep_for(std::chrono::milliseconds(100));
+      send(sock, delayed.data(), static_cast<i32>(delayed.size()), 0);
+    }
+    char buffer[4096];
+    i32 n;
+    while ((n = static_cast<i32>(recv(sock, buffer, sizeof(buffer), 0))) > 0) {
+      received.append(buffer, n);
+    }
+  }
+#ifdef _WIN32
+  closesocket(sock);
+#else
+  close(sock);
+#endif
+  return received;
+}
+
+// Accepts a single connection on `port`, reads the request head and answers
+// with the canned `response` bytes before closing.
+static std::thread serve_raw_once(u16 port, std::string response) {
+  i32 listener = static_cast<i32>(socket(AF_INET, SOCK_STREAM, 0));
+  i32 opt = 1;
+  setsockopt(listener, SOL_SOCKET, SO_REUSEADDR, (const char *)&opt,
+             sizeof(opt));
+  sockaddr_in addr{};
+  addr.sin_family = AF_INET;
+  addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+  addr.sin_port = htons(port);
+  bind(listener, (sockaddr *)&addr, sizeof(addr));
+  listen(listener, 1);
+  return std::thread([listener, response = std::move(response)]() {
+    i32 client = static_cast<i32>(accept(listener, nullptr, nullptr));
+    std::string request;
+    char buffer[4096];
+    i32 n;
+    while (request.find("\r\n\r\n") == std::string::npos &&
+           (n = static_cast<i32>(recv(client, buffer, sizeof(buffer), 0))) >
+               0) {
+      request.append(buffer, n);
+    }
+    send(client, response.data(), static_cast<i32>(response.size()), 0);
+#ifdef _WIN32
+    closesocket(client);
+    closesocket(listener);
+#else
+    close(client);
+    close(listener);
+#endif
+  });
+}
+
+// Accepts a single connection on `port` and answers `requests` bodiless
+// requests on it, numbering the responses, before closing. A client that
+// opens a second connection is refused.
+static std::thread serve_keep_alive_once(u16 port, i32 requests) {
+  i32 listener = static_cast<i32>(socket(AF_INET, SOCK_STREAM, 0));
+  i32 opt = 1;
+  setsockopt(listener, SOL_SOCKET, SO_REUSEADDR, (const char *)&opt,
+             sizeof(opt));
+  sockaddr_in addr{};
+  addr.sin_family = AF_INET;
+  addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+  addr.sin_port = htons(port);
+  bind(listener, (sockaddr *)&addr, sizeof(addr));
+  listen(listener, 1);
+  return std::thread([listener, requests]() {
+    i32 client = static_cast<i32>(accept(listener, nullptr, nullptr));
+#ifdef _WIN32
+    closesocket(listener);
+#else
+    close(listener);
+#endif
+    std::string pending;
+    char buffer[4096];
+    for (i32 i = 0; i < requests; ++i) {
+      i32 n = 0;
+      while (pending.find("\r\n\r\n") == std::string::npos &&
+             (n = static_cast<i32>(recv(client, buffer, sizeof(buffer), 0))) >
+                 0) {
+        pending.append(buffer, n);
+      }
+      auto end = pending.find("\r\n\r\n");
+      if (end == std::string::npos)
+        break;
+      pending.erase(0, end + 4);
+      std::string response = "HTTP/1.1 200 OK\r\nContent-Length: 1\r\n\r\n" +
+                             std::to_string(i);
+      send(client, response.data(), static_cast<i32>(response.size()), 0);
+    }
+#ifdef _WIN32
+    closesocket(client);
+#else
+    close(client);
+#endif
+  });
+}
+
+static size_t count_occurrences(std::string_view haystack,
+                                std::string_view needle) {
+  size_t count = 0;
+  for (auto pos = haystack.find(needle); pos != std::string_view::npos;
+       pos = haystack.find(needle, pos + needle.size())) {
+    ++count;
+  }
+  return count;
+}
+
+// Server tests that run once for each way of serving: blocking accept (one
+// connection at a time unless a test asks for workers) and the event loop.
+class ServerModeTest : public ::testing::TestWithParam<bool> {
+protected:
+  bool event_loop() const { return GetParam(); }
+  // A config for this mode on `port`, or on `port` + 1 for the event loop.
+  http::ServerConfig config(u16 port) const {
+    http::ServerConfig cfg{-1, static_cast<u16>(port + event_loop())};
+    cfg.use_event_loop = event_loop();
+    return cfg;
+  }
+};
+
+INSTANTIATE_TEST_SUITE_P(IntegrationTest, ServerModeTest, ::testing::Bool(),
+                         [](const ::testing::TestParamInfo<bool> &info) {
+                           return info.param ? "EventLoop" : "Blocking";
+                         });
+
 TEST(IntegrationTest, HttpBinGet) {
   auto future = http::Client::get("http://httpbingo.org/get");
   auto result = future.get();
@@ -90,4 +241,1857 @@ TEST(IntegrationTest, ServerPostRequest) {
   ASSERT_TRUE(result.has_value())
       << "Client request failed: " << result.error();
   EXPECT_EQ(result.value().body, R"({"test": "data"})");
-}
\ No newline at end of file
+}
+
+TEST(IntegrationTest, ServerEventLoop) {
+  http::ServerConfig cfg{-1, 10001};
+  cfg.use_event_loop = true;
+  cfg.event_loop_threads = 2;
+  http::Server server{std::move(cfg)};
+  server.route("/loop", http::EMethod::GET, [](const http::Request &) {
+    return http::Response(200, "Event loop response");
+  });
+  server.route("/api/echo", http::EMethod::POST,
+               [](const http::Request &req) {
+                 return http::Response(200, req.body);
+               });
+  auto start_result = server.start();
+  ASSERT_TRUE(start_result.has_value())
+      << "Server failed to start: " << start_result.error();
+  std::thread server_thread([&server]() { server.run(); });
+  std::this_thread::sleep_for(std::chrono::milliseconds(200));
+  std::vector<std::future<stl::result<http::Response>>> futures;
+  for (int i = 0; i < 16; ++i) {
+    futures.push_back(http::Client::get("http://127.0.0.1:10001/loop"));
+  }
+  auto post = http::Client::post("http://127.0.0.1:10001/api/echo",
+                                 R"({"test": "data"})");
+  for (auto &future : futures) {
+    auto result = future.get();
+    ASSERT_TRUE(result.has_value())
+        << "Client request failed: " << result.error();
+    EXPECT_EQ(result.value().body, "Event loop response");
+  }
+  auto post_result = post.get();
+  server.stop();
+  server_thread.join();
+  ASSERT_TRUE(post_result.has_value())
+      << "Client request failed: " << post_result.error();
+  EXPECT_EQ(post_result.value().body, R"({"test": "data"})");
+}
+
+TEST(IntegrationTest, ServerWorkerPool) {
+  http::ServerConfig cfg{-1, 10002, true};
+  cfg.worker_threads = 2;
+  http::Server server{std::move(cfg)};
+  server.route("/pool", http::EMethod::GET, [](const http::Request &) {
+    return http::Response(200, "Pooled response");
+  });
+  auto start_result = server.start();
+  ASSERT_TRUE(start_result.has_value())
+      << "Server failed to start: " << start_result.error();
+  std::thread server_thread([&server]() { server.run(); });
+  std::this_thread::sleep_for(std::chrono::milliseconds(200));
+  std::vector<std::future<stl::result<http::Response>>> futures;
+  for (int i = 0; i < 16; ++i) {
+    futures.push_back(http::Client::get("http://127.0.0.1:10002/pool"));
+  }
+  for (auto &future : futures) {
+    auto result = future.get();
+    ASSERT_TRUE(result.has_value())
+        << "Client request failed: " << result.error();
+    EXPECT_EQ(result.value().body, "Pooled response");
+  }
+  server.stop();
+  server_thread.join();
+}
+
+TEST(IntegrationTest, ServerShedsLoadWhenQueueFull) {
+  http::ServerConfig cfg{-1, 10003, true};
+  cfg.worker_threads = 1;
+  cfg.max_pending_connections = 1;
+  http::Server server{std::move(cfg)};
+  std::promise<void> release;
+  std::shared_future<void> released = release.get_future().share();
+  server.route("/slow", http::EMethod::GET, [released](const http::Request &) {
+    released.wait();
+    return http::Response(200, "Slow response");
+  });
+  auto start_result = server.start();
+  ASSERT_TRUE(start_result.has_value())
+      << "Server failed to start: " << start_result.error();
+  std::thread server_thread([&server]() { server.run(); });
+  std::this_thread::sleep_for(std::chrono::milliseconds(200));
+  // One request occupies the only worker, the next fills the queue.
+  auto busy = http::Client::get("http://127.0.0.1:10003/slow");
+  std::this_thread::sleep_for(std::chrono::milliseconds(100));
+  auto queued = http::Client::get("http://127.0.0.1:10003/slow");
+  std::this_thread::sleep_for(std::chrono::milliseconds(100));
+  auto shed = http::Client::get("http://127.0.0.1:10003/slow").get();
+  release.set_value();
+  auto busy_result = busy.get();
+  auto queued_result = queued.get();
+  server.stop();
+  server_thread.join();
+  ASSERT_TRUE(shed.has_value()) << "Client request failed: " << shed.error();
+  EXPECT_EQ(shed.value().status_code, 503);
+  ASSERT_TRUE(busy_result.has_value());
+  EXPECT_EQ(busy_result.value().status_code, 200);
+  ASSERT_TRUE(queued_result.has_value());
+  EXPECT_EQ(queued_result.value().status_code, 200);
+}
+
+static void expect_pipelined_keep_alive(http::ServerConfig cfg) {
+  u16 port = cfg.port;
+  http::Server server{std::move(cfg)};
+  server.route("/ping", http::EMethod::GET, [](const http::Request &) {
+    return http::Response(200, "pong");
+  });
+  auto start_result = server.start();
+  ASSERT_TRUE(start_result.has_value())
+      << "Server failed to start: " << start_result.error();
+  std::thread server_thread([&server]() { server.run(); });
+  std::this_thread::sleep_for(std::chrono::milliseconds(200));
+  std::string pipelined = "GET /ping HTTP/1.1\r\nHost: localhost\r\n\r\n"
+                          "GET /ping HTTP/1.1\r\nHost: localhost\r\n\r\n"
+                          "GET /ping HTTP/1.1\r\nHost: localhost\r\n"
+                          "Connection: close\r\n\r\n";
+  auto received = raw_exchange(port, pipelined);
+  auto http10 = raw_exchange(port, "GET /ping HTTP/1.0\r\n\r\n"
+                                   "GET /ping HTTP/1.0\r\n\r\n");
+  server.stop();
+  server_thread.join();
+  EXPECT_EQ(count_occurrences(received, "HTTP/1.1 200 OK"), 3u);
+  EXPECT_EQ(count_occurrences(received, "connection: keep-alive"), 2u);
+  EXPECT_EQ(count_occurrences(received, "connection: close"), 1u);
+  EXPECT_EQ(count_occurrences(http10, "HTTP/1.1 200 OK"), 1u);
+}
+
+TEST_P(ServerModeTest, KeepAlivePipelined) {
+  expect_pipelined_keep_alive(config(10004));
+}
+
+TEST(IntegrationTest, KeepAliveRequestLimit) {
+  http::ServerConfig cfg{-1, 10006};
+  cfg.max_keep_alive_requests = 2;
+  http::Server server{std::move(cfg)};
+  server.route("/ping", http::EMethod::GET, [](const http::Request &) {
+    return http::Response(200, "pong");
+  });
+  auto start_result = server.start();
+  ASSERT_TRUE(start_result.has_value())
+      << "Server failed to start: " << start_result.error();
+  std::thread server_thread([&server]() { server.run(); });
+  std::this_thread::sleep_for(std::chrono::milliseconds(200));
+  std::string request = "GET /ping HTTP/1.1\r\nHost: localhost\r\n\r\n";
+  auto received = raw_exchange(10006, request + request + request);
+  server.stop();
+  server_thread.join();
+  EXPECT_EQ(count_occurrences(received, "HTTP/1.1 200 OK"), 2u);
+  EXPECT_EQ(count_occurrences(received, "connection: close"), 1u);
+}
+
+TEST_P(ServerModeTest, KeepAlivePipelinedArena) {
+  auto cfg = config(10020);
+  cfg.use_request_arena = true;
+  cfg.request_arena_size = 256;
+  expect_pipelined_keep_alive(std::move(cfg));
+}
+
+TEST(IntegrationTest, ServerBinaryBodyRoundTrip) {
+  http::ServerConfig cfg{-1, 10007};
+  http::Server server{std::move(cfg)};
+  server.route("/api/echo", http::EMethod::POST,
+               [](const http::Request &req) {
+                 return http::Response(200, req.body);
+               });
+  auto start_result = server.start();
+  ASSERT_TRUE(start_result.has_value())
+      << "Server failed to start: " << start_result.error();
+  std::thread server_thread([&server]() { server.run(); });
+  std::this_thread::sleep_for(std::chrono::milliseconds(200));
+  std::string body("line one\nline two\r\n\0\xff\n", 22);
+  auto result =
+      http::Client::post("http://127.0.0.1:10007/api/echo", body).get();
+  server.stop();
+  server_thread.join();
+  ASSERT_TRUE(result.has_value())
+      << "Client request failed: " << result.error();
+  EXPECT_EQ(result.value().body, body);
+}
+
+static void expect_large_and_chunked_bodies(http::ServerConfig cfg) {
+  u16 port = cfg.port;
+  cfg.max_body_size = 4 * 1024 * 1024;
+  http::Server server{std::move(cfg)};
+  server.route("/api/size", http::EMethod::POST,
+               [](const http::Request &req) {
+                 return http::Response(200, std::to_string(req.body.size()));
+               });
+  server.route("/api/echo", http::EMethod::POST,
+               [](const http::Request &req) {
+                 return http::Response(200, req.body);
+               });
+  auto start_result = server.start();
+  ASSERT_TRUE(start_result.has_value())
+      << "Server failed to start: " << start_result.error();
+  std::thread server_thread([&server]() { server.run(); });
+  std::this_thread::sleep_for(std::chrono::milliseconds(200));
+  std::string url = "http://127.0.0.1:" + std::to_string(port);
+  auto large = http::Client::post(url + "/api/size",
+                                  std::string(3 * 1024 * 1024, 'x'))
+                   .get();
+  auto too_large = http::Client::post(url + "/api/size",
+                                      std::string(5 * 1024 * 1024, 'x'))
+                       .get();
+  auto chunked = raw_exchange(port, "POST /api/echo HTTP/1.1\r\n"
+                                    "Host: localhost\r\n"
+                                    "Transfer-Encoding: chunked\r\n"
+                                    "Connection: close\r\n\r\n"
+                                    "6\r\nchunk-\r\n7\r\ndecoded\r\n0\r\n\r\n");
+  auto continued = raw_exchange(port, "POST /api/echo HTTP/1.1\r\n"
+                                      "Host: localhost\r\n"
+                                      "Expect: 100-continue\r\n"
+                                      "Content-Length: 2\r\n"
+                                      "Connection: close\r\n\r\n",
+                                 "ok");
+  server.stop();
+  server_thread.join();
+  ASSERT_TRUE(large.has_value()) << "Client request failed: " << large.error();
+  EXPECT_EQ(large.value().body, std::to_string(3 * 1024 * 1024));
+  if (too_large.has_value()) {
+    EXPECT_EQ(too_large.value().status_code, 413);
+  }
+  EXPECT_NE(chunked.find("chunk-decoded"), std::string::npos);
+  EXPECT_EQ(continued.rfind("HTTP/1.1 100 Continue\r\n\r\n", 0), 0u);
+  EXPECT_NE(continued.find("HTTP/1.1 200 OK"), std::string::npos);
+}
+
+TEST_P(ServerModeTest, ServerRequestBodies) {
+  expect_large_and_chunked_bodies(config(10008));
+}
+
+TEST_P(ServerModeTest, ServerRequestBodiesArena) {
+  auto cfg = config(10069);
+  cfg.use_request_arena = true;
+  expect_large_and_chunked_bodies(std::move(cfg));
+}
+
+TEST(IntegrationTest, ClientDecodesChunkedResponse) {
+  auto server = serve_raw_once(10010, "HTTP/1.1 200 OK\r\n"
+                                      "Transfer-Encoding: chunked\r\n\r\n"
+                                      "7\r\nchunked\r\n"
+                                      "9\r\n response\r\n"
+                                      "0\r\n\r\n");
+  auto result = http::Client::get("http://127.0.0.1:10010/").get();
+  server.join();
+  ASSERT_TRUE(result.has_value())
+      << "Client request failed: " << result.error();
+  EXPECT_EQ(result.value().status_code, 200);
+  EXPECT_EQ(result.value().body, "chunked response");
+}
+
+TEST(IntegrationTest, ClientStreamsBodyChunks) {
+  std::string payload(256 * 1024, 'z');
+  auto server = serve_raw_once(10011, "HTTP/1.1 200 OK\r\nContent-Length: " +
+                                          std::to_string(payload.size()) +
+                                          "\r\n\r\n" + payload);
+  auto url_result = http::URL::parse("http://127.0.0.1:10011/download");
+  ASSERT_TRUE(url_result.has_value());
+  http::Request req(http::EMethod::GET, std::move(url_result.value()));
+  size_t received = 0;
+  size_t pieces = 0;
+  req.on_body_chunk = [&](std::string_view chunk) {
+    received += chunk.size();
+    ++pieces;
+  };
+  auto result = http::Client::send(req);
+  server.join();
+  ASSERT_TRUE(result.has_value())
+      << "Client request failed: " << result.error();
+  EXPECT_EQ(received, payload.size());
+  EXPECT_GT(pieces, 1u);
+  EXPECT_TRUE(result.value().body.empty());
+}
+
+TEST(IntegrationTest, ClientRejectsTruncatedBody) {
+  auto server = serve_raw_once(10012, "HTTP/1.1 200 OK\r\n"
+                                      "Content-Length: 100\r\n\r\nshort");
+  auto result = http::Client::get("http://127.0.0.1:10012/").get();
+  server.join();
+  EXPECT_FALSE(result.has_value());
+}
+
+TEST(IntegrationTest, ClientRejectsResetBody) {
+  // A body framed by the close, cut short by a reset instead.
+  auto reset_after_partial_body = [](u16 port) {
+    i32 listener = static_cast<i32>(socket(AF_INET, SOCK_STREAM, 0));
+    i32 opt = 1;
+    setsockopt(listener, SOL_SOCKET, SO_REUSEADDR, (const char *)&opt,
+               sizeof(opt));
+    sockaddr_in addr{};
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    addr.sin_port = htons(port);
+    bind(listener, (sockaddr *)&addr, sizeof(addr));
+    listen(listener, 1);
+    return std::thread([listener]() {
+      i32 client = static_cast<i32>(accept(listener, nullptr, nullptr));
+      char buffer[4096];
+      recv(client, buffer, sizeof(buffer), 0);
+      std::string partial = "HTTP/1.1 200 OK\r\n\r\npartial";
+      send(client, partial.data(), static_cast<i32>(partial.size()), 0);
+      std::this_thread::sleep_for(std::chrono::milliseconds(100));
+      linger abort{1, 0};
+      setsockopt(client, SOL_SOCKET, SO_LINGER, (const char *)&abort,
+                 sizeof(abort));
+#ifdef _WIN32
+      closesocket(client);
+      closesocket(listener);
+#else
+      close(client);
+      close(listener);
+#endif
+    });
+  };
+  auto server = reset_after_partial_body(10067);
+  auto url = http::URL::parse("http://127.0.0.1:10067/").value();
+  auto blocking = http::Client::send(http::Request(http::EMethod::GET, url));
+  server.join();
+  server = reset_after_partial_body(10068);
+  auto async = http::Client::get("http://127.0.0.1:10068/").get();
+  server.join();
+
+  ASSERT_FALSE(blocking.has_value()) << blocking.value().body;
+  EXPECT_EQ(blocking.error(), "Failed to read response");
+  ASSERT_FALSE(async.has_value()) << async.value().body;
+  EXPECT_EQ(async.error(), "Failed to read response");
+}
+
+TEST(IntegrationTest, ClientPoolReusesConnection) {
+  auto server = serve_keep_alive_once(10013, 3);
+  http::ClientPool pool;
+  for (i32 i = 0; i < 3; ++i) {
+    auto result = http::Client::get("http://127.0.0.1:10013/", pool).get();
+    ASSERT_TRUE(result.has_value())
+        << "Request " << i << " failed: " << result.error();
+    EXPECT_EQ(result.value().body, std::to_string(i));
+  }
+  server.join();
+  EXPECT_EQ(pool.idle_count(), 1u);
+}
+
+TEST(IntegrationTest, ClientPoolReplacesClosedConnection) {
+  http::ServerConfig cfg{-1, 10014};
+  cfg.keep_alive_timeout = std::chrono::milliseconds(100);
+  http::Server server{std::move(cfg)};
+  server.route("/ping", http::EMethod::GET, [](const http::Request &) {
+    return http::Response(200, "pong");
+  });
+  ASSERT_TRUE(server.start().has_value());
+  std::thread server_thread([&server]() { server.run(); });
+  std::this_thread::sleep_for(std::chrono::milliseconds(200));
+
+  http::ClientPool pool;
+  auto url = http::URL::parse("http://127.0.0.1:10014/ping").value();
+  auto first = http::Client::send(http::Request(http::EMethod::GET, url), pool);
+  EXPECT_EQ(pool.idle_count(url), 1u);
+  // Outlive the server's keep-alive timeout so the pooled socket goes stale.
+  std::this_thread::sleep_for(std::chrono::milliseconds(400));
+  auto second =
+      http::Client::send(http::Request(http::EMethod::GET, url), pool);
+  server.stop();
+  server_thread.join();
+  ASSERT_TRUE(first.has_value()) << first.error();
+  ASSERT_TRUE(second.has_value()) << second.error();
+  EXPECT_EQ(second.value().body, "pong");
+}
+
+TEST(IntegrationTest, ClientPoolHonoursLimits) {
+  http::ServerConfig cfg{-1, 10015};
+  http::Server server{std::move(cfg)};
+  server.route("/ping", http::EMethod::GET, [](const http::Request &) {
+    return http::Response(200, "pong");
+  });
+  ASSERT_TRUE(server.start().has_value());
+  std::thread server_thread([&server]() { server.run(); });
+  std::this_thread::sleep_for(std::chrono::milliseconds(200));
+
+  http::ClientPool pool(
+      http::ClientPoolConfig{1, std::chrono::milliseconds(50)});
+  auto url = http::URL::parse("http://127.0.0.1:10015/ping").value();
+  http::Request close_req(http::EMethod::GET, url);
+  close_req.set_header("Connection", "close");
+  auto closed = http::Client::send(close_req, pool);
+  EXPECT_EQ(pool.idle_count(url), 0u);
+  auto kept = http::Client::send(http::Request(http::EMethod::GET, url), pool);
+  EXPECT_EQ(pool.idle_count(url), 1u);
+  std::this_thread::sleep_for(std::chrono::milliseconds(100));
+  pool.evict_idle();
+  EXPECT_EQ(pool.idle_count(), 0u);
+  server.stop();
+  server_thread.join();
+  ASSERT_TRUE(closed.has_value()) << closed.error();
+  ASSERT_TRUE(kept.has_value()) << kept.error();
+}
+
+TEST(IntegrationTest, ClientExecutorBoundsConcurrency) {
+  http::ServerConfig cfg{-1, 10016, true};
+  cfg.worker_threads = 8;
+  http::Server server{std::move(cfg)};
+  std::atomic<i32> in_flight{0};
+  std::atomic<i32> peak{0};
+  server.route("/slow", http::EMethod::GET, [&](const http::Request &) {
+    i32 now = ++in_flight;
+    i32 seen = peak.load();
+    while (now > seen && !peak.compare_exchange_weak(seen, now)) {
+    }
+    std::this_thread::sleep_for(std::chrono::milliseconds(20));
+    --in_flight;
+    return http::Response(200, "done");
+  });
+  ASSERT_TRUE(server.start().has_value());
+  std::thread server_thread([&server]() { server.run(); });
+  std::this_thread::sleep_for(std::chrono::milliseconds(200));
+
+  http::Client::configure_executor(http::ClientExecutorConfig{2});
+  std::vector<std::future<stl::result<http::Response>>> futures;
+  for (i32 i = 0; i < 12; ++i) {
+    futures.push_back(http::Client::get("http://127.0.0.1:10016/slow"));
+  }
+  for (auto &future : futures) {
+    auto result = future.get();
+    ASSERT_TRUE(result.has_value()) << result.error();
+    EXPECT_EQ(result.value().body, "done");
+  }
+  http::Client::configure_executor(http::ClientExecutorConfig{});
+  server.stop();
+  server_thread.join();
+  EXPECT_LE(peak.load(), 2);
+}
+
+TEST_P(ServerModeTest, SendsBatches) {
+  auto cfg = config(10053);
+  cfg.is_multithreaded = true;
+  cfg.worker_threads = 8;
+  u16 port = cfg.port;
+  std::string base = "http://127.0.0.1:" + std::to_string(port);
+  // Pipelines get cut short and the rest is sent again.
+  cfg.max_keep_alive_requests = 5;
+  http::Server server{std::move(cfg)};
+  // Connections at once, as seen by the handlers.
+  std::atomic<i32> in_flight{0};
+  std::atomic<i32> peak{0};
+  server.route("/item", http::EMethod::GET, [&](const http::Request &req) {
+    i32 now = ++in_flight;
+    i32 seen = peak.load();
+    while (now > seen && !peak.compare_exchange_weak(seen, now)) {
+    }
+    std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    --in_flight;
+    return http::Response(200, req.url.query);
+  });
+  server.route("/item", http::EMethod::POST, [](const http::Request &req) {
+    return http::Response(200, "posted " + req.body);
+  });
+  ASSERT_TRUE(server.start().has_value());
+  std::thread server_thread([&server]() { server.run(); });
+  std::this_thread::sleep_for(std::chrono::milliseconds(200));
+
+  std::vector<http::Request> requests;
+  for (i32 i = 0; i < 60; ++i) {
+    auto url = http::URL::parse(base + "/item?" + std::to_string(i)).value();
+    if (i % 10 == 9) {
+      requests.emplace_back(http::EMethod::POST, std::move(url));
+      requests.back().set_body(std::to_string(i));
+    } else {
+      requests.emplace_back(http::EMethod::GET, std::move(url));
+    }
+  }
+  http::ClientPool pool;
+  auto results = http::Client::send_all(requests, pool, 3);
+  std::vector<i32> seen(requests.size(), 0);
+  http::Client::send_all(
+      requests, pool, 2,
+      [&seen](size_t index, stl::result<http::Response> result) {
+        if (result)
+          ++seen[index];
+      });
+  auto metrics = server.metrics();
+  pool.clear();
+  server.stop();
+  server_thread.join();
+
+  ASSERT_EQ(results.size(), requests.size());
+  for (size_t i = 0; i < results.size(); ++i) {
+    ASSERT_TRUE(results[i].has_value()) << i << ": " << results[i].error();
+    EXPECT_EQ(results[i].value().body,
+              i % 10 == 9 ? "posted " + std::to_string(i)
+                          : "?" + std::to_string(i));
+    EXPECT_EQ(seen[i], 1) << i;
+  }
+  EXPECT_EQ(metrics.requests, 120u);
+  EXPECT_LE(peak.load(), 3);
+  // No connection carried more than five.
+  EXPECT_GE(metrics.connections_accepted, 24u);
+}
+
+TEST(IntegrationTest, PipelinesBatchRequests) {
+  i32 listener = static_cast<i32>(socket(AF_INET, SOCK_STREAM, 0));
+  i32 opt = 1;
+  setsockopt(listener, SOL_SOCKET, SO_REUSEADDR, (const char *)&opt,
+             sizeof(opt));
+  sockaddr_in addr{};
+  addr.sin_family = AF_INET;
+  addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+  addr.sin_port = htons(10055);
+  bind(listener, (sockaddr *)&addr, sizeof(addr));
+  listen(listener, 1);
+  // Answers only once all three requests are in, in one write.
+  std::thread server([listener]() {
+    i32 client = static_cast<i32>(accept(listener, nullptr, nullptr));
+    std::string pending;
+    char buffer[4096];
+    size_t heads = 0;
+    i32 n = 0;
+    while (heads < 3 &&
+           (n = static_cast<i32>(recv(client, buffer, sizeof(buffer), 0))) >
+               0) {
+      pending.append(buffer, n);
+      heads = 0;
+      for (auto at = pending.find("\r\n\r\n"); at != std::string::npos;
+           at = pending.find("\r\n\r\n", at + 4))
+        ++heads;
+    }
+    std::string responses;
+    for (i32 i = 0; i < 3; ++i) {
+      responses += "HTTP/1.1 200 OK\r\nContent-Length: 1\r\n\r\n" +
+                   std::to_string(i);
+    }
+    send(client, responses.data(), static_cast<i32>(responses.size()), 0);
+#ifdef _WIN32
+    closesocket(client);
+    closesocket(listener);
+#else
+    close(client);
+    close(listener);
+#endif
+  });
+
+  std::vector<http::Request> requests;
+  for (i32 i = 0; i < 3; ++i) {
+    requests.emplace_back(http::EMethod::GET,
+                          http::URL::parse("http://127.0.0.1:10055/").value());
+    requests.back().timeout = std::chrono::seconds(2);
+  }
+  auto results = http::Client::send_all(requests, 1);
+  server.join();
+  ASSERT_EQ(results.size(), 3u);
+  for (size_t i = 0; i < results.size(); ++i) {
+    ASSERT_TRUE(results[i].has_value()) << results[i].error();
+    EXPECT_EQ(results[i].value().body, std::to_string(i));
+  }
+}
+
+TEST_P(ServerModeTest, ServerLargeResponse) {
+  auto cfg = config(10017);
+  u16 port = cfg.port;
+  http::Server server{std::move(cfg)};
+  std::string payload(4 * 1024 * 1024, '\0');
+  for (size_t i = 0; i < payload.size(); ++i)
+    payload[i] = static_cast<char>('a' + i % 26);
+  server.route("/big", http::EMethod::GET, [&payload](const http::Request &) {
+    return http::Response(200, payload);
+  });
+  ASSERT_TRUE(server.start().has_value());
+  std::thread server_thread([&server]() { server.run(); });
+  std::this_thread::sleep_for(std::chrono::milliseconds(200));
+  std::string url = "http://127.0.0.1:" + std::to_string(port) + "/big";
+  http::ClientPool pool;
+  auto first = http::Client::get(url, pool).get();
+  auto second = http::Client::get(url, pool).get();
+  // The blocking server waits on idle keep-alive sockets; hang up first.
+  pool.clear();
+  server.stop();
+  server_thread.join();
+  ASSERT_TRUE(first.has_value()) << first.error();
+  ASSERT_TRUE(second.has_value()) << second.error();
+  EXPECT_TRUE(first.value().body == payload);
+  EXPECT_TRUE(second.value().body == payload);
+}
+
+TEST(IntegrationTest, ServerRoutesParamsAndMethods) {
+  http::ServerConfig cfg{-1, 10019};
+  http::Server server{std::move(cfg)};
+  auto echo = [](const http::Request &req) {
+    std::string body;
+    for (const auto &param : req.params) {
+      body.append(param.name).append("=").append(param.value).append(";");
+    }
+    return http::Response(200, body.empty() ? "static" : body);
+  };
+  server.route("/users/:id", http::EMethod::GET, echo);
+  server.route("/users/:id", http::EMethod::DELETE, echo);
+  server.route("/users/new", http::EMethod::GET, echo);
+  server.route("/users/:id/posts/:post", http::EMethod::GET, echo);
+  server.route("/files/*path", http::EMethod::GET, echo);
+  ASSERT_TRUE(server.start().has_value());
+  std::thread server_thread([&server]() { server.run(); });
+  std::this_thread::sleep_for(std::chrono::milliseconds(200));
+
+  auto get = [](std::string_view path) {
+    return http::Client::get("http://127.0.0.1:10019" + std::string(path))
+        .get();
+  };
+  auto param = get("/users/42");
+  auto fixed = get("/users/new");
+  auto nested = get("/users/7/posts/9");
+  auto wildcard = get("/files/css/site.css");
+  auto missing = get("/users/42/comments");
+  auto url = http::URL::parse("http://127.0.0.1:10019/users/42").value();
+  auto wrong_method =
+      http::Client::send(http::Request(http::EMethod::PUT, std::move(url)));
+  server.stop();
+  server_thread.join();
+
+  ASSERT_TRUE(param.has_value());
+  EXPECT_EQ(param.value().body, "id=42;");
+  ASSERT_TRUE(fixed.has_value());
+  EXPECT_EQ(fixed.value().body, "static");
+  ASSERT_TRUE(nested.has_value());
+  EXPECT_EQ(nested.value().body, "id=7;post=9;");
+  ASSERT_TRUE(wildcard.has_value());
+  EXPECT_EQ(wildcard.value().body, "path=css/site.css;");
+  ASSERT_TRUE(missing.has_value());
+  EXPECT_EQ(missing.value().status_code, 404);
+  ASSERT_TRUE(wrong_method.has_value());
+  EXPECT_EQ(wrong_method.value().status_code, 405);
+  EXPECT_EQ(wrong_method.value().headers.get("Allow"), "GET, DELETE");
+}
+
+TEST(IntegrationTest, ServerMountsStaticRoutes) {
+  http::ServerConfig cfg{-1, 10056};
+  http::Server server{std::move(cfg)};
+  auto reply = [](std::string body) {
+    return [body](const http::Request &) { return http::Response(200, body); };
+  };
+  http::StaticRouter routes{
+      http::static_route<"/health", http::EMethod::GET>(reply("healthy")),
+      http::static_route<"/items", http::EMethod::GET>(reply("list")),
+      http::static_route<"/items", http::EMethod::POST>(
+          [](const http::Request &req) {
+            return http::Response(201, "created " + req.body);
+          }),
+      // Shadowed by the first /health route.
+      http::static_route<"/health", http::EMethod::GET>(reply("shadowed"))};
+  server.mount(std::move(routes));
+  server.route("/items", http::EMethod::DELETE, reply("deleted"));
+  server.route("/items/:id", http::EMethod::GET, [](const http::Request &req) {
+    return http::Response(200, "item " + std::string(req.params.get("id")));
+  });
+  ASSERT_TRUE(server.start().has_value());
+  std::thread server_thread([&server]() { server.run(); });
+  std::this_thread::sleep_for(std::chrono::milliseconds(200));
+
+  std::string base = "http://127.0.0.1:10056";
+  auto send = [&base](http::EMethod method, std::string_view path,
+                      std::string body = "") {
+    auto url = http::URL::parse(base + std::string(path)).value();
+    http::Request req(method, std::move(url));
+    if (!body.empty())
+      req.set_body(std::move(body));
+    return http::Client::send(std::move(req));
+  };
+  auto health = send(http::EMethod::GET, "/health");
+  auto list = send(http::EMethod::GET, "/items");
+  auto created = send(http::EMethod::POST, "/items", "x");
+  auto deleted = send(http::EMethod::DELETE, "/items");
+  auto item = send(http::EMethod::GET, "/items/7");
+  auto wrong_method = send(http::EMethod::PUT, "/items");
+  auto missing = send(http::EMethod::GET, "/healthz");
+  auto metrics = server.metrics();
+  server.stop();
+  server_thread.join();
+
+  ASSERT_TRUE(health.has_value());
+  EXPECT_EQ(health.value().body, "healthy");
+  ASSERT_TRUE(list.has_value());
+  EXPECT_EQ(list.value().body, "list");
+  ASSERT_TRUE(created.has_value());
+  EXPECT_EQ(created.value().status_code, 201);
+  EXPECT_EQ(created.value().body, "created x");
+  ASSERT_TRUE(deleted.has_value());
+  EXPECT_EQ(deleted.value().body, "deleted");
+  ASSERT_TRUE(item.has_value());
+  EXPECT_EQ(item.value().body, "item 7");
+  ASSERT_TRUE(wrong_method.has_value());
+  EXPECT_EQ(wrong_method.value().status_code, 405);
+  EXPECT_EQ(wrong_method.value().headers.get("Allow"), "GET, POST, DELETE");
+  ASSERT_TRUE(missing.has_value());
+  EXPECT_EQ(missing.value().status_code, 404);
+
+  // Mounted routes are listed in metrics like the others.
+  ASSERT_EQ(metrics.routes.size(), 6u);
+  EXPECT_EQ(metrics.routes[0].path, "/health");
+  EXPECT_EQ(metrics.routes[0].requests, 1u);
+  EXPECT_EQ(metrics.routes[2].method, http::EMethod::POST);
+  EXPECT_EQ(metrics.routes[2].requests, 1u);
+  EXPECT_EQ(metrics.routes[3].requests, 0u);
+  EXPECT_EQ(metrics.routes[4].path, "/items");
+  EXPECT_EQ(metrics.routes[4].requests, 1u);
+  EXPECT_EQ(metrics.method_not_allowed, 1u);
+}
+
+TEST(IntegrationTest, ServerCachesResponses) {
+  http::ServerConfig cfg{-1, 10057, true};
+  cfg.worker_threads = 2;
+  http::Server server{std::move(cfg)};
+  std::atomic<i32> calls{0};
+  auto counted = [&calls](std::string cache_control) {
+    return [&calls, cache_control](const http::Request &req) {
+      auto variant = req.headers.get("X-Variant");
+      http::Response resp(200,
+                          std::to_string(++calls) + " " + std::string(variant));
+      if (!cache_control.empty())
+        resp.headers.set("Cache-Control", cache_control);
+      return resp;
+    };
+  };
+  server.route("/cached", http::EMethod::GET, counted(""));
+  server.route("/long", http::EMethod::GET, counted("public, max-age=60"));
+  server.route("/nostore", http::EMethod::GET, counted("no-store"));
+  server.route("/stale", http::EMethod::GET, counted("max-age=0"));
+  server.route("/cookie", http::EMethod::GET, [&calls](const http::Request &) {
+    http::Response resp(200, std::to_string(++calls));
+    resp.headers.set("Set-Cookie", "session=1");
+    return resp;
+  });
+  server.route("/language", http::EMethod::GET,
+               [&calls](const http::Request &) {
+                 http::Response resp(200, std::to_string(++calls));
+                 resp.headers.set("Vary", "Accept-Language");
+                 return resp;
+               });
+  http::ResponseCacheConfig cache;
+  cache.default_ttl = std::chrono::milliseconds(300);
+  cache.vary_headers = {"X-Variant"};
+  server.cache_responses(cache);
+  ASSERT_TRUE(server.start().has_value());
+  std::thread server_thread([&server]() { server.run(); });
+  std::this_thread::sleep_for(std::chrono::milliseconds(200));
+
+  http::ClientPool pool;
+  auto get = [&pool](std::string_view path, http::Headers headers = {}) {
+    auto url = http::URL::parse("http://127.0.0.1:10057" + std::string(path));
+    http::Request req(http::EMethod::GET, std::move(url.value()));
+    for (const auto &field : headers)
+      req.headers.set(field.name, field.value);
+    auto resp = http::Client::send(req, pool);
+    return resp ? resp.value().body : resp.error();
+  };
+  auto with = [](std::string_view name, std::string_view value) {
+    http::Headers headers;
+    headers.set(name, value);
+    return headers;
+  };
+  std::vector<std::string> bodies;
+  bodies.push_back(get("/cached"));
+  bodies.push_back(get("/cached"));
+  bodies.push_back(get("/cached?page=2"));
+  bodies.push_back(get("/cached", with("X-Variant", "b")));
+  bodies.push_back(get("/cached", with("X-Variant", "b")));
+  // Bypasses the cache, and refreshes it.
+  bodies.push_back(get("/cached", with("Authorization", "Bearer x")));
+  bodies.push_back(get("/cached", with("Cache-Control", "no-cache")));
+  bodies.push_back(get("/cached"));
+  bodies.push_back(get("/nostore"));
+  bodies.push_back(get("/nostore"));
+  bodies.push_back(get("/stale"));
+  bodies.push_back(get("/stale"));
+  bodies.push_back(get("/cookie"));
+  bodies.push_back(get("/cookie"));
+  bodies.push_back(get("/language"));
+  bodies.push_back(get("/language"));
+  bodies.push_back(get("/long"));
+  // Without a pool, so the hit is sent with Connection: close.
+  auto url = http::URL::parse("http://127.0.0.1:10057/long").value();
+  auto closing = http::Client::send(http::Request(http::EMethod::GET, url));
+  std::this_thread::sleep_for(std::chrono::milliseconds(400));
+  bodies.push_back(get("/cached"));
+  bodies.push_back(get("/long"));
+  auto metrics = server.metrics();
+  pool.clear();
+  server.stop();
+  server_thread.join();
+
+  std::vector<std::string> expected{
+      "1 ", "1 ", "2 ", "3 b", "3 b", "4 ", "5 ",  "5 ",  "6 ", "7 ",
+      "8 ", "9 ", "10", "11",  "12",  "13", "14 ", "15 ", "14 "};
+  EXPECT_EQ(bodies, expected);
+  ASSERT_TRUE(closing.has_value()) << closing.error();
+  EXPECT_EQ(closing.value().body, "14 ");
+  EXPECT_EQ(closing.value().headers.get("Connection"), "close");
+  EXPECT_EQ(metrics.cache_hits, 5u);
+  EXPECT_EQ(metrics.cache_misses, 13u);
+  EXPECT_EQ(metrics.requests, 20u);
+}
+
+TEST(IntegrationTest, ServerCoalescesCacheMisses) {
+  http::ServerConfig cfg{-1, 10058, true};
+  cfg.worker_threads = 8;
+  http::Server server{std::move(cfg)};
+  std::atomic<i32> calls{0};
+  server.route("/slow", http::EMethod::GET, [&calls](const http::Request &) {
+    std::this_thread::sleep_for(std::chrono::milliseconds(300));
+    return http::Response(200, "call " + std::to_string(++calls));
+  });
+  server.cache_responses();
+  ASSERT_TRUE(server.start().has_value());
+  std::thread server_thread([&server]() { server.run(); });
+  std::this_thread::sleep_for(std::chrono::milliseconds(200));
+
+  std::vector<std::future<stl::result<http::Response>>> pending;
+  for (i32 i = 0; i < 6; ++i)
+    pending.push_back(http::Client::get("http://127.0.0.1:10058/slow"));
+  std::vector<stl::result<http::Response>> results;
+  for (auto &f : pending)
+    results.push_back(f.get());
+  auto metrics = server.metrics();
+  server.stop();
+  server_thread.join();
+
+  for (auto &result : results) {
+    ASSERT_TRUE(result.has_value()) << result.error();
+    EXPECT_EQ(result.value().body, "call 1");
+  }
+  EXPECT_EQ(calls.load(), 1);
+  EXPECT_EQ(metrics.cache_hits, 5u);
+  EXPECT_EQ(metrics.cache_misses, 1u);
+}
+
+TEST(IntegrationTest, ServerCoalescesCacheMissesEventLoop) {
+  http::ServerConfig cfg{-1, 10063};
+  cfg.use_event_loop = true;
+  cfg.event_loop_threads = 2;
+  http::Server server{std::move(cfg)};
+  std::atomic<i32> calls{0};
+  server.route("/slow", http::EMethod::GET, [&calls](const http::Request &) {
+    std::this_thread::sleep_for(std::chrono::milliseconds(800));
+    return http::Response(200, "call " + std::to_string(++calls));
+  });
+  server.route("/ping", http::EMethod::GET, [](const http::Request &) {
+    return http::Response(200, "pong");
+  });
+  server.cache_responses();
+  ASSERT_TRUE(server.start().has_value());
+  std::thread server_thread([&server]() { server.run(); });
+  std::this_thread::sleep_for(std::chrono::milliseconds(200));
+
+  std::string base = "http://127.0.0.1:10063";
+  auto leader = http::Client::get(base + "/slow");
+  std::this_thread::sleep_for(std::chrono::milliseconds(100));
+  // The leader's loop is stuck in the handler, so the other one accepts
+  // the rest. Waiting for the leader must not stop it serving.
+  auto waiter = http::Client::get(base + "/slow");
+  std::this_thread::sleep_for(std::chrono::milliseconds(100));
+  auto started = std::chrono::steady_clock::now();
+  auto ping = http::Client::get(base + "/ping").get();
+  auto ping_time = std::chrono::steady_clock::now() - started;
+  auto first = leader.get();
+  auto second = waiter.get();
+  auto metrics = server.metrics();
+  server.stop();
+  server_thread.join();
+
+  ASSERT_TRUE(ping.has_value()) << ping.error();
+  EXPECT_EQ(ping.value().body, "pong");
+  EXPECT_LT(ping_time, std::chrono::milliseconds(400));
+  ASSERT_TRUE(first.has_value()) << first.error();
+  ASSERT_TRUE(second.has_value()) << second.error();
+  EXPECT_EQ(first.value().body, "call 1");
+  EXPECT_EQ(second.value().body, "call 1");
+  EXPECT_EQ(calls.load(), 1);
+  EXPECT_EQ(metrics.cache_hits, 1u);
+}
+
+TEST_P(ServerModeTest, ServerMetrics) {
+  auto cfg = config(10022);
+  cfg.event_loop_threads = 2;
+  u16 port = cfg.port;
+  std::string base = "http://127.0.0.1:" + std::to_string(port);
+  http::Server server{std::move(cfg)};
+  server.route("/users/:id", http::EMethod::GET, [](const http::Request &) {
+    return http::Response(200, "user");
+  });
+  server.route("/boom", http::EMethod::GET,
+               [](const http::Request &) -> http::Response {
+                 throw std::runtime_error("boom");
+               });
+  server.expose_metrics();
+  ASSERT_TRUE(server.start().has_value());
+  std::thread server_thread([&server]() { server.run(); });
+  std::this_thread::sleep_for(std::chrono::milliseconds(200));
+
+  auto first = http::Client::get(base + "/users/1").get();
+  auto second = http::Client::get(base + "/users/2").get();
+  auto boom = http::Client::get(base + "/boom").get();
+  auto missing = http::Client::get(base + "/nope").get();
+  auto url = http::URL::parse(base + "/users/1").value();
+  auto wrong_method =
+      http::Client::send(http::Request(http::EMethod::POST, std::move(url)));
+  auto malformed = raw_exchange(port, "NOT HTTP\r\n\r\n");
+  auto exposed = http::Client::get(base + "/metrics").get();
+  server.stop();
+  server_thread.join();
+
+  ASSERT_TRUE(first.has_value());
+  ASSERT_TRUE(second.has_value());
+  ASSERT_TRUE(boom.has_value());
+  EXPECT_EQ(boom.value().status_code, 500);
+  EXPECT_NE(malformed.find("400"), std::string::npos);
+
+  auto metrics = server.metrics();
+  EXPECT_EQ(metrics.connections_accepted, 7u);
+  EXPECT_EQ(metrics.connections_active, 0u);
+  EXPECT_EQ(metrics.requests, 6u);
+  EXPECT_EQ(metrics.parse_errors, 1u);
+  EXPECT_EQ(metrics.not_found, 1u);
+  EXPECT_EQ(metrics.method_not_allowed, 1u);
+  EXPECT_EQ(metrics.handler_exceptions, 1u);
+  EXPECT_EQ(metrics.parse.count(), 6u);
+  EXPECT_EQ(metrics.handler.count(), 6u);
+  EXPECT_EQ(metrics.write.count(), 7u);
+  ASSERT_EQ(metrics.routes.size(), 3u);
+  EXPECT_EQ(metrics.routes[0].requests, 2u);
+  EXPECT_EQ(metrics.routes[0].latency.count(), 2u);
+  EXPECT_EQ(metrics.routes[1].requests, 1u);
+  EXPECT_EQ(metrics.routes[1].errors, 1u);
+  EXPECT_EQ(metrics.routes[2].path, "/metrics");
+
+  ASSERT_TRUE(exposed.has_value());
+  EXPECT_EQ(exposed.value().status_code, 200);
+  EXPECT_EQ(exposed.value().headers.get(http::EHeader::ContentType),
+            "text/plain; version=0.0.4");
+  EXPECT_NE(exposed.value().body.find("sap_http_route_requests_total{method="
+                                      "\"GET\",route=\"/users/:id\"} 2\n"),
+            std::string::npos);
+  EXPECT_NE(exposed.value().body.find("sap_http_handler_exceptions_total 1\n"),
+            std::string::npos);
+}
+
+TEST(IntegrationTest, ServerReusePortListeners) {
+  http::ServerConfig cfg{-1, 10024};
+  cfg.use_event_loop = true;
+  cfg.event_loop_threads = 4;
+  cfg.reuse_port = true;
+  cfg.pin_threads = true;
+  http::Server server{std::move(cfg)};
+  server.route("/", http::EMethod::GET,
+               [](const http::Request &) { return http::Response(200, "ok"); });
+  ASSERT_TRUE(server.start().has_value());
+  std::thread server_thread([&server]() { server.run(); });
+  std::this_thread::sleep_for(std::chrono::milliseconds(200));
+
+  std::vector<std::future<stl::result<http::Response>>> responses;
+  for (i32 i = 0; i < 32; ++i)
+    responses.push_back(http::Client::get("http://127.0.0.1:10024/"));
+  i32 ok = 0;
+  for (auto &response : responses) {
+    auto result = response.get();
+    if (result.has_value() && result.value().body == "ok")
+      ++ok;
+  }
+  server.stop();
+  server_thread.join();
+  EXPECT_EQ(ok, 32);
+}
+
+TEST(IntegrationTest, ServerDualStackBind) {
+  http::ServerConfig cfg{-1, 10025};
+  cfg.bind_address = "::";
+  cfg.listen_backlog = 64;
+  http::Server server{std::move(cfg)};
+  server.route("/", http::EMethod::GET,
+               [](const http::Request &) { return http::Response(200, "ok"); });
+  ASSERT_TRUE(server.start().has_value());
+  std::thread server_thread([&server]() { server.run(); });
+  std::this_thread::sleep_for(std::chrono::milliseconds(200));
+
+  auto v4 = http::Client::get("http://127.0.0.1:10025/").get();
+  std::string v6;
+  i32 sock = static_cast<i32>(socket(AF_INET6, SOCK_STREAM, 0));
+  sockaddr_in6 addr{};
+  addr.sin6_family = AF_INET6;
+  addr.sin6_addr = in6addr_loopback;
+  addr.sin6_port = htons(10025);
+  if (connect(sock, (sockaddr *)&addr, sizeof(addr)) == 0) {
+    std::string request = "GET / HTTP/1.1\r\nConnection: close\r\n\r\n";
+    send(sock, request.data(), static_cast<i32>(request.size()), 0);
+    char buffer[1024];
+    i32 n;
+    while ((n = static_cast<i32>(recv(sock, buffer, sizeof(buffer), 0))) > 0)
+      v6.append(buffer, n);
+  }
+#ifdef _WIN32
+  closesocket(sock);
+#else
+  close(sock);
+#endif
+  server.stop();
+  server_thread.join();
+
+  ASSERT_TRUE(v4.has_value());
+  EXPECT_EQ(v4.value().body, "ok");
+  EXPECT_EQ(v6.rfind("HTTP/1.1 200", 0), 0u);
+}
+
+static void write_file(const std::filesystem::path &path,
+                       const std::string &data) {
+  std::ofstream out(path, std::ios::binary | std::ios::trunc);
+  out << data;
+}
+
+TEST_P(ServerModeTest, ServerStaticFiles) {
+  auto cfg = config(10026);
+  u16 port = cfg.port;
+  std::string base = "http://127.0.0.1:" + std::to_string(port) + "/assets/";
+  auto root = std::filesystem::temp_directory_path() /
+              ("sap_http_static_" + std::to_string(port));
+  std::filesystem::remove_all(root);
+  std::filesystem::create_directories(root / "css");
+  write_file(root / "index.html", "<h1>home</h1>");
+  write_file(root / "css" / "site.css", "body { color: red; }");
+  write_file(root / "secret.txt", "outside");
+  std::string large(8 * 1024 * 1024 + 17, '\0');
+  for (size_t i = 0; i < large.size(); ++i)
+    large[i] = static_cast<char>('a' + i % 26);
+  write_file(root / "large.bin", large);
+
+  http::Server server{std::move(cfg)};
+  http::StaticFileConfig files;
+  files.revalidate_after = std::chrono::milliseconds(0);
+  server.serve_static("/assets", root.string(), files);
+  ASSERT_TRUE(server.start().has_value());
+  std::thread server_thread([&server]() { server.run(); });
+  std::this_thread::sleep_for(std::chrono::milliseconds(200));
+
+  auto send = [&](http::EMethod method, const std::string &path,
+                  std::string_view header = {}, std::string_view value = {}) {
+    http::Request req(method, http::URL::parse(base + path).value());
+    if (!header.empty())
+      req.headers.set(header, value);
+    return http::Client::send(req);
+  };
+  auto css = send(http::EMethod::GET, "css/site.css");
+  auto index = send(http::EMethod::GET, "");
+  auto head = send(http::EMethod::HEAD, "css/site.css");
+  std::string etag =
+      css.has_value() ? std::string(css.value().headers.get("ETag")) : "";
+  auto not_modified =
+      send(http::EMethod::GET, "css/site.css", "If-None-Match", etag);
+  auto range = send(http::EMethod::GET, "css/site.css", "Range", "bytes=0-3");
+  auto suffix = send(http::EMethod::GET, "css/site.css", "Range", "bytes=-3");
+  auto beyond =
+      send(http::EMethod::GET, "css/site.css", "Range", "bytes=500-");
+  auto escaped = send(http::EMethod::GET, "css/%2e%2e/secret.txt");
+  auto missing = send(http::EMethod::GET, "nope.txt");
+  auto whole = send(http::EMethod::GET, "large.bin");
+  auto tail = send(http::EMethod::GET, "large.bin", "Range",
+                   "bytes=" + std::to_string(large.size() - 10) + "-");
+  {
+    // A client that hangs up mid-download must not take the server down.
+    i32 sock = static_cast<i32>(socket(AF_INET, SOCK_STREAM, 0));
+    sockaddr_in addr{};
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    addr.sin_port = htons(port);
+    if (connect(sock, (sockaddr *)&addr, sizeof(addr)) == 0) {
+      std::string request = "GET /assets/large.bin HTTP/1.1\r\n\r\n";
+      ::send(sock, request.data(), static_cast<i32>(request.size()), 0);
+      char buffer[1024];
+      recv(sock, buffer, sizeof(buffer), 0);
+    }
+#ifdef _WIN32
+    closesocket(sock);
+#else
+    close(sock);
+#endif
+  }
+  write_file(root / "css" / "site.css", "body { color: blue; margin: 0; }");
+  auto changed =
+      send(http::EMethod::GET, "css/site.css", "If-None-Match", etag);
+  server.stop();
+  server_thread.join();
+  std::filesystem::remove_all(root);
+
+  ASSERT_TRUE(css.has_value());
+  EXPECT_EQ(css.value().status_code, 200);
+  EXPECT_EQ(css.value().body, "body { color: red; }");
+  EXPECT_EQ(css.value().headers.get(http::EHeader::ContentType), "text/css");
+  EXPECT_EQ(css.value().headers.get("Accept-Ranges"), "bytes");
+  EXPECT_FALSE(css.value().headers.get("Last-Modified").empty());
+  EXPECT_FALSE(etag.empty());
+  ASSERT_TRUE(index.has_value());
+  EXPECT_EQ(index.value().body, "<h1>home</h1>");
+  ASSERT_TRUE(head.has_value());
+  EXPECT_EQ(head.value().headers.get(http::EHeader::ContentLength), "20");
+  EXPECT_TRUE(head.value().body.empty());
+  ASSERT_TRUE(not_modified.has_value());
+  EXPECT_EQ(not_modified.value().status_code, 304);
+  EXPECT_TRUE(not_modified.value().body.empty());
+  ASSERT_TRUE(range.has_value());
+  EXPECT_EQ(range.value().status_code, 206);
+  EXPECT_EQ(range.value().body, "body");
+  EXPECT_EQ(range.value().headers.get("Content-Range"), "bytes 0-3/20");
+  ASSERT_TRUE(suffix.has_value());
+  EXPECT_EQ(suffix.value().body, "; }");
+  ASSERT_TRUE(beyond.has_value());
+  EXPECT_EQ(beyond.value().status_code, 416);
+  ASSERT_TRUE(escaped.has_value());
+  EXPECT_EQ(escaped.value().status_code, 404);
+  ASSERT_TRUE(missing.has_value());
+  EXPECT_EQ(missing.value().status_code, 404);
+  ASSERT_TRUE(whole.has_value());
+  EXPECT_EQ(whole.value().body.size(), large.size());
+  EXPECT_TRUE(whole.value().body == large);
+  ASSERT_TRUE(tail.has_value());
+  EXPECT_EQ(tail.value().body, large.substr(large.size() - 10));
+  ASSERT_TRUE(changed.has_value());
+  EXPECT_EQ(changed.value().status_code, 200);
+  EXPECT_EQ(changed.value().body, "body { color: blue; margin: 0; }");
+}
+
+TEST_P(ServerModeTest, ServerStreamingResponses) {
+  auto cfg = config(10028);
+  u16 port = cfg.port;
+  std::string base = "http://127.0.0.1:" + std::to_string(port);
+  http::Server server{std::move(cfg)};
+  server.route("/chunked", http::EMethod::GET,
+               [](const http::Request &, http::ResponseWriter &writer) {
+                 http::Headers headers;
+                 headers.set(http::EHeader::ContentType, "text/csv");
+                 writer.start(200, std::move(headers));
+                 for (i32 i = 0; i < 2000; ++i)
+                   writer.write("row," + std::to_string(i) + "\n");
+               });
+  server.route("/length", http::EMethod::GET,
+               [](const http::Request &, http::ResponseWriter &writer) {
+                 http::Headers headers;
+                 headers.set(http::EHeader::ContentLength, "10");
+                 writer.start(200, std::move(headers));
+                 writer.write("01234");
+                 writer.write("56789");
+               });
+  std::atomic<bool> saw_disconnect{false};
+  server.route("/endless", http::EMethod::GET,
+               [&saw_disconnect](const http::Request &,
+                                 http::ResponseWriter &writer) {
+                 std::string block(16 * 1024, 'x');
+                 for (i32 i = 0; i < 100000; ++i) {
+                   if (!writer.write(block)) {
+                     saw_disconnect = true;
+                     return;
+                   }
+                 }
+               });
+  ASSERT_TRUE(server.start().has_value());
+  std::thread server_thread([&server]() { server.run(); });
+  std::this_thread::sleep_for(std::chrono::milliseconds(200));
+
+  std::string expected;
+  for (i32 i = 0; i < 2000; ++i)
+    expected += "row," + std::to_string(i) + "\n";
+  http::ClientPool pool;
+  auto chunked = http::Client::get(base + "/chunked", pool).get();
+  auto length = http::Client::get(base + "/length", pool).get();
+  size_t reused = pool.idle_count();
+  pool.clear();
+  auto http10 = raw_exchange(port, "GET /length HTTP/1.0\r\n\r\n");
+  auto unframed = raw_exchange(port, "GET /chunked HTTP/1.0\r\n\r\n");
+  {
+    i32 sock = static_cast<i32>(socket(AF_INET, SOCK_STREAM, 0));
+    sockaddr_in addr{};
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    addr.sin_port = htons(port);
+    if (connect(sock, (sockaddr *)&addr, sizeof(addr)) == 0) {
+      std::string request = "GET /endless HTTP/1.1\r\n\r\n";
+      ::send(sock, request.data(), static_cast<i32>(request.size()), 0);
+      char buffer[4096];
+      recv(sock, buffer, sizeof(buffer), 0);
+    }
+#ifdef _WIN32
+    closesocket(sock);
+#else
+    close(sock);
+#endif
+  }
+  for (i32 i = 0; i < 50 && !saw_disconnect; ++i)
+    std::this_thread::sleep_for(std::chrono::milliseconds(20));
+  server.stop();
+  server_thread.join();
+
+  ASSERT_TRUE(chunked.has_value());
+  EXPECT_EQ(chunked.value().headers.get(http::EHeader::TransferEncoding),
+            "chunked");
+  EXPECT_EQ(chunked.value().headers.get(http::EHeader::ContentType),
+            "text/csv");
+  EXPECT_TRUE(chunked.value().body == expected);
+  ASSERT_TRUE(length.has_value());
+  EXPECT_EQ(length.value().body, "0123456789");
+  EXPECT_EQ(reused, 1u);
+  EXPECT_NE(http10.find("\r\n\r\n0123456789"), std::string::npos);
+  // HTTP/1.0 has no chunking: the body runs until the connection closes.
+  EXPECT_EQ(unframed.find("chunked"), std::string::npos);
+  EXPECT_TRUE(unframed.size() > expected.size() &&
+              unframed.substr(unframed.size() - expected.size()) == expected);
+  EXPECT_TRUE(saw_disconnect);
+}
+
+// Serves /slow after `delay`, on as many threads as callers can keep busy.
+static std::unique_ptr<http::Server>
+start_upstream(u16 port, std::chrono::milliseconds delay) {
+  http::ServerConfig cfg{-1, port, true};
+  cfg.worker_threads = 64;
+  auto upstream = std::make_unique<http::Server>(std::move(cfg));
+  upstream->route("/slow", http::EMethod::GET,
+                  [delay](const http::Request &req) {
+                    std::this_thread::sleep_for(delay);
+                    return http::Response(200, "upstream" + req.url.query);
+                  });
+  if (!upstream->start())
+    return nullptr;
+  return upstream;
+}
+
+TEST_P(ServerModeTest, ServerCoroutineHandlers) {
+  auto cfg = config(10030);
+  u16 port = cfg.port;
+  auto upstream_port = static_cast<u16>(port + 2);
+  // Blocking mode runs the coroutine to completion on the connection's
+  // thread, one upstream call after another; one loop thread keeps all
+  // upstream calls in flight at once.
+  i32 concurrent = event_loop() ? 32 : 3;
+  std::chrono::milliseconds limit = event_loop()
+                                        ? std::chrono::milliseconds(1500)
+                                        : std::chrono::seconds(5);
+  auto upstream = start_upstream(upstream_port, std::chrono::milliseconds(200));
+  ASSERT_TRUE(upstream);
+  std::thread upstream_thread([&upstream]() { upstream->run(); });
+
+  std::string upstream_base =
+      "http://127.0.0.1:" + std::to_string(upstream_port);
+  http::ClientPool upstream_pool;
+  http::Server server{std::move(cfg)};
+  server.route("/proxy", http::EMethod::GET,
+               [&](const http::Request &req) -> http::Task<http::Response> {
+                 auto url = http::URL::parse(upstream_base + "/slow" +
+                                             req.url.query);
+                 auto resp = co_await http::Client::co_send(
+                     http::Request(http::EMethod::GET, url.value()),
+                     upstream_pool);
+                 if (!resp)
+                   co_return http::Response(502, resp.error());
+                 co_return http::Response(200, "via " + resp.value().body);
+               });
+  // The params have to survive the request moving off the stack.
+  server.route("/users/:id", http::EMethod::GET,
+               [&](const http::Request &req) -> http::Task<http::Response> {
+                 auto url = http::URL::parse(upstream_base + "/slow");
+                 auto resp = co_await http::Client::co_send(
+                     http::Request(http::EMethod::GET, url.value()),
+                     upstream_pool);
+                 if (!resp)
+                   co_return http::Response(502, resp.error());
+                 co_return http::Response(
+                     200, "user " + std::string(req.params.get("id")));
+               });
+  server.route("/throws", http::EMethod::GET,
+               [](const http::Request &) -> http::Task<http::Response> {
+                 throw std::runtime_error("async failure");
+                 co_return http::Response(200);
+               });
+  server.route("/ping", http::EMethod::GET, [](const http::Request &) {
+    return http::Response(200, "pong");
+  });
+  ASSERT_TRUE(server.start().has_value());
+  std::thread server_thread([&server]() { server.run(); });
+  std::this_thread::sleep_for(std::chrono::milliseconds(200));
+
+  std::string base = "http://127.0.0.1:" + std::to_string(port);
+  // A client that leaves mid-call must not take the server down with it.
+  {
+    i32 sock = static_cast<i32>(socket(AF_INET, SOCK_STREAM, 0));
+    sockaddr_in addr{};
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    addr.sin_port = htons(port);
+    if (connect(sock, (sockaddr *)&addr, sizeof(addr)) == 0) {
+      std::string request = "GET /proxy?gone HTTP/1.1\r\n\r\n";
+      ::send(sock, request.data(), static_cast<i32>(request.size()), 0);
+      std::this_thread::sleep_for(std::chrono::milliseconds(50));
+    }
+    // Reset rather than close, so the server sees the hang-up while the
+    // handler is still suspended and abandons it.
+    linger reset{1, 0};
+    setsockopt(sock, SOL_SOCKET, SO_LINGER, (const char *)&reset,
+               sizeof(reset));
+#ifdef _WIN32
+    closesocket(sock);
+#else
+    close(sock);
+#endif
+  }
+
+  auto started = std::chrono::steady_clock::now();
+  std::vector<std::future<stl::result<http::Response>>> futures;
+  // A thread per caller, so the client side is never the bottleneck.
+  for (i32 i = 0; i < concurrent; ++i) {
+    futures.push_back(std::async(std::launch::async, [&base, i]() {
+      auto url = http::URL::parse(base + "/proxy?" + std::to_string(i));
+      return http::Client::send(http::Request(http::EMethod::GET, url.value()));
+    }));
+  }
+  std::vector<stl::result<http::Response>> results;
+  for (auto &future : futures)
+    results.push_back(future.get());
+  auto elapsed = std::chrono::steady_clock::now() - started;
+  auto thrown = http::Client::get(base + "/throws").get();
+  auto ping = http::Client::get(base + "/ping").get();
+  auto user = http::Client::get(base + "/users/42").get();
+  auto metrics = server.metrics();
+
+  server.stop();
+  server_thread.join();
+  upstream_pool.clear();
+  upstream->stop();
+  upstream_thread.join();
+
+  for (i32 i = 0; i < concurrent; ++i) {
+    ASSERT_TRUE(results[i].has_value()) << results[i].error();
+    EXPECT_EQ(results[i].value().status_code, 200);
+    EXPECT_EQ(results[i].value().body, "via upstream?" + std::to_string(i));
+  }
+  EXPECT_LT(elapsed, limit);
+  ASSERT_TRUE(thrown.has_value());
+  EXPECT_EQ(thrown.value().status_code, 500);
+  ASSERT_TRUE(ping.has_value());
+  EXPECT_EQ(ping.value().body, "pong");
+  ASSERT_TRUE(user.has_value()) << user.error();
+  EXPECT_EQ(user.value().body, "user 42");
+  EXPECT_EQ(metrics.handler_exceptions, 1u);
+  EXPECT_GE(metrics.routes[0].requests, static_cast<std::uint64_t>(concurrent));
+}
+
+#ifdef SAP_HTTP_ZLIB
+TEST(IntegrationTest, ServerCompressesAndClientDecodes) {
+  http::Server server{http::ServerConfig{-1, 10034}};
+  std::string payload;
+  for (i32 i = 0; i < 20000; ++i)
+    payload += "{\"id\":" + std::to_string(i) + ",\"ok\":true}\n";
+  server.use(http::compress_responses());
+  server.route("/data", http::EMethod::GET, [&payload](const http::Request &) {
+    http::Response resp(200, payload);
+    resp.headers.set(http::EHeader::ContentType, "application/json");
+    return resp;
+  });
+  ASSERT_TRUE(server.start().has_value());
+  std::thread server_thread([&server]() { server.run(); });
+  std::this_thread::sleep_for(std::chrono::milliseconds(200));
+
+  auto url = http::URL::parse("http://127.0.0.1:10034/data").value();
+  auto decoded = http::Client::send(http::Request(http::EMethod::GET, url));
+
+  http::Request raw_req(http::EMethod::GET, url);
+  raw_req.headers.set("Accept-Encoding", "gzip");
+  auto raw = http::Client::send(raw_req);
+
+  http::Request streamed_req(http::EMethod::GET, url);
+  std::string streamed;
+  size_t chunks = 0;
+  streamed_req.on_body_chunk = [&](std::string_view data) {
+    streamed.append(data);
+    ++chunks;
+  };
+  auto streamed_resp = http::Client::send(streamed_req);
+  auto wire = raw_exchange(10034, "GET /data HTTP/1.1\r\n"
+                                  "Accept-Encoding: gzip\r\n"
+                                  "Connection: close\r\n\r\n");
+  server.stop();
+  server_thread.join();
+
+  ASSERT_TRUE(decoded.has_value()) << decoded.error();
+  EXPECT_TRUE(decoded.value().body == payload);
+  EXPECT_FALSE(decoded.value().headers.has("content-encoding"));
+  // A caller that negotiates itself gets the bytes as sent.
+  ASSERT_TRUE(raw.has_value());
+  EXPECT_EQ(raw.value().headers.get("content-encoding"), "gzip");
+  EXPECT_LT(raw.value().body.size(), payload.size() / 4);
+  ASSERT_TRUE(streamed_resp.has_value()) << streamed_resp.error();
+  EXPECT_TRUE(streamed == payload);
+  EXPECT_GT(chunks, 1u);
+  EXPECT_NE(wire.find("content-encoding: gzip"), std::string::npos);
+}
+#endif
+
+// A listener that never accepts: the kernel completes up to `backlog`
+// handshakes and then leaves further connection attempts unanswered.
+static i32 listen_silently(u16 port, i32 backlog) {
+  i32 listener = static_cast<i32>(socket(AF_INET, SOCK_STREAM, 0));
+  i32 opt = 1;
+  setsockopt(listener, SOL_SOCKET, SO_REUSEADDR, (const char *)&opt,
+             sizeof(opt));
+  sockaddr_in addr{};
+  addr.sin_family = AF_INET;
+  addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+  addr.sin_port = htons(port);
+  bind(listener, (sockaddr *)&addr, sizeof(addr));
+  listen(listener, backlog);
+  return listener;
+}
+
+static void close_test_socket(i32 sock) {
+#ifdef _WIN32
+  closesocket(sock);
+#else
+  close(sock);
+#endif
+}
+
+TEST(IntegrationTest, ClientEnforcesTimeouts) {
+  i32 silent = listen_silently(10040, 8);
+  auto url = http::URL::parse("http://127.0.0.1:10040/").value();
+  auto timed = [&url](std::chrono::milliseconds timeout,
+                      std::chrono::milliseconds read_timeout) {
+    http::Request req(http::EMethod::GET, url);
+    req.timeout = timeout;
+    req.read_timeout = read_timeout;
+    return req;
+  };
+  auto started = std::chrono::steady_clock::now();
+  auto idle = http::Client::send(timed(std::chrono::seconds(5),
+                                       std::chrono::milliseconds(100)));
+  auto overall = http::Client::send(
+      timed(std::chrono::milliseconds(150), std::chrono::milliseconds(0)));
+  auto awaited = http::sync_wait(http::Client::co_send(
+      timed(std::chrono::seconds(5), std::chrono::milliseconds(100))));
+  http::ClientPool pool;
+  auto pooled = http::Client::send(
+      timed(std::chrono::seconds(5), std::chrono::milliseconds(100)), pool);
+  auto elapsed = std::chrono::steady_clock::now() - started;
+
+  // In an event-loop handler the wait is a timer on the loop.
+  http::ServerConfig cfg{-1, 10042};
+  cfg.use_event_loop = true;
+  http::Server server{std::move(cfg)};
+  server.route("/proxy", http::EMethod::GET,
+               [&](const http::Request &) -> http::Task<http::Response> {
+                 auto resp = co_await http::Client::co_send(timed(
+                     std::chrono::seconds(5), std::chrono::milliseconds(100)));
+                 co_return http::Response(502, resp ? "" : resp.error());
+               });
+  ASSERT_TRUE(server.start().has_value());
+  std::thread server_thread([&server]() { server.run(); });
+  std::this_thread::sleep_for(std::chrono::milliseconds(200));
+  auto proxied = http::Client::get("http://127.0.0.1:10042/proxy").get();
+  server.stop();
+  server_thread.join();
+
+  ASSERT_FALSE(idle.has_value());
+  EXPECT_EQ(idle.error(),
+            "Waiting for response from 127.0.0.1:10040 timed out");
+  ASSERT_FALSE(overall.has_value());
+  EXPECT_EQ(overall.error(),
+            "Request to 127.0.0.1:10040 timed out after 150 ms");
+  ASSERT_FALSE(awaited.has_value());
+  EXPECT_EQ(awaited.error(), idle.error());
+  ASSERT_FALSE(pooled.has_value());
+  EXPECT_EQ(pooled.error(), idle.error());
+  EXPECT_EQ(pool.idle_count(), 0u);
+  EXPECT_LT(elapsed, std::chrono::seconds(2));
+  ASSERT_TRUE(proxied.has_value()) << proxied.error();
+  EXPECT_EQ(proxied.value().body, idle.error());
+
+  // Fill the accept queue so the next handshake goes unanswered.
+  i32 full = listen_silently(10041, 0);
+  std::vector<i32> queued;
+  for (i32 i = 0; i < 4; ++i) {
+    i32 sock = static_cast<i32>(socket(AF_INET, SOCK_STREAM, 0));
+    sockaddr_in addr{};
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    addr.sin_port = htons(10041);
+    queued.push_back(sock);
+    // Non-blocking, so a connect the queue no longer admits returns.
+#ifndef _WIN32
+    fcntl(sock, F_SETFL, O_NONBLOCK);
+#endif
+    connect(sock, (sockaddr *)&addr, sizeof(addr));
+  }
+  std::this_thread::sleep_for(std::chrono::milliseconds(50));
+  http::Request connect_req(
+      http::EMethod::GET, http::URL::parse("http://127.0.0.1:10041/").value());
+  connect_req.connect_timeout = std::chrono::milliseconds(100);
+  started = std::chrono::steady_clock::now();
+  auto unanswered = http::Client::send(connect_req);
+  elapsed = std::chrono::steady_clock::now() - started;
+  for (i32 sock : queued)
+    close_test_socket(sock);
+  close_test_socket(full);
+  close_test_socket(silent);
+
+  ASSERT_FALSE(unanswered.has_value());
+  EXPECT_EQ(unanswered.error(), "Connecting to 127.0.0.1:10041 timed out");
+  EXPECT_LT(elapsed, std::chrono::seconds(1));
+}
+
+static i32 connect_raw(u16 port) {
+  i32 sock = static_cast<i32>(socket(AF_INET, SOCK_STREAM, 0));
+  sockaddr_in addr{};
+  addr.sin_family = AF_INET;
+  addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+  addr.sin_port = htons(port);
+  connect(sock, (sockaddr *)&addr, sizeof(addr));
+  return sock;
+}
+
+// Sends `head`, then `trickle` every 50 ms, and returns how long the server
+// took to hang up (capped at three seconds) along with what it sent.
+static std::pair<std::chrono::milliseconds, std::string>
+time_until_closed(u16 port, const std::string &head,
+                  const std::string &trickle = "") {
+  i32 sock = connect_raw(port);
+#ifdef _WIN32
+  DWORD wait = 50;
+#else
+  timeval wait{0, 50000};
+#endif
+  setsockopt(sock, SOL_SOCKET, SO_RCVTIMEO, (const char *)&wait, sizeof(wait));
+  auto started = std::chrono::steady_clock::now();
+  send(sock, head.data(), static_cast<i32>(head.size()), 0);
+  std::string received;
+  while (std::chrono::steady_clock::now() - started < std::chrono::seconds(3)) {
+    char buffer[512];
+    auto n = recv(sock, buffer, sizeof(buffer), 0);
+    if (n == 0)
+      break;
+    if (n > 0) {
+      received.append(buffer, n);
+      continue;
+    }
+    if (!trickle.empty())
+      send(sock, trickle.data(), static_cast<i32>(trickle.size()), 0);
+  }
+  auto elapsed = std::chrono::duration_cast<std::chrono::milliseconds>(
+      std::chrono::steady_clock::now() - started);
+  close_test_socket(sock);
+  return {elapsed, received};
+}
+
+TEST_P(ServerModeTest, ServerDropsSlowClients) {
+  auto cfg = config(10043);
+  cfg.is_multithreaded = true;
+  cfg.worker_threads = 2;
+  u16 port = cfg.port;
+  cfg.header_timeout = std::chrono::milliseconds(300);
+  cfg.body_timeout = std::chrono::milliseconds(300);
+  cfg.keep_alive_timeout = std::chrono::seconds(10);
+  http::Server server{std::move(cfg)};
+  server.route("/echo", http::EMethod::POST, [](const http::Request &req) {
+    return http::Response(200, req.body);
+  });
+  ASSERT_TRUE(server.start().has_value());
+  std::thread server_thread([&server]() { server.run(); });
+  std::this_thread::sleep_for(std::chrono::milliseconds(200));
+
+  // A head trickled in one header at a time never completes in time.
+  auto slowloris = time_until_closed(
+      port, "POST /echo HTTP/1.1\r\nHost: x\r\n", "X-Pad: 1\r\n");
+  // A body that stalls is dropped long before the keep-alive timeout.
+  auto stalled = time_until_closed(
+      port, "POST /echo HTTP/1.1\r\nContent-Length: 10\r\n\r\nabc");
+  // A body that keeps coming is fine, however long it takes overall.
+  std::string head = "POST /echo HTTP/1.1\r\nContent-Length: 12\r\n"
+                     "Connection: close\r\n\r\n";
+  auto steady = time_until_closed(port, head, "a");
+  auto metrics = server.metrics();
+  server.stop();
+  server_thread.join();
+
+  EXPECT_LT(slowloris.first, std::chrono::milliseconds(1000));
+  EXPECT_TRUE(slowloris.second.empty()) << slowloris.second;
+  EXPECT_LT(stalled.first, std::chrono::milliseconds(1000));
+  EXPECT_TRUE(stalled.second.empty()) << stalled.second;
+  EXPECT_NE(steady.second.find("\r\n\r\naaaaaaaaaaaa"), std::string::npos)
+      << steady.second;
+  EXPECT_EQ(metrics.connections_timed_out, 2u);
+}
+
+TEST_P(ServerModeTest, ServerLimitsConnections) {
+  auto cfg = config(10045);
+  cfg.is_multithreaded = true;
+  cfg.worker_threads = 4;
+  // The overall limit on one, the per-address one on the other.
+  if (event_loop())
+    cfg.max_connections_per_ip = 2;
+  else
+    cfg.max_connections = 2;
+  u16 port = cfg.port;
+  http::Server server{std::move(cfg)};
+  server.route("/ping", http::EMethod::GET, [](const http::Request &) {
+    return http::Response(200, "pong");
+  });
+  ASSERT_TRUE(server.start().has_value());
+  std::thread server_thread([&server]() { server.run(); });
+  std::this_thread::sleep_for(std::chrono::milliseconds(200));
+
+  i32 first = connect_raw(port);
+  i32 second = connect_raw(port);
+  std::this_thread::sleep_for(std::chrono::milliseconds(100));
+  auto refused = raw_exchange(port, "GET /ping HTTP/1.1\r\n\r\n");
+  close_test_socket(first);
+  std::this_thread::sleep_for(std::chrono::milliseconds(100));
+  auto admitted = http::Client::get("http://127.0.0.1:" +
+                                    std::to_string(port) + "/ping")
+                      .get();
+  close_test_socket(second);
+  auto metrics = server.metrics();
+  server.stop();
+  server_thread.join();
+
+  EXPECT_EQ(refused.rfind("HTTP/1.1 503", 0), 0u) << refused;
+  ASSERT_TRUE(admitted.has_value()) << admitted.error();
+  EXPECT_EQ(admitted.value().body, "pong");
+  EXPECT_EQ(metrics.connections_rejected, 1u);
+}
+
+TEST_P(ServerModeTest, ServerShutsDownGracefully) {
+  auto cfg = config(10059);
+  cfg.is_multithreaded = true;
+  cfg.worker_threads = 4;
+  u16 port = cfg.port;
+  cfg.keep_alive_timeout = std::chrono::seconds(10);
+  http::Server server{std::move(cfg)};
+  server.route("/slow", http::EMethod::GET, [](const http::Request &) {
+    std::this_thread::sleep_for(std::chrono::milliseconds(300));
+    return http::Response(200, "done");
+  });
+  server.route("/fast", http::EMethod::GET, [](const http::Request &) {
+    return http::Response(200, "fast");
+  });
+  ASSERT_TRUE(server.start().has_value());
+  std::thread server_thread([&server]() { server.run(); });
+  std::this_thread::sleep_for(std::chrono::milliseconds(200));
+
+  // A keep-alive connection between requests, and one mid-request.
+  auto idle = std::async(std::launch::async, [port]() {
+    return time_until_closed(port, "GET /fast HTTP/1.1\r\nHost: x\r\n\r\n");
+  });
+  std::this_thread::sleep_for(std::chrono::milliseconds(100));
+  auto busy = std::async(std::launch::async, [port]() {
+    return raw_exchange(port, "GET /slow HTTP/1.1\r\nHost: x\r\n\r\n");
+  });
+  std::this_thread::sleep_for(std::chrono::milliseconds(100));
+  auto started = std::chrono::steady_clock::now();
+  bool drained = server.shutdown(std::chrono::seconds(2));
+  auto took = std::chrono::steady_clock::now() - started;
+  server_thread.join();
+  auto refused = raw_exchange(port, "GET /fast HTTP/1.1\r\n\r\n");
+
+  EXPECT_TRUE(drained);
+  EXPECT_LT(took, std::chrono::milliseconds(1500));
+  auto kept = idle.get();
+  EXPECT_LT(kept.first, std::chrono::milliseconds(1500));
+  EXPECT_NE(kept.second.find("\r\n\r\nfast"), std::string::npos)
+      << kept.second;
+  auto answered = busy.get();
+  EXPECT_NE(answered.find("connection: close"), std::string::npos)
+      << answered;
+  EXPECT_NE(answered.find("\r\n\r\ndone"), std::string::npos) << answered;
+  EXPECT_TRUE(refused.empty()) << refused;
+}
+
+#ifndef _WIN32
+TEST(IntegrationTest, ServerHandsOffListener) {
+  auto path = std::filesystem::temp_directory_path() /
+              ("sap_http_handoff_" + std::to_string(getpid()));
+  auto serve = [](http::Server &server, std::string body) {
+    server.route("/who", http::EMethod::GET,
+                 [body](const http::Request &) {
+                   return http::Response(200, body);
+                 });
+    EXPECT_TRUE(server.start().has_value());
+    return std::thread([&server]() { server.run(); });
+  };
+  http::Server old_server{http::ServerConfig{-1, 10061}};
+  auto old_thread = serve(old_server, "old");
+  std::this_thread::sleep_for(std::chrono::milliseconds(200));
+  auto before = http::Client::get("http://127.0.0.1:10061/who").get();
+
+  auto received = std::async(std::launch::async, [&path]() {
+    return http::receive_listeners(path.string(), std::chrono::seconds(2));
+  });
+  while (!std::filesystem::exists(path))
+    std::this_thread::sleep_for(std::chrono::milliseconds(10));
+  auto sent = old_server.hand_off(path.string());
+  auto sockets = received.get();
+  ASSERT_TRUE(sent.has_value()) << sent.error();
+  ASSERT_TRUE(sockets.has_value()) << sockets.error();
+  ASSERT_EQ(sockets.value().size(), 1u);
+
+  http::ServerConfig cfg{sockets.value()[0], 10061};
+  http::Server new_server{std::move(cfg)};
+  auto new_thread = serve(new_server, "new");
+  EXPECT_TRUE(old_server.shutdown(std::chrono::seconds(1)));
+  old_thread.join();
+  auto after = http::Client::get("http://127.0.0.1:10061/who").get();
+  new_server.stop();
+  new_thread.join();
+
+  ASSERT_TRUE(before.has_value()) << before.error();
+  EXPECT_EQ(before.value().body, "old");
+  ASSERT_TRUE(after.has_value()) << after.error();
+  EXPECT_EQ(after.value().body, "new");
+  EXPECT_FALSE(std::filesystem::exists(path));
+  EXPECT_FALSE(http::receive_listeners(path.string(),
+                                       std::chrono::milliseconds(50))
+                   .has_value());
+}
+
+TEST(IntegrationTest, ServerHandsOffReusePortListeners) {
+  auto path = std::filesystem::temp_directory_path() /
+              ("sap_http_handoff_rp_" + std::to_string(getpid()));
+  auto serve = [](http::Server &server, std::string body) {
+    server.route("/who", http::EMethod::GET,
+                 [body](const http::Request &) {
+                   return http::Response(200, body);
+                 });
+    EXPECT_TRUE(server.start().has_value());
+    return std::thread([&server]() { server.run(); });
+  };
+  http::ServerConfig old_cfg{-1, 10066};
+  old_cfg.use_event_loop = true;
+  old_cfg.event_loop_threads = 4;
+  old_cfg.reuse_port = true;
+  http::Server old_server{std::move(old_cfg)};
+  auto old_thread = serve(old_server, "old");
+  std::this_thread::sleep_for(std::chrono::milliseconds(200));
+
+  auto received = std::async(std::launch::async, [&path]() {
+    return http::receive_listeners(path.string(), std::chrono::seconds(2));
+  });
+  while (!std::filesystem::exists(path))
+    std::this_thread::sleep_for(std::chrono::milliseconds(10));
+  auto sent = old_server.hand_off(path.string());
+  auto sockets = received.get();
+  ASSERT_TRUE(sent.has_value()) << sent.error();
+  ASSERT_TRUE(sockets.has_value()) << sockets.error();
+  ASSERT_EQ(sockets.value().size(), 4u);
+
+  // Fewer threads than sockets: each socket still gets a loop.
+  http::ServerConfig cfg{-1, 10066};
+  cfg.server_sockets = sockets.value();
+  cfg.use_event_loop = true;
+  http::Server new_server{std::move(cfg)};
+  auto new_thread = serve(new_server, "new");
+  EXPECT_TRUE(old_server.shutdown(std::chrono::seconds(1)));
+  old_thread.join();
+  // A connection per request, so the kernel spreads them over every
+  // socket; one nobody accepts from would leave some hanging.
+  i32 answered = 0;
+  for (i32 i = 0; i < 32; ++i) {
+    http::Request req(http::EMethod::GET,
+                      http::URL::parse("http://127.0.0.1:10066/who").value());
+    req.timeout = std::chrono::seconds(1);
+    auto resp = http::Client::send(req);
+    if (resp.has_value() && resp.value().body == "new")
+      ++answered;
+  }
+  new_server.stop();
+  new_thread.join();
+
+  EXPECT_EQ(answered, 32);
+}
+#endif
+
+TEST(IntegrationTest, ClientTracesRequests) {
+  http::Server server{http::ServerConfig{-1, 10062}};
+  server.route("/trace", http::EMethod::GET, [](const http::Request &) {
+    return http::Response(200, "traced");
+  });
+  ASSERT_TRUE(server.start().has_value());
+  std::thread server_thread([&server]() { server.run(); });
+  std::this_thread::sleep_for(std::chrono::milliseconds(200));
+
+  std::mutex mutex;
+  std::vector<http::ClientTrace> pooled;
+  std::vector<http::ClientTrace> global;
+  auto collect = [&mutex](std::vector<http::ClientTrace> &into) {
+    return [&mutex, &into](const http::ClientTrace &trace) {
+      std::lock_guard lock(mutex);
+      into.push_back(trace);
+    };
+  };
+  http::Client::observe(collect(global));
+  std::vector<stl::result<http::Response>> results;
+  {
+    http::ClientPoolConfig config;
+    config.observer = collect(pooled);
+    http::ClientPool pool(std::move(config));
+    auto url = http::URL::parse("http://127.0.0.1:10062/trace").value();
+    http::Request req(http::EMethod::GET, url);
+    results.push_back(http::Client::send(req, pool));
+    req.headers.set("traceparent",
+                    "00-4bf92f3577b34da6a3ce929d0e0e4736-00f067aa0ba902b7-01");
+    results.push_back(http::Client::send(req, pool));
+  }
+  results.push_back(http::Client::get("http://127.0.0.1:10062/trace").get());
+  results.push_back(http::Client::get("http://127.0.0.1:1/trace").get());
+  http::Client::observe({});
+  results.push_back(http::Client::get("http://127.0.0.1:10062/trace").get());
+  server.stop();
+  server_thread.join();
+
+  EXPECT_FALSE(results[3].has_value());
+  results.erase(results.begin() + 3);
+  for (auto &result : results)
+    ASSERT_TRUE(result.has_value()) << result.error();
+  ASSERT_EQ(pooled.size(), 2u);
+  ASSERT_EQ(global.size(), 2u);
+
+  const auto &fresh = pooled[0];
+  EXPECT_FALSE(fresh.reused);
+  EXPECT_EQ(fresh.attempts, 1u);
+  EXPECT_EQ(fresh.status_code, 200);
+  EXPECT_LE(fresh.start, fresh.dns_start);
+  EXPECT_LE(fresh.dns_start, fresh.dns_end);
+  EXPECT_LE(fresh.dns_end, fresh.connect_start);
+  EXPECT_LT(fresh.connect_start, fresh.connect_end);
+  EXPECT_LE(fresh.connect_end, fresh.write_start);
+  EXPECT_LE(fresh.write_start, fresh.write_end);
+  EXPECT_LT(fresh.write_end, fresh.first_byte);
+  EXPECT_LE(fresh.first_byte, fresh.end);
+  EXPECT_EQ(fresh.tls_start, http::ClientTrace::TimePoint{});
+  EXPECT_GT(fresh.bytes_sent, 0u);
+  EXPECT_GT(fresh.bytes_received, 6u);
+  EXPECT_EQ(fresh.trace_id.size(), 32u);
+  EXPECT_EQ(fresh.span_id.size(), 16u);
+  EXPECT_TRUE(fresh.parent_span_id.empty());
+
+  const auto &reused = pooled[1];
+  EXPECT_TRUE(reused.reused);
+  EXPECT_EQ(reused.dns_start, http::ClientTrace::TimePoint{});
+  EXPECT_EQ(reused.connect_start, http::ClientTrace::TimePoint{});
+  EXPECT_NE(reused.first_byte, http::ClientTrace::TimePoint{});
+  EXPECT_EQ(reused.trace_id, "4bf92f3577b34da6a3ce929d0e0e4736");
+  EXPECT_EQ(reused.parent_span_id, "00f067aa0ba902b7");
+  EXPECT_NE(reused.span_id, fresh.span_id);
+
+  EXPECT_EQ(global[0].status_code, 200);
+  EXPECT_TRUE(global[0].dns_cached);
+  EXPECT_EQ(global[1].status_code, 0);
+  EXPECT_FALSE(global[1].error.empty());
+  EXPECT_EQ(global[1].first_byte, http::ClientTrace::TimePoint{});
+  EXPECT_NE(global[1].to_otlp_json().find("\"status\":{\"code\":2,"),
+            std::string::npos);
+}
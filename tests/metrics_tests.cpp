@@ -0,0 +1,83 @@
+#include "net/http.h"
+#include <gtest/gtest.h>
+
+using namespace std::chrono_literals;
+
+TEST(MetricsTest, BucketsCoverEveryValue) {
+  EXPECT_EQ(http::LatencyHistogram::bucket_of(0), 0u);
+  EXPECT_EQ(http::LatencyHistogram::bucket_of(7), 7u);
+  EXPECT_EQ(http::LatencyHistogram::bucket_of(8), 8u);
+  // Each bucket starts right after the previous one ends.
+  for (size_t b = 1; b + 1 < http::LatencyHistogram::k_BucketCount; ++b) {
+    auto upper = http::LatencyHistogram::bucket_upper(b);
+    EXPECT_EQ(http::LatencyHistogram::bucket_of(upper), b);
+    EXPECT_EQ(http::LatencyHistogram::bucket_of(upper + 1), b + 1);
+  }
+  EXPECT_EQ(http::LatencyHistogram::bucket_of(UINT64_MAX),
+            http::LatencyHistogram::k_BucketCount - 1);
+}
+
+TEST(MetricsTest, QuantilesWithinBucketPrecision) {
+  http::LatencyHistogram histogram;
+  for (std::uint64_t us = 1; us <= 1000; ++us)
+    histogram.record(us * 1000);
+  EXPECT_EQ(histogram.count(), 1000u);
+  EXPECT_EQ(histogram.max(), 1ms);
+  EXPECT_EQ(histogram.mean(), 500500ns);
+
+  auto p50 = histogram.quantile(0.5).count();
+  auto p99 = histogram.quantile(0.99).count();
+  EXPECT_GE(p50, 500000);
+  EXPECT_LE(p50, 500000 * 9 / 8);
+  EXPECT_GE(p99, 990000);
+  EXPECT_LE(p99, 1000000);
+  EXPECT_EQ(histogram.quantile(1.0), 1ms);
+}
+
+TEST(MetricsTest, MergeAddsSamples) {
+  http::LatencyHistogram a, b;
+  a.record(100);
+  b.record(5000);
+  b.record(20000);
+  a.merge(b);
+  EXPECT_EQ(a.count(), 3u);
+  EXPECT_EQ(a.sum(), 25100ns);
+  EXPECT_EQ(a.max(), 20000ns);
+  EXPECT_EQ(a.count_at_or_below(10000), 2u);
+}
+
+TEST(MetricsTest, PrometheusText) {
+  http::ServerMetrics metrics;
+  metrics.requests = 3;
+  metrics.handler.record(2000);
+  http::RouteMetrics route;
+  route.path = "/users/:id";
+  route.method = http::EMethod::GET;
+  route.requests = 3;
+  route.latency.record(2000);
+  metrics.routes.push_back(route);
+
+  auto text = metrics.to_prometheus();
+  EXPECT_NE(text.find("# TYPE sap_http_requests_total counter\n"
+                      "sap_http_requests_total 3\n"),
+            std::string::npos);
+  EXPECT_NE(text.find("sap_http_phase_duration_seconds_bucket{phase=\"handler\""
+                      ",le=\"5e-06\"} 1\n"),
+            std::string::npos);
+  EXPECT_NE(text.find("sap_http_phase_duration_seconds_count{phase=\"parse\"} "
+                      "0\n"),
+            std::string::npos);
+  EXPECT_NE(text.find("sap_http_route_requests_total{method=\"GET\","
+                      "route=\"/users/:id\"} 3\n"),
+            std::string::npos);
+}
+
+TEST(MetricsTest, SnapshotBeforeStart) {
+  http::Server server;
+  server.route("/a", http::EMethod::GET,
+               [](const http::Request &) { return http::Response(200); });
+  auto metrics = server.metrics();
+  ASSERT_EQ(metrics.routes.size(), 1u);
+  EXPECT_EQ(metrics.routes[0].path, "/a");
+  EXPECT_EQ(metrics.requests, 0u);
+}
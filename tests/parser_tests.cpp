@@ -0,0 +1,225 @@
+#include "net/http.h"
+#include <gtest/gtest.h>
+
+TEST(ParserTest, ParseRequestHead) {
+  http::MessageParser parser;
+  std::string data = "GET /api/users?page=2 HTTP/1.1\r\n"
+                     "Host: example.com\r\n"
+                     "Accept: */*\r\n"
+                     "\r\n";
+  ASSERT_EQ(parser.parse(data), http::EParseStatus::Complete);
+  EXPECT_EQ(parser.method(), "GET");
+  EXPECT_EQ(parser.target(), "/api/users?page=2");
+  EXPECT_EQ(parser.version(), "HTTP/1.1");
+  EXPECT_EQ(parser.head_size(), data.size());
+  ASSERT_EQ(parser.header_count(), 2u);
+  EXPECT_EQ(parser.header_at(0).name, "Host");
+  EXPECT_EQ(parser.header_at(0).value, "example.com");
+}
+
+TEST(ParserTest, ViewsPointIntoBuffer) {
+  http::MessageParser parser;
+  std::string data = "POST /echo HTTP/1.1\r\nContent-Type: text/plain\r\n\r\n";
+  ASSERT_EQ(parser.parse(data), http::EParseStatus::Complete);
+  auto value = parser.header("content-type");
+  EXPECT_GE(value.data(), data.data());
+  EXPECT_LT(value.data(), data.data() + data.size());
+}
+
+TEST(ParserTest, IncrementalFeed) {
+  http::MessageParser parser;
+  std::string full = "GET / HTTP/1.1\r\nHost: a\r\nX-Long: value\r\n\r\n";
+  std::string buffer;
+  for (size_t i = 0; i + 1 < full.size(); ++i) {
+    buffer.push_back(full[i]);
+    ASSERT_EQ(parser.parse(buffer), http::EParseStatus::NeedMore);
+  }
+  buffer.push_back(full.back());
+  ASSERT_EQ(parser.parse(buffer), http::EParseStatus::Complete);
+  EXPECT_EQ(parser.header("x-long"), "value");
+}
+
+TEST(ParserTest, StopsAtEndOfHead) {
+  http::MessageParser parser;
+  std::string data = "POST /upload HTTP/1.1\r\nContent-Length: 4\r\n\r\n";
+  data.append("\r\n\0\xff", 4);
+  ASSERT_EQ(parser.parse(data), http::EParseStatus::Complete);
+  EXPECT_EQ(parser.head_size(), data.size() - 4);
+}
+
+TEST(ParserTest, CaseInsensitiveLookup) {
+  http::MessageParser parser;
+  ASSERT_EQ(parser.parse("GET / HTTP/1.1\r\nCONNECTION: close\r\n\r\n"),
+            http::EParseStatus::Complete);
+  EXPECT_TRUE(parser.has_header("Connection"));
+  EXPECT_EQ(parser.header("connection"), "close");
+  EXPECT_FALSE(parser.has_header("Host"));
+  EXPECT_EQ(parser.header("Host"), "");
+}
+
+TEST(ParserTest, TrimsValueWhitespace) {
+  http::MessageParser parser;
+  ASSERT_EQ(parser.parse("GET / HTTP/1.1\r\nX-Pad: \t padded \t\r\n\r\n"),
+            http::EParseStatus::Complete);
+  EXPECT_EQ(parser.header("X-Pad"), "padded");
+}
+
+TEST(ParserTest, RejectsMalformedRequestLine) {
+  http::MessageParser parser;
+  EXPECT_EQ(parser.parse("GET /\r\n\r\n"), http::EParseStatus::Error);
+  EXPECT_FALSE(parser.error().empty());
+}
+
+TEST(ParserTest, RejectsWhitespaceBeforeColon) {
+  http::MessageParser parser;
+  EXPECT_EQ(parser.parse("GET / HTTP/1.1\r\nHost : a\r\n\r\n"),
+            http::EParseStatus::Error);
+}
+
+// Names long enough to cover whole vector blocks and a scalar tail, with a
+// bad byte at every position.
+TEST(ParserTest, ValidatesLongFieldNames) {
+  std::string name = "X-Custom-Header-Name-Long-Enough-To-Span-Vector-Blocks";
+  http::MessageParser parser;
+  std::string data = "GET / HTTP/1.1\r\n" + name + ": v\r\n\r\n";
+  ASSERT_EQ(parser.parse(data), http::EParseStatus::Complete);
+  EXPECT_EQ(parser.header_at(0).name, name);
+  for (char bad : {' ', '(', '\x7f', '\x80', '\xe9'}) {
+    for (size_t i = 0; i < name.size(); ++i) {
+      std::string broken = name;
+      broken[i] = bad;
+      parser.reset();
+      EXPECT_EQ(parser.parse("GET / HTTP/1.1\r\n" + broken + ": v\r\n\r\n"),
+                http::EParseStatus::Error)
+          << "byte " << i;
+    }
+  }
+}
+
+TEST(ParserTest, RejectsOversizedHead) {
+  http::MessageParser parser;
+  parser.set_max_head_size(32);
+  std::string data = "GET / HTTP/1.1\r\nX-Filler: " + std::string(64, 'a');
+  EXPECT_EQ(parser.parse(data), http::EParseStatus::Error);
+}
+
+TEST(ParserTest, ResetForNextMessage) {
+  http::MessageParser parser;
+  ASSERT_EQ(parser.parse("GET /first HTTP/1.1\r\n\r\n"),
+            http::EParseStatus::Complete);
+  parser.reset();
+  ASSERT_EQ(parser.parse("GET /second HTTP/1.1\r\n\r\n"),
+            http::EParseStatus::Complete);
+  EXPECT_EQ(parser.target(), "/second");
+}
+
+TEST(ParserTest, ParseStatusLine) {
+  http::MessageParser parser(http::MessageParser::EKind::Response);
+  ASSERT_EQ(parser.parse("HTTP/1.1 404 Not Found\r\n"
+                         "Content-Length: 0\r\n\r\n"),
+            http::EParseStatus::Complete);
+  EXPECT_EQ(parser.status_code(), 404);
+  EXPECT_EQ(parser.reason(), "Not Found");
+  EXPECT_EQ(parser.header("content-length"), "0");
+}
+
+static std::string decode_all(http::BodyDecoder &decoder,
+                              std::string_view data,
+                              http::EParseStatus &status) {
+  std::string body;
+  size_t consumed = 0;
+  status = decoder.decode(data, consumed,
+                          [&body](std::string_view chunk) { body += chunk; });
+  return body;
+}
+
+TEST(BodyDecoderTest, ContentLength) {
+  http::MessageParser head;
+  ASSERT_EQ(head.parse("POST / HTTP/1.1\r\nContent-Length: 5\r\n\r\n"),
+            http::EParseStatus::Complete);
+  http::BodyDecoder decoder;
+  ASSERT_TRUE(decoder.start(head));
+  EXPECT_EQ(decoder.mode(), http::BodyDecoder::EMode::Length);
+  http::EParseStatus status;
+  EXPECT_EQ(decode_all(decoder, "hello and more", status), "hello");
+  EXPECT_EQ(status, http::EParseStatus::Complete);
+}
+
+TEST(BodyDecoderTest, ChunkedAcrossReads) {
+  http::BodyDecoder decoder;
+  decoder.reset(http::BodyDecoder::EMode::Chunked);
+  std::string wire = "5\r\nhello\r\n6;ext=1\r\n world\r\n"
+                     "0\r\nX-Trailer: 1\r\n\r\n";
+  std::string body;
+  std::string pending;
+  http::EParseStatus status = http::EParseStatus::NeedMore;
+  for (char c : wire) {
+    pending.push_back(c);
+    size_t consumed = 0;
+    status = decoder.decode(pending, consumed,
+                            [&body](std::string_view chunk) { body += chunk; });
+    pending.erase(0, consumed);
+    ASSERT_NE(status, http::EParseStatus::Error) << decoder.error();
+  }
+  EXPECT_EQ(status, http::EParseStatus::Complete);
+  EXPECT_EQ(body, "hello world");
+  EXPECT_EQ(decoder.body_size(), 11u);
+}
+
+TEST(BodyDecoderTest, RejectsMalformedChunkSize) {
+  http::BodyDecoder decoder;
+  decoder.reset(http::BodyDecoder::EMode::Chunked);
+  http::EParseStatus status;
+  decode_all(decoder, "zz\r\nhello\r\n", status);
+  EXPECT_EQ(status, http::EParseStatus::Error);
+}
+
+TEST(BodyDecoderTest, EnforcesMaxBodySize) {
+  http::BodyDecoder decoder;
+  decoder.set_max_body_size(4);
+  decoder.reset(http::BodyDecoder::EMode::Chunked);
+  http::EParseStatus status;
+  decode_all(decoder, "5\r\nhello\r\n0\r\n\r\n", status);
+  EXPECT_EQ(status, http::EParseStatus::Error);
+  EXPECT_TRUE(decoder.is_too_large());
+}
+
+TEST(BodyDecoderTest, RejectsContentLengthWithTransferEncoding) {
+  http::MessageParser head;
+  ASSERT_EQ(head.parse("POST / HTTP/1.1\r\nContent-Length: 5\r\n"
+                       "Transfer-Encoding: chunked\r\n\r\n"),
+            http::EParseStatus::Complete);
+  http::BodyDecoder decoder;
+  EXPECT_FALSE(decoder.start(head));
+}
+
+TEST(BodyDecoderTest, RepeatedContentLengthMustAgree) {
+  auto start = [](std::string_view fields) {
+    http::MessageParser head;
+    std::string data = "POST / HTTP/1.1\r\n" + std::string(fields) + "\r\n";
+    EXPECT_EQ(head.parse(data), http::EParseStatus::Complete);
+    http::BodyDecoder decoder;
+    bool started = decoder.start(head);
+    EXPECT_TRUE(started || decoder.error() == "Invalid Content-Length")
+        << decoder.error();
+    return started;
+  };
+  EXPECT_TRUE(start("Content-Length: 5\r\nContent-Length: 5\r\n"));
+  EXPECT_TRUE(start("Content-Length: 5, 5\r\n"));
+  EXPECT_FALSE(start("Content-Length: 5\r\nContent-Length: 6\r\n"));
+  EXPECT_FALSE(start("Content-Length: 5\r\nHost: a\r\ncontent-length: 50\r\n"));
+  EXPECT_FALSE(start("Content-Length: 5, 6\r\n"));
+  EXPECT_FALSE(start("Content-Length: 5\r\nContent-Length: 5, 7\r\n"));
+}
+
+TEST(BodyDecoderTest, ResponseUntilClose) {
+  http::MessageParser head(http::MessageParser::EKind::Response);
+  ASSERT_EQ(head.parse("HTTP/1.1 200 OK\r\n\r\n"),
+            http::EParseStatus::Complete);
+  http::BodyDecoder decoder;
+  ASSERT_TRUE(decoder.start(head));
+  http::EParseStatus status;
+  EXPECT_EQ(decode_all(decoder, "streamed", status), "streamed");
+  EXPECT_EQ(status, http::EParseStatus::NeedMore);
+  EXPECT_EQ(decoder.finish(), http::EParseStatus::Complete);
+}
@@ -61,6 +61,11 @@ TEST(RequestTest, StringToMethod) {
   EXPECT_EQ(http::string_to_method("HEAD"), http::EMethod::HEAD);
   EXPECT_EQ(http::string_to_method("PATCH"), http::EMethod::PATCH);
   EXPECT_EQ(http::string_to_method("OPTIONS"), http::EMethod::OPTIONS);
+  EXPECT_EQ(http::string_to_method("BREW"), http::EMethod::GET);
+  EXPECT_EQ(http::string_to_method(""), http::EMethod::GET);
+  // The lookup table is built and usable at compile time.
+  static_assert(http::string_to_method("PATCH") == http::EMethod::PATCH);
+  static_assert(http::method_name(http::EMethod::DELETE) == "DELETE");
 }
 
 TEST(RequestTest, DefaultHeaders) {
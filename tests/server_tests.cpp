@@ -49,4 +49,47 @@ TEST(ServerTest, MultithreadedMode) {
   http::ServerConfig cfg{-1, 8081, true};
   http::Server server{std::move(cfg)};
   SUCCEED();
-}
\ No newline at end of file
+}
+
+TEST(ServerTest, StartRejectsConflictingRouteParams) {
+  http::Server server;
+  server.route("/users/:id", http::EMethod::GET,
+               [](const http::Request &) { return http::Response(200); });
+  server.route("/users/:name/posts", http::EMethod::GET,
+               [](const http::Request &) { return http::Response(200); });
+  EXPECT_FALSE(server.start().has_value());
+}
+
+TEST(ServerTest, StartRejectsMidRouteWildcard) {
+  http::Server server;
+  server.route("/files/*path/meta", http::EMethod::GET,
+               [](const http::Request &) { return http::Response(200); });
+  EXPECT_FALSE(server.start().has_value());
+}
+
+TEST(ServerTest, RouteParamsLookup) {
+  http::RouteParams params;
+  EXPECT_TRUE(params.empty());
+  EXPECT_TRUE(params.set("id", "42"));
+  EXPECT_TRUE(params.set("id", "43"));
+  EXPECT_EQ(params.size(), 1u);
+  EXPECT_EQ(params.get("id"), "43");
+  EXPECT_FALSE(params.has("name"));
+  EXPECT_TRUE(params.get("name").empty());
+}
+
+TEST(ServerTest, StartRejectsReusePortWithoutEventLoop) {
+  http::ServerConfig cfg;
+  cfg.port = 10090;
+  cfg.reuse_port = true;
+  http::Server server{std::move(cfg)};
+  EXPECT_FALSE(server.start().has_value());
+}
+
+TEST(ServerTest, StartRejectsUnknownBindAddress) {
+  http::ServerConfig cfg;
+  cfg.port = 10091;
+  cfg.bind_address = "not an address";
+  http::Server server{std::move(cfg)};
+  EXPECT_FALSE(server.start().has_value());
+}
@@ -0,0 +1,62 @@
+#include "net/http.h"
+#include <gtest/gtest.h>
+#include <stdexcept>
+
+static http::Task<i32> add(i32 a, i32 b) { co_return a + b; }
+
+static http::Task<i32> add_twice(i32 a, i32 b) {
+  i32 first = co_await add(a, b);
+  i32 second = co_await add(first, b);
+  co_return second;
+}
+
+static http::Task<std::string> fail_with(std::string message) {
+  throw std::runtime_error(message);
+  co_return "";
+}
+
+TEST(TaskTest, RunsLazily) {
+  bool ran = false;
+  // The lambda has to outlive the coroutine, which reads its captures.
+  auto body = [&ran]() -> http::Task<> {
+    ran = true;
+    co_return;
+  };
+  auto task = body();
+  EXPECT_FALSE(ran);
+  task.start();
+  EXPECT_TRUE(ran);
+  EXPECT_TRUE(task.is_done());
+}
+
+TEST(TaskTest, AwaitsNestedTasks) {
+  EXPECT_EQ(http::sync_wait(add_twice(1, 2)), 5);
+}
+
+TEST(TaskTest, PropagatesExceptionsToTheAwaiter) {
+  auto caught = []() -> http::Task<std::string> {
+    try {
+      co_await fail_with("boom");
+    } catch (const std::runtime_error &e) {
+      co_return e.what();
+    }
+    co_return "no exception";
+  };
+  EXPECT_EQ(http::sync_wait(caught()), "boom");
+  EXPECT_THROW(http::sync_wait(fail_with("again")), std::runtime_error);
+}
+
+TEST(TaskTest, MovesOwnership) {
+  auto task = add(2, 3);
+  auto moved = std::move(task);
+  moved.start();
+  ASSERT_TRUE(moved.is_done());
+  EXPECT_EQ(moved.get(), 5);
+}
+
+TEST(TaskTest, ReportsConnectFailure) {
+  http::Request req(http::EMethod::GET,
+                    http::URL::parse("http://127.0.0.1:1/").value());
+  auto result = http::sync_wait(http::Client::co_send(std::move(req)));
+  EXPECT_FALSE(result.has_value());
+}
@@ -51,6 +51,17 @@ TEST(UrlTest, ParseQueryWithoutPath) {
   EXPECT_EQ(url.query, "?query=value");
 }
 
+TEST(UrlTest, ParseSlashInQuery) {
+  auto result = http::URL::parse("http://example.com:8080?next=/a/b:c");
+  ASSERT_TRUE(result.has_value());
+
+  auto &url = result.value();
+  EXPECT_EQ(url.host, "example.com");
+  EXPECT_EQ(url.port, "8080");
+  EXPECT_EQ(url.path, "/");
+  EXPECT_EQ(url.query, "?next=/a/b:c");
+}
+
 TEST(UrlTest, ParseRootPath) {
   auto result = http::URL::parse("http://example.com/");
   ASSERT_TRUE(result.has_value());